@@ -22,6 +22,7 @@
 #include "cache-item.h"
 #include "dcc.h"
 #include "image-encoders.h"
+#include "image-encoder-pool.h"
 #include "video-stream.h"
 #include "red-channel-client.h"
 
@@ -52,6 +53,8 @@ struct DisplayChannelClientPrivate
         FreeList free_list;
         std::array<uint64_t, MAX_DRAWABLE_PIXMAP_CACHE_ITEMS> pixmap_cache_items;
         int num_pixmap_cache_items;
+        /* image compressed in advance for the item being sent, if any */
+        ImageCompressJob *compress_job;
     } send_data;
 
     /* Host preferred video-codec order sorted with client preferred */
@@ -63,6 +66,21 @@ struct DisplayChannelClientPrivate
     std::array<bool, NUM_SURFACES> surface_client_created;
     std::array<QRegion, NUM_SURFACES> surface_client_lossy_region;
 
+    /* Drawables not queued while the pipe was full, sent as images of the
+     * surfaces once the client caught up. Disabled if damage_pipe_size is 0 */
+    std::array<QRegion, NUM_SURFACES> surface_damage;
+    uint32_t damaged_surfaces = 0;
+    uint32_t damage_pipe_size = 0;
+
+    /* Frame pacing, disabled if frame_interval is 0. The pipe is held until
+     * frame_hold_time and the frame after it is not sent before
+     * next_frame_time, see dcc_pace_frame(). The interval is doubled
+     * frame_backoff times while the client doesn't absorb the frames */
+    uint64_t frame_interval = 0;
+    uint64_t frame_hold_time = 0;
+    uint64_t next_frame_time = 0;
+    uint32_t frame_backoff = 0;
+
     std::array<VideoStreamAgent, NUM_STREAMS> stream_agents;
     uint32_t streams_max_latency;
     uint64_t streams_max_bit_rate;
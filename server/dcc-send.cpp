@@ -49,24 +49,24 @@ struct BitmapData {
 
 static int dcc_pixmap_cache_unlocked_hit(DisplayChannelClient *dcc, uint64_t id, int *lossy)
 {
+    DisplayChannel *display = DCC_TO_DC(dcc);
     PixmapCache *cache = dcc->priv->pixmap_cache;
     NewCacheItem *item;
     uint64_t serial;
+    uint64_t probes = 0;
 
     serial = dcc->get_message_serial();
-    item = cache->hash_table[BITS_CACHE_HASH_KEY(id)];
-
-    while (item) {
-        if (item->id == id) {
-            ring_remove(&item->lru_link);
-            ring_add(&cache->lru, &item->lru_link);
-            spice_assert(dcc->priv->id < MAX_CACHE_CLIENTS);
-            item->sync[dcc->priv->id] = serial;
-            cache->sync[dcc->priv->id] = serial;
-            *lossy = item->lossy;
-            break;
-        }
-        item = item->next;
+    item = cache->items.find(id, &probes);
+    stat_inc_counter(display->priv->pixmap_cache_lookups_counter, 1);
+    stat_inc_counter(display->priv->pixmap_cache_probes_counter, probes);
+
+    if (item) {
+        cache->items.touch(item);
+        spice_assert(dcc->priv->id < MAX_CACHE_CLIENTS);
+        item->sync[dcc->priv->id] = serial;
+        cache->sync[dcc->priv->id] = serial;
+        *lossy = item->lossy;
+        stat_inc_counter(display->priv->pixmap_cache_lookup_hits_counter, 1);
     }
 
     return !!item;
@@ -330,19 +330,61 @@ static void marshaller_compress_buf_free(uint8_t *data, void *opaque)
     compress_buf_free(static_cast<RedCompressBuf *>(opaque));
 }
 
-static void marshaller_add_compressed(SpiceMarshaller *m,
-                                      RedCompressBuf *comp_buf, size_t size)
+static void marshaller_zerocopy_buffer_release(uint8_t *data, void *opaque)
+{
+    red_stream_zerocopy_buffer_release(static_cast<RedZeroCopyBuffer *>(opaque));
+}
+
+/* Add a buffer by reference. If the stream supports it large buffers are
+ * sent without copying them, free_data is then delayed until the kernel
+ * does not use the buffer anymore */
+static void marshaller_add_by_ref_zerocopy(DisplayChannelClient *dcc, SpiceMarshaller *m,
+                                           uint8_t *data, size_t size,
+                                           RedZeroCopyFree free_data, void *opaque)
+{
+    RedStream *stream = dcc->get_stream();
+
+    if (size >= RED_STREAM_ZEROCOPY_MIN_SIZE && stream && red_stream_is_zerocopy(stream)) {
+        RedZeroCopyBuffer *buffer =
+            red_stream_zerocopy_buffer_new(stream, data, size, free_data, opaque);
+        spice_marshaller_add_by_ref_full(m, data, size,
+                                         marshaller_zerocopy_buffer_release, buffer);
+        return;
+    }
+    spice_marshaller_add_by_ref_full(m, data, size, free_data, opaque);
+}
+
+static void marshaller_unref_cache_entry(uint8_t *data, void *opaque)
 {
-    size_t max = size;
+    image_compress_cache_entry_unref(static_cast<ImageCompressCacheEntry *>(opaque));
+}
+
+static void marshaller_add_compressed(DisplayChannelClient *dcc, SpiceMarshaller *m,
+                                      const compress_send_data_t *comp_data)
+{
+    RedCompressBuf *comp_buf = comp_data->comp_buf;
+    ImageCompressCacheEntry *cache_entry = comp_data->cache_entry;
+    size_t max = comp_data->comp_buf_size;
     size_t now;
     do {
         spice_return_if_fail(comp_buf);
         now = MIN(sizeof(comp_buf->buf), max);
         max -= now;
-        spice_marshaller_add_by_ref_full(m, comp_buf->buf.bytes, now,
-                                         marshaller_compress_buf_free, comp_buf);
+        if (cache_entry) {
+            /* the buffers are shared, keep them until every message is sent */
+            marshaller_add_by_ref_zerocopy(dcc, m, comp_buf->buf.bytes, now,
+                                           marshaller_unref_cache_entry,
+                                           image_compress_cache_entry_ref(cache_entry));
+        } else {
+            marshaller_add_by_ref_zerocopy(dcc, m, comp_buf->buf.bytes, now,
+                                           marshaller_compress_buf_free, comp_buf);
+        }
         comp_buf = comp_buf->send_next;
     } while (max);
+
+    if (cache_entry) {
+        image_compress_cache_entry_unref(cache_entry);
+    }
 }
 
 static void marshaller_unref_drawable(uint8_t *data, void *opaque)
@@ -437,7 +479,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
            in order to prevent starvation in the client between pixmap_cache and
            global dictionary (in cases of multiple monitors) */
         if (red_stream_get_family(dcc->get_stream()) == AF_UNIX ||
-            !dcc_compress_image(dcc, &image, &simage->u.bitmap,
+            !dcc_compress_image(dcc, &image, &simage->u.bitmap, &simage->descriptor,
                                 drawable, can_lossy, &comp_send_data)) {
             SpicePalette *palette;
 
@@ -472,8 +514,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
         spice_marshall_Image(m, &image, &bitmap_palette_out, &lzplt_palette_out);
         spice_assert(bitmap_palette_out == nullptr);
 
-        marshaller_add_compressed(m, comp_send_data.comp_buf,
-                                  comp_send_data.comp_buf_size);
+        marshaller_add_compressed(dcc, m, &comp_send_data);
 
         if (lzplt_palette_out && comp_send_data.lzplt_palette) {
             spice_marshall_Palette(lzplt_palette_out, comp_send_data.lzplt_palette);
@@ -1637,6 +1678,61 @@ static void red_release_video_encoder_buffer(uint8_t *data, void *opaque)
     buffer->free(buffer);
 }
 
+static bool is_stream_frame_sized(const VideoStream *stream, const RedDrawable *red_drawable)
+{
+    const SpiceCopy *copy = &red_drawable->u.copy;
+
+    return (copy->src_area.right - copy->src_area.left != stream->width) ||
+           (copy->src_area.bottom - copy->src_area.top != stream->height) ||
+           !rect_is_equal(&red_drawable->bbox, &stream->dest_area);
+}
+
+/* The marshaller takes ownership of outbuf */
+static void red_marshall_stream_frame(DisplayChannelClient *dcc,
+                                      SpiceMarshaller *base_marshaller,
+                                      VideoStreamAgent *agent,
+                                      const RedDrawable *red_drawable,
+                                      uint32_t frame_mm_time,
+                                      VideoBuffer *outbuf)
+{
+    int stream_id = display_channel_get_video_stream_id(DCC_TO_DC(dcc), agent->stream);
+
+    if (!is_stream_frame_sized(agent->stream, red_drawable)) {
+        SpiceMsgDisplayStreamData stream_data;
+
+        dcc->init_send_data(SPICE_MSG_DISPLAY_STREAM_DATA);
+
+        stream_data.base.id = stream_id;
+        stream_data.base.multi_media_time = frame_mm_time;
+        stream_data.data_size = outbuf->size;
+
+        spice_marshall_msg_display_stream_data(base_marshaller, &stream_data);
+    } else {
+        SpiceMsgDisplayStreamDataSized stream_data;
+        const SpiceCopy *copy = &red_drawable->u.copy;
+
+        dcc->init_send_data(SPICE_MSG_DISPLAY_STREAM_DATA_SIZED);
+
+        stream_data.base.id = stream_id;
+        stream_data.base.multi_media_time = frame_mm_time;
+        stream_data.data_size = outbuf->size;
+        stream_data.width = copy->src_area.right - copy->src_area.left;
+        stream_data.height = copy->src_area.bottom - copy->src_area.top;
+        stream_data.dest = red_drawable->bbox;
+
+        spice_debug("stream %d: sized frame: dest ==> ", stream_data.base.id);
+        rect_debug(&stream_data.dest);
+        spice_marshall_msg_display_stream_data_sized(base_marshaller, &stream_data);
+    }
+#ifdef STREAM_STATS
+    agent->stats.num_frames_sent++;
+    agent->stats.size_sent += outbuf->size;
+    agent->stats.end = frame_mm_time;
+#endif
+    marshaller_add_by_ref_zerocopy(dcc, base_marshaller, outbuf->data, outbuf->size,
+                                   &red_release_video_encoder_buffer, outbuf);
+}
+
 static bool red_marshall_stream_data(DisplayChannelClient *dcc,
                                      SpiceMarshaller *base_marshaller,
                                      Drawable *drawable)
@@ -1645,7 +1741,6 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
     VideoStream *stream = drawable->stream;
     SpiceCopy *copy;
     uint32_t frame_mm_time;
-    int is_sized;
     VideoEncodeResults ret;
 
     spice_assert(drawable->red_drawable->type == QXL_DRAW_COPY);
@@ -1655,11 +1750,7 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
         return FALSE;
     }
 
-    is_sized = (copy->src_area.right - copy->src_area.left != stream->width) ||
-               (copy->src_area.bottom - copy->src_area.top != stream->height) ||
-               !rect_is_equal(&drawable->red_drawable->bbox, &stream->dest_area);
-
-    if (is_sized &&
+    if (is_stream_frame_sized(stream, drawable->red_drawable.get()) &&
         !dcc->test_remote_cap(SPICE_DISPLAY_CAP_SIZED_STREAM)) {
         return FALSE;
     }
@@ -1684,6 +1775,9 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
         agent->stats.num_drops_fps++;
 #endif
         return TRUE;
+    case VIDEO_ENCODER_FRAME_PENDING:
+        /* sent once encoded, see video_stream_push_encoded_frames() */
+        return TRUE;
     case VIDEO_ENCODER_FRAME_UNSUPPORTED:
         return FALSE;
     case VIDEO_ENCODER_FRAME_ENCODE_DONE:
@@ -1693,40 +1787,8 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
         return FALSE;
     }
 
-    if (!is_sized) {
-        SpiceMsgDisplayStreamData stream_data;
-
-        dcc->init_send_data(SPICE_MSG_DISPLAY_STREAM_DATA);
-
-        stream_data.base.id = stream_id;
-        stream_data.base.multi_media_time = frame_mm_time;
-        stream_data.data_size = outbuf->size;
-
-        spice_marshall_msg_display_stream_data(base_marshaller, &stream_data);
-    } else {
-        SpiceMsgDisplayStreamDataSized stream_data;
-
-        dcc->init_send_data(SPICE_MSG_DISPLAY_STREAM_DATA_SIZED);
-
-        stream_data.base.id = stream_id;
-        stream_data.base.multi_media_time = frame_mm_time;
-        stream_data.data_size = outbuf->size;
-        stream_data.width = copy->src_area.right - copy->src_area.left;
-        stream_data.height = copy->src_area.bottom - copy->src_area.top;
-        stream_data.dest = drawable->red_drawable->bbox;
-
-        spice_debug("stream %d: sized frame: dest ==> ", stream_data.base.id);
-        rect_debug(&stream_data.dest);
-        spice_marshall_msg_display_stream_data_sized(base_marshaller, &stream_data);
-    }
-    spice_marshaller_add_by_ref_full(base_marshaller, outbuf->data, outbuf->size,
-                                     &red_release_video_encoder_buffer, outbuf);
-#ifdef STREAM_STATS
-    agent->stats.num_frames_sent++;
-    agent->stats.size_sent += outbuf->size;
-    agent->stats.end = frame_mm_time;
-#endif
-
+    red_marshall_stream_frame(dcc, base_marshaller, agent, drawable->red_drawable.get(),
+                              frame_mm_time, outbuf);
     return TRUE;
 }
 
@@ -1936,15 +1998,15 @@ static void red_marshall_image(DisplayChannelClient *dcc,
 
     compress_send_data_t comp_send_data = {nullptr};
 
-    int comp_succeeded = dcc_compress_image(dcc, &red_image, &bitmap, nullptr, item->can_lossy, &comp_send_data);
+    int comp_succeeded = dcc_compress_image(dcc, &red_image, &bitmap, nullptr, nullptr,
+                                            item->can_lossy, &comp_send_data);
 
     surface_lossy_region = &dcc->priv->surface_client_lossy_region[item->surface_id];
     if (comp_succeeded) {
         spice_marshall_Image(src_bitmap_out, &red_image,
                              &bitmap_palette_out, &lzplt_palette_out);
 
-        marshaller_add_compressed(src_bitmap_out,
-                                  comp_send_data.comp_buf, comp_send_data.comp_buf_size);
+        marshaller_add_compressed(dcc, src_bitmap_out, &comp_send_data);
 
         if (lzplt_palette_out && comp_send_data.lzplt_palette) {
             spice_marshall_Palette(lzplt_palette_out, comp_send_data.lzplt_palette);
@@ -2318,6 +2380,7 @@ static void reset_send_data(DisplayChannelClient *dcc)
     dcc->priv->send_data.num_pixmap_cache_items = 0;
     memset(dcc->priv->send_data.free_list.sync, 0,
            sizeof(dcc->priv->send_data.free_list.sync));
+    dcc->priv->send_data.compress_job = nullptr;
 }
 
 void DisplayChannelClient::send_item(RedPipeItem *pipe_item)
@@ -2329,7 +2392,11 @@ void DisplayChannelClient::send_item(RedPipeItem *pipe_item)
     switch (pipe_item->type) {
     case RED_PIPE_ITEM_TYPE_DRAW: {
         auto dpi = static_cast<RedDrawablePipeItem*>(pipe_item);
+        priv->send_data.compress_job = dpi->compress_job;
+        stat_time_t marshal_start = stat_histogram_start();
         marshall_qxl_drawable(this, m, dpi);
+        stat_histogram_add(&DCC_TO_DC(this)->priv->marshal_histogram, marshal_start);
+        set_send_origin_time(dpi->drawable->creation_time);
         break;
     }
     case RED_PIPE_ITEM_TYPE_INVAL_ONE:
@@ -2343,6 +2410,13 @@ void DisplayChannelClient::send_item(RedPipeItem *pipe_item)
     case RED_PIPE_ITEM_TYPE_STREAM_CLIP:
         marshall_stream_clip(this, m, static_cast<VideoStreamClipItem*>(pipe_item));
         break;
+    case RED_PIPE_ITEM_TYPE_STREAM_DATA: {
+        auto item = static_cast<StreamDataItem*>(pipe_item);
+        red_marshall_stream_frame(this, m, item->agent, item->red_drawable.get(),
+                                  item->frame_mm_time, item->outbuf);
+        item->outbuf = nullptr;
+        break;
+    }
     case RED_PIPE_ITEM_TYPE_STREAM_DESTROY: {
         auto item = static_cast<StreamCreateDestroyItem*>(pipe_item);
         marshall_stream_end(this, m, item->agent);
@@ -2354,9 +2428,12 @@ void DisplayChannelClient::send_item(RedPipeItem *pipe_item)
     case RED_PIPE_ITEM_TYPE_MIGRATE_DATA:
         display_channel_marshall_migrate_data(this, m);
         break;
-    case RED_PIPE_ITEM_TYPE_IMAGE:
-        red_marshall_image(this, m, static_cast<RedImageItem*>(pipe_item));
+    case RED_PIPE_ITEM_TYPE_IMAGE: {
+        auto item = static_cast<RedImageItem*>(pipe_item);
+        priv->send_data.compress_job = item->compress_job;
+        red_marshall_image(this, m, item);
         break;
+    }
     case RED_PIPE_ITEM_TYPE_PIXMAP_SYNC:
         display_channel_marshall_pixmap_sync(this, m);
         break;
@@ -17,6 +17,8 @@
 */
 #include <config.h>
 
+#include <cerrno>
+
 #include <common/utils.h>
 #include "dcc-private.h"
 #include "display-channel.h"
@@ -27,8 +29,62 @@
 
 #define DISPLAY_CLIENT_SHORT_TIMEOUT 15000000000ULL //nano
 #define DISPLAY_FREE_LIST_DEFAULT_SIZE 128
+/* send large images and video frames with MSG_ZEROCOPY */
+#define DISPLAY_ZEROCOPY_ENV "SPICE_DISPLAY_ZEROCOPY"
+/* write to the socket from a thread for each client */
+#define DISPLAY_SENDER_ENV "SPICE_DISPLAY_SENDER_THREAD"
+/* the damage of a surface is reduced to its extents past this */
+#define DISPLAY_DAMAGE_MAX_RECTS 16
+#define DISPLAY_FRAME_MIN_RATE 10
+#define DISPLAY_FRAME_MAX_RATE 1000
 
 static void dcc_init_stream_agents(DisplayChannelClient *dcc);
+static void dcc_precompress_drawable(DisplayChannelClient *dcc, RedDrawablePipeItem *dpi);
+static void dcc_precompress_image(DisplayChannelClient *dcc, RedImageItem *item);
+
+static uint32_t dcc_get_damage_pipe_size_from_env(void)
+{
+    const char *env = getenv(DISPLAY_DAMAGE_PIPE_SIZE_ENV);
+    unsigned long pipe_size;
+    char *end;
+
+    if (!env || !*env) {
+        return 0;
+    }
+
+    errno = 0;
+    pipe_size = strtoul(env, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        spice_warning("error parsing %s: %s", DISPLAY_DAMAGE_PIPE_SIZE_ENV, env);
+        return 0;
+    }
+    /* past MAX_PIPE_SIZE the worker stops processing the commands */
+    return MIN(pipe_size, MAX_PIPE_SIZE);
+}
+
+/* Interval between two frames in ns, 0 if the frames are not paced */
+static uint64_t dcc_get_frame_interval_from_env(void)
+{
+    const char *env = getenv(DISPLAY_FRAME_RATE_ENV);
+    unsigned long rate;
+    char *end;
+
+    if (!env || !*env) {
+        return 0;
+    }
+
+    errno = 0;
+    rate = strtoul(env, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        spice_warning("error parsing %s: %s", DISPLAY_FRAME_RATE_ENV, env);
+        return 0;
+    }
+    if (rate == 0) {
+        return 0;
+    }
+    rate = CLAMP(rate, DISPLAY_FRAME_MIN_RATE, DISPLAY_FRAME_MAX_RATE);
+    return NSEC_PER_SEC / rate;
+}
 
 DisplayChannelClient::DisplayChannelClient(DisplayChannel *display,
                          RedClient *client, RedStream *stream,
@@ -61,12 +117,28 @@ DisplayChannelClient::DisplayChannelClient(DisplayChannel *display,
     image_encoders_init(&priv->encoders, &DCC_TO_DC(this)->priv->encoder_shared_data);
 
     dcc_init_stream_agents(this);
+
+    for (auto &damage : priv->surface_damage) {
+        region_init(&damage);
+    }
+    priv->damage_pipe_size = dcc_get_damage_pipe_size_from_env();
+    priv->frame_interval = dcc_get_frame_interval_from_env();
+
+    /* the sender thread and zero copy can't be used together */
+    if (getenv(DISPLAY_SENDER_ENV) != nullptr && red_stream_enable_sender(stream)) {
+        spice_debug("sender thread enabled");
+    } else if (getenv(DISPLAY_ZEROCOPY_ENV) != nullptr && red_stream_enable_zerocopy(stream)) {
+        spice_debug("zero copy send enabled");
+    }
 }
 
 DisplayChannelClient::~DisplayChannelClient()
 {
     g_clear_pointer(&priv->preferred_video_codecs, g_array_unref);
     g_clear_pointer(&priv->client_preferred_video_codecs, g_array_unref);
+    for (auto &damage : priv->surface_damage) {
+        region_destroy(&damage);
+    }
 }
 
 RedSurfaceCreateItem::RedSurfaceCreateItem(uint32_t surface_id,
@@ -227,6 +299,8 @@ dcc_add_surface_area_image(DisplayChannelClient *dcc, RedSurface *surface,
         }
     }
 
+    dcc_precompress_image(dcc, item.get());
+
     if (pipe_item_pos != dcc->get_pipe().end()) {
         dcc->pipe_add_after_pos(item, pipe_item_pos);
     } else {
@@ -289,32 +363,194 @@ RedDrawablePipeItem::RedDrawablePipeItem(DisplayChannelClient *init_dcc, Drawabl
 
 RedDrawablePipeItem::~RedDrawablePipeItem()
 {
+    /* the job may still be reading the drawable data */
+    image_compress_job_free(compress_job);
     drawable->pipes = g_list_remove(drawable->pipes, this);
+    if (!drawable->pipes) {
+        /* no other client will send the images */
+        image_compress_cache_clear(&drawable->compressed_images);
+    }
     drawable_unref(drawable);
 }
 
+/* A client which can't keep up gets the drawables as damage of their
+ * surfaces rather than in its pipe, until dcc_push_damage() sends it */
+static bool dcc_add_drawable_damage(DisplayChannelClient *dcc, Drawable *drawable)
+{
+    if (!dcc->priv->damaged_surfaces &&
+        (!dcc->priv->damage_pipe_size || dcc->get_pipe_size() < dcc->priv->damage_pipe_size)) {
+        return false;
+    }
+
+    /* the id may already be released, or used by a new surface */
+    if (DCC_TO_DC(dcc)->priv->surfaces[drawable->surface->id] != drawable->surface) {
+        return false;
+    }
+
+    add_drawable_surface_images(dcc, drawable);
+
+    QRegion *damage = &dcc->priv->surface_damage[drawable->surface->id];
+    if (region_is_empty(damage)) {
+        dcc->priv->damaged_surfaces++;
+    }
+    region_add(damage, &drawable->red_drawable->bbox);
+    if (pixman_region32_n_rects(damage) > DISPLAY_DAMAGE_MAX_RECTS) {
+        SpiceRect extents;
+
+        region_extents(damage, &extents);
+        region_clear(damage);
+        region_add(damage, &extents);
+    }
+    return true;
+}
+
+void dcc_clear_damage(DisplayChannelClient *dcc, uint32_t surface_id)
+{
+    QRegion *damage = &dcc->priv->surface_damage[surface_id];
+
+    if (!region_is_empty(damage)) {
+        region_clear(damage);
+        dcc->priv->damaged_surfaces--;
+    }
+}
+
+bool dcc_push_damage(DisplayChannelClient *dcc)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+
+    if (!dcc->priv->damaged_surfaces) {
+        return false;
+    }
+    if (!dcc->pipe_is_empty() || dcc->is_blocked()) {
+        return true;
+    }
+
+    for (uint32_t surface_id = 0; dcc->priv->damaged_surfaces; surface_id++) {
+        QRegion *damage = &dcc->priv->surface_damage[surface_id];
+        SpiceRect rects[DISPLAY_DAMAGE_MAX_RECTS];
+
+        if (region_is_empty(damage)) {
+            continue;
+        }
+        RedSurface *surface = display->priv->surfaces[surface_id];
+        int n_rects = MIN(pixman_region32_n_rects(damage), DISPLAY_DAMAGE_MAX_RECTS);
+        region_ret_rects(damage, rects, n_rects);
+        dcc_clear_damage(dcc, surface_id);
+        if (!surface) {
+            continue;
+        }
+
+        /* a single image with the current content replaces all the
+         * drawables of the area */
+        for (int i = 0; i < n_rects; i++) {
+            display_channel_draw(display, &rects[i], surface_id);
+            dcc_add_surface_area_image(dcc, surface, &rects[i],
+                                       dcc->get_pipe().end(), true);
+        }
+    }
+    return false;
+}
+
+/* The clients which couldn't display more frames get fewer of them, at
+ * most 4 frames per roundtrip, and the interval grows while the link
+ * doesn't absorb a frame per interval */
+static uint64_t dcc_get_frame_interval(DisplayChannelClient *dcc)
+{
+    uint64_t interval = dcc->priv->frame_interval;
+    uint64_t roundtrip;
+    int rcc_roundtrip = dcc->get_roundtrip_ms();
+
+    if (rcc_roundtrip < 0) {
+        /* no latency measured on this channel yet, the main channel
+         * client returns 0 if it did not measure one either */
+        roundtrip = dcc->get_client()->get_main()->get_roundtrip_ms();
+    } else {
+        roundtrip = rcc_roundtrip;
+    }
+    interval = MAX(interval, roundtrip * NSEC_PER_MILLISEC / 4);
+    interval <<= dcc->priv->frame_backoff;
+    return MIN(interval, NSEC_PER_SEC / DISPLAY_FRAME_MIN_RATE);
+}
+
+/* Called at each frame: if the socket is still blocked sending the previous
+ * frames the link is slower than the frame rate, the interval is doubled.
+ * Once the client catches up the interval is halved back */
+static void dcc_update_frame_backoff(DisplayChannelClient *dcc)
+{
+    if (dcc->is_blocked()) {
+        if ((dcc->priv->frame_interval << dcc->priv->frame_backoff) <
+            NSEC_PER_SEC / DISPLAY_FRAME_MIN_RATE) {
+            dcc->priv->frame_backoff++;
+        }
+    } else if (dcc->priv->frame_backoff > 0) {
+        dcc->priv->frame_backoff--;
+    }
+}
+
+/* Send the pipe at most once per frame interval. After an idle interval
+ * the drawable is sent right away, otherwise the pipe is held until the
+ * next frame so that the drawables covered by the following ones are
+ * removed from it rather than sent */
+static void dcc_pace_frame(DisplayChannelClient *dcc)
+{
+    if (!dcc->priv->frame_interval) {
+        return;
+    }
+
+    uint64_t now = spice_get_monotonic_time_ns();
+    if (now < dcc->priv->frame_hold_time) {
+        return;
+    }
+    dcc_update_frame_backoff(dcc);
+    if (now >= dcc->priv->next_frame_time) {
+        dcc->priv->next_frame_time = now + dcc_get_frame_interval(dcc);
+        return;
+    }
+    dcc->priv->frame_hold_time = dcc->priv->next_frame_time;
+    dcc->priv->next_frame_time += dcc_get_frame_interval(dcc);
+    dcc->hold_pipe(dcc->priv->frame_hold_time);
+}
+
 void dcc_prepend_drawable(DisplayChannelClient *dcc, Drawable *drawable)
 {
+    if (dcc_add_drawable_damage(dcc, drawable)) {
+        return;
+    }
+
     auto dpi = red::make_shared<RedDrawablePipeItem>(dcc, drawable);
 
     add_drawable_surface_images(dcc, drawable);
+    dcc_precompress_drawable(dcc, dpi.get());
     dcc->pipe_add(dpi);
+    dcc_pace_frame(dcc);
 }
 
 void dcc_append_drawable(DisplayChannelClient *dcc, Drawable *drawable)
 {
+    if (dcc_add_drawable_damage(dcc, drawable)) {
+        return;
+    }
+
     auto dpi = red::make_shared<RedDrawablePipeItem>(dcc, drawable);
 
     add_drawable_surface_images(dcc, drawable);
+    dcc_precompress_drawable(dcc, dpi.get());
     dcc->pipe_add_tail(dpi);
+    dcc_pace_frame(dcc);
 }
 
 void dcc_add_drawable_after(DisplayChannelClient *dcc, Drawable *drawable, RedPipeItem *pos)
 {
+    if (dcc_add_drawable_damage(dcc, drawable)) {
+        return;
+    }
+
     auto dpi = red::make_shared<RedDrawablePipeItem>(dcc, drawable);
 
     add_drawable_surface_images(dcc, drawable);
+    dcc_precompress_drawable(dcc, dpi.get());
     dcc->pipe_add_after(dpi, pos);
+    dcc_pace_frame(dcc);
 }
 
 static void dcc_init_stream_agents(DisplayChannelClient *dcc)
@@ -487,6 +723,11 @@ void dcc_push_monitors_config(DisplayChannelClient *dcc)
     dcc->pipe_add(mci);
 }
 
+RedImageItem::~RedImageItem()
+{
+    image_compress_job_free(compress_job);
+}
+
 RedSurfaceDestroyItem::RedSurfaceDestroyItem(uint32_t surface_id)
 {
     surface_destroy.surface_id = surface_id;
@@ -537,6 +778,7 @@ void dcc_destroy_surface(DisplayChannelClient *dcc, uint32_t surface_id)
     }
 
     display = DCC_TO_DC(dcc);
+    dcc_clear_damage(dcc, surface_id);
 
     if (display->get_during_target_migrate() ||
         !dcc->priv->surface_client_created[surface_id]) {
@@ -569,17 +811,106 @@ static bool can_lz_compress(SpiceBitmap *bitmap)
            !(bitmap->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE);
 }
 
+static BitmapGradualType get_bitmap_graduality(DisplayChannelClient *dcc, SpiceBitmap *bitmap,
+                                               const SpiceImageDescriptor *descriptor,
+                                               Drawable *drawable)
+{
+    if (!bitmap_fmt_has_graduality(bitmap->format)) {
+        return BITMAP_GRADUAL_NOT_AVAIL;
+    }
+    if (drawable != nullptr && drawable->copy_bitmap_graduality != BITMAP_GRADUAL_INVALID) {
+        return drawable->copy_bitmap_graduality;
+    }
+    return display_channel_get_bitmap_graduality(DCC_TO_DC(dcc), descriptor, bitmap);
+}
+
+static bool can_jpeg_compress(DisplayChannel *display, SpiceBitmap *bitmap, int can_lossy)
+{
+    return can_lossy && display->priv->enable_jpeg &&
+           (bitmap->format != SPICE_BITMAP_FMT_RGBA || !bitmap_has_extra_stride(bitmap));
+}
+
+/* Bit rate measured by the main channel, 0 if unknown */
+static uint64_t dcc_get_bit_rate(DisplayChannelClient *dcc)
+{
+    MainChannelClient *mcc = dcc->get_client()->get_main();
+
+    return mcc->is_network_info_initialized() ? mcc->get_bitrate_per_sec() : 0;
+}
+
+/* Let the compression selector choose among the codecs usable for the bitmap.
+ * When lossy compression is allowed QUIC images are encoded with JPEG, like
+ * without the selector JPEG is then used only for the highly gradual bitmaps
+ * or the ones LZ can't compress */
+static SpiceImageCompression dcc_select_compression(DisplayChannelClient *dcc,
+                                                    SpiceBitmap *bitmap,
+                                                    const SpiceImageDescriptor *descriptor,
+                                                    Drawable *drawable, int can_lossy,
+                                                    BitmapGradualType *graduality)
+{
+    ImageCompressSelector *selector = DCC_TO_DC(dcc)->priv->compress_selector;
+    uint32_t candidates = 0;
+
+    *graduality = get_bitmap_graduality(dcc, bitmap, descriptor, drawable);
+    if (can_quic_compress(bitmap)) {
+        if (!can_jpeg_compress(DCC_TO_DC(dcc), bitmap, can_lossy)) {
+            candidates |= IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_QUIC);
+        } else if (*graduality == BITMAP_GRADUAL_HIGH || !can_lz_compress(bitmap)) {
+            candidates |= IMAGE_COMPRESS_CANDIDATE(IMAGE_COMPRESS_JPEG);
+        }
+    }
+    if (can_lz_compress(bitmap)) {
+        candidates |= IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_LZ);
+        if (dcc->priv->image_compression == SPICE_IMAGE_COMPRESSION_AUTO_GLZ &&
+            drawable != nullptr && bitmap_fmt_has_graduality(bitmap->format)) {
+            candidates |= IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_GLZ);
+        }
+#ifdef USE_LZ4
+        if (bitmap_fmt_is_rgb(bitmap->format) &&
+            dcc->test_remote_cap(SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
+            candidates |= IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_LZ4);
+        }
+#endif
+    }
+
+    SpiceImageCompression compression =
+        image_compress_selector_choose(selector, *graduality, candidates,
+                                       bitmap->y * uint64_t{bitmap->stride},
+                                       dcc_get_bit_rate(dcc));
+    if (compression == SPICE_IMAGE_COMPRESSION_INVALID) {
+        return SPICE_IMAGE_COMPRESSION_OFF;
+    }
+    if (compression == IMAGE_COMPRESS_JPEG) {
+        return SPICE_IMAGE_COMPRESSION_QUIC;
+    }
+    return compression;
+}
+
 #define MIN_SIZE_TO_COMPRESS 54
-static SpiceImageCompression get_compression_for_bitmap(SpiceBitmap *bitmap,
-                                                        SpiceImageCompression preferred_compression,
-                                                        Drawable *drawable)
+/* If the compression selector is used 'graduality' is set to the
+ * graduality class of the bitmap, otherwise to BITMAP_GRADUAL_INVALID.
+ * 'descriptor' is the one of the guest image or NULL */
+static SpiceImageCompression get_compression_for_bitmap(DisplayChannelClient *dcc,
+                                                        SpiceBitmap *bitmap,
+                                                        const SpiceImageDescriptor *descriptor,
+                                                        Drawable *drawable, int can_lossy,
+                                                        BitmapGradualType *graduality)
 {
+    SpiceImageCompression preferred_compression = dcc->priv->image_compression;
+
+    *graduality = BITMAP_GRADUAL_INVALID;
     if (bitmap->y * bitmap->stride < MIN_SIZE_TO_COMPRESS) { // TODO: change the size cond
         return SPICE_IMAGE_COMPRESSION_OFF;
     }
     if (preferred_compression == SPICE_IMAGE_COMPRESSION_OFF) {
         return SPICE_IMAGE_COMPRESSION_OFF;
     }
+    if ((preferred_compression == SPICE_IMAGE_COMPRESSION_AUTO_GLZ ||
+         preferred_compression == SPICE_IMAGE_COMPRESSION_AUTO_LZ) &&
+        DCC_TO_DC(dcc)->priv->compress_selector) {
+        return dcc_select_compression(dcc, bitmap, descriptor, drawable, can_lossy,
+                                      graduality);
+    }
     if (preferred_compression == SPICE_IMAGE_COMPRESSION_QUIC) {
         if (can_quic_compress(bitmap)) {
             return SPICE_IMAGE_COMPRESSION_QUIC;
@@ -593,7 +924,8 @@ static SpiceImageCompression get_compression_for_bitmap(SpiceBitmap *bitmap,
             if (drawable == nullptr ||
                 drawable->copy_bitmap_graduality == BITMAP_GRADUAL_INVALID) {
                 if (bitmap_fmt_has_graduality(bitmap->format) &&
-                    bitmap_get_graduality_level(bitmap) == BITMAP_GRADUAL_HIGH) {
+                    display_channel_get_bitmap_graduality(DCC_TO_DC(dcc), descriptor, bitmap) ==
+                    BITMAP_GRADUAL_HIGH) {
                     return SPICE_IMAGE_COMPRESSION_QUIC;
                 }
             } else if (drawable->copy_bitmap_graduality == BITMAP_GRADUAL_HIGH) {
@@ -634,29 +966,238 @@ static SpiceImageCompression get_compression_for_bitmap(SpiceBitmap *bitmap,
     return SPICE_IMAGE_COMPRESSION_INVALID;
 }
 
+/* Only images big enough to be worth the thread hand-off are compressed
+ * in advance */
+#define MIN_SIZE_TO_PRECOMPRESS (64 * 1024)
+
+static ImageCompressJob *dcc_precompress_bitmap(DisplayChannelClient *dcc, SpiceBitmap *bitmap,
+                                                const SpiceImageDescriptor *descriptor,
+                                                Drawable *drawable, int can_lossy,
+                                                SpiceChunks *owned_chunks)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    SpiceImageCompression image_compression;
+    BitmapGradualType graduality;
+
+    if (bitmap->y * bitmap->stride < MIN_SIZE_TO_PRECOMPRESS ||
+        !bitmap_fmt_is_rgb(bitmap->format) ||
+        (bitmap->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE)) {
+        return nullptr;
+    }
+
+    image_compression = get_compression_for_bitmap(dcc, bitmap, descriptor, drawable,
+                                                   can_lossy, &graduality);
+    switch (image_compression) {
+    case SPICE_IMAGE_COMPRESSION_QUIC:
+    case SPICE_IMAGE_COMPRESSION_LZ:
+        break;
+#ifdef USE_LZ4
+    case SPICE_IMAGE_COMPRESSION_LZ4:
+        if (!dcc->test_remote_cap(SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
+            image_compression = SPICE_IMAGE_COMPRESSION_LZ;
+        }
+        break;
+#endif
+    default:
+        /* GLZ depends on the shared dictionary state, it must be encoded
+         * in order while sending */
+        return nullptr;
+    }
+
+    return image_encoder_pool_submit(display->priv->encoder_pool, bitmap, owned_chunks,
+                                     dcc->priv->image_compression, image_compression,
+                                     graduality, image_compression == SPICE_IMAGE_COMPRESSION_QUIC &&
+                                     can_jpeg_compress(display, bitmap, can_lossy),
+                                     dcc->priv->encoders.jpeg_quality);
+}
+
+static void dcc_precompress_drawable(DisplayChannelClient *dcc, RedDrawablePipeItem *dpi)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    Drawable *drawable = dpi->drawable;
+    RedDrawable *red_drawable = drawable->red_drawable.get();
+
+    if (!display->priv->encoder_pool || drawable->stream ||
+        red_drawable->type != QXL_DRAW_COPY ||
+        red_stream_get_family(dcc->get_stream()) == AF_UNIX) {
+        return;
+    }
+
+    SpiceImage *image = red_drawable->u.copy.src_bitmap;
+    if (!image || image->descriptor.type != SPICE_IMAGE_TYPE_BITMAP) {
+        return;
+    }
+
+    /* the lossy marshalling of a copy always allows a lossy source */
+    dpi->compress_job = dcc_precompress_bitmap(dcc, &image->u.bitmap, &image->descriptor,
+                                               drawable, display->priv->enable_jpeg, nullptr);
+}
+
+static void dcc_precompress_image(DisplayChannelClient *dcc, RedImageItem *item)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    SpiceBitmap bitmap;
+
+    if (!display->priv->encoder_pool) {
+        return;
+    }
+
+    /* same bitmap red_marshall_image will build */
+    bitmap.format = item->image_format;
+    bitmap.flags = item->top_down ? SPICE_BITMAP_FLAGS_TOP_DOWN : 0;
+    bitmap.x = item->width;
+    bitmap.y = item->height;
+    bitmap.stride = item->stride;
+    bitmap.palette = nullptr;
+    bitmap.palette_id = 0;
+    bitmap.data = spice_chunks_new_linear(item->data, bitmap.stride * bitmap.y);
+
+    item->compress_job = dcc_precompress_bitmap(dcc, &bitmap, nullptr, nullptr, item->can_lossy,
+                                                bitmap.data);
+    if (!item->compress_job) {
+        spice_chunks_destroy(bitmap.data);
+    }
+}
+
+/* The job compressing 'src' in advance, if any. The compression was
+ * already chosen for it, even if the job turns out to produce nothing */
+static ImageCompressJob *dcc_take_compress_job(DisplayChannelClient *dcc, SpiceBitmap *src,
+                                               int can_lossy)
+{
+    ImageCompressJob *job = dcc->priv->send_data.compress_job;
+
+    if (!image_compress_job_matches(job, src, dcc->priv->image_compression,
+                                    can_jpeg_compress(DCC_TO_DC(dcc), src, can_lossy))) {
+        return nullptr;
+    }
+    dcc->priv->send_data.compress_job = nullptr;
+    return job;
+}
+
+/* Account a compression done by the client or by the encoder pool */
+static void dcc_compress_image_done(DisplayChannelClient *dcc, RedStatHistogram *histogram,
+                                    SpiceImageCompression image_compression,
+                                    BitmapGradualType graduality, const SpiceBitmap *src,
+                                    const compress_send_data_t *comp_data,
+                                    uint64_t compress_time)
+{
+    DisplayChannel *display_channel = DCC_TO_DC(dcc);
+
+    stat_histogram_add_time(histogram, compress_time);
+    if (graduality != BITMAP_GRADUAL_INVALID) {
+        image_compress_selector_update(display_channel->priv->compress_selector, graduality,
+                                       image_compression, src->stride * uint64_t{src->y},
+                                       comp_data->comp_buf_size, compress_time);
+    }
+}
+
+/* Whether the compressed image can be shared with the other clients
+ * sending 'drawable' */
+static bool dcc_can_share_image(Drawable *drawable, const SpiceBitmap *src,
+                                SpiceImageCompression image_compression)
+{
+    /* palettes are cached per client and GLZ depends on the dictionary */
+    if (drawable == nullptr || drawable->pipes == nullptr || drawable->pipes->next == nullptr ||
+        image_compression == SPICE_IMAGE_COMPRESSION_GLZ ||
+        !bitmap_fmt_is_rgb(src->format) ||
+        (src->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE)) {
+        return false;
+    }
+    return true;
+}
+
 int dcc_compress_image(DisplayChannelClient *dcc,
-                       SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
+                       SpiceImage *dest, SpiceBitmap *src,
+                       const SpiceImageDescriptor *src_descriptor, Drawable *drawable,
                        int can_lossy,
                        compress_send_data_t* o_comp_data)
 {
     DisplayChannel *display_channel = DCC_TO_DC(dcc);
+    auto histograms = &display_channel->priv->compress_histograms;
+    RedStatHistogram *histogram = nullptr;
     SpiceImageCompression image_compression;
+    BitmapGradualType graduality;
+    ImageCompressCacheKey shared_key;
+    bool share;
     stat_start_time_t start_time;
+    uint64_t compress_start;
     int success = FALSE;
 
+    o_comp_data->cache_entry = nullptr;
+    ImageCompressJob *job = dcc_take_compress_job(dcc, src, can_lossy);
+    if (job) {
+        uint64_t compress_time;
+
+        /* chosen when the job was submitted, not again */
+        image_compression = image_compress_job_get_compression(job, &graduality);
+        if (image_compress_job_take(job, dest, o_comp_data, &compress_time,
+                                    &display_channel->priv->encoder_shared_data)) {
+            switch (image_compression) {
+            case SPICE_IMAGE_COMPRESSION_QUIC:
+                histogram = &histograms->quic;
+                if (o_comp_data->is_lossy) {
+                    // lossy, estimated apart from the lossless codecs
+                    image_compression = IMAGE_COMPRESS_JPEG;
+                    histogram = &histograms->jpeg;
+                }
+                break;
+#ifdef USE_LZ4
+            case SPICE_IMAGE_COMPRESSION_LZ4:
+                histogram = &histograms->lz4;
+                break;
+#endif
+            default:
+                histogram = &histograms->lz;
+                break;
+            }
+            dcc_compress_image_done(dcc, histogram, image_compression, graduality, src,
+                                    o_comp_data, compress_time);
+            return TRUE;
+        }
+    }
+
     stat_start_time_init(&start_time, &display_channel->priv->encoder_shared_data.off_stat);
 
-    image_compression = get_compression_for_bitmap(src, dcc->priv->image_compression, drawable);
+    if (!job) {
+        image_compression = get_compression_for_bitmap(dcc, src, src_descriptor, drawable,
+                                                       can_lossy, &graduality);
+#ifdef USE_LZ4
+        if (image_compression == SPICE_IMAGE_COMPRESSION_LZ4 &&
+            !dcc->test_remote_cap(SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
+            image_compression = SPICE_IMAGE_COMPRESSION_LZ;
+        }
+#endif
+    }
+
+    share = dcc_can_share_image(drawable, src, image_compression);
+    if (share) {
+        shared_key.src = src;
+        shared_key.compression = image_compression;
+        shared_key.use_jpeg = image_compression == SPICE_IMAGE_COMPRESSION_QUIC &&
+                              can_jpeg_compress(display_channel, src, can_lossy);
+        shared_key.jpeg_quality = dcc->priv->encoders.jpeg_quality;
+        if (image_compress_cache_lookup(drawable->compressed_images, &shared_key,
+                                        dest, o_comp_data)) {
+            stat_inc_counter(display_channel->priv->compress_shared_hits_counter, 1);
+            return TRUE;
+        }
+        stat_inc_counter(display_channel->priv->compress_shared_misses_counter, 1);
+    }
+
+    compress_start = spice_get_monotonic_time_ns();
     switch (image_compression) {
     case SPICE_IMAGE_COMPRESSION_OFF:
         break;
     case SPICE_IMAGE_COMPRESSION_QUIC:
-        if (can_lossy && display_channel->priv->enable_jpeg &&
-            (src->format != SPICE_BITMAP_FMT_RGBA || !bitmap_has_extra_stride(src))) {
+        if (can_jpeg_compress(display_channel, src, can_lossy)) {
             success = image_encoders_compress_jpeg(&dcc->priv->encoders, dest, src, o_comp_data);
+            // lossy, estimated apart from the lossless codecs
+            image_compression = IMAGE_COMPRESS_JPEG;
+            histogram = &histograms->jpeg;
             break;
         }
         success = image_encoders_compress_quic(&dcc->priv->encoders, dest, src, o_comp_data);
+        histogram = &histograms->quic;
         break;
     case SPICE_IMAGE_COMPRESSION_GLZ:
         success = image_encoders_compress_glz(&dcc->priv->encoders, dest, src,
@@ -664,20 +1205,21 @@ int dcc_compress_image(DisplayChannelClient *dcc,
                                               o_comp_data,
                                               display_channel->priv->enable_zlib_glz_wrap);
         if (success) {
+            histogram = &histograms->glz;
             break;
         }
         goto lz_compress;
 #ifdef USE_LZ4
     case SPICE_IMAGE_COMPRESSION_LZ4:
-        if (dcc->test_remote_cap(SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
-            success = image_encoders_compress_lz4(&dcc->priv->encoders, dest, src, o_comp_data);
-            break;
-        }
+        success = image_encoders_compress_lz4(&dcc->priv->encoders, dest, src, o_comp_data);
+        histogram = &histograms->lz4;
+        break;
 #endif
-        /* fall through */
     case SPICE_IMAGE_COMPRESSION_LZ:
 lz_compress:
+        image_compression = SPICE_IMAGE_COMPRESSION_LZ;
         success = image_encoders_compress_lz(&dcc->priv->encoders, dest, src, o_comp_data);
+        histogram = &histograms->lz;
         if (success && !bitmap_fmt_is_rgb(src->format)) {
             dcc_palette_cache_palette(dcc, dest->u.lz_plt.palette, &(dest->u.lz_plt.flags));
         }
@@ -689,6 +1231,14 @@ lz_compress:
     if (!success) {
         uint64_t image_size = src->stride * uint64_t{src->y};
         stat_compress_add(&display_channel->priv->encoder_shared_data.off_stat, start_time, image_size, image_size);
+        return success;
+    }
+
+    dcc_compress_image_done(dcc, histogram, image_compression, graduality, src, o_comp_data,
+                            spice_get_monotonic_time_ns() - compress_start);
+
+    if (share) {
+        image_compress_cache_add(&drawable->compressed_images, &shared_key, dest, o_comp_data);
     }
 
     return success;
@@ -746,11 +1296,9 @@ bool dcc_pixmap_cache_unlocked_add(DisplayChannelClient *dcc, uint64_t id,
     PixmapCache *cache = dcc->priv->pixmap_cache;
     NewCacheItem *item;
     uint64_t serial;
-    int key;
 
     spice_assert(size > 0);
 
-    item = g_new(NewCacheItem, 1);
     serial = dcc->get_message_serial();
 
     if (cache->generation != dcc->priv->pixmap_cache_generation) {
@@ -758,42 +1306,34 @@ bool dcc_pixmap_cache_unlocked_add(DisplayChannelClient *dcc, uint64_t id,
             dcc->pipe_add_type(RED_PIPE_ITEM_TYPE_PIXMAP_SYNC);
             dcc->priv->pending_pixmaps_sync = TRUE;
         }
-        g_free(item);
         return FALSE;
     }
 
+    /* another channel client of the same client can have added it
+     * in the meantime, the client will just replace it */
+    if ((item = cache->items.find(id))) {
+        cache->items.touch(item);
+        item->lossy = lossy;
+        item->sync[dcc->priv->id] = serial;
+        cache->sync[dcc->priv->id] = serial;
+        return TRUE;
+    }
+
     cache->available -= size;
     while (cache->available < 0) {
-        NewCacheItem *tail;
-        NewCacheItem **now;
+        NewCacheItem *tail = cache->items.lru_tail();
 
-        SPICE_VERIFY(SPICE_OFFSETOF(NewCacheItem, lru_link) == 0);
-        if (!(tail = SPICE_CONTAINEROF(ring_get_tail(&cache->lru), NewCacheItem, lru_link)) ||
-                                                     tail->sync[dcc->priv->id] == serial) {
+        if (!tail || tail->sync[dcc->priv->id] == serial) {
             cache->available += size;
-            g_free(item);
             return FALSE;
         }
 
-        now = &cache->hash_table[BITS_CACHE_HASH_KEY(tail->id)];
-        for (;;) {
-            spice_assert(*now);
-            if (*now == tail) {
-                *now = tail->next;
-                break;
-            }
-            now = &(*now)->next;
-        }
-        ring_remove(&tail->lru_link);
         cache->available += tail->size;
         cache->sync[dcc->priv->id] = serial;
         dcc_push_release(dcc, SPICE_RES_TYPE_PIXMAP, tail->id, tail->sync);
-        g_free(tail);
+        cache->items.remove(tail);
     }
-    item->next = cache->hash_table[(key = BITS_CACHE_HASH_KEY(id))];
-    cache->hash_table[key] = item;
-    ring_item_init(&item->lru_link);
-    ring_add(&cache->lru, &item->lru_link);
+    item = cache->items.insert(id);
     item->id = id;
     item->size = size;
     item->lossy = lossy;
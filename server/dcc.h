@@ -30,6 +30,12 @@
 
 #include "push-visibility.h"
 
+/* pipe size from which the drawables are accumulated as damage */
+#define DISPLAY_DAMAGE_PIPE_SIZE_ENV "SPICE_DISPLAY_DAMAGE_PIPE_SIZE"
+/* frames per second sent to the clients, the drawables are sent as they
+ * come if not set */
+#define DISPLAY_FRAME_RATE_ENV "SPICE_DISPLAY_FRAME_RATE"
+
 struct DisplayChannel;
 struct DisplayChannelClientPrivate;
 
@@ -132,9 +138,15 @@ void                       dcc_add_drawable_after                    (DisplayCha
                                                                       RedPipeItem *pos);
 bool                       dcc_drawable_is_in_pipe                   (DisplayChannelClient *dcc,
                                                                       Drawable *drawable);
+/* returns whether some damage is still waiting for the client */
+bool                       dcc_push_damage                           (DisplayChannelClient *dcc);
+void                       dcc_clear_damage                          (DisplayChannelClient *dcc,
+                                                                      uint32_t surface_id);
 
 int                        dcc_compress_image                        (DisplayChannelClient *dcc,
-                                                                      SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
+                                                                      SpiceImage *dest, SpiceBitmap *src,
+                                                                      const SpiceImageDescriptor *src_descriptor,
+                                                                      Drawable *drawable,
                                                                       int can_lossy,
                                                                       compress_send_data_t* o_comp_data);
 
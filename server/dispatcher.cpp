@@ -26,6 +26,14 @@
 #ifndef _WIN32
 #include <poll.h>
 #endif
+#if defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_LINUX_FUTEX_H)
+#define DISPATCHER_HAVE_RING 1
+#include <atomic>
+#include <climits>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include "dispatcher.h"
 
@@ -44,6 +52,49 @@ struct DispatcherMessage {
     uint32_t ack:1;
 };
 
+#ifdef DISPATCHER_HAVE_RING
+#define DISPATCHER_RING_SIZE (64 * 1024)
+
+/* Ring used by DISPATCHER_TRANSPORT_RING.
+ * Positions are free running byte counters, each message is stored as a
+ * DispatcherMessage header followed by the payload aligned to 8 bytes.
+ * Senders are serialized by DispatcherPrivate::lock so there is only
+ * one writer and one reader of the ring at any time.
+ */
+struct DispatcherRing {
+    SPICE_CXX_GLIB_ALLOCATOR
+
+    /* written by the sender */
+    std::atomic<uint32_t> head{0};
+    /* a sender is waiting for the receiver to free some space */
+    std::atomic<uint32_t> sender_waiting{0};
+    /* keep fields written by different threads in different cache lines */
+    uint8_t padding[64];
+    /* written by the receiver */
+    std::atomic<uint32_t> tail{0};
+    /* the receiver found the ring empty, the next sender must ring the eventfd */
+    std::atomic<uint32_t> receiver_idle{1};
+    /* number of acknowledged messages, senders wait on it */
+    std::atomic<uint32_t> acks{0};
+    uint8_t data[DISPATCHER_RING_SIZE];
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+              "futex calls need plain 32 bit atomics");
+
+static void futex_wait(std::atomic<uint32_t> *addr, uint32_t val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t> *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+#else
+struct DispatcherRing;
+#endif
+
 struct DispatcherPrivate {
     SPICE_CXX_GLIB_ALLOCATOR
     explicit DispatcherPrivate(uint32_t init_max_message_type):
@@ -53,10 +104,22 @@ struct DispatcherPrivate {
     ~DispatcherPrivate();
     void send_message(const DispatcherMessage& msg, void *payload);
     bool handle_single_read();
+    void dispatch_message(const DispatcherMessage& msg);
     static void handle_event(int fd, int event, DispatcherPrivate* priv);
+#ifdef DISPATCHER_HAVE_RING
+    bool init_ring();
+    void ring_write(uint32_t pos, const void *buf, uint32_t size);
+    void ring_read(uint32_t pos, void *buf, uint32_t size);
+    void ring_kick();
+    void ring_send_message(const DispatcherMessage& msg, void *payload);
+    bool ring_handle_single_read();
+#endif
 
+    /* for DISPATCHER_TRANSPORT_RING recv_fd is the eventfd and
+     * send_fd is not used */
     int recv_fd;
     int send_fd;
+    DispatcherRing *ring;
     pthread_mutex_t lock;
     DispatcherMessage *messages;
     const guint max_message_type;
@@ -72,28 +135,57 @@ DispatcherPrivate::~DispatcherPrivate()
         continue;
     }
     g_free(messages);
-    socket_close(send_fd);
-    socket_close(recv_fd);
+#ifdef DISPATCHER_HAVE_RING
+    if (ring) {
+        close(recv_fd);
+        delete ring;
+    } else
+#endif
+    {
+        socket_close(send_fd);
+        socket_close(recv_fd);
+    }
     pthread_mutex_destroy(&lock);
     g_free(payload);
 }
 
 Dispatcher::~Dispatcher() = default;
 
-Dispatcher::Dispatcher(uint32_t max_message_type):
+#ifdef DISPATCHER_HAVE_RING
+bool DispatcherPrivate::init_ring()
+{
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        spice_warning("eventfd failed %s", strerror(errno));
+        return false;
+    }
+    recv_fd = fd;
+    send_fd = -1;
+    ring = new DispatcherRing();
+    return true;
+}
+#endif
+
+Dispatcher::Dispatcher(uint32_t max_message_type, DispatcherTransport transport):
     priv(new DispatcherPrivate(max_message_type))
 {
     int channels[2];
 
+    priv->messages = g_new0(DispatcherMessage, priv->max_message_type);
+    pthread_mutex_init(&priv->lock, nullptr);
+
+#ifdef DISPATCHER_HAVE_RING
+    if (transport == DISPATCHER_TRANSPORT_RING && priv->init_ring()) {
+        return;
+    }
+#endif
+
     if (socketpair(AF_LOCAL, SOCK_STREAM, 0, channels) == -1) {
         spice_error("socketpair failed %s", strerror(errno));
         return;
     }
-    pthread_mutex_init(&priv->lock, nullptr);
     priv->recv_fd = channels[0];
     priv->send_fd = channels[1];
-
-    priv->messages = g_new0(DispatcherMessage, priv->max_message_type);
 }
 
 #define ACK 0xffffffff
@@ -192,12 +284,29 @@ static int write_safe(int fd, const void *raw_buf, size_t size)
     return written_size;
 }
 
+void DispatcherPrivate::dispatch_message(const DispatcherMessage& msg)
+{
+    if (any_handler && msg.type != DISPATCHER_MESSAGE_TYPE_CUSTOM) {
+        any_handler(opaque, msg.type, payload);
+    }
+    if (msg.handler) {
+        msg.handler(opaque, payload);
+    } else {
+        g_warning("error: no handler for message type %d", msg.type);
+    }
+}
+
 bool DispatcherPrivate::handle_single_read()
 {
     int ret;
     DispatcherMessage msg[1];
     uint32_t ack = ACK;
 
+#ifdef DISPATCHER_HAVE_RING
+    if (ring) {
+        return ring_handle_single_read();
+    }
+#endif
     if ((ret = read_safe(recv_fd, msg, sizeof(msg), false)) == -1) {
         g_warning("error reading from dispatcher: %d", errno);
         return false;
@@ -215,14 +324,7 @@ bool DispatcherPrivate::handle_single_read()
         /* TODO: close socketpair? */
         return false;
     }
-    if (any_handler && msg->type != DISPATCHER_MESSAGE_TYPE_CUSTOM) {
-        any_handler(opaque, msg->type, payload);
-    }
-    if (msg->handler) {
-        msg->handler(opaque, payload);
-    } else {
-        g_warning("error: no handler for message type %d", msg->type);
-    }
+    dispatch_message(*msg);
     if (msg->ack) {
         if (write_safe(recv_fd, &ack, sizeof(ack)) == -1) {
             g_warning("error writing ack for message %d", msg->type);
@@ -238,14 +340,130 @@ bool DispatcherPrivate::handle_single_read()
  */
 void DispatcherPrivate::handle_event(int fd, int event, DispatcherPrivate* priv)
 {
+#ifdef DISPATCHER_HAVE_RING
+    if (priv->ring) {
+        eventfd_t value;
+        /* just reset the doorbell, the ring is checked anyway */
+        eventfd_read(fd, &value);
+    }
+#endif
     while (priv->handle_single_read()) {
     }
 }
 
+#ifdef DISPATCHER_HAVE_RING
+void DispatcherPrivate::ring_write(uint32_t pos, const void *buf, uint32_t size)
+{
+    uint32_t offset = pos % sizeof(ring->data);
+    uint32_t part = MIN(size, sizeof(ring->data) - offset);
+
+    memcpy(ring->data + offset, buf, part);
+    memcpy(ring->data, static_cast<const uint8_t *>(buf) + part, size - part);
+}
+
+void DispatcherPrivate::ring_read(uint32_t pos, void *buf, uint32_t size)
+{
+    uint32_t offset = pos % sizeof(ring->data);
+    uint32_t part = MIN(size, sizeof(ring->data) - offset);
+
+    memcpy(buf, ring->data + offset, part);
+    memcpy(static_cast<uint8_t *>(buf) + part, ring->data, size - part);
+}
+
+/* wake up the receiver if it's not already processing the ring */
+void DispatcherPrivate::ring_kick()
+{
+    if (ring->receiver_idle.exchange(0)) {
+        while (eventfd_write(recv_fd, 1) == -1 && errno == EINTR) {
+            continue;
+        }
+    }
+}
+
+void DispatcherPrivate::ring_send_message(const DispatcherMessage& msg, void *msg_payload)
+{
+    const uint32_t needed = sizeof(msg) + SPICE_ALIGN(msg.size, 8);
+    uint32_t head, acks;
+
+    if (needed > sizeof(ring->data)) {
+        g_warning("error: message %d too big for the dispatcher ring", msg.type);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    head = ring->head.load(std::memory_order_relaxed);
+    for (;;) {
+        uint32_t tail = ring->tail.load(std::memory_order_acquire);
+        if (sizeof(ring->data) - (head - tail) >= needed) {
+            break;
+        }
+        /* ring is full, make sure the receiver is running and wait for it
+         * to consume some data */
+        ring->sender_waiting.store(1);
+        ring_kick();
+        futex_wait(&ring->tail, tail);
+        ring->sender_waiting.store(0);
+    }
+
+    acks = ring->acks.load(std::memory_order_relaxed);
+    ring_write(head, &msg, sizeof(msg));
+    ring_write(head + sizeof(msg), msg_payload, msg.size);
+    ring->head.store(head + needed);
+    ring_kick();
+
+    if (msg.ack) {
+        while (ring->acks.load(std::memory_order_acquire) == acks) {
+            futex_wait(&ring->acks, acks);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+bool DispatcherPrivate::ring_handle_single_read()
+{
+    DispatcherMessage msg;
+    uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+
+    if (ring->head.load(std::memory_order_acquire) == tail) {
+        /* ring looks empty, tell senders to ring the eventfd and check
+         * again to not miss a message queued in the meantime */
+        ring->receiver_idle.store(1);
+        if (ring->head.load() == tail) {
+            return false;
+        }
+        ring->receiver_idle.store(0);
+    }
+
+    ring_read(tail, &msg, sizeof(msg));
+    if (G_UNLIKELY(msg.size > payload_size)) {
+        payload = g_realloc(payload, msg.size);
+        payload_size = msg.size;
+    }
+    ring_read(tail + sizeof(msg), payload, msg.size);
+    ring->tail.store(tail + sizeof(msg) + SPICE_ALIGN(msg.size, 8));
+    if (ring->sender_waiting.load()) {
+        futex_wake(&ring->tail);
+    }
+
+    dispatch_message(msg);
+    if (msg.ack) {
+        ring->acks.fetch_add(1, std::memory_order_release);
+        futex_wake(&ring->acks);
+    }
+    return true;
+}
+#endif
+
 void DispatcherPrivate::send_message(const DispatcherMessage& msg, void *msg_payload)
 {
     uint32_t ack;
 
+#ifdef DISPATCHER_HAVE_RING
+    if (ring) {
+        ring_send_message(msg, msg_payload);
+        return;
+    }
+#endif
     pthread_mutex_lock(&lock);
     if (write_safe(send_fd, &msg, sizeof(msg)) == -1) {
         g_warning("error: failed to send message header for message %d",
@@ -323,3 +541,8 @@ void Dispatcher::set_opaque(void *opaque)
 {
     priv->opaque = opaque;
 }
+
+DispatcherTransport Dispatcher::get_transport() const
+{
+    return priv->ring ? DISPATCHER_TRANSPORT_RING : DISPATCHER_TRANSPORT_SOCKET;
+}
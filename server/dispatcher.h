@@ -40,10 +40,20 @@ typedef void (*dispatcher_handle_any_message)(void *opaque,
                                               uint32_t message_type,
                                               void *payload);
 
+/* How messages are moved from the sending threads to the receiving one */
+enum DispatcherTransport {
+    /* messages are written to a socketpair */
+    DISPATCHER_TRANSPORT_SOCKET,
+    /* messages are copied into a memory ring, an eventfd wakes up the
+     * receiving thread only if it's idle. Falls back to
+     * DISPATCHER_TRANSPORT_SOCKET if not supported by the platform */
+    DISPATCHER_TRANSPORT_RING,
+};
+
 /**
  * A Dispatcher provides inter-thread communication by serializing messages.
- * Currently the Dispatcher uses a unix socket (socketpair) for dispatching the
- * messages.
+ * Messages are dispatched either through a unix socket (socketpair) or through
+ * a ring buffer, see DispatcherTransport.
  *
  * Message types are identified by a unique integer value and must first be
  * registered with the class (see register_handler()) before they
@@ -62,8 +72,10 @@ public:
      *                          be handled by this dispatcher. Each message type is
      *                          identified by an integer value between 0 and
      *                          max_message_type-1.
+     * @param transport:        how messages are transferred
      */
-    Dispatcher(uint32_t max_message_type);
+    Dispatcher(uint32_t max_message_type,
+               DispatcherTransport transport=DISPATCHER_TRANSPORT_SOCKET);
 
     /**
      * Sends a message to the receiving thread. The message type must have been
@@ -154,6 +166,11 @@ public:
      */
     void set_opaque(void *opaque);
 
+    /**
+     * @return the transport actually used by the dispatcher
+     */
+    DispatcherTransport get_transport() const;
+
 protected:
     virtual ~Dispatcher();
 
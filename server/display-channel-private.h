@@ -19,11 +19,25 @@
 #define DISPLAY_CHANNEL_PRIVATE_H_
 
 #include "display-channel.h"
+#include "image-encoder-pool.h"
+#include "image-compress-cache.h"
+#include "image-compress-selector.h"
+#include "surface-tile-map.h"
+#include "id-cache-table.hpp"
 
 #define TRACE_ITEMS_SHIFT 3
 #define NUM_TRACE_ITEMS (1 << TRACE_ITEMS_SHIFT)
 #define ITEMS_TRACE_MASK (NUM_TRACE_ITEMS - 1)
 
+/* Graduality level of an image cached by the guest, the size is checked
+ * in case an id is reused for a different image */
+struct GradualityCacheItem {
+    BitmapGradualType graduality;
+    uint8_t format;
+    uint32_t width;
+    uint32_t height;
+};
+
 struct DrawContext {
     SpiceCanvas *canvas;
     int canvas_draws_on_surface;
@@ -49,10 +63,16 @@ struct RedSurface {
      * actually used for drawing. The ring is maintained in order of age, the
      * tail being the oldest drawable. */
     Ring current_list;
+    /* spatial indexes of the items of the top level ring of 'current'
+     * and of 'current_list' */
+    RectIndex *tree_index;
+    RectIndex *list_index;
     DrawContext context;
 
     Ring depend_on_me;
     QRegion draw_dirty_region;
+    /* hashes of the content copied to the surface, optional */
+    SurfaceTileMap *tile_map;
 
     //fix me - better handling here
     /* 'create_cmd' holds surface data through a pointer to guest memory, it
@@ -120,6 +140,8 @@ struct DisplayChannelPrivate
     SpiceImageSurfaces image_surfaces;
 
     ImageCache image_cache;
+    /* see display_channel_get_bitmap_graduality() */
+    red::IdCacheTable<GradualityCacheItem> graduality_cache;
 
     int gl_draw_async_count;
 
@@ -134,7 +156,39 @@ struct DisplayChannelPrivate
     RedStatCounter cache_hits_counter;
     RedStatCounter add_to_cache_counter;
     RedStatCounter non_cache_counter;
+    /* pixmap cache efficiency, hit rate is hits/lookups and the average
+     * probe length is probes/lookups */
+    RedStatCounter pixmap_cache_lookups_counter;
+    RedStatCounter pixmap_cache_lookup_hits_counter;
+    RedStatCounter pixmap_cache_probes_counter;
+    /* images compressed once for several clients, see Drawable::compressed_images */
+    RedStatCounter compress_shared_hits_counter;
+    RedStatCounter compress_shared_misses_counter;
+    RedStatCounter graduality_cache_hits_counter;
+    RedStatCounter graduality_cache_misses_counter;
     ImageEncoderSharedData encoder_shared_data;
+    /* optional threads compressing images before they are sent */
+    ImageEncoderPool *encoder_pool;
+    /* optional cost model choosing the codec in the automatic modes */
+    ImageCompressSelector *compress_selector;
+    /* keep a SurfaceTileMap for the surfaces to send only the changed
+     * parts of the bitmap copies */
+    bool enable_tile_map;
+    bool enable_rect_index;
+    RedStatCounter tile_map_skip_counter;
+    RedStatCounter tile_map_crop_counter;
+    /* durations of the stages of the drawables, from the command to the
+     * bytes written (see also RedWorker and RedChannelClient) */
+    RedStatHistogram tree_histogram;
+    RedStatHistogram render_histogram;
+    RedStatHistogram marshal_histogram;
+    struct {
+        RedStatHistogram quic;
+        RedStatHistogram glz;
+        RedStatHistogram lz;
+        RedStatHistogram lz4;
+        RedStatHistogram jpeg;
+    } compress_histograms;
 };
 
 #define FOREACH_DCC(_channel, _data) \
@@ -158,6 +212,7 @@ enum {
     RED_PIPE_ITEM_TYPE_STREAM_ACTIVATE_REPORT,
     RED_PIPE_ITEM_TYPE_GL_SCANOUT,
     RED_PIPE_ITEM_TYPE_GL_DRAW,
+    RED_PIPE_ITEM_TYPE_STREAM_DATA,
 };
 
 struct RedMonitorsConfigItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_MONITORS_CONFIG> {
@@ -206,6 +261,7 @@ struct RedGlDrawItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_GL_DRAW> {
 };
 
 struct RedImageItem final: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_IMAGE> {
+    ~RedImageItem();
     SpicePoint pos;
     int width;
     int height;
@@ -215,6 +271,7 @@ struct RedImageItem final: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_IMAGE> {
     int image_format;
     uint32_t image_flags;
     int can_lossy;
+    ImageCompressJob *compress_job = nullptr;
     uint8_t data[0];
 };
 
@@ -223,6 +280,7 @@ struct RedDrawablePipeItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_DRAW> {
     ~RedDrawablePipeItem();
     Drawable *const drawable;
     DisplayChannelClient *const dcc;
+    ImageCompressJob *compress_job = nullptr;
 };
 
 /* This item is used to send a full quality image (lossless) of the area where the stream was.
@@ -51,6 +51,9 @@ DisplayChannel::~DisplayChannel()
 
     monitors_config_unref(priv->monitors_config);
     g_array_unref(priv->video_codecs);
+    image_encoder_pool_free(priv->encoder_pool);
+    image_compress_selector_free(priv->compress_selector);
+    priv->graduality_cache.destroy();
 }
 
 static void drawable_draw(DisplayChannel *display, Drawable *drawable);
@@ -157,6 +160,19 @@ int display_channel_get_streams_timeout(DisplayChannel *display)
     return timeout;
 }
 
+/* Send the damage accumulated for the clients which caught up, returns
+ * whether some clients still have damage waiting */
+bool display_channel_push_damage(DisplayChannel *display)
+{
+    DisplayChannelClient *dcc;
+    bool pending = false;
+
+    FOREACH_DCC(display, dcc) {
+        pending |= dcc_push_damage(dcc);
+    }
+    return pending;
+}
+
 void display_channel_set_stream_video(DisplayChannel *display, int stream_video)
 {
     spice_return_if_fail(display);
@@ -247,6 +263,9 @@ static void display_channel_surface_unref(DisplayChannel *display, RedSurface *s
     surface->destroy_cmd.reset();
 
     region_destroy(&surface->draw_dirty_region);
+    surface_tile_map_free(surface->tile_map);
+    rect_index_free(surface->tree_index);
+    rect_index_free(surface->list_index);
     FOREACH_DCC(display, dcc) {
         dcc_destroy_surface(dcc, surface->id);
     }
@@ -255,10 +274,22 @@ static void display_channel_surface_unref(DisplayChannel *display, RedSurface *s
     delete surface;
 }
 
+/* The drawables may keep the surface alive but the damage of the clients
+ * can't be sent once its id is released */
+static void display_channel_surface_id_release(DisplayChannel *display, uint32_t surface_id)
+{
+    DisplayChannelClient *dcc;
+
+    FOREACH_DCC(display, dcc) {
+        dcc_clear_damage(dcc, surface_id);
+    }
+    display->priv->surfaces[surface_id] = nullptr;
+}
+
 void display_channel_surface_id_unref(DisplayChannel *display, uint32_t surface_id)
 {
     display_channel_surface_unref(display, display->priv->surfaces[surface_id]);
-    display->priv->surfaces[surface_id] = nullptr;
+    display_channel_surface_id_release(display, surface_id);
 }
 
 static void streams_update_visible_region(DisplayChannel *display, Drawable *drawable)
@@ -352,11 +383,21 @@ static void current_add_drawable(DisplayChannel *display,
                                  Drawable *drawable, RingItem *pos)
 {
     RedSurface *surface;
+    TreeItem *item = &drawable->tree_item.base;
 
     surface = drawable->surface;
-    ring_add_after(&drawable->tree_item.base.siblings_link, pos);
+    ring_add_after(&item->siblings_link, pos);
     ring_add(&display->priv->current_list, &drawable->list_link);
     ring_add(&surface->current_list, &drawable->surface_list_link);
+    if (!item->container) {
+        /* either at the head of the ring or replacing the item at @pos */
+        tree_item_index_add(item, surface->tree_index,
+                            pos == &surface->current ? nullptr :
+                            SPICE_CONTAINEROF(pos, TreeItem, siblings_link));
+    }
+    const pixman_box32_t *extents = &item->rgn.extents;
+    SpiceRect rect = { extents->x1, extents->y1, extents->x2, extents->y2 };
+    rect_index_add(surface->list_index, &drawable->list_index_entry, drawable, &rect, nullptr);
     drawable->refs++;
 }
 
@@ -366,7 +407,12 @@ static void current_remove_drawable(DisplayChannel *display, Drawable *item)
 {
     /* todo: move all to unref? */
     video_stream_trace_add_drawable(display, item);
+    if (item->tree_item.shadow) {
+        tree_item_index_remove(&item->tree_item.shadow->base, item->surface->tree_index);
+    }
     draw_item_remove_shadow(&item->tree_item);
+    tree_item_index_remove(&item->tree_item.base, item->surface->tree_index);
+    rect_index_remove(item->surface->list_index, &item->list_index_entry, item);
     ring_remove(&item->tree_item.base.siblings_link);
     ring_remove(&item->list_link);
     ring_remove(&item->surface_list_link);
@@ -386,7 +432,7 @@ static void drawable_remove_from_pipes(Drawable *drawable)
 }
 
 /* This function should never be called for Shadow TreeItems */
-static void current_remove(DisplayChannel *display, TreeItem *item)
+static void current_remove(DisplayChannel *display, RedSurface *surface, TreeItem *item)
 {
     TreeItem *now = item;
 
@@ -415,7 +461,7 @@ static void current_remove(DisplayChannel *display, TreeItem *item)
              * iterator to the item's previous sibling and free this empty
              * container */
             ring_item = now->siblings_link.prev;
-            container_free(now_as_container);
+            container_free(now_as_container, surface->tree_index);
         }
         if (now == item) {
             /* This is true if the initial @item was a DRAWABLE, or if @item
@@ -451,7 +497,7 @@ static void current_remove_all(DisplayChannel *display, RedSurface *surface)
          * result in the associated Shadow item being removed from the tree,
          * this loop will never call current_remove() on a Shadow item unless
          * we change the order that items are inserted into the tree */
-        current_remove(display, now);
+        current_remove(display, surface, now);
     }
 }
 
@@ -545,6 +591,23 @@ static bool current_add_equal(DisplayChannel *display, DrawItem *item, TreeItem
     return FALSE;
 }
 
+/* Return the next item after @pos in @ring which may intersect @extents.
+ * For the top level ring of the surface the items which can't intersect
+ * are skipped using the index */
+static RingItem *current_next_candidate(RedSurface *surface, Ring *ring, RingItem *pos,
+                                        const pixman_box32_t *extents)
+{
+    if (ring != &surface->current || !surface->tree_index) {
+        return ring_next(ring, pos);
+    }
+
+    SpiceRect area = { extents->x1, extents->y1, extents->x2, extents->y2 };
+    uint64_t order = pos == ring ? UINT64_MAX :
+                     SPICE_CONTAINEROF(pos, TreeItem, siblings_link)->index_entry.order;
+    auto item = static_cast<TreeItem *>(rect_index_find(surface->tree_index, order, &area));
+    return item ? &item->siblings_link : nullptr;
+}
+
 /* This function excludes the given region from a single TreeItem. Both @rgn
  * and @item may be modified.
  *
@@ -711,7 +774,8 @@ static void __exclude_region(DisplayChannel *display, Ring *ring, TreeItem *item
  * @frame_candidate: usually callers pass NULL, sometimes it's the drawable
  *      that's being added to the 'current' ring. TODO: What is its purpose?
  */
-static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_item,
+static void exclude_region(DisplayChannel *display, RedSurface *surface,
+                           Ring *ring, RingItem *ring_item,
                            QRegion *rgn, TreeItem **last, Drawable *frame_candidate)
 {
     Ring *top_ring;
@@ -742,7 +806,7 @@ static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_i
                 ring_item = now->siblings_link.prev;
                 /* if __exclude_region() removed the entire region for this
                  * sibling item, remove it from the 'current' tree */
-                current_remove(display, now);
+                current_remove(display, surface, now);
                 if (last && *last == now) {
                     /* the caller wanted to stop at this item, but this item
                      * has been removed, so we set @last to the next item */
@@ -773,9 +837,11 @@ static void exclude_region(DisplayChannel *display, Ring *ring, RingItem *ring_i
 
         SPICE_VERIFY(SPICE_OFFSETOF(TreeItem, siblings_link) == 0);
         /* if this is the last item to check, or if the current ring is
-         * completed, don't go any further */
+         * completed, don't go any further. Without @last the items which
+         * don't intersect @rgn can be skipped */
         while ((last && *last == reinterpret_cast<TreeItem *>(ring_item)) ||
-               !(ring_item = ring_next(ring, ring_item))) {
+               !(ring_item = last ? ring_next(ring, ring_item) :
+                 current_next_candidate(surface, ring, ring_item, &rgn->extents))) {
             /* we're currently iterating the top ring, so we're done */
             if (ring == top_ring) {
                 stat_add(&display->priv->exclude_stat, start_time);
@@ -820,6 +886,7 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
 
     /* Prepend the shadow to the beginning of the current ring */
     ring_add(ring, &shadow->base.siblings_link);
+    tree_item_index_add(&shadow->base, item->surface->tree_index, nullptr);
     /* Prepend the draw item to the beginning of the current ring. NOTE: this
      * means that the drawable is placed *before* its associated shadow in the
      * tree. Changing this order will violate several unstated assumptions */
@@ -831,7 +898,8 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
          * items already in the tree.  Start iterating through the tree
          * starting with the shadow item to avoid excluding the new item
          * itself */
-        exclude_region(display, ring, &shadow->base.siblings_link, &exclude_rgn, nullptr, nullptr);
+        exclude_region(display, item->surface, ring, &shadow->base.siblings_link,
+                       &exclude_rgn, nullptr, nullptr);
         region_destroy(&exclude_rgn);
         streams_update_visible_region(display, item);
     } else {
@@ -848,6 +916,7 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
 static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
 {
     DrawItem *item = &drawable->tree_item;
+    RedSurface *surface = drawable->surface;
     RingItem *now;
     QRegion exclude_rgn;
     RingItem *exclude_base = nullptr;
@@ -855,7 +924,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
 
     spice_assert(!region_is_empty(&item->base.rgn));
     region_init(&exclude_rgn);
-    now = ring_next(ring, ring);
+    now = current_next_candidate(surface, ring, ring, &item->base.rgn.extents);
 
     /* check whether the new drawable region intersects any of the items
      * already in the 'current' ring */
@@ -866,7 +935,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
         if (!region_bounds_intersects(&item->base.rgn, &sibling->rgn)) {
             /* the bounds of the two items are totally disjoint, so no need to
              * check further. check the next item */
-            now = ring_next(ring, now);
+            now = current_next_candidate(surface, ring, now, &item->base.rgn.extents);
             continue;
         }
         /* bounds overlap, but check whether the regions actually overlap */
@@ -874,7 +943,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
         if (!(test_res & REGION_TEST_SHARED)) {
             /* there's no overlap of the regions between these two items. Move
              * on to the next one. */
-            now = ring_next(ring, now);
+            now = current_next_candidate(surface, ring, now, &item->base.rgn.extents);
             continue;
         }
         if (sibling->type != TREE_ITEM_TYPE_SHADOW) {
@@ -918,7 +987,8 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
                          * item is obscured and has a shadow. -jjongsma
                          */
                         TreeItem *next = sibling;
-                        exclude_region(display, ring, exclude_base, &exclude_rgn, &next, nullptr);
+                        exclude_region(display, surface, ring, exclude_base, &exclude_rgn,
+                                       &next, nullptr);
                         if (next != sibling) {
                             /* the @next param is only changed if the given item
                              * was removed as a side-effect of calling
@@ -942,7 +1012,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
                 now = now->prev;
                 /* remove the obscured sibling from the 'current' tree, which
                  * will also remove its shadow (if any) */
-                current_remove(display, sibling);
+                current_remove(display, surface, sibling);
                 /* advance the loop variable */
                 now = ring_next(ring, now);
                 if (shadow || skip) {
@@ -965,7 +1035,8 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
                  * this loop may have added various Shadow::on_hold regions to
                  * it. */
                 if (exclude_base) {
-                    exclude_region(display, ring, exclude_base, &exclude_rgn, nullptr, nullptr);
+                    exclude_region(display, surface, ring, exclude_base, &exclude_rgn,
+                                   nullptr, nullptr);
                     region_clear(&exclude_rgn);
                     exclude_base = nullptr;
                 }
@@ -985,7 +1056,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
                 if (!DRAW_ITEM(sibling)->container_root) {
                     /* Create a new container to hold the sibling and the new
                      * drawable */
-                    container = container_new(DRAW_ITEM(sibling));
+                    container = container_new(DRAW_ITEM(sibling), surface->tree_index);
                     if (!container) {
                         spice_warning("create new container failed");
                         region_destroy(&exclude_rgn);
@@ -1015,7 +1086,7 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
          * Shadows that were associated with DrawItems that were removed from
          * the tree.  Add the new item's region to that */
         region_or(&exclude_rgn, &item->base.rgn);
-        exclude_region(display, ring, exclude_base, &exclude_rgn, nullptr, drawable);
+        exclude_region(display, surface, ring, exclude_base, &exclude_rgn, nullptr, drawable);
         video_stream_trace_update(display, drawable);
         streams_update_visible_region(display, drawable);
         /*
@@ -1310,6 +1381,159 @@ static Drawable *display_channel_get_drawable(DisplayChannel *display, uint8_t e
     return drawable;
 }
 
+/* Get the lines of 'area' in a 32 bit bitmap.
+ * Returns nullptr if the lines are not contiguous in memory */
+static const uint8_t **get_bitmap_rows(const SpiceBitmap *bitmap, const SpiceRect *area)
+{
+    const SpiceChunks *chunks = bitmap->data;
+    const uint8_t **rows;
+    uint32_t chunk_first_row = 0;
+    uint32_t n = 0;
+
+    if (bitmap->stride < bitmap->x * 4) {
+        return nullptr;
+    }
+    for (n = 0; n + 1 < chunks->num_chunks; n++) {
+        if (chunks->chunk[n].len % bitmap->stride != 0) {
+            return nullptr;
+        }
+    }
+
+    rows = g_new(const uint8_t *, area->bottom - area->top);
+    n = 0;
+    for (int32_t y = area->top; y < area->bottom; y++) {
+        uint32_t row = bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN ? y : bitmap->y - 1 - y;
+
+        if (row < chunk_first_row) {
+            n = 0;
+            chunk_first_row = 0;
+        }
+        while (n < chunks->num_chunks &&
+               row >= chunk_first_row + chunks->chunk[n].len / bitmap->stride) {
+            chunk_first_row += chunks->chunk[n].len / bitmap->stride;
+            n++;
+        }
+        if (n == chunks->num_chunks) {
+            g_free(rows);
+            return nullptr;
+        }
+        rows[y - area->top] = chunks->chunk[n].data + (row - chunk_first_row) * bitmap->stride;
+    }
+    return rows;
+}
+
+/* Replace the source of a copy with a bitmap containing only the part
+ * drawn to 'area' */
+static void drawable_crop_copy(RedDrawable *red_drawable, const SpiceRect *area,
+                               const uint8_t *const *rows)
+{
+    SpiceCopy *copy = &red_drawable->u.copy;
+    SpiceImage *src = copy->src_bitmap;
+    const uint32_t width = area->right - area->left;
+    const uint32_t height = area->bottom - area->top;
+    const uint32_t stride = width * 4;
+    const uint32_t src_left = copy->src_area.left + (area->left - red_drawable->bbox.left);
+    auto data = static_cast<uint8_t *>(spice_malloc_n(height, stride));
+
+    for (uint32_t y = 0; y < height; y++) {
+        memcpy(data + y * stride, rows[area->top - red_drawable->bbox.top + y] + src_left * 4,
+               stride);
+    }
+
+    SpiceImage *image = g_new0(SpiceImage, 1);
+    image->descriptor = src->descriptor;
+    /* the image is different from the cached one with the same id */
+    image->descriptor.flags &= ~(SPICE_IMAGE_FLAGS_CACHE_ME | SPICE_IMAGE_FLAGS_CACHE_REPLACE_ME);
+    image->descriptor.width = width;
+    image->descriptor.height = height;
+    image->u.bitmap.format = src->u.bitmap.format;
+    image->u.bitmap.flags = SPICE_BITMAP_FLAGS_TOP_DOWN;
+    image->u.bitmap.x = width;
+    image->u.bitmap.y = height;
+    image->u.bitmap.stride = stride;
+    image->u.bitmap.data = spice_chunks_new_linear(data, height * stride);
+    image->u.bitmap.data->flags |= SPICE_CHUNKS_FLAGS_FREE;
+
+    red_put_image(src);
+    copy->src_bitmap = image;
+    copy->src_area.left = 0;
+    copy->src_area.top = 0;
+    copy->src_area.right = width;
+    copy->src_area.bottom = height;
+    red_drawable->bbox = *area;
+}
+
+/* Whether the drawable just replaces its area with a 32 bit bitmap */
+static bool is_bitmap_put(const RedDrawable *red_drawable)
+{
+    const SpiceCopy *copy = &red_drawable->u.copy;
+
+    if (red_drawable->type != QXL_DRAW_COPY) {
+        return false;
+    }
+
+    const SpiceImage *image = copy->src_bitmap;
+    if (image == nullptr ||
+        red_drawable->effect != QXL_EFFECT_OPAQUE ||
+        red_drawable->clip.type != SPICE_CLIP_TYPE_NONE ||
+        copy->rop_descriptor != SPICE_ROPD_OP_PUT ||
+        copy->mask.bitmap != nullptr ||
+        image->descriptor.type != SPICE_IMAGE_TYPE_BITMAP ||
+        (image->u.bitmap.data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE)) {
+        return false;
+    }
+    if (image->u.bitmap.format != SPICE_BITMAP_FMT_32BIT &&
+        image->u.bitmap.format != SPICE_BITMAP_FMT_RGBA) {
+        return false;
+    }
+    /* no scaling and the source inside the bitmap */
+    return copy->src_area.right - copy->src_area.left ==
+               red_drawable->bbox.right - red_drawable->bbox.left &&
+           copy->src_area.bottom - copy->src_area.top ==
+               red_drawable->bbox.bottom - red_drawable->bbox.top &&
+           copy->src_area.left >= 0 && copy->src_area.top >= 0 &&
+           copy->src_area.right <= (int32_t) image->u.bitmap.x &&
+           copy->src_area.bottom <= (int32_t) image->u.bitmap.y;
+}
+
+/**
+ * Compare the content copied by the drawable with the one of the surface
+ * tiles, a copy is reduced to the part of the surface really changed.
+ * Must be called only once the drawable is going to be added to the tree.
+ * Returns false if the drawable does not change the surface.
+ */
+static bool drawable_update_tile_map(DisplayChannel *display, Drawable *drawable)
+{
+    RedDrawable *red_drawable = drawable->red_drawable.get();
+    SurfaceTileMap *tile_map = drawable->surface->tile_map;
+    const uint8_t **rows;
+    SpiceRect changed;
+
+    if (!is_bitmap_put(red_drawable) ||
+        !(rows = get_bitmap_rows(&red_drawable->u.copy.src_bitmap->u.bitmap,
+                                 &red_drawable->u.copy.src_area))) {
+        surface_tile_map_invalidate(tile_map, &red_drawable->bbox);
+        return true;
+    }
+
+    if (!surface_tile_map_update(tile_map, &red_drawable->bbox, rows,
+                                 red_drawable->u.copy.src_area.left, &changed)) {
+        g_free(rows);
+        stat_inc_counter(display->priv->tile_map_skip_counter, 1);
+        return false;
+    }
+
+    if (surface_tile_map_should_crop(&changed, &red_drawable->bbox)) {
+        drawable_crop_copy(red_drawable, &changed, rows);
+        /* a bitmap put has no clip, its region is the bounding box */
+        region_clear(&drawable->tree_item.base.rgn);
+        region_add(&drawable->tree_item.base.rgn, &red_drawable->bbox);
+        stat_inc_counter(display->priv->tile_map_crop_counter, 1);
+    }
+    g_free(rows);
+    return true;
+}
+
 /**
  * Add a Drawable to the items to draw.
  * On failure the Drawable is not added.
@@ -1345,6 +1569,11 @@ static void display_channel_add_drawable(DisplayChannel *display, Drawable *draw
         return;
     }
 
+    /* the drawable is accepted, the tile map can be updated */
+    if (drawable->surface->tile_map && !drawable_update_tile_map(display, drawable)) {
+        return;
+    }
+
     Ring *ring = &drawable->surface->current;
     int add_to_pipe;
     if (has_shadow(red_drawable)) {
@@ -1375,7 +1604,9 @@ void display_channel_process_draw(DisplayChannel *display,
         return;
     }
 
+    stat_time_t tree_start = stat_histogram_start();
     display_channel_add_drawable(display, drawable);
+    stat_histogram_add(&display->priv->tree_histogram, tree_start);
 
     drawable_unref(drawable);
 }
@@ -1465,8 +1696,11 @@ static bool free_one_drawable(DisplayChannel *display, int force_glz_free)
     drawable_draw(display, drawable);
     container = drawable->tree_item.base.container;
 
+    /* keep the surface and its index while cleaning up */
+    drawable->refs++;
     current_remove_drawable(display, drawable);
-    container_cleanup(container);
+    container_cleanup(container, drawable->surface->tree_index);
+    drawable_unref(drawable);
     return TRUE;
 }
 
@@ -1565,6 +1799,8 @@ static Drawable *display_channel_drawable_try_new(DisplayChannel *display,
     ring_item_init(&drawable->tree_item.base.siblings_link);
     drawable->tree_item.base.type = TREE_ITEM_TYPE_DRAWABLE;
     region_init(&drawable->tree_item.base.rgn);
+    drawable->tree_item.base.index_entry.order = 0;
+    drawable->list_index_entry.order = 0;
     glz_retention_init(&drawable->glz_retention);
     drawable->process_commands_generation = process_commands_generation;
 
@@ -1622,6 +1858,7 @@ void drawable_unref(Drawable *drawable)
     display_channel_surface_unref(display, drawable->surface);
 
     glz_retention_detach_drawables(&drawable->glz_retention);
+    image_compress_cache_clear(&drawable->compressed_images);
 
     drawable_free(display, drawable);
 }
@@ -1652,6 +1889,8 @@ static void drawable_draw(DisplayChannel *display, Drawable *drawable)
     canvas = surface->context.canvas;
     spice_return_if_fail(canvas);
 
+    stat_time_t render_start = stat_histogram_start();
+
     image_cache_aging(&display->priv->image_cache);
 
     region_add(&surface->draw_dirty_region, &drawable->red_drawable->bbox);
@@ -1778,6 +2017,7 @@ static void drawable_draw(DisplayChannel *display, Drawable *drawable)
     default:
         spice_warning("invalid type");
     }
+    stat_histogram_add(&display->priv->render_histogram, render_start);
 }
 
 static void surface_update_dest(RedSurface *surface, const SpiceRect *area)
@@ -1814,7 +2054,7 @@ static void draw_until(DisplayChannel *display, RedSurface *surface, Drawable *l
         now->refs++;
         container = now->tree_item.base.container;
         current_remove_drawable(display, now);
-        container_cleanup(container);
+        container_cleanup(container, surface->tree_index);
         /* drawable_draw may call display_channel_draw for the surfaces 'now' depends on. Notice,
            that it is valid to call display_channel_draw in this case and not display_channel_draw_till:
            It is impossible that there was newer item then 'last' in one of the surfaces
@@ -1825,27 +2065,43 @@ static void draw_until(DisplayChannel *display, RedSurface *surface, Drawable *l
     } while (now != last);
 }
 
-/* Find the first Drawable in the @current ring that intersects the given
- * @area, starting at item @from (or the head of the ring if @from is NULL).
- *
- * NOTE: this function expects @current to be a ring of Drawables, and more
- * specifically an instance of Surface::current_list (not Surface::current) */
-static Drawable* current_find_intersects_rect(Ring *current, RingItem *from,
+/* Find the first Drawable in the current_list ring of @surface that
+ * intersects the given @area, starting at item @from (or the head of the
+ * ring if @from is NULL). Only the drawables whose bounds intersect @area
+ * according to the index of the ring are checked */
+static Drawable* current_find_intersects_rect(RedSurface *surface, Drawable *from,
                                               const SpiceRect *area)
 {
-    RingItem *it;
+    uint64_t order = from ? from->list_index_entry.order + 1 : UINT64_MAX;
     QRegion rgn;
+    Drawable *now;
     Drawable *last = nullptr;
 
     region_init(&rgn);
     region_add(&rgn, area);
 
-    for (it = from ? from : ring_next(current, current); it != nullptr; it = ring_next(current, it)) {
-        Drawable *now = SPICE_CONTAINEROF(it, Drawable, surface_list_link);
+    if (!surface->list_index) {
+        Ring *ring = &surface->current_list;
+        RingItem *it;
+
+        for (it = from ? &from->surface_list_link : ring_next(ring, ring); it != nullptr;
+             it = ring_next(ring, it)) {
+            now = SPICE_CONTAINEROF(it, Drawable, surface_list_link);
+            if (region_intersects(&rgn, &now->tree_item.base.rgn)) {
+                last = now;
+                break;
+            }
+        }
+        region_destroy(&rgn);
+        return last;
+    }
+
+    while ((now = static_cast<Drawable *>(rect_index_find(surface->list_index, order, area)))) {
         if (region_intersects(&rgn, &now->tree_item.base.rgn)) {
             last = now;
             break;
         }
+        order = now->list_index_entry.order;
     }
 
     region_destroy(&rgn);
@@ -1889,8 +2145,7 @@ void display_channel_draw_until(DisplayChannel *display, const SpiceRect *area,
     if (!surface_last)
         return;
 
-    last = current_find_intersects_rect(&surface->current_list,
-                                        &surface_last->surface_list_link, area);
+    last = current_find_intersects_rect(surface, surface_last, area);
     if (!last)
         return;
 
@@ -1917,7 +2172,7 @@ static void display_channel_surface_draw(DisplayChannel *display, RedSurface *su
 {
     Drawable *last;
 
-    last = current_find_intersects_rect(&surface->current_list, nullptr, area);
+    last = current_find_intersects_rect(surface, nullptr, area);
     if (last)
         draw_until(display, surface, last);
 
@@ -2013,10 +2268,11 @@ void display_channel_destroy_surfaces(DisplayChannel *display)
     //to handle better
     for (auto& surface : display->priv->surfaces) {
         if (surface) {
-            display_channel_destroy_surface_wait(display, surface->id);
+            uint32_t surface_id = surface->id;
+            display_channel_destroy_surface_wait(display, surface_id);
             if (surface) {
                 display_channel_surface_unref(display, surface);
-                surface = nullptr;
+                display_channel_surface_id_release(display, surface_id);
             }
         }
     }
@@ -2115,8 +2371,14 @@ display_channel_create_surface(DisplayChannel *display, uint32_t surface_id, uin
     // finish initialization
     ring_init(&surface->current);
     ring_init(&surface->current_list);
+    if (display->priv->enable_rect_index) {
+        surface->tree_index = rect_index_new(width, height);
+        surface->list_index = rect_index_new(width, height);
+    }
     ring_init(&surface->depend_on_me);
     region_init(&surface->draw_dirty_region);
+    surface->tile_map = display->priv->enable_tile_map ?
+        surface_tile_map_new(width, height) : nullptr;
 
     if (display->priv->surfaces[surface_id]) {
         display_channel_surface_unref(display, display->priv->surfaces[surface_id]);
@@ -2201,6 +2463,7 @@ DisplayChannel::DisplayChannel(RedsState *reds,
     priv->stream_video = SPICE_STREAM_VIDEO_OFF;
 
     image_encoder_shared_init(&priv->encoder_shared_data);
+    priv->encoder_pool = image_encoder_pool_new_from_env();
 
     ring_init(&priv->current_list);
     drawables_init(this);
@@ -2223,6 +2486,35 @@ DisplayChannel::DisplayChannel(RedsState *reds,
                       "add_to_cache", TRUE);
     stat_init_counter(&priv->non_cache_counter, reds, stat,
                       "non_cache", TRUE);
+    stat_init_counter(&priv->pixmap_cache_lookups_counter, reds, stat,
+                      "pixmap_cache_lookups", TRUE);
+    stat_init_counter(&priv->pixmap_cache_lookup_hits_counter, reds, stat,
+                      "pixmap_cache_lookup_hits", TRUE);
+    stat_init_counter(&priv->pixmap_cache_probes_counter, reds, stat,
+                      "pixmap_cache_probes", TRUE);
+    stat_init_counter(&priv->compress_shared_hits_counter, reds, stat,
+                      "compress_shared_hits", TRUE);
+    stat_init_counter(&priv->compress_shared_misses_counter, reds, stat,
+                      "compress_shared_misses", TRUE);
+    stat_init_counter(&priv->graduality_cache_hits_counter, reds, stat,
+                      "graduality_cache_hits", TRUE);
+    stat_init_counter(&priv->graduality_cache_misses_counter, reds, stat,
+                      "graduality_cache_misses", TRUE);
+    priv->compress_selector = image_compress_selector_new_from_env(reds, stat);
+    priv->enable_tile_map = getenv(SURFACE_TILE_MAP_ENV) != nullptr;
+    priv->enable_rect_index = getenv(RECT_INDEX_DISABLE_ENV) == nullptr;
+    stat_init_counter(&priv->tile_map_skip_counter, reds, stat,
+                      "tile_map_skip", TRUE);
+    stat_init_counter(&priv->tile_map_crop_counter, reds, stat,
+                      "tile_map_crop", TRUE);
+    stat_init_histogram(&priv->tree_histogram, reds, stat, "tree_insert", TRUE);
+    stat_init_histogram(&priv->render_histogram, reds, stat, "render", TRUE);
+    stat_init_histogram(&priv->marshal_histogram, reds, stat, "marshal", TRUE);
+    stat_init_histogram(&priv->compress_histograms.quic, reds, stat, "compress_quic", TRUE);
+    stat_init_histogram(&priv->compress_histograms.glz, reds, stat, "compress_glz", TRUE);
+    stat_init_histogram(&priv->compress_histograms.lz, reds, stat, "compress_lz", TRUE);
+    stat_init_histogram(&priv->compress_histograms.lz4, reds, stat, "compress_lz4", TRUE);
+    stat_init_histogram(&priv->compress_histograms.jpeg, reds, stat, "compress_jpeg", TRUE);
 
     set_cap(SPICE_DISPLAY_CAP_MONITORS_CONFIG);
     set_cap(SPICE_DISPLAY_CAP_PREF_COMPRESSION);
@@ -2281,7 +2573,7 @@ void display_channel_process_surface_cmd(DisplayChannel *display,
         }
         surface->destroy_cmd = surface_cmd;
         display_channel_destroy_surface(display, surface);
-        display->priv->surfaces[surface_id] = nullptr;
+        display_channel_surface_id_release(display, surface_id);
         break;
     default:
         spice_warn_if_reached();
@@ -2405,6 +2697,44 @@ void display_channel_set_monitors_config_to_primary(DisplayChannel *display)
 void display_channel_reset_image_cache(DisplayChannel *self)
 {
     image_cache_reset(&self->priv->image_cache);
+    /* the guest can reuse the ids */
+    self->priv->graduality_cache.clear();
+}
+
+#define GRADUALITY_CACHE_SIZE 4096
+
+BitmapGradualType display_channel_get_bitmap_graduality(DisplayChannel *display,
+                                                        const SpiceImageDescriptor *descriptor,
+                                                        SpiceBitmap *bitmap)
+{
+    auto cache = &display->priv->graduality_cache;
+
+    if (descriptor == nullptr || !(descriptor->flags & SPICE_IMAGE_FLAGS_CACHE_ME)) {
+        return bitmap_get_graduality_level(bitmap);
+    }
+
+    GradualityCacheItem *item = cache->find(descriptor->id);
+    if (item && item->format == bitmap->format &&
+        item->width == bitmap->x && item->height == bitmap->y) {
+        cache->touch(item);
+        stat_inc_counter(display->priv->graduality_cache_hits_counter, 1);
+        return item->graduality;
+    }
+    stat_inc_counter(display->priv->graduality_cache_misses_counter, 1);
+
+    if (item == nullptr) {
+        if (cache->size() >= GRADUALITY_CACHE_SIZE) {
+            cache->remove(cache->lru_tail());
+        }
+        item = cache->insert(descriptor->id);
+    } else {
+        cache->touch(item);
+    }
+    item->graduality = bitmap_get_graduality_level(bitmap);
+    item->format = bitmap->format;
+    item->width = bitmap->x;
+    item->height = bitmap->y;
+    return item->graduality;
 }
 
 void display_channel_debug_oom(DisplayChannel *display, const char *msg)
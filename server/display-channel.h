@@ -64,10 +64,14 @@ struct Drawable {
     RingItem surface_list_link;
     RingItem list_link;
     DrawItem tree_item;
+    /* position in the index of surface->current_list */
+    RectIndexEntry list_index_entry;
     GList *pipes;
     red::shared_ptr<RedDrawable> red_drawable;
 
     GlzImageRetention glz_retention;
+    /* images compressed by a client which other clients can reuse */
+    ImageCompressCacheEntry *compressed_images;
 
     red_time_t creation_time;
     red_time_t first_frame_time;
@@ -114,6 +118,7 @@ void                       display_channel_set_stream_video          (DisplayCha
 void                       display_channel_set_video_codecs          (DisplayChannel *display,
                                                                       GArray *video_codecs);
 int                        display_channel_get_streams_timeout       (DisplayChannel *display);
+bool                       display_channel_push_damage               (DisplayChannel *display);
 void                       display_channel_compress_stats_print      (DisplayChannel *display);
 void                       display_channel_compress_stats_reset      (DisplayChannel *display);
 bool                       display_channel_wait_for_migrate_data     (DisplayChannel *display);
@@ -141,6 +146,11 @@ void display_channel_push_monitors_config(DisplayChannel *display);
 
 RedSurface *display_channel_validate_surface(DisplayChannel *display, uint32_t surface_id);
 void display_channel_reset_image_cache(DisplayChannel *self);
+/* Graduality level of a bitmap, cached by image id if the guest asked to
+ * cache the image. 'descriptor' can be NULL */
+BitmapGradualType display_channel_get_bitmap_graduality(DisplayChannel *display,
+                                                        const SpiceImageDescriptor *descriptor,
+                                                        SpiceBitmap *bitmap);
 
 void display_channel_debug_oom(DisplayChannel *display, const char *msg);
 
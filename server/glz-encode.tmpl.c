@@ -34,6 +34,7 @@
 #define ENCODE_PIXEL(e, pix) encode(e, (pix).a)   // gets the pixel and write only the needed bytes
                                                   // from the pixel
 #define SAME_PIXEL(pix1, pix2) ((pix1).a == (pix2).a)
+#define SAME_PIXEL_MASK { 0xff, 0xff, 0xff, 0xff }
 #define MIN_REF_ENCODE_SIZE 4
 #define MAX_REF_ENCODE_SIZE 7
 #define HASH_FUNC(v, p) {  \
@@ -51,6 +52,7 @@
 #define FNAME(name) glz_rgb_alpha_##name
 #define ENCODE_PIXEL(e, pix) {encode(e, (pix).pad);}
 #define SAME_PIXEL(pix1, pix2) ((pix1).pad == (pix2).pad)
+#define SAME_PIXEL_MASK { 0x00, 0x00, 0x00, 0xff }
 #define MIN_REF_ENCODE_SIZE 4
 #define MAX_REF_ENCODE_SIZE 7
 #define HASH_FUNC(v, p) {    \
@@ -68,6 +70,11 @@
 #define FNAME(name) glz_rgb16_##name
 #define GET_rgb(pix) ((pix) & 0x7fffu)
 #define SAME_PIXEL(p1, p2) (GET_rgb(p1) == GET_rgb(p2))
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define SAME_PIXEL_MASK { 0xff, 0x7f, 0xff, 0x7f }
+#else
+#define SAME_PIXEL_MASK { 0x7f, 0xff, 0x7f, 0xff }
+#endif
 #define ENCODE_PIXEL(e, pix) {encode(e, (pix) >> 8); encode(e, (pix) & 0xff);}
 #define MIN_REF_ENCODE_SIZE 2
 #define MAX_REF_ENCODE_SIZE 3
@@ -99,6 +106,11 @@
 #define MIN_REF_ENCODE_SIZE 2
 #define MAX_REF_ENCODE_SIZE 2
 #define SAME_PIXEL(p1, p2) ((p1).r == (p2).r && (p1).g == (p2).g && (p1).b == (p2).b)
+#ifdef LZ_RGB24
+#define SAME_PIXEL_MASK { 0xff, 0xff, 0xff, 0xff }
+#else
+#define SAME_PIXEL_MASK { 0xff, 0xff, 0xff, 0x00 }
+#endif
 #define HASH_FUNC(v, p) {    \
     v = DJB2_START;          \
     DJB2_HASH(v, p[0].r);    \
@@ -124,7 +136,7 @@
 /* returns the length of the match. 0 if no match.
   if image_distance = 0, pixel_distance is the distance between the matching pixels.
   Otherwise, it is the offset from the beginning of the referred image */
-static inline size_t FNAME(do_match)(SharedDictionary *dict,
+static inline size_t FNAME(do_match)(SharedDictionary *dict, GlzMatchLenFunc match_len,
                                      WindowImageSegment *ref_seg, const PIXEL *ref,
                                      const PIXEL *ref_limit,
                                      WindowImageSegment *ip_seg,  const PIXEL *ip,
@@ -195,13 +207,14 @@ static inline size_t FNAME(do_match)(SharedDictionary *dict,
 
 
     /* continue the match*/
-    while ((tmp_ip < ip_limit) && (tmp_ref < ref_limit)) {
-        if (!SAME_PIXEL(*tmp_ref, *tmp_ip)) {
-            break;
-        } else {
-            tmp_ref++;
-            tmp_ip++;
-        }
+    if ((tmp_ip < ip_limit) && (tmp_ref < ref_limit)) {
+        static const uint8_t same_pixel_mask[4] = SAME_PIXEL_MASK;
+        size_t max_len = MIN(ip_limit - tmp_ip, ref_limit - tmp_ref);
+        size_t len = match_len((const uint8_t *)tmp_ip, (const uint8_t *)tmp_ref,
+                               max_len * sizeof(PIXEL), same_pixel_mask) / sizeof(PIXEL);
+
+        tmp_ref += len;
+        tmp_ip += len;
     }
 
 
@@ -317,7 +330,8 @@ static void FNAME(compress_seg)(Encoder *encoder, uint32_t seg_idx, PIXEL *from,
 #endif
                 ref_limit = (PIXEL *)ref_seg->lines_end;
 
-                len = FNAME(do_match)(encoder->dict, ref_seg, ref, ref_limit, seg, ip, ip_bound,
+                len = FNAME(do_match)(encoder->dict, encoder->match_len,
+                                      ref_seg, ref, ref_limit, seg, ip, ip_bound,
                                       pix_per_byte,
                                       &image_dist, &pix_dist);
 
@@ -516,6 +530,7 @@ static void FNAME(compress)(Encoder *encoder)
 #undef PIXEL
 #undef ENCODE_PIXEL
 #undef SAME_PIXEL
+#undef SAME_PIXEL_MASK
 #undef HASH_FUNC
 #undef GET_rgb
 #undef LZ_PLT
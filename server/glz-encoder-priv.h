@@ -188,6 +188,18 @@ void glz_dictionary_post_encode(uint32_t encoder_id, GlzEncoderUsrContext *usr,
         (dict)->window.encoders_heads[enc_id]].pixels_so_far <= \
         ref_seg->pixels_so_far)))
 
+/* Returns the number of leading bytes that are the same in 'a' and 'b',
+   at most 'len'. Only the bits set in 'mask' are compared, 'mask' is a 4 bytes
+   pattern repeated over the buffers. Uses SIMD instructions if available. */
+size_t glz_match_len(const uint8_t *a, const uint8_t *b, size_t len, const uint8_t mask[4]);
+
+typedef size_t (*GlzMatchLenFunc)(const uint8_t *a, const uint8_t *b, size_t len,
+                                  const uint8_t mask[4]);
+
+/* The implementation of glz_match_len() for this CPU, the encoders
+   resolve it once when they are created */
+GlzMatchLenFunc glz_get_match_len_func(void);
+
 #ifdef DEBUG
 
 #define GLZ_ASSERT(usr, x)                                              \
@@ -19,6 +19,11 @@
 #include <glib.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GLZ_X86_SIMD
+#include <immintrin.h>
+#endif
 #include "glz-encoder.h"
 #include "glz-encoder-priv.h"
 
@@ -28,6 +33,7 @@ typedef struct Encoder {
     GlzEncoderUsrContext *usr;
     uint8_t id;
     SharedDictionary     *dict;
+    GlzMatchLenFunc match_len;
 
     struct {
         LzImageType type;
@@ -139,6 +145,7 @@ GlzEncoderContext *glz_encoder_create(uint8_t id, GlzEncDictContext *dictionary,
     encoder->id = id;
     encoder->usr = usr;
     encoder->dict = (SharedDictionary *)dictionary;
+    encoder->match_len = glz_get_match_len_func();
 
     return (GlzEncoderContext *)encoder;
 }
@@ -196,6 +203,122 @@ typedef uint16_t rgb16_pixel_t;
 #define MAX_PIXEL_LONG_DISTANCE 33554432    // (1 << 25)  2 ^ (12 + 5 + 8)
 #define MAX_IMAGE_DIST 16777215             // (1 << 24 - 1)
 
+/*
+ * Match extension. The pixels are compared as bytes, the mask filters
+ * out the bytes SAME_PIXEL ignores. Vectors sizes are multiple of the mask
+ * pattern so the mask can be applied with a single AND.
+ */
+static size_t match_len_tail(const uint8_t *a, const uint8_t *b, size_t len,
+                             const uint8_t mask[4])
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if ((a[i] ^ b[i]) & mask[i & 3]) {
+            break;
+        }
+    }
+    return i;
+}
+
+static size_t match_len_generic(const uint8_t *a, const uint8_t *b, size_t len,
+                                const uint8_t mask[4])
+{
+    uint8_t mask_bytes[8];
+    uint64_t mask64;
+    size_t i;
+
+    memcpy(mask_bytes, mask, 4);
+    memcpy(mask_bytes + 4, mask, 4);
+    memcpy(&mask64, mask_bytes, 8);
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        uint64_t x, y;
+
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if ((x ^ y) & mask64) {
+            break;
+        }
+    }
+    return i + match_len_tail(a + i, b + i, len - i, mask);
+}
+
+#ifdef GLZ_X86_SIMD
+__attribute__((target("sse2")))
+static size_t match_len_sse2(const uint8_t *a, const uint8_t *b, size_t len,
+                             const uint8_t mask[4])
+{
+    uint32_t mask32;
+    __m128i vmask;
+    size_t i;
+
+    memcpy(&mask32, mask, 4);
+    vmask = _mm_set1_epi32(mask32);
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i diff = _mm_and_si128(_mm_xor_si128(x, y), vmask);
+        unsigned int ne = _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) ^ 0xffffu;
+
+        if (ne) {
+            return i + __builtin_ctz(ne);
+        }
+    }
+    return i + match_len_tail(a + i, b + i, len - i, mask);
+}
+
+__attribute__((target("avx2")))
+static size_t match_len_avx2(const uint8_t *a, const uint8_t *b, size_t len,
+                             const uint8_t mask[4])
+{
+    uint32_t mask32;
+    __m256i vmask;
+    size_t i;
+
+    memcpy(&mask32, mask, 4);
+    vmask = _mm256_set1_epi32(mask32);
+    for (i = 0; i + 32 <= len; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i diff = _mm256_and_si256(_mm256_xor_si256(x, y), vmask);
+        unsigned int ne = ~(unsigned int)
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(diff, _mm256_setzero_si256()));
+
+        if (ne) {
+            return i + __builtin_ctz(ne);
+        }
+    }
+    return i + match_len_tail(a + i, b + i, len - i, mask);
+}
+#endif
+
+static GlzMatchLenFunc match_len_func = match_len_generic;
+static pthread_once_t match_len_once = PTHREAD_ONCE_INIT;
+
+static void match_len_init(void)
+{
+#ifdef GLZ_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        match_len_func = match_len_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        match_len_func = match_len_sse2;
+    }
+#endif
+}
+
+GlzMatchLenFunc glz_get_match_len_func(void)
+{
+    pthread_once(&match_len_once, match_len_init);
+    return match_len_func;
+}
+
+size_t glz_match_len(const uint8_t *a, const uint8_t *b, size_t len, const uint8_t mask[4])
+{
+    return glz_get_match_len_func()(a, b, len, mask);
+}
+
 
 //#define DEBUG_ENCODE
 
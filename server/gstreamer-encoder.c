@@ -34,6 +34,9 @@
 
 #define SPICE_GST_DEFAULT_FPS 30
 
+/* The maximum number of idle pipelines kept for each codec */
+#define SPICE_GST_MAX_POOLED_PIPELINES 4
+
 #ifndef HAVE_GSTREAMER_0_10
 # define DO_ZERO_COPY
 #endif
@@ -64,12 +67,24 @@ typedef struct {
     { spice_format, bpp, depth, endianness, blue_mask, green_mask, red_mask }
 #endif
 
+/* A frame pushed to the pipeline */
+typedef struct SpiceGstFrame {
+    uint32_t mm_time;
+    /* The time at which the frame was pushed */
+    uint64_t start;
+    /* Only set, and referenced, in the asynchronous mode */
+    gpointer bitmap_opaque;
+} SpiceGstFrame;
+
 typedef struct SpiceGstVideoBuffer {
     VideoBuffer base;
     GstBuffer *gst_buffer;
 #ifndef HAVE_GSTREAMER_0_10
     GstMapInfo map;
 #endif
+    SpiceGstFrame frame;
+    /* The time it took the pipeline to encode the frame */
+    uint64_t duration;
 } SpiceGstVideoBuffer;
 
 typedef struct {
@@ -93,6 +108,8 @@ typedef struct SpiceGstEncoder {
 
 #ifdef DO_ZERO_COPY
     GAsyncQueue *unused_bitmap_opaques;
+    /* The number of BitmapWrapper the pipeline still references */
+    gint bitmap_wrappers;
 #endif
 
     /* Rate control callbacks */
@@ -101,6 +118,11 @@ typedef struct SpiceGstEncoder {
     /* Spice's initial bit rate estimation in bits per second. */
     uint64_t starting_bit_rate;
 
+    /* The maximum number of idle pipelines to keep for this codec, see
+     * put_pooled_pipeline().
+     */
+    uint32_t pipeline_pool_size;
+
     /* ---------- Video characteristics ---------- */
 
     uint32_t width;
@@ -132,10 +154,19 @@ typedef struct SpiceGstEncoder {
 #   define SPICE_GST_VIDEO_PIPELINE_CAPS     0x4
     uint32_t set_pipeline;
 
-    /* Output buffer */
+    /* If true encode_frame() returns without waiting for the compressed
+     * frames, they are then picked up with get_frame().
+     */
+    gboolean async;
+
+    /* The frames being encoded, oldest first, and the compressed frames
+     * waiting to be picked up. Both are protected by outbuf_mutex.
+     */
+#   define SPICE_GST_MAX_PENDING_FRAMES 2
     pthread_mutex_t outbuf_mutex;
     pthread_cond_t outbuf_cond;
-    VideoBuffer *outbuf;
+    GQueue pending_frames;
+    GQueue outbufs;
 
     /* The video bit rate. */
     uint64_t video_bit_rate;
@@ -351,6 +382,40 @@ static void set_pipeline_changes(SpiceGstEncoder *encoder, uint32_t flags)
     encoder->set_pipeline |= flags;
 }
 
+/* Frees the frames that are still queued, the pipeline must not be able to
+ * return any more of them.
+ */
+static void clear_frames(SpiceGstEncoder *encoder)
+{
+    SpiceGstFrame *frame;
+    SpiceGstVideoBuffer *outbuf;
+
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    while ((frame = (SpiceGstFrame*)g_queue_pop_head(&encoder->pending_frames))) {
+        if (frame->bitmap_opaque) {
+            encoder->bitmap_unref(frame->bitmap_opaque);
+        }
+        g_free(frame);
+    }
+    while ((outbuf = (SpiceGstVideoBuffer*)g_queue_pop_head(&encoder->outbufs))) {
+        if (outbuf->frame.bitmap_opaque) {
+            encoder->bitmap_unref(outbuf->frame.bitmap_opaque);
+        }
+        outbuf->base.free(&outbuf->base);
+    }
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+}
+
+/* Waits until the pipeline has returned all the frames pushed to it */
+static void wait_for_pending_frames(SpiceGstEncoder *encoder)
+{
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    while (!g_queue_is_empty(&encoder->pending_frames)) {
+        pthread_cond_wait(&encoder->outbuf_cond, &encoder->outbuf_mutex);
+    }
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+}
+
 static void free_pipeline(SpiceGstEncoder *encoder)
 {
     if (encoder->src_caps) {
@@ -365,6 +430,7 @@ static void free_pipeline(SpiceGstEncoder *encoder)
         gst_object_unref(encoder->pipeline);
         encoder->pipeline = NULL;
     }
+    clear_frames(encoder);
 }
 
 
@@ -826,6 +892,29 @@ static void set_appsrc_caps(SpiceGstEncoder *encoder)
     gst_app_src_set_caps(encoder->appsrc, encoder->src_caps);
 }
 
+/* Hands a compressed frame, or an empty buffer in case of error, over to the
+ * main thread.
+ */
+static void push_compressed_buffer(SpiceGstEncoder *encoder, SpiceGstVideoBuffer *outbuf)
+{
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    SpiceGstFrame *frame = (SpiceGstFrame*)g_queue_pop_head(&encoder->pending_frames);
+    if (frame) {
+        outbuf->frame = *frame;
+        outbuf->duration = spice_get_monotonic_time_ns() - frame->start;
+        g_free(frame);
+    }
+    g_queue_push_tail(&encoder->outbufs, outbuf);
+    pthread_cond_signal(&encoder->outbuf_cond);
+    if (encoder->async) {
+        /* This is done with the lock held so the encoder cannot be
+         * destroyed before the callback returns.
+         */
+        encoder->cbs.frame_ready(encoder->cbs.opaque);
+    }
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+}
+
 static GstBusSyncReply handle_pipeline_message(GstBus *bus, GstMessage *msg, gpointer video_encoder)
 {
     SpiceGstEncoder *encoder = (SpiceGstEncoder*) video_encoder;
@@ -843,10 +932,7 @@ static GstBusSyncReply handle_pipeline_message(GstBus *bus, GstMessage *msg, gpo
         g_clear_error(&err);
 
         /* Unblock the main thread */
-        pthread_mutex_lock(&encoder->outbuf_mutex);
-        encoder->outbuf = (VideoBuffer*)create_gst_video_buffer();
-        pthread_cond_signal(&encoder->outbuf_cond);
-        pthread_mutex_unlock(&encoder->outbuf_mutex);
+        push_compressed_buffer(encoder, create_gst_video_buffer());
     }
     return GST_BUS_PASS;
 }
@@ -876,10 +962,7 @@ static GstFlowReturn new_sample(GstAppSink *gstappsink, gpointer video_encoder)
 #endif
 
     /* Notify the main thread that the output buffer is ready */
-    pthread_mutex_lock(&encoder->outbuf_mutex);
-    encoder->outbuf = (VideoBuffer*)outbuf;
-    pthread_cond_signal(&encoder->outbuf_cond);
-    pthread_mutex_unlock(&encoder->outbuf_mutex);
+    push_compressed_buffer(encoder, outbuf);
 
     return GST_FLOW_OK;
 }
@@ -907,6 +990,45 @@ static const gchar* get_gst_codec_name(const SpiceGstEncoder *encoder)
     }
 }
 
+/* Routes the pipeline output and errors to the encoder */
+static void connect_pipeline(SpiceGstEncoder *encoder)
+{
+#ifdef HAVE_GSTREAMER_0_10
+    GstAppSinkCallbacks appsink_cbs = {NULL, NULL, &new_sample, NULL, {NULL}};
+#else
+    GstAppSinkCallbacks appsink_cbs = {NULL, NULL, &new_sample, ._gst_reserved={NULL}};
+#endif
+    gst_app_sink_set_callbacks(encoder->appsink, &appsink_cbs, encoder, NULL);
+
+    /* Hook into the bus so we can handle errors */
+    GstBus *bus = gst_element_get_bus(encoder->pipeline);
+#ifdef HAVE_GSTREAMER_0_10
+    gst_bus_set_sync_handler(bus, handle_pipeline_message, encoder);
+#else
+    gst_bus_set_sync_handler(bus, handle_pipeline_message, encoder, NULL);
+#endif
+    gst_object_unref(bus);
+}
+
+/* The reverse of connect_pipeline(), for pipelines that outlive the encoder */
+static void disconnect_pipeline(SpiceGstEncoder *encoder)
+{
+#ifdef HAVE_GSTREAMER_0_10
+    GstAppSinkCallbacks appsink_cbs = {NULL, NULL, NULL, NULL, {NULL}};
+#else
+    GstAppSinkCallbacks appsink_cbs = {NULL, NULL, NULL, ._gst_reserved={NULL}};
+#endif
+    gst_app_sink_set_callbacks(encoder->appsink, &appsink_cbs, NULL, NULL);
+
+    GstBus *bus = gst_element_get_bus(encoder->pipeline);
+#ifdef HAVE_GSTREAMER_0_10
+    gst_bus_set_sync_handler(bus, NULL, NULL);
+#else
+    gst_bus_set_sync_handler(bus, NULL, NULL, NULL);
+#endif
+    gst_object_unref(bus);
+}
+
 static gboolean create_pipeline(SpiceGstEncoder *encoder)
 {
 #ifdef HAVE_GSTREAMER_0_10
@@ -987,22 +1109,7 @@ static gboolean create_pipeline(SpiceGstEncoder *encoder)
     encoder->appsrc = GST_APP_SRC(gst_bin_get_by_name(GST_BIN(encoder->pipeline), "src"));
     encoder->gstenc = gst_bin_get_by_name(GST_BIN(encoder->pipeline), "encoder");
     encoder->appsink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(encoder->pipeline), "sink"));
-
-#ifdef HAVE_GSTREAMER_0_10
-    GstAppSinkCallbacks appsink_cbs = {NULL, NULL, &new_sample, NULL, {NULL}};
-#else
-    GstAppSinkCallbacks appsink_cbs = {NULL, NULL, &new_sample, ._gst_reserved={NULL}};
-#endif
-    gst_app_sink_set_callbacks(encoder->appsink, &appsink_cbs, encoder, NULL);
-
-    /* Hook into the bus so we can handle errors */
-    GstBus *bus = gst_element_get_bus(encoder->pipeline);
-#ifdef HAVE_GSTREAMER_0_10
-    gst_bus_set_sync_handler(bus, handle_pipeline_message, encoder);
-#else
-    gst_bus_set_sync_handler(bus, handle_pipeline_message, encoder, NULL);
-#endif
-    gst_object_unref(bus);
+    connect_pipeline(encoder);
 
     if (encoder->base.codec_type == SPICE_VIDEO_CODEC_TYPE_MJPEG) {
         /* See https://bugzilla.gnome.org/show_bug.cgi?id=753257 */
@@ -1088,16 +1195,222 @@ static void set_gstenc_bitrate(SpiceGstEncoder *encoder)
     spice_debug("setting the GStreamer %s to %" G_GUINT64_FORMAT, prop, gst_bit_rate);
 }
 
+/* ---------- Pipeline pool ---------- */
+
+/* The pipeline of a stopped stream, kept playing so a later stream can use
+ * it without going through the plugin lookup and negotiation again.
+ */
+typedef struct SpiceGstPooledPipeline {
+    SpiceVideoCodecType codec_type;
+    GstElement *pipeline;
+    GstAppSink *appsink;
+    GstAppSrc *appsrc;
+    GstCaps *src_caps;
+    GstElement *gstenc;
+    GParamSpec *gstenc_bitrate_param;
+    gboolean gstenc_bitrate_is_dynamic;
+
+    /* The format the pipeline is playing, width is 0 if the pipeline was
+     * never started or has changes pending.
+     */
+    uint32_t width;
+    uint32_t height;
+    SpiceBitmapFmt spice_format;
+} SpiceGstPooledPipeline;
+
+/* The idle pipelines of all the codecs, the most recent first */
+static pthread_mutex_t pipeline_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static GQueue pipeline_pool = G_QUEUE_INIT;
+
+static void free_pooled_pipeline(SpiceGstPooledPipeline *pooled)
+{
+    if (pooled->src_caps) {
+        gst_caps_unref(pooled->src_caps);
+    }
+    gst_element_set_state(pooled->pipeline, GST_STATE_NULL);
+    gst_object_unref(pooled->appsrc);
+    gst_object_unref(pooled->gstenc);
+    gst_object_unref(pooled->appsink);
+    gst_object_unref(pooled->pipeline);
+    g_free(pooled);
+}
+
+static gboolean has_pooled_pipeline(SpiceVideoCodecType codec_type)
+{
+    gboolean found = FALSE;
+
+    pthread_mutex_lock(&pipeline_pool_lock);
+    for (GList *l = pipeline_pool.head; l && !found; l = l->next) {
+        found = ((SpiceGstPooledPipeline*)l->data)->codec_type == codec_type;
+    }
+    pthread_mutex_unlock(&pipeline_pool_lock);
+    return found;
+}
+
+/* Moves the encoder's pipeline to the pool. Returns FALSE if the pipeline
+ * should be freed instead.
+ */
+static gboolean put_pooled_pipeline(SpiceGstEncoder *encoder)
+{
+    if (!encoder->pipeline || encoder->pipeline_pool_size == 0 || encoder->errors) {
+        return FALSE;
+    }
+
+    /* Nothing from this stream must come out of the pipeline once it is
+     * used by another one.
+     */
+    wait_for_pending_frames(encoder);
+#ifdef DO_ZERO_COPY
+    /* The source buffers reference this encoder which is about to be
+     * freed. Rather than having the worker wait for the pipeline to
+     * release them, stopping the pipeline frees them right away.
+     */
+    if (g_atomic_int_get(&encoder->bitmap_wrappers)) {
+        spice_debug("the pipeline still holds some frames, not reusing it");
+        return FALSE;
+    }
+#endif
+    disconnect_pipeline(encoder);
+
+    SpiceGstPooledPipeline *pooled = g_new0(SpiceGstPooledPipeline, 1);
+    pooled->codec_type = encoder->base.codec_type;
+    pooled->pipeline = encoder->pipeline;
+    pooled->appsink = encoder->appsink;
+    pooled->appsrc = encoder->appsrc;
+    pooled->src_caps = encoder->src_caps;
+    pooled->gstenc = encoder->gstenc;
+    pooled->gstenc_bitrate_param = encoder->gstenc_bitrate_param;
+    pooled->gstenc_bitrate_is_dynamic = encoder->gstenc_bitrate_is_dynamic;
+    if (!encoder->set_pipeline) {
+        pooled->width = encoder->width;
+        pooled->height = encoder->height;
+        pooled->spice_format = encoder->spice_format;
+    }
+    encoder->pipeline = NULL;
+    encoder->src_caps = NULL;
+
+    /* Evict the oldest pipeline of this codec if there are too many */
+    SpiceGstPooledPipeline *evicted = NULL;
+    uint32_t count = 0;
+    pthread_mutex_lock(&pipeline_pool_lock);
+    g_queue_push_head(&pipeline_pool, pooled);
+    for (GList *l = pipeline_pool.head; l; l = l->next) {
+        SpiceGstPooledPipeline *other = (SpiceGstPooledPipeline*)l->data;
+        if (other->codec_type == pooled->codec_type &&
+            ++count > encoder->pipeline_pool_size) {
+            evicted = other;
+            g_queue_delete_link(&pipeline_pool, l);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pipeline_pool_lock);
+
+    if (evicted) {
+        free_pooled_pipeline(evicted);
+    }
+    return TRUE;
+}
+
+void gstreamer_encoder_clear_pipeline_pool(void)
+{
+    pthread_mutex_lock(&pipeline_pool_lock);
+    GList *pipelines = pipeline_pool.head;
+    g_queue_init(&pipeline_pool);
+    pthread_mutex_unlock(&pipeline_pool_lock);
+
+    for (GList *l = pipelines; l; l = l->next) {
+        free_pooled_pipeline((SpiceGstPooledPipeline*)l->data);
+    }
+    g_list_free(pipelines);
+}
+
+/* Gives the encoder a pooled pipeline, preferably one already playing the
+ * right format. Returns FALSE if there is none for this codec.
+ */
+static gboolean take_pooled_pipeline(SpiceGstEncoder *encoder)
+{
+    SpiceGstPooledPipeline *pooled = NULL;
+    GList *link = NULL;
+
+    pthread_mutex_lock(&pipeline_pool_lock);
+    for (GList *l = pipeline_pool.head; l; l = l->next) {
+        SpiceGstPooledPipeline *candidate = (SpiceGstPooledPipeline*)l->data;
+        if (candidate->codec_type != encoder->base.codec_type) {
+            continue;
+        }
+        if (!link) {
+            link = l;
+        }
+        if (candidate->width == encoder->width &&
+            candidate->height == encoder->height &&
+            candidate->spice_format == encoder->spice_format) {
+            link = l;
+            break;
+        }
+    }
+    if (link) {
+        pooled = (SpiceGstPooledPipeline*)link->data;
+        g_queue_delete_link(&pipeline_pool, link);
+    }
+    pthread_mutex_unlock(&pipeline_pool_lock);
+
+    if (!pooled) {
+        return FALSE;
+    }
+
+    encoder->pipeline = pooled->pipeline;
+    encoder->appsink = pooled->appsink;
+    encoder->appsrc = pooled->appsrc;
+    encoder->src_caps = pooled->src_caps;
+    encoder->gstenc = pooled->gstenc;
+    encoder->gstenc_bitrate_param = pooled->gstenc_bitrate_param;
+    encoder->gstenc_bitrate_is_dynamic = pooled->gstenc_bitrate_is_dynamic;
+    connect_pipeline(encoder);
+
+    if (pooled->width == 0) {
+        /* Configure it as if it had just been created */
+        set_pipeline_changes(encoder, SPICE_GST_VIDEO_PIPELINE_STATE |
+                                      SPICE_GST_VIDEO_PIPELINE_BITRATE |
+                                      SPICE_GST_VIDEO_PIPELINE_CAPS);
+    } else if (pooled->width != encoder->width ||
+               pooled->height != encoder->height ||
+               pooled->spice_format != encoder->spice_format) {
+        set_pipeline_changes(encoder, SPICE_GST_VIDEO_PIPELINE_BITRATE |
+                                      SPICE_GST_VIDEO_PIPELINE_CAPS);
+    } else {
+        spice_debug("reusing a %dx%d %s pipeline", encoder->width, encoder->height,
+                    get_gst_codec_name(encoder));
+        if (encoder->gstenc_bitrate_is_dynamic) {
+            set_gstenc_bitrate(encoder);
+        } else {
+            set_pipeline_changes(encoder, SPICE_GST_VIDEO_PIPELINE_BITRATE);
+        }
+        /* The client has none of the frames the next one may refer to */
+        GstEvent *event = gst_video_event_new_downstream_force_key_unit(
+            GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, TRUE, 0);
+        if (!gst_element_send_event(encoder->gstenc, event)) {
+            spice_debug("GStreamer error: could not request a key frame");
+            set_pipeline_changes(encoder, SPICE_GST_VIDEO_PIPELINE_CAPS);
+        }
+    }
+    g_free(pooled);
+    return TRUE;
+}
+
 /* A helper for spice_gst_encoder_encode_frame() */
 static gboolean configure_pipeline(SpiceGstEncoder *encoder)
 {
-    if (!encoder->pipeline && !create_pipeline(encoder)) {
+    if (!encoder->pipeline && !take_pooled_pipeline(encoder) &&
+        !create_pipeline(encoder)) {
         return FALSE;
     }
     if (!encoder->set_pipeline) {
         return TRUE;
     }
 
+    /* Stopping the pipeline would lose the frames being encoded */
+    wait_for_pending_frames(encoder);
+
     /* If the pipeline state does not need to be changed it's because it is
      * already in the PLAYING state. So first set it to the NULL state so it
      * can be (re)configured.
@@ -1168,6 +1481,7 @@ static BitmapWrapper *bitmap_wrapper_new(SpiceGstEncoder *encoder, gpointer bitm
     wrapper->encoder = encoder;
     wrapper->opaque = bitmap_opaque;
     encoder->bitmap_ref(bitmap_opaque);
+    g_atomic_int_inc(&encoder->bitmap_wrappers);
     return wrapper;
 }
 
@@ -1176,6 +1490,7 @@ static void bitmap_wrapper_unref(gpointer data)
     BitmapWrapper *wrapper = (BitmapWrapper*) data;
     if (g_atomic_int_dec_and_test(&wrapper->refs)) {
         g_async_queue_push(wrapper->encoder->unused_bitmap_opaques, wrapper->opaque);
+        g_atomic_int_add(&wrapper->encoder->bitmap_wrappers, -1);
         g_free(wrapper);
     }
 }
@@ -1432,11 +1747,10 @@ static VideoEncodeResults
 pull_compressed_buffer(SpiceGstEncoder *encoder, VideoBuffer **outbuf)
 {
     pthread_mutex_lock(&encoder->outbuf_mutex);
-    while (!encoder->outbuf) {
+    while (g_queue_is_empty(&encoder->outbufs)) {
         pthread_cond_wait(&encoder->outbuf_cond, &encoder->outbuf_mutex);
     }
-    *outbuf = encoder->outbuf;
-    encoder->outbuf = NULL;
+    *outbuf = (VideoBuffer*)g_queue_pop_head(&encoder->outbufs);
     pthread_mutex_unlock(&encoder->outbuf_mutex);
 
     if ((*outbuf)->data) {
@@ -1449,6 +1763,66 @@ pull_compressed_buffer(SpiceGstEncoder *encoder, VideoBuffer **outbuf)
     return VIDEO_ENCODER_FRAME_UNSUPPORTED;
 }
 
+/* A helper for spice_gst_encoder_encode_frame() */
+static SpiceGstFrame *add_pending_frame(SpiceGstEncoder *encoder, uint32_t frame_mm_time,
+                                        gpointer bitmap_opaque)
+{
+    SpiceGstFrame *frame = g_new0(SpiceGstFrame, 1);
+    frame->mm_time = frame_mm_time;
+    frame->start = spice_get_monotonic_time_ns();
+    if (encoder->async) {
+        /* Keep the bitmap for the caller of get_frame() */
+        encoder->bitmap_ref(bitmap_opaque);
+        frame->bitmap_opaque = bitmap_opaque;
+    }
+
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    g_queue_push_tail(&encoder->pending_frames, frame);
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+    return frame;
+}
+
+/* A helper for spice_gst_encoder_encode_frame(), for frames that could not
+ * be pushed.
+ */
+static void remove_pending_frame(SpiceGstEncoder *encoder, SpiceGstFrame *frame)
+{
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    gboolean found = g_queue_remove(&encoder->pending_frames, frame);
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+
+    /* Otherwise a pipeline error got attached to it */
+    if (found) {
+        if (frame->bitmap_opaque) {
+            encoder->bitmap_unref(frame->bitmap_opaque);
+        }
+        g_free(frame);
+    }
+}
+
+static uint32_t get_pending_frame_count(SpiceGstEncoder *encoder)
+{
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    uint32_t count = g_queue_get_length(&encoder->pending_frames);
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+    return count;
+}
+
+/* Takes a compressed frame into account for the bit rate control */
+static void add_encoded_frame(SpiceGstEncoder *encoder, SpiceGstVideoBuffer *outbuf)
+{
+    uint32_t frame_mm_time = outbuf->frame.mm_time;
+    uint32_t last_mm_time = get_last_frame_mm_time(encoder);
+    add_frame(encoder, frame_mm_time, outbuf->duration, outbuf->base.size);
+
+    int32_t refill = encoder->bit_rate * (frame_mm_time - last_mm_time) / MSEC_PER_SEC / 8;
+    encoder->vbuffer_free = MIN(encoder->vbuffer_free + refill,
+                                encoder->vbuffer_size) - outbuf->base.size;
+
+    server_increase_bit_rate(encoder, frame_mm_time);
+    update_next_frame_mm_time(encoder);
+}
+
 
 /* ---------- VideoEncoder's public API ---------- */
 
@@ -1456,7 +1830,10 @@ static void spice_gst_encoder_destroy(VideoEncoder *video_encoder)
 {
     SpiceGstEncoder *encoder = (SpiceGstEncoder*)video_encoder;
 
-    free_pipeline(encoder);
+    if (!put_pooled_pipeline(encoder)) {
+        free_pipeline(encoder);
+    }
+    clear_frames(encoder);
     pthread_mutex_destroy(&encoder->outbuf_mutex);
     pthread_cond_destroy(&encoder->outbuf_cond);
 
@@ -1528,14 +1905,25 @@ spice_gst_encoder_encode_frame(VideoEncoder *video_encoder,
         return VIDEO_ENCODER_FRAME_DROP;
     }
 
+    if (encoder->async &&
+        get_pending_frame_count(encoder) >= SPICE_GST_MAX_PENDING_FRAMES) {
+        /* The pipeline cannot keep up with the source */
+        return VIDEO_ENCODER_FRAME_DROP;
+    }
+
     if (!configure_pipeline(encoder)) {
         encoder->errors++;
         return VIDEO_ENCODER_FRAME_UNSUPPORTED;
     }
 
-    uint64_t start = spice_get_monotonic_time_ns();
+    SpiceGstFrame *frame = add_pending_frame(encoder, frame_mm_time, bitmap_opaque);
     VideoEncodeResults rc = push_raw_frame(encoder, bitmap, src, top_down, bitmap_opaque);
-    if (rc == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+    if (rc != VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+        remove_pending_frame(encoder, frame);
+    } else if (encoder->async) {
+        clear_zero_copy_queue(encoder, FALSE);
+        return VIDEO_ENCODER_FRAME_PENDING;
+    } else {
         rc = pull_compressed_buffer(encoder, outbuf);
         if (rc != VIDEO_ENCODER_FRAME_ENCODE_DONE) {
             /* The input buffer will be stuck in the pipeline, preventing
@@ -1554,18 +1942,49 @@ spice_gst_encoder_encode_frame(VideoEncoder *video_encoder,
     if (rc != VIDEO_ENCODER_FRAME_ENCODE_DONE) {
         return rc;
     }
-    uint32_t last_mm_time = get_last_frame_mm_time(encoder);
-    add_frame(encoder, frame_mm_time, spice_get_monotonic_time_ns() - start,
-              (*outbuf)->size);
+    add_encoded_frame(encoder, (SpiceGstVideoBuffer*)*outbuf);
 
-    int32_t refill = encoder->bit_rate * (frame_mm_time - last_mm_time) / MSEC_PER_SEC / 8;
-    encoder->vbuffer_free = MIN(encoder->vbuffer_free + refill,
-                                encoder->vbuffer_size) - (*outbuf)->size;
+    return rc;
+}
 
-    server_increase_bit_rate(encoder, frame_mm_time);
-    update_next_frame_mm_time(encoder);
+static VideoEncodeResults
+spice_gst_encoder_get_frame(VideoEncoder *video_encoder,
+                            uint32_t *frame_mm_time,
+                            gpointer *bitmap_opaque,
+                            VideoBuffer **outbuf)
+{
+    SpiceGstEncoder *encoder = (SpiceGstEncoder*)video_encoder;
+    g_return_val_if_fail(outbuf != NULL, VIDEO_ENCODER_FRAME_UNSUPPORTED);
+    *outbuf = NULL;
 
-    return rc;
+    /* Unref the encoded frames' bitmap_opaque structures if any */
+    clear_zero_copy_queue(encoder, FALSE);
+
+    pthread_mutex_lock(&encoder->outbuf_mutex);
+    SpiceGstVideoBuffer *buffer = (SpiceGstVideoBuffer*)g_queue_pop_head(&encoder->outbufs);
+    gboolean pending = !g_queue_is_empty(&encoder->pending_frames);
+    pthread_mutex_unlock(&encoder->outbuf_mutex);
+
+    if (!buffer) {
+        return pending ? VIDEO_ENCODER_FRAME_PENDING : VIDEO_ENCODER_FRAME_UNSUPPORTED;
+    }
+    if (!buffer->base.data) {
+        spice_debug("failed to pull the compressed buffer");
+        if (buffer->frame.bitmap_opaque) {
+            encoder->bitmap_unref(buffer->frame.bitmap_opaque);
+        }
+        buffer->base.free(&buffer->base);
+        /* Rebuild the pipeline, see spice_gst_encoder_encode_frame() */
+        free_pipeline(encoder);
+        encoder->errors++;
+        return VIDEO_ENCODER_FRAME_UNSUPPORTED;
+    }
+
+    add_encoded_frame(encoder, buffer);
+    *frame_mm_time = buffer->frame.mm_time;
+    *bitmap_opaque = buffer->frame.bitmap_opaque;
+    *outbuf = &buffer->base;
+    return VIDEO_ENCODER_FRAME_ENCODE_DONE;
 }
 
 static void spice_gst_encoder_client_stream_report(VideoEncoder *video_encoder,
@@ -1731,6 +2150,25 @@ static bool orc_check(void)
     return orc_dynamic_code_ok;
 }
 
+static uint32_t get_pipeline_pool_size_from_env(void)
+{
+    const char *env = getenv(GSTREAMER_ENCODER_PIPELINE_POOL_ENV);
+    unsigned long size;
+    char *end;
+
+    if (!env || !*env) {
+        return 0;
+    }
+
+    errno = 0;
+    size = strtoul(env, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        spice_warning("error parsing %s: %s", GSTREAMER_ENCODER_PIPELINE_POOL_ENV, env);
+        return 0;
+    }
+    return MIN(size, SPICE_GST_MAX_POOLED_PIPELINES);
+}
+
 VideoEncoder *gstreamer_encoder_new(SpiceVideoCodecType codec_type,
                                     uint64_t starting_bit_rate,
                                     VideoEncoderRateControlCbs *cbs,
@@ -1758,6 +2196,7 @@ VideoEncoder *gstreamer_encoder_new(SpiceVideoCodecType codec_type,
     SpiceGstEncoder *encoder = g_new0(SpiceGstEncoder, 1);
     encoder->base.destroy = spice_gst_encoder_destroy;
     encoder->base.encode_frame = spice_gst_encoder_encode_frame;
+    encoder->base.get_frame = spice_gst_encoder_get_frame;
     encoder->base.client_stream_report = spice_gst_encoder_client_stream_report;
     encoder->base.notify_server_frame_drop = spice_gst_encoder_notify_server_frame_drop;
     encoder->base.get_bit_rate = spice_gst_encoder_get_bit_rate;
@@ -1772,12 +2211,18 @@ VideoEncoder *gstreamer_encoder_new(SpiceVideoCodecType codec_type,
     encoder->bitmap_ref = bitmap_ref;
     encoder->bitmap_unref = bitmap_unref;
     encoder->format = GSTREAMER_FORMAT_INVALID;
+    encoder->async = cbs->frame_ready && getenv(GSTREAMER_ENCODER_ASYNC_ENV) != NULL;
+    encoder->pipeline_pool_size = get_pipeline_pool_size_from_env();
     pthread_mutex_init(&encoder->outbuf_mutex, NULL);
     pthread_cond_init(&encoder->outbuf_cond, NULL);
+    g_queue_init(&encoder->pending_frames);
+    g_queue_init(&encoder->outbufs);
 
     /* All the other fields are initialized to zero by g_new0(). */
 
-    if (!create_pipeline(encoder)) {
+    /* A pooled pipeline will be picked once the video format is known */
+    if ((encoder->pipeline_pool_size == 0 || !has_pooled_pipeline(codec_type)) &&
+        !create_pipeline(encoder)) {
         /* Some GStreamer dependency is probably missing */
         pthread_cond_destroy(&encoder->outbuf_cond);
         pthread_mutex_destroy(&encoder->outbuf_mutex);
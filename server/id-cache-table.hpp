@@ -0,0 +1,298 @@
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Hash table of cache items indexed by their 64 bit id and kept in LRU order.
+ * The index is an open addressing table with linear probing, the items are
+ * stored densely in a separate array and linked in LRU order by index so
+ * a lookup usually touches a single cache line of the index.
+ * A zero initialized table is a valid empty table so it can be embedded in
+ * structures allocated with g_new0.
+ * Item pointers are invalidated by insert() and remove().
+ */
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <glib.h>
+
+#include "push-visibility.h"
+
+namespace red {
+
+template <typename T>
+class IdCacheTable
+{
+    static_assert(std::is_trivially_copyable<T>::value, "items are moved with memcpy");
+
+    static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+    static constexpr uint32_t MIN_SLOTS = 64;
+
+    struct Slot {
+        uint64_t id;
+        uint32_t index;
+    };
+
+    struct Node {
+        T item;
+        uint64_t id;
+        uint32_t prev;
+        uint32_t next;
+    };
+
+public:
+    /* Returns the item with the given id or nullptr.
+     * @p probes, if not nullptr, is incremented by the number of index slots
+     * inspected */
+    T *find(uint64_t id, uint64_t *probes=nullptr)
+    {
+        uint32_t slot;
+        if (!lookup(id, &slot, probes)) {
+            return nullptr;
+        }
+        return &nodes[slots[slot].index].item;
+    }
+
+    /* Add a new item as the most recently used one. @p id must not be
+     * already present */
+    T *insert(uint64_t id)
+    {
+        uint32_t slot;
+
+        if (num_items >= max_items()) {
+            grow();
+        }
+        if (lookup(id, &slot)) {
+            g_warn_if_reached();
+            return &nodes[slots[slot].index].item;
+        }
+
+        uint32_t index = num_items++;
+        slots[slot].id = id;
+        slots[slot].index = index;
+        nodes[index].id = id;
+        lru_link(index);
+        return &nodes[index].item;
+    }
+
+    void remove(T *item)
+    {
+        uint32_t index = node_index(item);
+        uint32_t slot;
+
+        lru_unlink(index);
+        if (!lookup(nodes[index].id, &slot)) {
+            g_return_if_reached();
+        }
+        remove_slot(slot);
+
+        /* keep the items dense moving the last one in the hole */
+        uint32_t last = --num_items;
+        if (index != last) {
+            nodes[index] = nodes[last];
+            if (lookup(nodes[index].id, &slot)) {
+                slots[slot].index = index;
+            }
+            relink(index);
+        }
+    }
+
+    /* mark the item as the most recently used */
+    void touch(T *item)
+    {
+        uint32_t index = node_index(item);
+
+        if (index != lru_head) {
+            lru_unlink(index);
+            lru_link(index);
+        }
+    }
+
+    /* least recently used item or nullptr if empty */
+    T *lru_tail()
+    {
+        return num_items ? &nodes[lru_last].item : nullptr;
+    }
+
+    uint64_t get_id(const T *item) const
+    {
+        return reinterpret_cast<const Node *>(item)->id;
+    }
+
+    uint32_t size() const
+    {
+        return num_items;
+    }
+
+    /* remove all items keeping the allocated memory */
+    void clear()
+    {
+        for (uint32_t i = 0; i < num_slots; i++) {
+            slots[i].index = INVALID_INDEX;
+        }
+        num_items = 0;
+    }
+
+    /* remove all items and free the memory */
+    void destroy()
+    {
+        g_free(slots);
+        g_free(nodes);
+        slots = nullptr;
+        nodes = nullptr;
+        num_slots = 0;
+        num_items = 0;
+    }
+
+private:
+    /* murmur3 finalizer, ids are often sequential or share the low bits */
+    static uint64_t hash(uint64_t id)
+    {
+        id ^= id >> 33;
+        id *= UINT64_C(0xff51afd7ed558ccd);
+        id ^= id >> 33;
+        id *= UINT64_C(0xc4ceb9fe1a85ec53);
+        id ^= id >> 33;
+        return id;
+    }
+
+    /* keep load factor under 3/4 */
+    uint32_t max_items() const
+    {
+        return num_slots - num_slots / 4;
+    }
+
+    uint32_t node_index(const T *item) const
+    {
+        return reinterpret_cast<const Node *>(item) - nodes;
+    }
+
+    /* Look for the slot containing @p id. If not found returns false and
+     * @p slot is the empty slot where the id should be inserted */
+    bool lookup(uint64_t id, uint32_t *slot, uint64_t *probes=nullptr) const
+    {
+        if (num_slots == 0) {
+            *slot = 0;
+            return false;
+        }
+
+        const uint32_t mask = num_slots - 1;
+        uint32_t i = hash(id) & mask;
+        uint32_t n = 1;
+        for (; slots[i].index != INVALID_INDEX; i = (i + 1) & mask, n++) {
+            if (slots[i].id == id) {
+                break;
+            }
+        }
+        if (probes) {
+            *probes += n;
+        }
+        *slot = i;
+        return slots[i].index != INVALID_INDEX;
+    }
+
+    /* backward shift deletion, no tombstones are needed */
+    void remove_slot(uint32_t hole)
+    {
+        const uint32_t mask = num_slots - 1;
+
+        for (uint32_t i = (hole + 1) & mask; slots[i].index != INVALID_INDEX; i = (i + 1) & mask) {
+            uint32_t home = hash(slots[i].id) & mask;
+            /* move the entry only if its home is not between the hole and its position */
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                slots[hole] = slots[i];
+                hole = i;
+            }
+        }
+        slots[hole].index = INVALID_INDEX;
+    }
+
+    void grow()
+    {
+        uint32_t new_num_slots = num_slots ? num_slots * 2 : MIN_SLOTS;
+
+        g_free(slots);
+        slots = g_new(Slot, new_num_slots);
+        num_slots = new_num_slots;
+        nodes = g_renew(Node, nodes, max_items());
+
+        for (uint32_t i = 0; i < num_slots; i++) {
+            slots[i].index = INVALID_INDEX;
+        }
+        for (uint32_t index = 0; index < num_items; index++) {
+            uint32_t slot;
+            lookup(nodes[index].id, &slot);
+            slots[slot].id = nodes[index].id;
+            slots[slot].index = index;
+        }
+    }
+
+    void lru_link(uint32_t index)
+    {
+        nodes[index].prev = INVALID_INDEX;
+        nodes[index].next = num_items > 1 ? lru_head : INVALID_INDEX;
+        if (num_items > 1) {
+            nodes[lru_head].prev = index;
+        } else {
+            lru_last = index;
+        }
+        lru_head = index;
+    }
+
+    void lru_unlink(uint32_t index)
+    {
+        Node *node = &nodes[index];
+
+        if (node->prev != INVALID_INDEX) {
+            nodes[node->prev].next = node->next;
+        } else {
+            lru_head = node->next;
+        }
+        if (node->next != INVALID_INDEX) {
+            nodes[node->next].prev = node->prev;
+        } else {
+            lru_last = node->prev;
+        }
+    }
+
+    /* a node was moved to @p to, update its neighbours */
+    void relink(uint32_t to)
+    {
+        Node *node = &nodes[to];
+
+        if (node->prev != INVALID_INDEX) {
+            nodes[node->prev].next = to;
+        } else {
+            lru_head = to;
+        }
+        if (node->next != INVALID_INDEX) {
+            nodes[node->next].prev = to;
+        } else {
+            lru_last = to;
+        }
+    }
+
+    Slot *slots = nullptr;
+    Node *nodes = nullptr;
+    uint32_t num_slots = 0;
+    uint32_t num_items = 0;
+    uint32_t lru_head = 0;
+    uint32_t lru_last = 0;
+};
+
+} // namespace red
+
+#include "pop-visibility.h"
@@ -20,52 +20,23 @@
 #include "red-parse-qxl.h"
 #include "display-channel.h"
 
-static ImageCacheItem *image_cache_find(ImageCache *cache, uint64_t id)
-{
-    ImageCacheItem *item = cache->hash_table[id % IMAGE_CACHE_HASH_SIZE];
-
-    while (item) {
-        if (item->id == id) {
-            return item;
-        }
-        item = item->next;
-    }
-    return nullptr;
-}
-
 static bool image_cache_hit(ImageCache *cache, uint64_t id)
 {
     ImageCacheItem *item;
-    if (!(item = image_cache_find(cache, id))) {
+    if (!(item = cache->items.find(id))) {
         return FALSE;
     }
 #ifdef IMAGE_CACHE_AGE
     item->age = cache->age;
 #endif
-    ring_remove(&item->lru_link);
-    ring_add(&cache->lru, &item->lru_link);
+    cache->items.touch(item);
     return TRUE;
 }
 
 static void image_cache_remove(ImageCache *cache, ImageCacheItem *item)
 {
-    ImageCacheItem **now;
-
-    now = &cache->hash_table[item->id % IMAGE_CACHE_HASH_SIZE];
-    for (;;) {
-        spice_assert(*now);
-        if (*now == item) {
-            *now = item->next;
-            break;
-        }
-        now = &(*now)->next;
-    }
-    ring_remove(&item->lru_link);
     pixman_image_unref(item->image);
-    g_free(item);
-#ifndef IMAGE_CACHE_AGE
-    cache->num_items--;
-#endif
+    cache->items.remove(item);
 }
 
 #define IMAGE_CACHE_MAX_ITEMS 2
@@ -75,37 +46,31 @@ static void image_cache_put(SpiceImageCache *spice_cache, uint64_t id, pixman_im
     ImageCache *cache = SPICE_UPCAST(ImageCache, spice_cache);
     ImageCacheItem *item;
 
+    if ((item = cache->items.find(id))) {
+        /* replace the old image */
+        image_cache_remove(cache, item);
+    }
+
 #ifndef IMAGE_CACHE_AGE
-    if (cache->num_items == IMAGE_CACHE_MAX_ITEMS) {
-        SPICE_VERIFY(SPICE_OFFSETOF(ImageCacheItem, lru_link) == 0);
-        ImageCacheItem *tail =
-            SPICE_CONTAINEROF(ring_get_tail(&cache->lru), ImageCacheItem, lru_link);
+    if (cache->items.size() == IMAGE_CACHE_MAX_ITEMS) {
+        ImageCacheItem *tail = cache->items.lru_tail();
         spice_assert(tail);
         image_cache_remove(cache, tail);
     }
 #endif
 
-    item = g_new(ImageCacheItem, 1);
-    item->id = id;
+    item = cache->items.insert(id);
 #ifdef IMAGE_CACHE_AGE
     item->age = cache->age;
-#else
-    cache->num_items++;
 #endif
     item->image = pixman_image_ref(image);
-    ring_item_init(&item->lru_link);
-
-    item->next = cache->hash_table[item->id % IMAGE_CACHE_HASH_SIZE];
-    cache->hash_table[item->id % IMAGE_CACHE_HASH_SIZE] = item;
-
-    ring_add(&cache->lru, &item->lru_link);
 }
 
 static pixman_image_t *image_cache_get(SpiceImageCache *spice_cache, uint64_t id)
 {
     ImageCache *cache = SPICE_UPCAST(ImageCache, spice_cache);
 
-    ImageCacheItem *item = image_cache_find(cache, id);
+    ImageCacheItem *item = cache->items.find(id);
     if (!item) {
         spice_error("not found");
     }
@@ -120,12 +85,8 @@ void image_cache_init(ImageCache *cache)
     };
 
     cache->base.ops = &image_cache_ops;
-    memset(cache->hash_table, 0, sizeof(cache->hash_table));
-    ring_init(&cache->lru);
 #ifdef IMAGE_CACHE_AGE
     cache->age = 0;
-#else
-    cache->num_items = 0;
 #endif
 }
 
@@ -133,10 +94,10 @@ void image_cache_reset(ImageCache *cache)
 {
     ImageCacheItem *item;
 
-    SPICE_VERIFY(SPICE_OFFSETOF(ImageCacheItem, lru_link) == 0);
-    while ((item = SPICE_CONTAINEROF(ring_get_head(&cache->lru), ImageCacheItem, lru_link))) {
+    while ((item = cache->items.lru_tail())) {
         image_cache_remove(cache, item);
     }
+    cache->items.destroy();
 #ifdef IMAGE_CACHE_AGE
     cache->age = 0;
 #endif
@@ -146,12 +107,11 @@ void image_cache_reset(ImageCache *cache)
 
 void image_cache_aging(ImageCache *cache)
 {
-    SPICE_VERIFY(SPICE_OFFSETOF(ImageCacheItem, lru_link) == 0);
 #ifdef IMAGE_CACHE_AGE
     ImageCacheItem *item;
 
     cache->age++;
-    while ((item = (ImageCacheItem *)ring_get_tail(&cache->lru)) &&
+    while ((item = cache->items.lru_tail()) &&
            cache->age - item->age > IMAGE_CACHE_DEPTH) {
         image_cache_remove(cache, item);
     }
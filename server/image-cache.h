@@ -24,31 +24,25 @@
 #include <common/canvas_base.h>
 #include <common/ring.h>
 
+#include "id-cache-table.hpp"
+
 #include "push-visibility.h"
 
 /* FIXME: move back to display-channel.h (once structs are private) */
 struct Drawable;
 
 struct ImageCacheItem {
-    RingItem lru_link;
-    uint64_t id;
 #ifdef IMAGE_CACHE_AGE
     uint32_t age;
 #endif
-    struct ImageCacheItem *next;
     pixman_image_t *image;
 };
 
-#define IMAGE_CACHE_HASH_SIZE 1024
-
 struct ImageCache {
     SpiceImageCache base;
-    ImageCacheItem *hash_table[IMAGE_CACHE_HASH_SIZE];
-    Ring lru;
+    red::IdCacheTable<ImageCacheItem> items;
 #ifdef IMAGE_CACHE_AGE
     uint32_t age;
-#else
-    uint32_t num_items;
 #endif
 };
 
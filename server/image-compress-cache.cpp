@@ -0,0 +1,103 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "red-common.h"
+#include "image-compress-cache.h"
+
+struct ImageCompressCacheEntry {
+    /* the buffers can be released by the stream code once sent,
+     * so the count is updated atomically */
+    gint refs;
+    ImageCompressCacheEntry *next;
+
+    ImageCompressCacheKey key;
+    SpiceImage dest;
+    compress_send_data_t comp_data;
+};
+
+static bool key_equal(const ImageCompressCacheKey *a, const ImageCompressCacheKey *b)
+{
+    return a->src == b->src && a->compression == b->compression &&
+           a->use_jpeg == b->use_jpeg &&
+           (!a->use_jpeg || a->jpeg_quality == b->jpeg_quality);
+}
+
+bool image_compress_cache_lookup(ImageCompressCacheEntry *list,
+                                 const ImageCompressCacheKey *key,
+                                 SpiceImage *dest, compress_send_data_t *o_comp_data)
+{
+    for (ImageCompressCacheEntry *entry = list; entry; entry = entry->next) {
+        if (!key_equal(&entry->key, key)) {
+            continue;
+        }
+        dest->descriptor.type = entry->dest.descriptor.type;
+        dest->u = entry->dest.u;
+        *o_comp_data = entry->comp_data;
+        o_comp_data->cache_entry = image_compress_cache_entry_ref(entry);
+        return true;
+    }
+    return false;
+}
+
+void image_compress_cache_add(ImageCompressCacheEntry **list,
+                              const ImageCompressCacheKey *key,
+                              const SpiceImage *dest, compress_send_data_t *o_comp_data)
+{
+    spice_return_if_fail(o_comp_data->cache_entry == nullptr);
+
+    auto entry = g_new0(ImageCompressCacheEntry, 1);
+    /* one reference for the list and one for the caller */
+    entry->refs = 2;
+    entry->key = *key;
+    entry->dest.descriptor.type = dest->descriptor.type;
+    entry->dest.u = dest->u;
+    entry->comp_data = *o_comp_data;
+    entry->next = *list;
+    *list = entry;
+
+    o_comp_data->cache_entry = entry;
+}
+
+void image_compress_cache_clear(ImageCompressCacheEntry **list)
+{
+    ImageCompressCacheEntry *entry = *list;
+
+    *list = nullptr;
+    while (entry) {
+        ImageCompressCacheEntry *next = entry->next;
+        entry->next = nullptr;
+        image_compress_cache_entry_unref(entry);
+        entry = next;
+    }
+}
+
+ImageCompressCacheEntry *image_compress_cache_entry_ref(ImageCompressCacheEntry *entry)
+{
+    g_atomic_int_inc(&entry->refs);
+    return entry;
+}
+
+void image_compress_cache_entry_unref(ImageCompressCacheEntry *entry)
+{
+    if (!g_atomic_int_dec_and_test(&entry->refs)) {
+        return;
+    }
+    compress_buf_free_chain(entry->comp_data.comp_buf);
+    g_free(entry);
+}
@@ -0,0 +1,71 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file image-compress-cache.h
+ * Compressed images shared between the clients of a display channel.
+ *
+ * When several clients are connected each of them compresses the images
+ * of a drawable. The result of a dictionary-free codec only depends on
+ * the image and the codec parameters, so it's kept on the drawable while
+ * other clients still have to send it and reused by the clients which
+ * choose the same parameters.
+ *
+ * The compressed buffers are reference counted, they are released when
+ * the drawable does not need them anymore and every message using them
+ * has been sent.
+ */
+
+#ifndef IMAGE_COMPRESS_CACHE_H_
+#define IMAGE_COMPRESS_CACHE_H_
+
+#include "image-encoders.h"
+
+#include "push-visibility.h"
+
+/* Parameters the compressed data depends on */
+struct ImageCompressCacheKey {
+    /* the image of the drawable */
+    const SpiceBitmap *src;
+    SpiceImageCompression compression;
+    bool use_jpeg;
+    int jpeg_quality;
+};
+
+/* Look for the image in 'list'. On success 'dest' and 'o_comp_data' are
+ * filled like after a compression and o_comp_data->cache_entry holds a
+ * reference to the data */
+bool image_compress_cache_lookup(ImageCompressCacheEntry *list,
+                                 const ImageCompressCacheKey *key,
+                                 SpiceImage *dest, compress_send_data_t *o_comp_data);
+
+/* Move the result of a compression to a new entry of 'list'.
+ * o_comp_data->cache_entry is set to a reference to the entry */
+void image_compress_cache_add(ImageCompressCacheEntry **list,
+                              const ImageCompressCacheKey *key,
+                              const SpiceImage *dest, compress_send_data_t *o_comp_data);
+
+/* Release the references of the list */
+void image_compress_cache_clear(ImageCompressCacheEntry **list);
+
+ImageCompressCacheEntry *image_compress_cache_entry_ref(ImageCompressCacheEntry *entry);
+void image_compress_cache_entry_unref(ImageCompressCacheEntry *entry);
+
+#include "pop-visibility.h"
+
+#endif /* IMAGE_COMPRESS_CACHE_H_ */
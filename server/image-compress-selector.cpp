@@ -0,0 +1,258 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <cerrno>
+#include <cstdlib>
+
+#include "image-compress-selector.h"
+#include "utils.h"
+
+/* samples needed before trusting the estimates of a codec */
+#define MIN_SAMPLES 4
+/* every this many choices another codec is tried to refresh its estimates */
+#define EXPLORE_INTERVAL 64
+/* weight of a new sample in the moving averages is 1/AVERAGE_WEIGHT */
+#define AVERAGE_WEIGHT 8
+/* the CPU usage is measured over this period */
+#define BUDGET_PERIOD_NS (NSEC_PER_SEC / 2)
+
+#define NUM_GRADUALITY_CLASSES (BITMAP_GRADUAL_HIGH + 1)
+
+struct CodecEstimate {
+    double ns_per_byte;
+    /* original size / compressed size */
+    double ratio;
+    uint32_t samples;
+    /* times chosen to get the first samples */
+    uint32_t tries;
+};
+
+struct GradualityClass {
+    CodecEstimate codecs[IMAGE_COMPRESS_NUM_CODECS];
+    uint32_t choices;
+    /* next codec to retry */
+    uint32_t explore_next;
+};
+
+struct ImageCompressSelector {
+    /* percentage of the time which can be spent compressing */
+    unsigned int cpu_budget;
+    uint64_t period_start;
+    uint64_t period_cpu_ns;
+    /* CPU usage of the last complete period, in percent */
+    unsigned int cpu_usage;
+
+    GradualityClass classes[NUM_GRADUALITY_CLASSES];
+
+    RedStatCounter chosen_counters[IMAGE_COMPRESS_NUM_CODECS];
+    RedStatCounter explore_counter;
+    RedStatCounter over_budget_counter;
+};
+
+ImageCompressSelector *image_compress_selector_new(unsigned int cpu_budget,
+                                                   RedsState *reds,
+                                                   const RedStatNode *stat)
+{
+    static const struct {
+        SpiceImageCompression compression;
+        const char *name;
+    } counter_names[] = {
+        { SPICE_IMAGE_COMPRESSION_QUIC, "compress_auto_quic" },
+        { SPICE_IMAGE_COMPRESSION_GLZ, "compress_auto_glz" },
+        { SPICE_IMAGE_COMPRESSION_LZ, "compress_auto_lz" },
+        { SPICE_IMAGE_COMPRESSION_LZ4, "compress_auto_lz4" },
+        { IMAGE_COMPRESS_JPEG, "compress_auto_jpeg" },
+    };
+    ImageCompressSelector *selector;
+
+    spice_return_val_if_fail(cpu_budget > 0 && cpu_budget <= 100, nullptr);
+
+    selector = g_new0(ImageCompressSelector, 1);
+    selector->cpu_budget = cpu_budget;
+
+    for (const auto &counter : counter_names) {
+        stat_init_counter(&selector->chosen_counters[counter.compression], reds, stat,
+                          counter.name, TRUE);
+    }
+    stat_init_counter(&selector->explore_counter, reds, stat, "compress_auto_explore", TRUE);
+    stat_init_counter(&selector->over_budget_counter, reds, stat,
+                      "compress_auto_over_budget", TRUE);
+    return selector;
+}
+
+ImageCompressSelector *image_compress_selector_new_from_env(RedsState *reds,
+                                                            const RedStatNode *stat)
+{
+    const char *env = getenv(IMAGE_COMPRESS_SELECTOR_ENV);
+    unsigned long cpu_budget;
+    char *end;
+
+    if (!env) {
+        return nullptr;
+    }
+    if (!*env) {
+        return image_compress_selector_new(100, reds, stat);
+    }
+
+    errno = 0;
+    cpu_budget = strtoul(env, &end, 10);
+    if (errno != 0 || *end != '\0' || cpu_budget == 0 || cpu_budget > 100) {
+        spice_warning("error parsing %s: %s", IMAGE_COMPRESS_SELECTOR_ENV, env);
+        return nullptr;
+    }
+    return image_compress_selector_new(cpu_budget, reds, stat);
+}
+
+void image_compress_selector_free(ImageCompressSelector *selector)
+{
+    g_free(selector);
+}
+
+static GradualityClass *get_class(ImageCompressSelector *selector,
+                                  BitmapGradualType graduality)
+{
+    if (graduality >= NUM_GRADUALITY_CLASSES) {
+        graduality = BITMAP_GRADUAL_NOT_AVAIL;
+    }
+    return &selector->classes[graduality];
+}
+
+/* Pick a candidate to try, returns SPICE_IMAGE_COMPRESSION_INVALID if the
+ * estimates are good enough. The candidates are tried in turn and a codec
+ * whose results are not reported (failing) is not tried forever */
+static SpiceImageCompression choose_explore(GradualityClass *cls, uint32_t candidates)
+{
+    uint32_t compression;
+
+    for (uint32_t i = 0; i < IMAGE_COMPRESS_NUM_CODECS; i++) {
+        compression = (cls->explore_next + i) % IMAGE_COMPRESS_NUM_CODECS;
+        CodecEstimate *estimate = &cls->codecs[compression];
+        if ((candidates & IMAGE_COMPRESS_CANDIDATE(compression)) &&
+            estimate->samples < MIN_SAMPLES && estimate->tries < MIN_SAMPLES) {
+            estimate->tries++;
+            cls->explore_next = compression + 1;
+            return static_cast<SpiceImageCompression>(compression);
+        }
+    }
+
+    if (cls->choices % EXPLORE_INTERVAL != 0) {
+        return SPICE_IMAGE_COMPRESSION_INVALID;
+    }
+    for (uint32_t i = 0; i < IMAGE_COMPRESS_NUM_CODECS; i++) {
+        compression = (cls->explore_next + i) % IMAGE_COMPRESS_NUM_CODECS;
+        if (candidates & IMAGE_COMPRESS_CANDIDATE(compression)) {
+            cls->explore_next = compression + 1;
+            return static_cast<SpiceImageCompression>(compression);
+        }
+    }
+    return SPICE_IMAGE_COMPRESSION_INVALID;
+}
+
+SpiceImageCompression image_compress_selector_choose(ImageCompressSelector *selector,
+                                                     BitmapGradualType graduality,
+                                                     uint32_t candidates,
+                                                     uint64_t size, uint64_t bit_rate)
+{
+    GradualityClass *cls = get_class(selector, graduality);
+    SpiceImageCompression best = SPICE_IMAGE_COMPRESSION_INVALID;
+    double best_cost = 0;
+    bool over_budget = selector->cpu_usage > selector->cpu_budget;
+
+    if (candidates == 0) {
+        return SPICE_IMAGE_COMPRESSION_INVALID;
+    }
+
+    cls->choices++;
+    best = choose_explore(cls, candidates);
+    if (best != SPICE_IMAGE_COMPRESSION_INVALID) {
+        stat_inc_counter(selector->explore_counter, 1);
+        stat_inc_counter(selector->chosen_counters[best], 1);
+        return best;
+    }
+
+    for (uint32_t compression = 0; compression < IMAGE_COMPRESS_NUM_CODECS; compression++) {
+        const CodecEstimate *estimate = &cls->codecs[compression];
+        double cost;
+
+        if (!(candidates & IMAGE_COMPRESS_CANDIDATE(compression)) ||
+            estimate->samples == 0) {
+            continue;
+        }
+        cost = estimate->ns_per_byte * size;
+        if (!over_budget && bit_rate) {
+            cost += size / estimate->ratio * 8 * NSEC_PER_SEC / bit_rate;
+        }
+        if (best == SPICE_IMAGE_COMPRESSION_INVALID || cost < best_cost) {
+            best = static_cast<SpiceImageCompression>(compression);
+            best_cost = cost;
+        }
+    }
+
+    if (best == SPICE_IMAGE_COMPRESSION_INVALID) {
+        /* no candidate produced results yet */
+        best = static_cast<SpiceImageCompression>(g_bit_nth_lsf(candidates, -1));
+    }
+    if (over_budget) {
+        stat_inc_counter(selector->over_budget_counter, 1);
+    }
+    stat_inc_counter(selector->chosen_counters[best], 1);
+    return best;
+}
+
+static void update_cpu_usage(ImageCompressSelector *selector, uint64_t time_ns)
+{
+    uint64_t now = spice_get_monotonic_time_ns();
+    uint64_t elapsed = now - selector->period_start;
+
+    selector->period_cpu_ns += time_ns;
+    if (elapsed >= BUDGET_PERIOD_NS) {
+        selector->cpu_usage = selector->period_cpu_ns * 100 / elapsed;
+        selector->period_start = now;
+        selector->period_cpu_ns = 0;
+    }
+}
+
+void image_compress_selector_update(ImageCompressSelector *selector,
+                                    BitmapGradualType graduality,
+                                    SpiceImageCompression compression,
+                                    uint64_t size, uint64_t compressed_size,
+                                    uint64_t time_ns)
+{
+    spice_return_if_fail(compression < IMAGE_COMPRESS_NUM_CODECS);
+
+    update_cpu_usage(selector, time_ns);
+    if (size == 0 || compressed_size == 0) {
+        return;
+    }
+
+    CodecEstimate *estimate = &get_class(selector, graduality)->codecs[compression];
+    double ns_per_byte = (double) time_ns / size;
+    double ratio = (double) size / compressed_size;
+
+    if (estimate->samples == 0) {
+        estimate->ns_per_byte = ns_per_byte;
+        estimate->ratio = ratio;
+    } else {
+        estimate->ns_per_byte += (ns_per_byte - estimate->ns_per_byte) / AVERAGE_WEIGHT;
+        estimate->ratio += (ratio - estimate->ratio) / AVERAGE_WEIGHT;
+    }
+    if (estimate->samples < UINT32_MAX) {
+        estimate->samples++;
+    }
+}
@@ -0,0 +1,81 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file image-compress-selector.h
+ * Choose the image codec from measured costs.
+ *
+ * For each class of bitmaps (by graduality level) the selector keeps a
+ * moving average of the compression time per byte and of the compression
+ * ratio of every codec. The codec chosen is the one minimizing the time
+ * to compress the image plus the time to transmit the result with the
+ * bandwidth of the client. Codecs without enough samples are tried first
+ * and every codec is retried from time to time to follow content changes.
+ *
+ * A CPU budget limits the fraction of time spent compressing, when it's
+ * exceeded the fastest codec is used.
+ */
+
+#ifndef IMAGE_COMPRESS_SELECTOR_H_
+#define IMAGE_COMPRESS_SELECTOR_H_
+
+#include "red-common.h"
+#include "spice-bitmap-utils.h"
+#include "stat.h"
+
+#include "push-visibility.h"
+
+/* Enable the selector for the automatic compression modes, the value is
+ * the CPU budget as percentage of a core (1-100) */
+#define IMAGE_COMPRESS_SELECTOR_ENV "SPICE_COMPRESS_ADAPTIVE"
+
+struct ImageCompressSelector;
+
+ImageCompressSelector *image_compress_selector_new(unsigned int cpu_budget,
+                                                   RedsState *reds,
+                                                   const RedStatNode *stat);
+ImageCompressSelector *image_compress_selector_new_from_env(RedsState *reds,
+                                                            const RedStatNode *stat);
+void image_compress_selector_free(ImageCompressSelector *selector);
+
+/* JPEG is sent as a lossy QUIC image, as a candidate it's estimated apart
+ * from the lossless codecs */
+#define IMAGE_COMPRESS_JPEG static_cast<SpiceImageCompression>(SPICE_IMAGE_COMPRESSION_ENUM_END)
+#define IMAGE_COMPRESS_NUM_CODECS (SPICE_IMAGE_COMPRESSION_ENUM_END + 1)
+
+/* Bit mask of the codecs that can be used for an image */
+#define IMAGE_COMPRESS_CANDIDATE(compression) (1u << (compression))
+
+/* Choose between 'candidates' (a mask of IMAGE_COMPRESS_CANDIDATE) for
+ * an image of 'size' bytes sent at 'bit_rate' bits per second.
+ * Returns SPICE_IMAGE_COMPRESSION_INVALID if there's no candidate */
+SpiceImageCompression image_compress_selector_choose(ImageCompressSelector *selector,
+                                                     BitmapGradualType graduality,
+                                                     uint32_t candidates,
+                                                     uint64_t size, uint64_t bit_rate);
+
+/* Report the result of a compression */
+void image_compress_selector_update(ImageCompressSelector *selector,
+                                    BitmapGradualType graduality,
+                                    SpiceImageCompression compression,
+                                    uint64_t size, uint64_t compressed_size,
+                                    uint64_t time_ns);
+
+#include "pop-visibility.h"
+
+#endif /* IMAGE_COMPRESS_SELECTOR_H_ */
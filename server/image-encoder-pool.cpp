@@ -0,0 +1,369 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+
+#include <pthread.h>
+#include <common/ring.h>
+
+#include "red-common.h"
+#include "image-encoder-pool.h"
+
+// compatibility for FreeBSD
+#ifdef HAVE_PTHREAD_NP_H
+#include <pthread_np.h>
+#define pthread_setname_np pthread_set_name_np
+#endif
+
+enum ImageCompressJobState {
+    IMAGE_COMPRESS_JOB_QUEUED,
+    IMAGE_COMPRESS_JOB_RUNNING,
+    IMAGE_COMPRESS_JOB_DONE,
+    IMAGE_COMPRESS_JOB_TAKEN,
+    IMAGE_COMPRESS_JOB_CANCELLED,
+};
+
+struct ImageCompressJob {
+    RingItem link;
+    ImageEncoderPool *pool;
+    ImageCompressJobState state;
+
+    SpiceBitmap src;
+    SpiceChunks *owned_chunks;
+    SpiceImageCompression preferred_compression;
+    SpiceImageCompression compression;
+    BitmapGradualType graduality;
+    bool use_jpeg;
+    int jpeg_quality;
+
+    bool success;
+    uint64_t compress_time;
+    /* statistics of this job only, added to the ones of the display
+     * when the result is taken */
+    ImageEncoderSharedData stats;
+    SpiceImage dest;
+    compress_send_data_t comp_data;
+};
+
+struct ImageEncoderPoolThread {
+    ImageEncoderPool *pool;
+    pthread_t thread;
+    ImageEncoderSharedData shared_data;
+    ImageEncoders encoders;
+};
+
+struct ImageEncoderPool {
+    pthread_mutex_t lock;
+    /* signaled when a job is queued or the pool is going away */
+    pthread_cond_t job_cond;
+    /* signaled when a job is done */
+    pthread_cond_t done_cond;
+    Ring queue;
+    bool quit;
+
+    unsigned int n_threads;
+    ImageEncoderPoolThread *threads;
+};
+
+static void image_compress_job_run(ImageCompressJob *job, ImageEncoders *enc)
+{
+    ImageEncoderSharedData *thread_shared_data = enc->shared_data;
+    uint64_t start = spice_get_monotonic_time_ns();
+
+    job->success = false;
+    enc->jpeg_quality = job->jpeg_quality;
+    enc->shared_data = &job->stats;
+
+    switch (job->compression) {
+    case SPICE_IMAGE_COMPRESSION_QUIC:
+        if (job->use_jpeg) {
+            job->success = image_encoders_compress_jpeg(enc, &job->dest, &job->src,
+                                                        &job->comp_data);
+            break;
+        }
+        job->success = image_encoders_compress_quic(enc, &job->dest, &job->src,
+                                                    &job->comp_data);
+        break;
+#ifdef USE_LZ4
+    case SPICE_IMAGE_COMPRESSION_LZ4:
+        job->success = image_encoders_compress_lz4(enc, &job->dest, &job->src,
+                                                   &job->comp_data);
+        break;
+#endif
+    case SPICE_IMAGE_COMPRESSION_LZ:
+        job->success = image_encoders_compress_lz(enc, &job->dest, &job->src,
+                                                  &job->comp_data);
+        break;
+    default:
+        spice_warn_if_reached();
+    }
+    enc->shared_data = thread_shared_data;
+    job->compress_time = spice_get_monotonic_time_ns() - start;
+}
+
+static void *image_encoder_pool_thread_main(void *opaque)
+{
+    auto thread = static_cast<ImageEncoderPoolThread *>(opaque);
+    ImageEncoderPool *pool = thread->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        RingItem *item = nullptr;
+
+        while (!pool->quit && !(item = ring_get_tail(&pool->queue))) {
+            pthread_cond_wait(&pool->job_cond, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+
+        auto job = SPICE_CONTAINEROF(item, ImageCompressJob, link);
+        ring_remove(&job->link);
+        job->state = IMAGE_COMPRESS_JOB_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+
+        image_compress_job_run(job, &thread->encoders);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = IMAGE_COMPRESS_JOB_DONE;
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return nullptr;
+}
+
+ImageEncoderPool *image_encoder_pool_new(unsigned int n_threads)
+{
+#ifndef _WIN32
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+#endif
+    unsigned int i;
+
+    spice_return_val_if_fail(n_threads > 0, nullptr);
+    n_threads = MIN(n_threads, IMAGE_ENCODER_POOL_MAX_THREADS);
+
+    auto pool = g_new0(ImageEncoderPool, 1);
+    pthread_mutex_init(&pool->lock, nullptr);
+    pthread_cond_init(&pool->job_cond, nullptr);
+    pthread_cond_init(&pool->done_cond, nullptr);
+    ring_init(&pool->queue);
+    pool->threads = g_new0(ImageEncoderPoolThread, n_threads);
+
+#ifndef _WIN32
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+#endif
+    for (i = 0; i < n_threads; i++) {
+        ImageEncoderPoolThread *thread = &pool->threads[i];
+        int r;
+
+        thread->pool = pool;
+        image_encoder_shared_init(&thread->shared_data);
+        image_encoders_init(&thread->encoders, &thread->shared_data);
+        if ((r = pthread_create(&thread->thread, nullptr,
+                                image_encoder_pool_thread_main, thread))) {
+            spice_warning("create compression thread failed %d", r);
+            image_encoders_free(&thread->encoders);
+            break;
+        }
+#if !defined(__APPLE__)
+        pthread_setname_np(thread->thread, "SPICE Compress");
+#endif
+    }
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, nullptr);
+#endif
+    pool->n_threads = i;
+
+    if (pool->n_threads == 0) {
+        image_encoder_pool_free(pool);
+        return nullptr;
+    }
+    spice_debug("started %u compression threads", pool->n_threads);
+    return pool;
+}
+
+ImageEncoderPool *image_encoder_pool_new_from_env(void)
+{
+    const char *env = getenv(IMAGE_ENCODER_POOL_THREADS_ENV);
+    unsigned long n_threads;
+    char *end;
+
+    if (!env || !*env) {
+        return nullptr;
+    }
+
+    errno = 0;
+    n_threads = strtoul(env, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        spice_warning("error parsing %s: %s", IMAGE_ENCODER_POOL_THREADS_ENV, env);
+        return nullptr;
+    }
+    if (n_threads == 0) {
+        return nullptr;
+    }
+    return image_encoder_pool_new(MIN(n_threads, IMAGE_ENCODER_POOL_MAX_THREADS));
+}
+
+void image_encoder_pool_free(ImageEncoderPool *pool)
+{
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    /* jobs are owned by pipe items, which must be gone by now */
+    spice_warn_if_fail(ring_is_empty(&pool->queue));
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->job_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i].thread, nullptr);
+        image_encoders_free(&pool->threads[i].encoders);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->job_cond);
+    pthread_mutex_destroy(&pool->lock);
+    g_free(pool->threads);
+    g_free(pool);
+}
+
+ImageCompressJob *image_encoder_pool_submit(ImageEncoderPool *pool,
+                                            const SpiceBitmap *src,
+                                            SpiceChunks *owned_chunks,
+                                            SpiceImageCompression preferred_compression,
+                                            SpiceImageCompression compression,
+                                            BitmapGradualType graduality,
+                                            bool use_jpeg, int jpeg_quality)
+{
+    spice_return_val_if_fail(pool != nullptr, nullptr);
+    spice_return_val_if_fail(!(src->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE), nullptr);
+
+    auto job = g_new0(ImageCompressJob, 1);
+    job->pool = pool;
+    job->src = *src;
+    job->owned_chunks = owned_chunks;
+    job->preferred_compression = preferred_compression;
+    job->compression = compression;
+    job->graduality = graduality;
+    job->use_jpeg = use_jpeg;
+    job->jpeg_quality = jpeg_quality;
+    image_encoder_shared_init(&job->stats);
+    ring_item_init(&job->link);
+
+    pthread_mutex_lock(&pool->lock);
+    job->state = IMAGE_COMPRESS_JOB_QUEUED;
+    ring_add(&pool->queue, &job->link);
+    pthread_cond_signal(&pool->job_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return job;
+}
+
+bool image_compress_job_matches(const ImageCompressJob *job, const SpiceBitmap *src,
+                                SpiceImageCompression preferred_compression,
+                                bool can_jpeg)
+{
+    if (!job || src->data->num_chunks == 0) {
+        return false;
+    }
+    if (job->preferred_compression != preferred_compression ||
+        job->use_jpeg != (job->compression == SPICE_IMAGE_COMPRESSION_QUIC && can_jpeg)) {
+        return false;
+    }
+    return src->data->chunk[0].data == job->src.data->chunk[0].data &&
+           src->format == job->src.format && src->flags == job->src.flags &&
+           src->x == job->src.x && src->y == job->src.y && src->stride == job->src.stride;
+}
+
+SpiceImageCompression image_compress_job_get_compression(const ImageCompressJob *job,
+                                                         BitmapGradualType *graduality)
+{
+    *graduality = job->graduality;
+    return job->compression;
+}
+
+bool image_compress_job_take(ImageCompressJob *job, SpiceImage *dest,
+                             compress_send_data_t *o_comp_data,
+                             uint64_t *compress_time,
+                             ImageEncoderSharedData *shared_data)
+{
+    ImageEncoderPool *pool = job->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    if (job->state == IMAGE_COMPRESS_JOB_QUEUED) {
+        /* not started yet, compressing it in the caller is faster than waiting */
+        ring_remove(&job->link);
+        job->state = IMAGE_COMPRESS_JOB_CANCELLED;
+    }
+    while (job->state == IMAGE_COMPRESS_JOB_RUNNING) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (job->state != IMAGE_COMPRESS_JOB_DONE || !job->success) {
+        return false;
+    }
+
+    dest->descriptor.type = job->dest.descriptor.type;
+    dest->u = job->dest.u;
+    *o_comp_data = job->comp_data;
+    *compress_time = job->compress_time;
+    image_encoder_shared_stat_add(shared_data, &job->stats);
+    job->state = IMAGE_COMPRESS_JOB_TAKEN;
+    return true;
+}
+
+void image_compress_job_free(ImageCompressJob *job)
+{
+    if (!job) {
+        return;
+    }
+
+    ImageEncoderPool *pool = job->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    if (job->state == IMAGE_COMPRESS_JOB_QUEUED) {
+        ring_remove(&job->link);
+        job->state = IMAGE_COMPRESS_JOB_CANCELLED;
+    }
+    while (job->state == IMAGE_COMPRESS_JOB_RUNNING) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (job->state == IMAGE_COMPRESS_JOB_DONE && job->success) {
+        compress_buf_free_chain(job->comp_data.comp_buf);
+    }
+    if (job->owned_chunks) {
+        spice_chunks_destroy(job->owned_chunks);
+    }
+    g_free(job);
+}
@@ -0,0 +1,85 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file image-encoder-pool.h
+ * Pool of threads compressing images ahead of the sending code.
+ *
+ * Jobs are submitted by the worker thread when an item is added to a client
+ * pipe and are picked up by dcc_compress_image() when the item is marshalled.
+ * Only dictionary-free codecs (QUIC, JPEG, LZ and LZ4) can be used, GLZ
+ * must stay serialized with the rest of the channel client traffic.
+ */
+
+#ifndef IMAGE_ENCODER_POOL_H_
+#define IMAGE_ENCODER_POOL_H_
+
+#include "image-encoders.h"
+#include "spice-bitmap-utils.h"
+
+#include "push-visibility.h"
+
+/* Number of compression threads for each display channel, 0 or unset
+ * disables the pool */
+#define IMAGE_ENCODER_POOL_THREADS_ENV "SPICE_COMPRESS_THREADS"
+#define IMAGE_ENCODER_POOL_MAX_THREADS 32
+
+struct ImageEncoderPool;
+struct ImageCompressJob;
+
+ImageEncoderPool *image_encoder_pool_new(unsigned int n_threads);
+ImageEncoderPool *image_encoder_pool_new_from_env(void);
+void image_encoder_pool_free(ImageEncoderPool *pool);
+
+/* Queue compression of 'src'. The bitmap data must stay valid until
+ * image_compress_job_free() is called. If 'owned_chunks' is not NULL
+ * it's released together with the job. 'graduality' is the one the
+ * compression was chosen for, kept for the caller. */
+ImageCompressJob *image_encoder_pool_submit(ImageEncoderPool *pool,
+                                            const SpiceBitmap *src,
+                                            SpiceChunks *owned_chunks,
+                                            SpiceImageCompression preferred_compression,
+                                            SpiceImageCompression compression,
+                                            BitmapGradualType graduality,
+                                            bool use_jpeg, int jpeg_quality);
+
+bool image_compress_job_matches(const ImageCompressJob *job, const SpiceBitmap *src,
+                                SpiceImageCompression preferred_compression,
+                                bool can_jpeg);
+
+/* The compression and graduality the job was submitted with */
+SpiceImageCompression image_compress_job_get_compression(const ImageCompressJob *job,
+                                                         BitmapGradualType *graduality);
+
+/* Wait for the job to complete and move its result to 'dest' and
+ * 'o_comp_data'. Returns false if the job did not produce any data, in
+ * which case the caller should compress the image itself. A job that
+ * was not started yet is cancelled instead of waited for.
+ * On success the time spent compressing is set in 'compress_time' (in ns)
+ * and the statistics of the job are added to 'shared_data'. */
+bool image_compress_job_take(ImageCompressJob *job, SpiceImage *dest,
+                             compress_send_data_t *o_comp_data,
+                             uint64_t *compress_time,
+                             ImageEncoderSharedData *shared_data);
+
+/* Cancel or wait for the job and release any data not taken */
+void image_compress_job_free(ImageCompressJob *job);
+
+#include "pop-visibility.h"
+
+#endif /* IMAGE_ENCODER_POOL_H_ */
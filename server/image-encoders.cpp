@@ -1350,8 +1350,33 @@ static void stat_sum(stat_info_t *total, const stat_info_t *stat)
     total->comp_size += stat->comp_size;
     total->total += stat->total;
 }
+
+static void stat_merge(stat_info_t *dest, const stat_info_t *stat)
+{
+    if (!stat->count) {
+        return;
+    }
+    stat_sum(dest, stat);
+    dest->max = MAX(dest->max, stat->max);
+    dest->min = MIN(dest->min, stat->min);
+}
 #endif
 
+void image_encoder_shared_stat_add(ImageEncoderSharedData *shared_data,
+                                   const ImageEncoderSharedData *stats)
+{
+#ifdef COMPRESS_STAT
+    stat_merge(&shared_data->off_stat, &stats->off_stat);
+    stat_merge(&shared_data->quic_stat, &stats->quic_stat);
+    stat_merge(&shared_data->lz_stat, &stats->lz_stat);
+    stat_merge(&shared_data->glz_stat, &stats->glz_stat);
+    stat_merge(&shared_data->jpeg_stat, &stats->jpeg_stat);
+    stat_merge(&shared_data->zlib_glz_stat, &stats->zlib_glz_stat);
+    stat_merge(&shared_data->jpeg_alpha_stat, &stats->jpeg_alpha_stat);
+    stat_merge(&shared_data->lz4_stat, &stats->lz4_stat);
+#endif
+}
+
 void image_encoder_shared_stat_print(const ImageEncoderSharedData *shared_data)
 {
 #ifdef COMPRESS_STAT
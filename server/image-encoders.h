@@ -43,10 +43,14 @@ typedef struct ImageEncoders ImageEncoders;
 typedef struct ImageEncoderSharedData ImageEncoderSharedData;
 typedef struct GlzSharedDictionary GlzSharedDictionary;
 typedef struct GlzImageRetention GlzImageRetention;
+typedef struct ImageCompressCacheEntry ImageCompressCacheEntry;
 
 void image_encoder_shared_init(ImageEncoderSharedData *shared_data);
 void image_encoder_shared_stat_reset(ImageEncoderSharedData *shared_data);
 void image_encoder_shared_stat_print(const ImageEncoderSharedData *shared_data);
+/* Add the statistics of 'stats', collected by another thread */
+void image_encoder_shared_stat_add(ImageEncoderSharedData *shared_data,
+                                   const ImageEncoderSharedData *stats);
 
 void image_encoders_init(ImageEncoders *enc, ImageEncoderSharedData *shared_data);
 void image_encoders_free(ImageEncoders *enc);
@@ -80,6 +84,15 @@ static inline void compress_buf_free(RedCompressBuf *buf)
     g_free(buf);
 }
 
+static inline void compress_buf_free_chain(RedCompressBuf *buf)
+{
+    while (buf) {
+        RedCompressBuf *next = buf->send_next;
+        compress_buf_free(buf);
+        buf = next;
+    }
+}
+
 gboolean image_encoders_get_glz_dictionary(ImageEncoders *enc,
                                            struct RedClient *client,
                                            uint8_t id, int window_size);
@@ -199,6 +212,9 @@ typedef struct compress_send_data_t {
     uint32_t comp_buf_size;
     SpicePalette *lzplt_palette;
     gboolean is_lossy;
+    /* if not NULL comp_buf is shared with other clients and owned by
+     * this entry, the caller holds a reference to it */
+    ImageCompressCacheEntry *cache_entry;
 } compress_send_data_t;
 
 bool image_encoders_compress_quic(ImageEncoders *enc, SpiceImage *dest,
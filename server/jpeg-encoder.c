@@ -26,6 +26,7 @@
 
 #include "red-common.h"
 #include "jpeg-encoder.h"
+#include "pixel-convert.h"
 
 struct JpegEncoderContext {
     JpegEncoderUsrContext *usr;
@@ -40,7 +41,8 @@ struct JpegEncoderContext {
         int height;
         int stride;
         unsigned int out_size;
-        void (*convert_line_to_RGB24) (void *line, int width, uint8_t **out_line);
+        /* NULL if libjpeg reads the lines directly */
+        PixelConvertLineFunc convert_line_to_RGB24;
     } cur_image;
 };
 
@@ -111,62 +113,6 @@ void jpeg_encoder_destroy(JpegEncoderContext* encoder)
     g_free(encoder);
 }
 
-static void convert_RGB16_to_RGB24(void *line, int width, uint8_t **out_line)
-{
-    uint16_t *src_line = (uint16_t *) line;
-    uint8_t *out_pix;
-    int x;
-
-    spice_assert(out_line && *out_line);
-
-    out_pix = *out_line;
-
-    for (x = 0; x < width; x++) {
-       uint16_t pixel = *src_line++;
-       pixel = GUINT16_FROM_LE(pixel);
-       *out_pix++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
-       *out_pix++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
-       *out_pix++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
-   }
-}
-
-static void convert_BGR24_to_RGB24(void *in_line, int width, uint8_t **out_line)
-{
-    int x;
-    uint8_t *out_pix;
-    uint8_t *line = (uint8_t *) in_line;
-    spice_assert(out_line && *out_line);
-
-    out_pix = *out_line;
-
-    for (x = 0; x < width; x++) {
-        *out_pix++ = line[2];
-        *out_pix++ = line[1];
-        *out_pix++ = line[0];
-        line += 3;
-    }
-}
-
-static void convert_BGRX32_to_RGB24(void *line, int width, uint8_t **out_line)
-{
-    uint32_t *src_line = (uint32_t *) line;
-    uint8_t *out_pix;
-    int x;
-
-    spice_assert(out_line && *out_line);
-
-    out_pix = *out_line;
-
-    for (x = 0; x < width; x++) {
-        uint32_t pixel = *src_line++;
-        pixel = GUINT32_FROM_LE(pixel);
-        *out_pix++ = (pixel >> 16) & 0xff;
-        *out_pix++ = (pixel >> 8) & 0xff;
-        *out_pix++ = pixel & 0xff;
-    }
-}
-
-
 #define FILL_LINES() {                                                  \
     if (lines == lines_end) {                                           \
         int n = jpeg->usr->more_lines(jpeg->usr, &lines);               \
@@ -180,20 +126,26 @@ static void convert_BGRX32_to_RGB24(void *line, int width, uint8_t **out_line)
 static void do_jpeg_encode(JpegEncoder *jpeg, uint8_t *lines, unsigned int num_lines)
 {
     uint8_t *lines_end;
-    uint8_t *RGB24_line;
+    uint8_t *RGB24_line = NULL;
     int stride, width;
     JSAMPROW row_pointer[1];
     width = jpeg->cur_image.width;
     stride = jpeg->cur_image.stride;
 
-    RGB24_line = g_new(uint8_t, width*3);
+    if (jpeg->cur_image.convert_line_to_RGB24) {
+        RGB24_line = g_new(uint8_t, width*3);
+    }
 
     lines_end = lines + (stride * num_lines);
 
     for (;jpeg->cinfo.next_scanline < jpeg->cinfo.image_height; lines += stride) {
         FILL_LINES();
-        jpeg->cur_image.convert_line_to_RGB24(lines, width, &RGB24_line);
-        row_pointer[0] = RGB24_line;
+        if (RGB24_line) {
+            jpeg->cur_image.convert_line_to_RGB24(lines, RGB24_line, width);
+            row_pointer[0] = RGB24_line;
+        } else {
+            row_pointer[0] = lines;
+        }
         jpeg_write_scanlines(&jpeg->cinfo, row_pointer, 1);
     }
 
@@ -210,15 +162,28 @@ int jpeg_encode(JpegEncoderContext *enc, int quality, JpegEncoderImageType type,
     enc->cur_image.stride = stride;
     enc->cur_image.out_size = 0;
 
+    enc->cinfo.input_components = 3;
+    enc->cinfo.in_color_space = JCS_RGB;
+    enc->cur_image.convert_line_to_RGB24 = NULL;
+
     switch (type) {
     case JPEG_IMAGE_TYPE_RGB16:
-        enc->cur_image.convert_line_to_RGB24 = convert_RGB16_to_RGB24;
+        enc->cur_image.convert_line_to_RGB24 = pixel_convert_rgb16_to_rgb24;
         break;
     case JPEG_IMAGE_TYPE_BGR24:
-        enc->cur_image.convert_line_to_RGB24 = convert_BGR24_to_RGB24;
+#ifdef JCS_EXTENSIONS
+        enc->cinfo.in_color_space = JCS_EXT_LE_BGR;
+#else
+        enc->cur_image.convert_line_to_RGB24 = pixel_convert_bgr24_to_rgb24;
+#endif
         break;
     case JPEG_IMAGE_TYPE_BGRX32:
-        enc->cur_image.convert_line_to_RGB24 = convert_BGRX32_to_RGB24;
+#ifdef JCS_EXTENSIONS
+        enc->cinfo.in_color_space = JCS_EXT_LE_BGRX;
+        enc->cinfo.input_components = 4;
+#else
+        enc->cur_image.convert_line_to_RGB24 = pixel_convert_bgrx32_to_rgb24;
+#endif
         break;
     default:
         spice_error("bad image type");
@@ -226,8 +191,6 @@ int jpeg_encode(JpegEncoderContext *enc, int quality, JpegEncoderImageType type,
 
     enc->cinfo.image_width = width;
     enc->cinfo.image_height = height;
-    enc->cinfo.input_components = 3;
-    enc->cinfo.in_color_space = JCS_RGB;
     jpeg_set_defaults(&enc->cinfo);
     jpeg_set_quality(&enc->cinfo, quality, TRUE);
 
@@ -23,14 +23,24 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
+#include <signal.h>
+#include <pthread.h>
 #include <jerror.h>
 #include <jpeglib.h>
 
 #include "red-common.h"
 #include "video-encoder.h"
+#include "pixel-convert.h"
 #include "utils.h"
 
+// compatibility for FreeBSD
+#ifdef HAVE_PTHREAD_NP_H
+#include <pthread_np.h>
+#define pthread_setname_np pthread_set_name_np
+#endif
+
 #define MJPEG_MAX_FPS 25
 #define MJPEG_MIN_FPS 1
 
@@ -75,15 +85,21 @@ static const int mjpeg_quality_samples[MJPEG_QUALITY_SAMPLE_NUM] = {20, 30, 40,
 /* The compressed buffer initial size. */
 #define MJPEG_INITIAL_BUFFER_SIZE (32 * 1024)
 
-#ifdef JCS_EXTENSIONS
-#  ifndef WORDS_BIGENDIAN
-#    define JCS_EXT_LE_BGRX JCS_EXT_BGRX
-#    define JCS_EXT_LE_BGR JCS_EXT_BGR
-#  else
-#    define JCS_EXT_LE_BGRX JCS_EXT_XRGB
-#    define JCS_EXT_LE_BGR JCS_EXT_RGB
-#  endif
-#endif
+/*
+ * Large frames can be split in horizontal slices encoded concurrently,
+ * see mjpeg_encoder_setup_slices(). Smaller frames, or slices of fewer
+ * MCU rows, don't gain enough to pay for the synchronization.
+ */
+#define MJPEG_SLICE_MAX_THREADS 15
+#define MJPEG_SLICE_MIN_PIXELS (1280 * 720)
+#define MJPEG_SLICE_MIN_MCU_ROWS 4
+
+#define MJPEG_MARKER_SOF0 0xc0
+#define MJPEG_MARKER_SOF2 0xc2
+#define MJPEG_MARKER_RST0 0xd0
+#define MJPEG_MARKER_SOI 0xd8
+#define MJPEG_MARKER_EOI 0xd9
+#define MJPEG_MARKER_SOS 0xda
 
 enum {
     MJPEG_QUALITY_EVAL_TYPE_SET,
@@ -174,6 +190,22 @@ typedef struct MJpegVideoBuffer {
     size_t maxsize;
 } MJpegVideoBuffer;
 
+typedef struct MJpegSlice {
+    struct MJpegEncoder *encoder;
+    pthread_t thread;
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    uint8_t *row;
+    uint32_t row_size;
+
+    /* the slice encoded as a whole JPEG image */
+    uint8_t *data;
+    size_t data_size;
+    size_t size;
+    bool success;
+} MJpegSlice;
+
 typedef struct MJpegEncoder {
     VideoEncoder base;
     uint8_t *row;
@@ -184,7 +216,29 @@ typedef struct MJpegEncoder {
     struct jpeg_error_mgr jerr;
 
     unsigned int bytes_per_pixel; /* bytes per pixel of the input buffer */
-    void (*pixel_converter)(void *src, uint8_t *dest);
+    /* NULL if libjpeg reads the lines directly */
+    PixelConvertLineFunc line_converter;
+
+    /* Slice encoding. Slice 0 is encoded by the caller in cinfo, slice n by
+     * slice_threads[n - 1]. The threads are started by the first frame big
+     * enough to be split. */
+    unsigned int slice_max_threads;
+    unsigned int num_slice_threads;
+    MJpegSlice *slice_threads;
+    pthread_mutex_t slice_lock;
+    pthread_cond_t slice_start_cond;
+    pthread_cond_t slice_done_cond;
+    uint32_t slice_generation;
+    unsigned int slices_pending;
+    bool slice_quit;
+
+    /* the frame being encoded, num_slices is 1 if it's not split */
+    unsigned int num_slices;
+    unsigned int slice_height;
+    unsigned int frame_height;
+    int frame_quality;
+    uint8_t **frame_lines;
+    uint32_t frame_lines_size;
 
     MJpegEncoderRateControl rate_control;
     VideoEncoderRateControlCbs cbs;
@@ -196,6 +250,7 @@ typedef struct MJpegEncoder {
 } MJpegEncoder;
 
 static void mjpeg_encoder_process_server_drops(MJpegEncoder *encoder);
+static void mjpeg_encoder_stop_slice_threads(MJpegEncoder *encoder);
 static uint32_t get_min_required_playback_delay(const MJpegEncoder *encoder,
                                                 uint64_t frame_enc_size);
 
@@ -222,6 +277,11 @@ static MJpegVideoBuffer* create_mjpeg_video_buffer(void)
 static void mjpeg_encoder_destroy(VideoEncoder *video_encoder)
 {
     MJpegEncoder *encoder = SPICE_CONTAINEROF(video_encoder, MJpegEncoder, base);
+    mjpeg_encoder_stop_slice_threads(encoder);
+    pthread_mutex_destroy(&encoder->slice_lock);
+    pthread_cond_destroy(&encoder->slice_start_cond);
+    pthread_cond_destroy(&encoder->slice_done_cond);
+    g_free(encoder->frame_lines);
     g_free(encoder->cinfo.dest);
     jpeg_destroy_compress(&encoder->cinfo);
     g_free(encoder->row);
@@ -233,37 +293,6 @@ static uint8_t mjpeg_encoder_get_bytes_per_pixel(MJpegEncoder *encoder)
     return encoder->bytes_per_pixel;
 }
 
-#ifndef JCS_EXTENSIONS
-/* Pixel conversion routines */
-static void pixel_rgb24bpp_to_24(void *src_ptr, uint8_t *dest)
-{
-    uint8_t *src = src_ptr;
-    /* libjpegs stores rgb, spice/win32 stores bgr */
-    *dest++ = src[2]; /* red */
-    *dest++ = src[1]; /* green */
-    *dest++ = src[0]; /* blue */
-}
-
-static void pixel_rgb32bpp_to_24(void *src, uint8_t *dest)
-{
-    uint32_t pixel = *(uint32_t *)src;
-    pixel = GUINT32_FROM_LE(pixel);
-    *dest++ = (pixel >> 16) & 0xff;
-    *dest++ = (pixel >>  8) & 0xff;
-    *dest++ = (pixel >>  0) & 0xff;
-}
-#endif
-
-static void pixel_rgb16bpp_to_24(void *src, uint8_t *dest)
-{
-    uint16_t pixel = *(uint16_t *)src;
-    pixel = GUINT16_FROM_LE(pixel);
-    *dest++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
-    *dest++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
-    *dest++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
-}
-
-
 /* code from libjpeg 8 to handle compression to a memory buffer
  *
  * Copyright (C) 1994-1996, Thomas G. Lane.
@@ -351,6 +380,295 @@ spice_jpeg_mem_dest(j_compress_ptr cinfo,
 }
 /* end of code from libjpeg */
 
+/* Encode the lines of slice 'index' of the current frame as a separate
+ * image, with the same parameters as the first slice */
+static bool mjpeg_slice_encode(MJpegSlice *slice, unsigned int index)
+{
+    MJpegEncoder *encoder = slice->encoder;
+    struct jpeg_compress_struct *cinfo = &slice->cinfo;
+    mem_destination_mgr *dest;
+    unsigned int first_line = index * encoder->slice_height;
+    unsigned int num_lines = MIN(encoder->slice_height, encoder->frame_height - first_line);
+    unsigned int i;
+
+    if (encoder->line_converter != NULL && slice->row_size < encoder->row_size) {
+        slice->row = (uint8_t*) g_realloc(slice->row, encoder->row_size);
+        slice->row_size = encoder->row_size;
+    }
+
+    spice_jpeg_mem_dest(cinfo, &slice->data, &slice->data_size);
+    cinfo->in_color_space = encoder->cinfo.in_color_space;
+    cinfo->input_components = encoder->cinfo.input_components;
+    cinfo->image_width = encoder->cinfo.image_width;
+    cinfo->image_height = num_lines;
+    jpeg_set_defaults(cinfo);
+    cinfo->dct_method = JDCT_IFAST;
+    jpeg_set_quality(cinfo, encoder->frame_quality, TRUE);
+    cinfo->restart_in_rows = encoder->cinfo.restart_in_rows;
+    jpeg_start_compress(cinfo, TRUE);
+
+    for (i = 0; i < num_lines; i++) {
+        uint8_t *line = encoder->frame_lines[first_line + i];
+
+        if (encoder->line_converter) {
+            encoder->line_converter(line, slice->row, cinfo->image_width);
+            line = slice->row;
+        }
+        if (jpeg_write_scanlines(cinfo, &line, 1) == 0) {
+            jpeg_abort_compress(cinfo);
+            return FALSE;
+        }
+    }
+    jpeg_finish_compress(cinfo);
+
+    dest = (mem_destination_mgr *) cinfo->dest;
+    slice->size = dest->pub.next_output_byte - dest->buffer;
+    return TRUE;
+}
+
+static void *mjpeg_slice_thread_main(void *opaque)
+{
+    MJpegSlice *slice = opaque;
+    MJpegEncoder *encoder = slice->encoder;
+    unsigned int index = slice - encoder->slice_threads + 1;
+    uint32_t generation = 0;
+
+    pthread_mutex_lock(&encoder->slice_lock);
+    for (;;) {
+        while (!encoder->slice_quit && encoder->slice_generation == generation) {
+            pthread_cond_wait(&encoder->slice_start_cond, &encoder->slice_lock);
+        }
+        if (encoder->slice_quit) {
+            break;
+        }
+        generation = encoder->slice_generation;
+        if (index >= encoder->num_slices) {
+            continue;
+        }
+        pthread_mutex_unlock(&encoder->slice_lock);
+
+        slice->success = mjpeg_slice_encode(slice, index);
+
+        pthread_mutex_lock(&encoder->slice_lock);
+        if (--encoder->slices_pending == 0) {
+            pthread_cond_signal(&encoder->slice_done_cond);
+        }
+    }
+    pthread_mutex_unlock(&encoder->slice_lock);
+
+    return NULL;
+}
+
+static bool mjpeg_encoder_start_slice_threads(MJpegEncoder *encoder)
+{
+#ifndef _WIN32
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+#endif
+    unsigned int i;
+
+    encoder->slice_threads = g_new0(MJpegSlice, encoder->slice_max_threads);
+
+#ifndef _WIN32
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+#endif
+    for (i = 0; i < encoder->slice_max_threads; i++) {
+        MJpegSlice *slice = &encoder->slice_threads[i];
+        int r;
+
+        slice->encoder = encoder;
+        slice->cinfo.err = jpeg_std_error(&slice->jerr);
+        jpeg_create_compress(&slice->cinfo);
+        slice->data_size = MJPEG_INITIAL_BUFFER_SIZE;
+        slice->data = g_malloc(slice->data_size);
+        if ((r = pthread_create(&slice->thread, NULL, mjpeg_slice_thread_main, slice))) {
+            spice_warning("create MJPEG slice thread failed %d", r);
+            jpeg_destroy_compress(&slice->cinfo);
+            g_free(slice->data);
+            break;
+        }
+#if !defined(__APPLE__)
+        pthread_setname_np(slice->thread, "SPICE MJPEG");
+#endif
+    }
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, NULL);
+#endif
+    encoder->num_slice_threads = i;
+
+    if (encoder->num_slice_threads == 0) {
+        g_clear_pointer(&encoder->slice_threads, g_free);
+        /* don't try again for each frame */
+        encoder->slice_max_threads = 0;
+        return FALSE;
+    }
+    spice_debug("started %u MJPEG slice threads", encoder->num_slice_threads);
+    return TRUE;
+}
+
+static void mjpeg_encoder_stop_slice_threads(MJpegEncoder *encoder)
+{
+    unsigned int i;
+
+    if (encoder->num_slice_threads == 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&encoder->slice_lock);
+    encoder->slice_quit = TRUE;
+    pthread_cond_broadcast(&encoder->slice_start_cond);
+    pthread_mutex_unlock(&encoder->slice_lock);
+
+    for (i = 0; i < encoder->num_slice_threads; i++) {
+        MJpegSlice *slice = &encoder->slice_threads[i];
+
+        pthread_join(slice->thread, NULL);
+        g_free(slice->cinfo.dest);
+        jpeg_destroy_compress(&slice->cinfo);
+        g_free(slice->row);
+        g_free(slice->data);
+    }
+    g_free(encoder->slice_threads);
+    encoder->slice_threads = NULL;
+    encoder->num_slice_threads = 0;
+}
+
+/*
+ * Decide whether the frame described by cinfo is split in slices.
+ *
+ * Each slice is a whole number of MCU rows, encoded as a separate image
+ * with a restart interval as long as the slice. The slices are then joined
+ * into one JPEG image, separated by restart markers, which is exactly what
+ * libjpeg would produce for the whole frame with the same restart interval,
+ * so any decoder can read it.
+ */
+static void mjpeg_encoder_setup_slices(MJpegEncoder *encoder)
+{
+    struct jpeg_compress_struct *cinfo = &encoder->cinfo;
+    unsigned int mcu_width, mcu_height, mcu_rows, mcus_per_row, rows_per_slice;
+    int max_h_samp = 1, max_v_samp = 1;
+    int i;
+
+    encoder->num_slices = 1;
+    encoder->frame_height = cinfo->image_height;
+    if (encoder->slice_max_threads == 0 ||
+        (uint64_t) cinfo->image_width * cinfo->image_height < MJPEG_SLICE_MIN_PIXELS ||
+        cinfo->image_height > JPEG_MAX_DIMENSION) {
+        return;
+    }
+
+    for (i = 0; i < cinfo->num_components; i++) {
+        max_h_samp = MAX(max_h_samp, cinfo->comp_info[i].h_samp_factor);
+        max_v_samp = MAX(max_v_samp, cinfo->comp_info[i].v_samp_factor);
+    }
+    mcu_width = max_h_samp * DCTSIZE;
+    mcu_height = max_v_samp * DCTSIZE;
+    mcu_rows = (cinfo->image_height + mcu_height - 1) / mcu_height;
+    mcus_per_row = (cinfo->image_width + mcu_width - 1) / mcu_width;
+
+    if (encoder->num_slice_threads == 0 && !mjpeg_encoder_start_slice_threads(encoder)) {
+        return;
+    }
+    rows_per_slice = (mcu_rows + encoder->num_slice_threads) / (encoder->num_slice_threads + 1);
+    rows_per_slice = MAX(rows_per_slice, MJPEG_SLICE_MIN_MCU_ROWS);
+    /* the restart interval is stored in 16 bits */
+    if ((uint64_t) rows_per_slice * mcus_per_row > 65535 || rows_per_slice >= mcu_rows) {
+        return;
+    }
+
+    encoder->num_slices = (mcu_rows + rows_per_slice - 1) / rows_per_slice;
+    encoder->slice_height = rows_per_slice * mcu_height;
+    if (encoder->frame_lines_size < encoder->frame_height) {
+        encoder->frame_lines = g_renew(uint8_t *, encoder->frame_lines, encoder->frame_height);
+        encoder->frame_lines_size = encoder->frame_height;
+    }
+    cinfo->image_height = encoder->slice_height;
+    cinfo->restart_in_rows = rows_per_slice;
+}
+
+/* Return the offset of the entropy coded data of a JPEG image written by
+ * libjpeg, and optionally of its frame header, or 0 if not found */
+static size_t jpeg_get_scan_data_offset(const uint8_t *data, size_t size, size_t *sof_offset)
+{
+    size_t pos = 2;
+
+    if (size < 2 || data[0] != 0xff || data[1] != MJPEG_MARKER_SOI) {
+        return 0;
+    }
+    while (pos + 4 <= size && data[pos] == 0xff) {
+        uint8_t marker = data[pos + 1];
+
+        if (marker >= MJPEG_MARKER_SOF0 && marker <= MJPEG_MARKER_SOF2 && sof_offset) {
+            *sof_offset = pos;
+        }
+        pos += 2 + (data[pos + 2] << 8 | data[pos + 3]);
+        if (marker == MJPEG_MARKER_SOS) {
+            return pos <= size ? pos : 0;
+        }
+    }
+    return 0;
+}
+
+/* Append the slices encoded by the threads to the first one */
+static bool mjpeg_encoder_join_slices(MJpegEncoder *encoder)
+{
+    mem_destination_mgr *dest = (mem_destination_mgr *) encoder->cinfo.dest;
+    size_t size = dest->pub.next_output_byte - dest->buffer;
+    size_t sof_offset = 0;
+    size_t data_offset[MJPEG_SLICE_MAX_THREADS];
+    size_t new_size;
+    uint8_t *out;
+    unsigned int i;
+
+    if (jpeg_get_scan_data_offset(dest->buffer, size, &sof_offset) == 0 || sof_offset == 0) {
+        spice_warning("bad MJPEG slice header");
+        return FALSE;
+    }
+    /* the image ends with EOI, which is replaced by the next slice */
+    new_size = size;
+    for (i = 1; i < encoder->num_slices; i++) {
+        MJpegSlice *slice = &encoder->slice_threads[i - 1];
+
+        data_offset[i - 1] = jpeg_get_scan_data_offset(slice->data, slice->size, NULL);
+        if (data_offset[i - 1] == 0 || slice->size < data_offset[i - 1] + 2) {
+            spice_warning("bad MJPEG slice header");
+            return FALSE;
+        }
+        new_size += slice->size - data_offset[i - 1];
+    }
+
+    if (new_size > dest->bufsize) {
+        dest->bufsize = MAX(new_size, dest->bufsize * 2);
+        dest->buffer = (uint8_t *) g_realloc(dest->buffer, dest->bufsize);
+    }
+
+    /* fix the height of the frame, the first slice was encoded with its own */
+    dest->buffer[sof_offset + 5] = encoder->frame_height >> 8;
+    dest->buffer[sof_offset + 6] = encoder->frame_height & 0xff;
+
+    out = dest->buffer + size - 2;
+    for (i = 1; i < encoder->num_slices; i++) {
+        MJpegSlice *slice = &encoder->slice_threads[i - 1];
+        size_t data_size = slice->size - data_offset[i - 1] - 2;
+
+        *out++ = 0xff;
+        *out++ = MJPEG_MARKER_RST0 + (i - 1) % 8;
+        memcpy(out, slice->data + data_offset[i - 1], data_size);
+        out += data_size;
+    }
+    *out++ = 0xff;
+    *out++ = MJPEG_MARKER_EOI;
+
+    dest->pub.next_output_byte = out;
+    dest->pub.free_in_buffer = dest->bufsize - new_size;
+    term_mem_destination(&encoder->cinfo);
+    return TRUE;
+}
+
 static inline uint32_t mjpeg_encoder_get_source_fps(const MJpegEncoder *encoder)
 {
     return encoder->cbs.get_source_fps ?
@@ -764,7 +1082,7 @@ mjpeg_encoder_start_frame(MJpegEncoder *encoder,
 
     encoder->cinfo.in_color_space   = JCS_RGB;
     encoder->cinfo.input_components = 3;
-    encoder->pixel_converter = NULL;
+    encoder->line_converter = NULL;
 
     switch (format) {
     case SPICE_BITMAP_FMT_32BIT:
@@ -774,19 +1092,19 @@ mjpeg_encoder_start_frame(MJpegEncoder *encoder,
         encoder->cinfo.in_color_space   = JCS_EXT_LE_BGRX;
         encoder->cinfo.input_components = 4;
 #else
-        encoder->pixel_converter = pixel_rgb32bpp_to_24;
+        encoder->line_converter = pixel_convert_bgrx32_to_rgb24;
 #endif
         break;
     case SPICE_BITMAP_FMT_16BIT:
         encoder->bytes_per_pixel = 2;
-        encoder->pixel_converter = pixel_rgb16bpp_to_24;
+        encoder->line_converter = pixel_convert_rgb16_to_rgb24;
         break;
     case SPICE_BITMAP_FMT_24BIT:
         encoder->bytes_per_pixel = 3;
 #ifdef JCS_EXTENSIONS
         encoder->cinfo.in_color_space = JCS_EXT_LE_BGR;
 #else
-        encoder->pixel_converter = pixel_rgb24bpp_to_24;
+        encoder->line_converter = pixel_convert_bgr24_to_rgb24;
 #endif
         break;
     default:
@@ -796,7 +1114,7 @@ mjpeg_encoder_start_frame(MJpegEncoder *encoder,
 
     encoder->cinfo.image_width = src->right - src->left;
     encoder->cinfo.image_height = src->bottom - src->top;
-    if (encoder->pixel_converter != NULL) {
+    if (encoder->line_converter != NULL) {
         JDIMENSION stride = encoder->cinfo.image_width * 3;
         /* check for integer overflow */
         if (stride < encoder->cinfo.image_width) {
@@ -814,6 +1132,8 @@ mjpeg_encoder_start_frame(MJpegEncoder *encoder,
     encoder->cinfo.dct_method       = JDCT_IFAST;
     quality = mjpeg_quality_samples[encoder->rate_control.quality_id];
     jpeg_set_quality(&encoder->cinfo, quality, TRUE);
+    encoder->frame_quality = quality;
+    mjpeg_encoder_setup_slices(encoder);
     jpeg_start_compress(&encoder->cinfo, encoder->first_frame);
 
     encoder->num_frames++;
@@ -826,17 +1146,9 @@ static int mjpeg_encoder_encode_scanline(MJpegEncoder *encoder,
                                          size_t image_width)
 {
     unsigned int scanlines_written;
-    uint8_t *row;
 
-    row = encoder->row;
-    if (encoder->pixel_converter) {
-        unsigned int x;
-        for (x = 0; x < image_width; x++) {
-            /* src_pixels is expected to be 4 bytes aligned */
-            encoder->pixel_converter(src_pixels, row);
-            row += 3;
-            src_pixels += encoder->bytes_per_pixel;
-        }
+    if (encoder->line_converter) {
+        encoder->line_converter(src_pixels, encoder->row, image_width);
         scanlines_written = jpeg_write_scanlines(&encoder->cinfo, &encoder->row, 1);
     } else {
         scanlines_written = jpeg_write_scanlines(&encoder->cinfo, &src_pixels, 1);
@@ -850,12 +1162,50 @@ static int mjpeg_encoder_encode_scanline(MJpegEncoder *encoder,
     return scanlines_written;
 }
 
+/* Encode the first slice while the threads encode the other ones */
+static bool mjpeg_encoder_encode_slices(MJpegEncoder *encoder, size_t image_width)
+{
+    unsigned int i;
+    bool success = TRUE;
+
+    pthread_mutex_lock(&encoder->slice_lock);
+    encoder->slice_generation++;
+    encoder->slices_pending = encoder->num_slices - 1;
+    pthread_cond_broadcast(&encoder->slice_start_cond);
+    pthread_mutex_unlock(&encoder->slice_lock);
+
+    for (i = 0; i < encoder->slice_height; i++) {
+        if (mjpeg_encoder_encode_scanline(encoder, encoder->frame_lines[i], image_width) == 0) {
+            success = FALSE;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&encoder->slice_lock);
+    while (encoder->slices_pending > 0) {
+        pthread_cond_wait(&encoder->slice_done_cond, &encoder->slice_lock);
+    }
+    pthread_mutex_unlock(&encoder->slice_lock);
+
+    for (i = 1; i < encoder->num_slices && success; i++) {
+        if (!encoder->slice_threads[i - 1].success) {
+            jpeg_abort_compress(&encoder->cinfo);
+            success = FALSE;
+        }
+    }
+    return success;
+}
+
 static size_t mjpeg_encoder_end_frame(MJpegEncoder *encoder)
 {
     mem_destination_mgr *dest = (mem_destination_mgr *) encoder->cinfo.dest;
     MJpegEncoderRateControl *rate_control = &encoder->rate_control;
 
     jpeg_finish_compress(&encoder->cinfo);
+    if (encoder->num_slices > 1 && !mjpeg_encoder_join_slices(encoder)) {
+        rate_control->last_enc_size = 0;
+        return 0;
+    }
 
     encoder->first_frame = FALSE;
     rate_control->last_enc_size = dest->pub.next_output_byte - dest->buffer;
@@ -934,11 +1284,18 @@ static bool encode_frame(MJpegEncoder *encoder, const SpiceRect *src,
         }
 
         src_line += src->left * mjpeg_encoder_get_bytes_per_pixel(encoder);
+        if (encoder->num_slices > 1) {
+            encoder->frame_lines[i] = src_line;
+            continue;
+        }
         if (mjpeg_encoder_encode_scanline(encoder, src_line, stream_width) == 0) {
             return FALSE;
         }
     }
 
+    if (encoder->num_slices > 1) {
+        return mjpeg_encoder_encode_slices(encoder, stream_width);
+    }
     return TRUE;
 }
 
@@ -961,6 +1318,8 @@ mjpeg_encoder_encode_frame(VideoEncoder *video_encoder,
     if (ret == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
         if (encode_frame(encoder, src, bitmap, top_down)) {
             buffer->base.size = mjpeg_encoder_end_frame(encoder);
+        }
+        if (buffer->base.size > 0) {
             *outbuf = (VideoBuffer*)buffer;
         } else {
             ret = VIDEO_ENCODER_FRAME_UNSUPPORTED;
@@ -1360,6 +1719,25 @@ static void mjpeg_encoder_get_stats(VideoEncoder *video_encoder,
     stats->avg_quality = (double)encoder->avg_quality / encoder->num_frames;
 }
 
+static unsigned int mjpeg_encoder_get_slice_threads_from_env(void)
+{
+    const char *env = getenv(MJPEG_ENCODER_SLICE_THREADS_ENV);
+    unsigned long n_threads;
+    char *end;
+
+    if (!env || !*env) {
+        return 0;
+    }
+
+    errno = 0;
+    n_threads = strtoul(env, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        spice_warning("error parsing %s: %s", MJPEG_ENCODER_SLICE_THREADS_ENV, env);
+        return 0;
+    }
+    return MIN(n_threads, MJPEG_SLICE_MAX_THREADS);
+}
+
 VideoEncoder *mjpeg_encoder_new(SpiceVideoCodecType codec_type,
                                 uint64_t starting_bit_rate,
                                 VideoEncoderRateControlCbs *cbs,
@@ -1392,5 +1770,10 @@ VideoEncoder *mjpeg_encoder_new(SpiceVideoCodecType codec_type,
     encoder->cinfo.err = jpeg_std_error(&encoder->jerr);
     jpeg_create_compress(&encoder->cinfo);
 
+    encoder->slice_max_threads = mjpeg_encoder_get_slice_threads_from_env();
+    pthread_mutex_init(&encoder->slice_lock, NULL);
+    pthread_cond_init(&encoder->slice_start_cond, NULL);
+    pthread_cond_init(&encoder->slice_done_cond, NULL);
+
     return (VideoEncoder*)encoder;
 }
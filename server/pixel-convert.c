@@ -0,0 +1,202 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <string.h>
+#include <pthread.h>
+#include <glib.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_CONVERT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#include "pixel-convert.h"
+
+static void rgb16_to_rgb24_generic(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    unsigned x;
+
+    for (x = 0; x < width; x++) {
+        uint16_t pixel;
+        memcpy(&pixel, src, sizeof(pixel));
+        pixel = GUINT16_FROM_LE(pixel);
+        *dest++ = ((pixel >> 7) & 0xf8) | ((pixel >> 12) & 0x7);
+        *dest++ = ((pixel >> 2) & 0xf8) | ((pixel >> 7) & 0x7);
+        *dest++ = ((pixel << 3) & 0xf8) | ((pixel >> 2) & 0x7);
+        src += 2;
+    }
+}
+
+static void bgr24_to_rgb24_generic(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    unsigned x;
+
+    for (x = 0; x < width; x++) {
+        *dest++ = src[2];
+        *dest++ = src[1];
+        *dest++ = src[0];
+        src += 3;
+    }
+}
+
+static void bgrx32_to_rgb24_generic(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    unsigned x;
+
+    for (x = 0; x < width; x++) {
+        *dest++ = src[2];
+        *dest++ = src[1];
+        *dest++ = src[0];
+        src += 4;
+    }
+}
+
+#ifdef PIXEL_CONVERT_X86_SIMD
+/* Store 16 pixels, each vector holds 4 of them in its 12 low bytes and
+ * zeroes in the other bytes */
+__attribute__((target("ssse3")))
+static inline void store_rgb24_ssse3(uint8_t *dest, __m128i a, __m128i b, __m128i c, __m128i d)
+{
+    _mm_storeu_si128((__m128i *)dest, _mm_or_si128(a, _mm_slli_si128(b, 12)));
+    _mm_storeu_si128((__m128i *)(dest + 16),
+                     _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+    _mm_storeu_si128((__m128i *)(dest + 32),
+                     _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+}
+
+/* 4 pixels held in 32 bit lanes as 0x00bbggrr */
+__attribute__((target("ssse3")))
+static inline __m128i pack_rgbx_ssse3(__m128i pixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                          -1, -1, -1, -1);
+
+    return _mm_shuffle_epi8(pixels, shuffle);
+}
+
+/* 4 x555 pixels held in 32 bit lanes */
+__attribute__((target("ssse3")))
+static inline __m128i rgb16_to_rgbx_ssse3(__m128i pixels)
+{
+    const __m128i mask_high = _mm_set1_epi32(0xf8);
+    const __m128i mask_low = _mm_set1_epi32(0x7);
+    __m128i r = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 7), mask_high),
+                             _mm_and_si128(_mm_srli_epi32(pixels, 12), mask_low));
+    __m128i g = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pixels, 2), mask_high),
+                             _mm_and_si128(_mm_srli_epi32(pixels, 7), mask_low));
+    __m128i b = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(pixels, 3), mask_high),
+                             _mm_and_si128(_mm_srli_epi32(pixels, 2), mask_low));
+
+    return _mm_or_si128(r, _mm_or_si128(_mm_slli_epi32(g, 8), _mm_slli_epi32(b, 16)));
+}
+
+__attribute__((target("ssse3")))
+static void rgb16_to_rgb24_ssse3(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    unsigned x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)src);
+        __m128i hi = _mm_loadu_si128((const __m128i *)(src + 16));
+
+        store_rgb24_ssse3(dest,
+                          pack_rgbx_ssse3(rgb16_to_rgbx_ssse3(_mm_unpacklo_epi16(lo, zero))),
+                          pack_rgbx_ssse3(rgb16_to_rgbx_ssse3(_mm_unpackhi_epi16(lo, zero))),
+                          pack_rgbx_ssse3(rgb16_to_rgbx_ssse3(_mm_unpacklo_epi16(hi, zero))),
+                          pack_rgbx_ssse3(rgb16_to_rgbx_ssse3(_mm_unpackhi_epi16(hi, zero))));
+        src += 32;
+        dest += 48;
+    }
+    rgb16_to_rgb24_generic(src, dest, width - x);
+}
+
+__attribute__((target("ssse3")))
+static void bgr24_to_rgb24_ssse3(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9,
+                                          -1, -1, -1, -1);
+    unsigned x;
+
+    /* the last load reads 4 bytes after the 16 pixels */
+    for (x = 0; x + 18 <= width; x += 16) {
+        store_rgb24_ssse3(dest,
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle),
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 12)), shuffle),
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 24)), shuffle),
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 36)), shuffle));
+        src += 48;
+        dest += 48;
+    }
+    bgr24_to_rgb24_generic(src, dest, width - x);
+}
+
+__attribute__((target("ssse3")))
+static void bgrx32_to_rgb24_ssse3(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                          -1, -1, -1, -1);
+    unsigned x;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+        store_rgb24_ssse3(dest,
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle),
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 16)), shuffle),
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 32)), shuffle),
+                          _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 48)), shuffle));
+        src += 64;
+        dest += 48;
+    }
+    bgrx32_to_rgb24_generic(src, dest, width - x);
+}
+#endif
+
+static PixelConvertLineFunc rgb16_to_rgb24_func = rgb16_to_rgb24_generic;
+static PixelConvertLineFunc bgr24_to_rgb24_func = bgr24_to_rgb24_generic;
+static PixelConvertLineFunc bgrx32_to_rgb24_func = bgrx32_to_rgb24_generic;
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+
+static void convert_init(void)
+{
+#ifdef PIXEL_CONVERT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        rgb16_to_rgb24_func = rgb16_to_rgb24_ssse3;
+        bgr24_to_rgb24_func = bgr24_to_rgb24_ssse3;
+        bgrx32_to_rgb24_func = bgrx32_to_rgb24_ssse3;
+    }
+#endif
+}
+
+void pixel_convert_rgb16_to_rgb24(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    pthread_once(&convert_once, convert_init);
+    rgb16_to_rgb24_func(src, dest, width);
+}
+
+void pixel_convert_bgr24_to_rgb24(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    pthread_once(&convert_once, convert_init);
+    bgr24_to_rgb24_func(src, dest, width);
+}
+
+void pixel_convert_bgrx32_to_rgb24(const uint8_t *src, uint8_t *dest, unsigned width)
+{
+    pthread_once(&convert_once, convert_init);
+    bgrx32_to_rgb24_func(src, dest, width);
+}
@@ -0,0 +1,64 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file pixel-convert.h
+ * Conversion of lines of pixels to the RGB24 layout of libjpeg.
+ *
+ * The JPEG encoders use it for the formats libjpeg can't read directly.
+ * The lines are converted with SSSE3 when the CPU supports it.
+ */
+
+#ifndef PIXEL_CONVERT_H_
+#define PIXEL_CONVERT_H_
+
+#include <stdint.h>
+#include <spice/macros.h>
+
+#include "push-visibility.h"
+
+SPICE_BEGIN_DECLS
+
+/* Convert a line of 'width' pixels from 'src' to 'dest', which must hold
+ * width * 3 bytes. The lines don't need to be aligned */
+typedef void (*PixelConvertLineFunc)(const uint8_t *src, uint8_t *dest, unsigned width);
+
+/* 16 bit x555 pixels, in little endian */
+void pixel_convert_rgb16_to_rgb24(const uint8_t *src, uint8_t *dest, unsigned width);
+/* 3 bytes pixels, blue first */
+void pixel_convert_bgr24_to_rgb24(const uint8_t *src, uint8_t *dest, unsigned width);
+/* 4 bytes pixels, blue first */
+void pixel_convert_bgrx32_to_rgb24(const uint8_t *src, uint8_t *dest, unsigned width);
+
+SPICE_END_DECLS
+
+#include "pop-visibility.h"
+
+/* The libjpeg-turbo color spaces reading the little endian pixels of
+ * spice directly, jpeglib.h must be included first to use them */
+#ifdef JCS_EXTENSIONS
+#  ifndef WORDS_BIGENDIAN
+#    define JCS_EXT_LE_BGRX JCS_EXT_BGRX
+#    define JCS_EXT_LE_BGR JCS_EXT_BGR
+#  else
+#    define JCS_EXT_LE_BGRX JCS_EXT_XRGB
+#    define JCS_EXT_LE_BGR JCS_EXT_RGB
+#  endif
+#endif
+
+#endif /* PIXEL_CONVERT_H_ */
@@ -20,37 +20,18 @@
 
 int pixmap_cache_unlocked_set_lossy(PixmapCache *cache, uint64_t id, int lossy)
 {
-    NewCacheItem *item;
+    NewCacheItem *item = cache->items.find(id);
 
-    item = cache->hash_table[BITS_CACHE_HASH_KEY(id)];
-
-    while (item) {
-        if (item->id == id) {
-            item->lossy = lossy;
-            break;
-        }
-        item = item->next;
+    if (item) {
+        item->lossy = lossy;
     }
     return !!item;
 }
 
 void pixmap_cache_clear(PixmapCache *cache)
 {
-    NewCacheItem *item;
-
-    if (cache->frozen) {
-        cache->lru.next = cache->frozen_head;
-        cache->lru.prev = cache->frozen_tail;
-        cache->frozen = FALSE;
-    }
-
-    SPICE_VERIFY(SPICE_OFFSETOF(NewCacheItem, lru_link) == 0);
-    while ((item = SPICE_CONTAINEROF(ring_get_head(&cache->lru), NewCacheItem, lru_link))) {
-        ring_remove(&item->lru_link);
-        g_free(item);
-    }
-    memset(cache->hash_table, 0, sizeof(*cache->hash_table) * BITS_CACHE_HASH_SIZE);
-
+    cache->frozen = FALSE;
+    cache->items.clear();
     cache->available = cache->size;
 }
 
@@ -63,10 +44,7 @@ bool pixmap_cache_freeze(PixmapCache *cache)
         return FALSE;
     }
 
-    cache->frozen_head = cache->lru.next;
-    cache->frozen_tail = cache->lru.prev;
-    ring_init(&cache->lru);
-    memset(cache->hash_table, 0, sizeof(*cache->hash_table) * BITS_CACHE_HASH_SIZE);
+    cache->items.clear();
     cache->available = -1;
     cache->frozen = TRUE;
 
@@ -80,6 +58,7 @@ static void pixmap_cache_destroy(PixmapCache *cache)
 
     pthread_mutex_lock(&cache->lock);
     pixmap_cache_clear(cache);
+    cache->items.destroy();
     pthread_mutex_unlock(&cache->lock);
 }
 
@@ -95,7 +74,6 @@ static PixmapCache *pixmap_cache_new(RedClient *client, uint8_t id, int64_t size
     pthread_mutex_init(&cache->lock, nullptr);
     cache->id = id;
     cache->refs = 1;
-    ring_init(&cache->lru);
     cache->available = size;
     cache->size = size;
     cache->client = client;
@@ -22,19 +22,13 @@
 #include <common/ring.h>
 
 #include "red-channel.h"
+#include "id-cache-table.hpp"
 
 #include "push-visibility.h"
 
 #define MAX_CACHE_CLIENTS 4
 
-#define BITS_CACHE_HASH_SHIFT 10
-#define BITS_CACHE_HASH_SIZE (1 << BITS_CACHE_HASH_SHIFT)
-#define BITS_CACHE_HASH_MASK (BITS_CACHE_HASH_SIZE - 1)
-#define BITS_CACHE_HASH_KEY(id) ((id) & BITS_CACHE_HASH_MASK)
-
 struct NewCacheItem {
-    RingItem lru_link;
-    NewCacheItem *next;
     uint64_t id;
     uint64_t sync[MAX_CACHE_CLIENTS];
     size_t size;
@@ -46,14 +40,11 @@ struct PixmapCache {
     pthread_mutex_t lock;
     uint8_t id;
     uint32_t refs;
-    NewCacheItem *hash_table[BITS_CACHE_HASH_SIZE];
-    Ring lru;
+    red::IdCacheTable<NewCacheItem> items;
     int64_t available;
     int64_t size;
 
     int frozen;
-    RingItem *frozen_head;
-    RingItem *frozen_tail;
 
     uint32_t generation;
     struct {
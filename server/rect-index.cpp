@@ -0,0 +1,189 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <cstring>
+
+#include "rect-index.h"
+
+struct RectIndexCellItem {
+    uint64_t order;
+    SpiceRect rect;
+    void *item;
+};
+
+/* items sorted by order */
+struct RectIndexCell {
+    RectIndexCellItem *items;
+    uint32_t count;
+    uint32_t size;
+};
+
+struct RectIndex {
+    uint32_t cells_x;
+    uint32_t cells_y;
+    uint64_t last_order;
+    RectIndexCell cells[];
+};
+
+RectIndex *rect_index_new(uint32_t width, uint32_t height)
+{
+    uint32_t cells_x = MAX((width + RECT_INDEX_CELL_SIZE - 1) / RECT_INDEX_CELL_SIZE, 1);
+    uint32_t cells_y = MAX((height + RECT_INDEX_CELL_SIZE - 1) / RECT_INDEX_CELL_SIZE, 1);
+    RectIndex *index;
+
+    index = static_cast<RectIndex *>(g_malloc0(sizeof(RectIndex) +
+                                               sizeof(RectIndexCell) * cells_x * cells_y));
+    index->cells_x = cells_x;
+    index->cells_y = cells_y;
+    return index;
+}
+
+void rect_index_free(RectIndex *index)
+{
+    if (!index) {
+        return;
+    }
+    for (uint32_t i = 0; i < index->cells_x * index->cells_y; i++) {
+        g_free(index->cells[i].items);
+    }
+    g_free(index);
+}
+
+static inline uint32_t cell_coord(int32_t pos, uint32_t count)
+{
+    return pos < 0 ? 0 : MIN(uint32_t(pos) / RECT_INDEX_CELL_SIZE, count - 1);
+}
+
+/* Compute the range of cells 'rect' touches. Parts outside of the surface
+ * go to the border cells so items outside are still found by areas outside */
+static void get_cell_range(const RectIndex *index, const SpiceRect *rect,
+                           uint32_t *cx0, uint32_t *cy0, uint32_t *cx1, uint32_t *cy1)
+{
+    *cx0 = cell_coord(rect->left, index->cells_x);
+    *cy0 = cell_coord(rect->top, index->cells_y);
+    *cx1 = MAX(cell_coord(rect->right - 1, index->cells_x), *cx0);
+    *cy1 = MAX(cell_coord(rect->bottom - 1, index->cells_y), *cy0);
+}
+
+/* position of the first item with order >= 'order' */
+static uint32_t cell_lower_bound(const RectIndexCell *cell, uint64_t order)
+{
+    uint32_t low = 0, high = cell->count;
+
+    while (low < high) {
+        uint32_t mid = (low + high) / 2;
+        if (cell->items[mid].order < order) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static inline bool rects_intersect(const SpiceRect *a, const SpiceRect *b)
+{
+    return a->left < b->right && b->left < a->right &&
+           a->top < b->bottom && b->top < a->bottom;
+}
+
+void rect_index_add(RectIndex *index, RectIndexEntry *entry, void *item,
+                    const SpiceRect *rect, const RectIndexEntry *after)
+{
+    uint32_t cx0, cy0, cx1, cy1;
+
+    if (!index) {
+        return;
+    }
+    spice_return_if_fail(entry->order == 0);
+    spice_return_if_fail(after == nullptr || after->order != 0);
+
+    entry->order = after ? after->order : ++index->last_order;
+    entry->rect = *rect;
+
+    get_cell_range(index, rect, &cx0, &cy0, &cx1, &cy1);
+    for (uint32_t cy = cy0; cy <= cy1; cy++) {
+        for (uint32_t cx = cx0; cx <= cx1; cx++) {
+            RectIndexCell *cell = &index->cells[cy * index->cells_x + cx];
+            if (cell->count == cell->size) {
+                cell->size = MAX(cell->size * 2, 8);
+                cell->items = g_renew(RectIndexCellItem, cell->items, cell->size);
+            }
+            /* the new items are usually the last ones */
+            uint32_t pos = after ? cell_lower_bound(cell, entry->order) : cell->count;
+            memmove(&cell->items[pos + 1], &cell->items[pos],
+                    (cell->count - pos) * sizeof(RectIndexCellItem));
+            cell->items[pos] = { entry->order, *rect, item };
+            cell->count++;
+        }
+    }
+}
+
+void rect_index_remove(RectIndex *index, RectIndexEntry *entry, void *item)
+{
+    uint32_t cx0, cy0, cx1, cy1;
+
+    if (!index || entry->order == 0) {
+        return;
+    }
+
+    get_cell_range(index, &entry->rect, &cx0, &cy0, &cx1, &cy1);
+    for (uint32_t cy = cy0; cy <= cy1; cy++) {
+        for (uint32_t cx = cx0; cx <= cx1; cx++) {
+            RectIndexCell *cell = &index->cells[cy * index->cells_x + cx];
+            uint32_t pos = cell_lower_bound(cell, entry->order);
+            /* an item taking the place of another one has the same order */
+            while (pos < cell->count && cell->items[pos].item != item) {
+                pos++;
+            }
+            spice_assert(pos < cell->count && cell->items[pos].order == entry->order);
+            cell->count--;
+            memmove(&cell->items[pos], &cell->items[pos + 1],
+                    (cell->count - pos) * sizeof(RectIndexCellItem));
+        }
+    }
+    entry->order = 0;
+}
+
+void *rect_index_find(RectIndex *index, uint64_t order, const SpiceRect *area)
+{
+    uint32_t cx0, cy0, cx1, cy1;
+    uint64_t found_order = 0;
+    void *found = nullptr;
+
+    get_cell_range(index, area, &cx0, &cy0, &cx1, &cy1);
+    for (uint32_t cy = cy0; cy <= cy1; cy++) {
+        for (uint32_t cx = cx0; cx <= cx1; cx++) {
+            const RectIndexCell *cell = &index->cells[cy * index->cells_x + cx];
+            uint32_t pos = cell_lower_bound(cell, order);
+
+            /* look for the last intersecting item, unless an item
+             * found in a previous cell comes later */
+            while (pos > 0 && cell->items[pos - 1].order > found_order) {
+                pos--;
+                if (rects_intersect(&cell->items[pos].rect, area)) {
+                    found_order = cell->items[pos].order;
+                    found = cell->items[pos].item;
+                    break;
+                }
+            }
+        }
+    }
+    return found;
+}
@@ -0,0 +1,72 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file rect-index.h
+ * Find the items of an ordered list intersecting an area.
+ *
+ * The surface is split in square cells, each one keeping the items
+ * covering it sorted by order. Finding the next item of the list
+ * intersecting an area only looks at the items of the cells of the area
+ * instead of walking the whole list.
+ *
+ * The index does not know the shape of the items, the rectangle of an item
+ * must contain it for all the time it is in the index, callers check the
+ * real shape of the items found.
+ */
+
+#ifndef RECT_INDEX_H_
+#define RECT_INDEX_H_
+
+#include "red-common.h"
+
+#include "push-visibility.h"
+
+/* Walk the rings of the surfaces instead of using the indexes, to
+ * compare them */
+#define RECT_INDEX_DISABLE_ENV "SPICE_DISABLE_RECT_INDEX"
+
+#define RECT_INDEX_CELL_SIZE 64
+
+struct RectIndex;
+
+/* Position of an item in an index, kept by the item */
+struct RectIndexEntry {
+    /* 0 if the item is not in an index */
+    uint64_t order;
+    SpiceRect rect;
+};
+
+RectIndex *rect_index_new(uint32_t width, uint32_t height);
+void rect_index_free(RectIndex *index);
+
+/* Add 'item' covering 'rect'. The item is placed just before 'after' in
+ * the order, which must be removed before the next search, or after all
+ * the items if 'after' is NULL.
+ * Adding to or removing from a NULL index does nothing */
+void rect_index_add(RectIndex *index, RectIndexEntry *entry, void *item,
+                    const SpiceRect *rect, const RectIndexEntry *after);
+void rect_index_remove(RectIndex *index, RectIndexEntry *entry, void *item);
+
+/* Return the last item before 'order' in the order whose rectangle
+ * intersects 'area', NULL if none */
+void *rect_index_find(RectIndex *index, uint64_t order, const SpiceRect *area);
+
+#include "pop-visibility.h"
+
+#endif /* RECT_INDEX_H_ */
@@ -41,6 +41,10 @@
 
 #define MAX_HEADER_SIZE sizeof(SpiceDataHeader)
 
+/* Size of the buffer used to read ahead from the socket, enough for many
+ * small messages. Larger message bodies are read directly */
+#define RECEIVE_BUF_SIZE (16 * 1024)
+
 #ifndef IOV_MAX
 #define IOV_MAX 1024
 #endif
@@ -112,6 +116,13 @@ struct IncomingMessageBuffer {
     uint32_t header_pos;
     uint8_t *msg; // data of the msg following the header. allocated by alloc_msg_buf.
     uint32_t msg_pos;
+
+    // data read from the socket not yet consumed, allocated on first read
+    uint8_t *recv_buf;
+    uint32_t recv_pos;
+    uint32_t recv_end;
+    // used to process the buffered data after reading is unblocked
+    SpiceTimer *recv_timer;
 };
 
 struct RedChannelClientPrivate
@@ -144,20 +155,31 @@ struct RedChannelClientPrivate
         uint32_t size;
         bool blocked;
         uint64_t last_sent_serial;
+        /* see set_send_origin_time, 0 if not set */
+        uint64_t origin_time;
 
+        /* begin_time is the start of the message for the write histogram,
+         * an urgent message has its own so it can't alter the main one */
         struct {
             SpiceMarshaller *marshaller;
             uint8_t *header_data;
+            stat_time_t begin_time;
         } main;
 
         struct {
             SpiceMarshaller *marshaller;
+            stat_time_t begin_time;
         } urgent;
     } send_data;
+    /* notifications of the stream sender thread, see red_stream_enable_sender */
+    SpiceWatch *sender_watch;
 
     bool block_read;
     bool during_send;
     RedChannelClient::Pipe pipe;
+    /* the pipe is not sent before this time, see hold_pipe() */
+    uint64_t pipe_hold_until;
+    SpiceTimer *pipe_hold_timer;
 
     RedChannelCapabilities remote_caps;
     bool is_mini_header;
@@ -173,7 +195,12 @@ struct RedChannelClientPrivate
 
     RedStatCounter out_messages;
     RedStatCounter out_bytes;
+    /* time to write a message and time from the origin of a message
+     * to its end written */
+    RedStatHistogram write_histogram;
+    RedStatHistogram latency_histogram;
 
+    inline bool pipe_held();
     inline RedPipeItemPtr pipe_item_get();
     inline void pipe_remove(RedPipeItem *item);
     void handle_pong(SpiceMsgPing *ping);
@@ -181,6 +208,7 @@ struct RedChannelClientPrivate
     void pipe_clear();
     void data_sent(int n);
     void data_read(int n);
+    int receive(uint8_t *buf, uint32_t size);
     inline int get_out_msg_size();
     inline int prepare_out_msg(struct iovec *vec, int vec_size, int pos);
     inline void set_blocked();
@@ -330,6 +358,8 @@ RedChannelClientPrivate::RedChannelClientPrivate(RedChannel *init_channel,
     const RedStatNode *node = channel->get_stat_node();
     stat_init_counter(&out_messages, reds, node, "out_messages", TRUE);
     stat_init_counter(&out_bytes, reds, node, "out_bytes", TRUE);
+    stat_init_histogram(&write_histogram, reds, node, "write", TRUE);
+    stat_init_histogram(&latency_histogram, reds, node, "latency", TRUE);
 }
 
 RedChannelClientPrivate::~RedChannelClientPrivate()
@@ -340,8 +370,15 @@ RedChannelClientPrivate::~RedChannelClientPrivate()
     red_timer_remove(connectivity_monitor.timer);
     connectivity_monitor.timer = nullptr;
 
-    red_stream_free(stream);
+    red_timer_remove(incoming.recv_timer);
+    g_free(incoming.recv_buf);
 
+    red_timer_remove(pipe_hold_timer);
+
+    red_watch_remove(sender_watch);
+
+    /* destroy the marshallers first, they can release zero copy
+     * buffers registered in the stream */
     if (send_data.main.marshaller) {
         spice_marshaller_destroy(send_data.main.marshaller);
     }
@@ -350,6 +387,8 @@ RedChannelClientPrivate::~RedChannelClientPrivate()
         spice_marshaller_destroy(send_data.urgent.marshaller);
     }
 
+    red_stream_free(stream);
+
     red_channel_capabilities_reset(&remote_caps);
 }
 
@@ -421,6 +460,10 @@ void RedChannelClientPrivate::reset_send_data()
         spice_assert(send_data.marshaller != send_data.urgent.marshaller);
         send_data.header.set_msg_sub_list(&send_data.header, 0);
     }
+    /* an urgent message is sent in the middle of the main one */
+    if (!urgent_marshaller_is_active()) {
+        send_data.origin_time = 0;
+    }
 }
 
 void RedChannelClient::send_set_ack()
@@ -539,6 +582,14 @@ void RedChannelClient::msg_sent()
     }
 #endif
 
+    stat_histogram_add(&priv->write_histogram, priv->urgent_marshaller_is_active() ?
+                                               priv->send_data.urgent.begin_time :
+                                               priv->send_data.main.begin_time);
+    if (priv->send_data.origin_time && !priv->urgent_marshaller_is_active()) {
+        stat_histogram_add(&priv->latency_histogram, priv->send_data.origin_time);
+        priv->send_data.origin_time = 0;
+    }
+
     priv->clear_sent_item();
 
     if (priv->urgent_marshaller_is_active()) {
@@ -735,6 +786,10 @@ void RedChannelClient::start_connectivity_monitoring(uint32_t timeout_ms)
 static void red_channel_client_event(int fd, int event, RedChannelClient *rcc)
 {
     red::shared_ptr<RedChannelClient> hold_rcc(rcc);
+    /* zero copy completions are reported as socket errors */
+    if (rcc->get_stream()) {
+        red_stream_zerocopy_poll(rcc->get_stream());
+    }
     if (event & SPICE_WATCH_EVENT_READ) {
         rcc->receive();
     }
@@ -743,6 +798,13 @@ static void red_channel_client_event(int fd, int event, RedChannelClient *rcc)
     }
 }
 
+static void red_channel_client_sender_event(int fd, int event, RedChannelClient *rcc)
+{
+    red::shared_ptr<RedChannelClient> hold_rcc(rcc);
+    red_stream_sender_ack(rcc->get_stream());
+    rcc->push();
+}
+
 static uint32_t full_header_get_msg_size(SpiceDataHeaderOpaque *header)
 {
     return GUINT32_FROM_LE(((SpiceDataHeader *)header->data)->size);
@@ -827,6 +889,11 @@ bool RedChannelClient::init()
                         SPICE_WATCH_EVENT_READ,
                         red_channel_client_event,
                         this);
+    if (red_stream_get_sender_fd(priv->stream) != -1) {
+        priv->sender_watch =
+            core->watch_new(red_stream_get_sender_fd(priv->stream), 0,
+                            red_channel_client_sender_event, this);
+    }
 
     if (red_stream_get_family(priv->stream) != AF_UNIX) {
         priv->latency_monitor.timer =
@@ -865,6 +932,17 @@ void RedChannelClientPrivate::watch_update_mask(int event_mask)
         event_mask &= ~SPICE_WATCH_EVENT_READ;
     }
 
+    /* the socket is written by the sender thread, if blocked wait for
+     * the thread to make room instead of waiting for the socket */
+    if (sender_watch) {
+        red_watch_update_mask(sender_watch,
+                              send_data.blocked && (event_mask & SPICE_WATCH_EVENT_WRITE) ?
+                              SPICE_WATCH_EVENT_READ : 0);
+        if (send_data.blocked) {
+            event_mask &= ~SPICE_WATCH_EVENT_WRITE;
+        }
+    }
+
     red_watch_update_mask(stream->watch, event_mask);
 }
 
@@ -877,6 +955,11 @@ void RedChannelClient::block_read()
     priv->watch_update_mask(SPICE_WATCH_EVENT_WRITE);
 }
 
+static void receive_timer(RedChannelClient *rcc)
+{
+    rcc->receive();
+}
+
 void RedChannelClient::unblock_read()
 {
     if (!priv->block_read) {
@@ -884,6 +967,16 @@ void RedChannelClient::unblock_read()
     }
     priv->block_read = false;
     priv->watch_update_mask(SPICE_WATCH_EVENT_READ|SPICE_WATCH_EVENT_WRITE);
+
+    /* the socket watch won't trigger for data we already read */
+    IncomingMessageBuffer *buffer = &priv->incoming;
+    if (buffer->recv_pos < buffer->recv_end) {
+        if (!buffer->recv_timer) {
+            SpiceCoreInterfaceInternal *core = priv->channel->get_core_interface();
+            buffer->recv_timer = core->timer_new(receive_timer, this);
+        }
+        red_timer_start(buffer->recv_timer, 0);
+    }
 }
 
 void RedChannelClientPrivate::seamless_migration_done()
@@ -926,6 +1019,8 @@ void RedChannelClient::shutdown()
     if (priv->stream && priv->stream->watch) {
         red_watch_remove(priv->stream->watch);
         priv->stream->watch = nullptr;
+        red_watch_remove(priv->sender_watch);
+        priv->sender_watch = nullptr;
         ::shutdown(priv->stream->socket, SHUT_RDWR);
     }
 }
@@ -956,6 +1051,9 @@ void RedChannelClient::handle_outgoing()
             switch (errno) {
             case EAGAIN:
                 priv->set_blocked();
+                if (priv->sender_watch) {
+                    priv->watch_update_mask(SPICE_WATCH_EVENT_READ|SPICE_WATCH_EVENT_WRITE);
+                }
                 break;
             case EINTR:
                 continue;
@@ -983,11 +1081,10 @@ void RedChannelClient::handle_outgoing()
     }
 }
 
-/* return the number of bytes read. -1 in case of error */
+/* return the number of bytes read, 0 if no data is available. -1 in case of error */
 static int red_peer_receive(RedStream *stream, uint8_t *buf, uint32_t size)
 {
-    uint8_t *pos = buf;
-    while (size) {
+    for (;;) {
         int now;
         /* if we don't have a watch it means socket has been shutdown
          * shutdown read doesn't work as accepted - receive may return data afterward.
@@ -996,33 +1093,78 @@ static int red_peer_receive(RedStream *stream, uint8_t *buf, uint32_t size)
         if (!stream->watch) {
             return -1;
         }
-        now = red_stream_read(stream, pos, size);
-        if (now <= 0) {
-            if (now == 0) {
-                return -1;
-            }
-            spice_assert(now == -1);
-            if (errno == EAGAIN) {
-                break;
-            }
-            if (errno == EINTR) {
-                continue;
-            }
-            if (errno != EPIPE) {
-                g_warning("%s", strerror(errno));
-            }
+        now = red_stream_read(stream, buf, size);
+        if (now > 0) {
+            return now;
+        }
+        if (now == 0) {
             return -1;
         }
-        size -= now;
-        pos += now;
+        spice_assert(now == -1);
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EPIPE) {
+            g_warning("%s", strerror(errno));
+        }
+        return -1;
+    }
+}
+
+/* Fill buf with data from the read ahead buffer or the socket.
+ * Return the number of bytes read. -1 in case of error */
+int RedChannelClientPrivate::receive(uint8_t *buf, uint32_t size)
+{
+    IncomingMessageBuffer *buffer = &incoming;
+    uint32_t pos = 0;
+
+    // don't process buffered data after shutdown
+    if (!stream->watch) {
+        return -1;
+    }
+
+    while (pos < size) {
+        int now;
+
+        if (buffer->recv_pos < buffer->recv_end) {
+            now = MIN(buffer->recv_end - buffer->recv_pos, size - pos);
+            memcpy(buf + pos, buffer->recv_buf + buffer->recv_pos, now);
+            buffer->recv_pos += now;
+            pos += now;
+            continue;
+        }
+
+        if (size - pos >= RECEIVE_BUF_SIZE) {
+            // large message, avoid the copy
+            now = red_peer_receive(stream, buf + pos, size - pos);
+            if (now <= 0) {
+                return now < 0 ? -1 : pos;
+            }
+            data_read(now);
+            pos += now;
+            continue;
+        }
+
+        if (!buffer->recv_buf) {
+            buffer->recv_buf = static_cast<uint8_t *>(g_malloc(RECEIVE_BUF_SIZE));
+        }
+        now = red_peer_receive(stream, buffer->recv_buf, RECEIVE_BUF_SIZE);
+        if (now <= 0) {
+            return now < 0 ? -1 : pos;
+        }
+        data_read(now);
+        buffer->recv_pos = 0;
+        buffer->recv_end = now;
     }
-    return pos - buf;
+    return pos;
 }
 
-// TODO: this implementation, as opposed to the old implementation in red_worker,
-// does many calls to red_peer_receive and through it cb_read, and thus avoids pointer
-// arithmetic for the case where a single cb_read could return multiple messages. But
-// this is suboptimal potentially. Profile and consider fixing.
+// Data is read from the socket in RECEIVE_BUF_SIZE chunks so a burst of small
+// messages costs a single read. Headers and small bodies are then copied
+// from the read ahead buffer.
 void RedChannelClient::handle_incoming()
 {
     RedStream *stream = priv->stream;
@@ -1045,14 +1187,12 @@ void RedChannelClient::handle_incoming()
         RedChannel *channel = get_channel();
 
         if (buffer->header_pos < buffer->header.header_size) {
-            bytes_read = red_peer_receive(stream,
-                                          buffer->header.data + buffer->header_pos,
-                                          buffer->header.header_size - buffer->header_pos);
+            bytes_read = priv->receive(buffer->header.data + buffer->header_pos,
+                                       buffer->header.header_size - buffer->header_pos);
             if (bytes_read == -1) {
                 disconnect();
                 return;
             }
-            priv->data_read(bytes_read);
             buffer->header_pos += bytes_read;
 
             if (buffer->header_pos != buffer->header.header_size) {
@@ -1077,16 +1217,14 @@ void RedChannelClient::handle_incoming()
                 }
             }
 
-            bytes_read = red_peer_receive(stream,
-                                          buffer->msg + buffer->msg_pos,
-                                          msg_size - buffer->msg_pos);
+            bytes_read = priv->receive(buffer->msg + buffer->msg_pos,
+                                       msg_size - buffer->msg_pos);
             if (bytes_read == -1) {
                 release_recv_buf(msg_type, msg_size, buffer->msg);
                 buffer->msg = nullptr;
                 disconnect();
                 return;
             }
-            priv->data_read(bytes_read);
             buffer->msg_pos += bytes_read;
             if (buffer->msg_pos != msg_size) {
                 return;
@@ -1130,11 +1268,23 @@ void RedChannelClient::send()
     handle_outgoing();
 }
 
+inline bool RedChannelClientPrivate::pipe_held()
+{
+    if (!pipe_hold_until) {
+        return false;
+    }
+    if (spice_get_monotonic_time_ns() < pipe_hold_until) {
+        return true;
+    }
+    pipe_hold_until = 0;
+    return false;
+}
+
 inline RedPipeItemPtr RedChannelClientPrivate::pipe_item_get()
 {
     RedPipeItemPtr ret;
 
-    if (send_data.blocked || waiting_for_ack() || pipe.empty()) {
+    if (send_data.blocked || waiting_for_ack() || pipe.empty() || pipe_held()) {
         return ret;
     }
     ret = std::move(pipe.back());
@@ -1169,8 +1319,9 @@ void RedChannelClient::push()
      * If we don't remove WRITE if we are waiting for ack we will be keep
      * notified that we can write and we then exit (see pipe_item_get) as we
      * are waiting for the ack consuming CPU in a tight loop
+     * The same goes for a held pipe, hold_pipe() reenables WRITE events
      */
-    if ((no_item_being_sent() && priv->pipe.empty()) ||
+    if ((no_item_being_sent() && (priv->pipe.empty() || priv->pipe_held())) ||
         priv->waiting_for_ack()) {
         priv->watch_update_mask(SPICE_WATCH_EVENT_READ);
 
@@ -1334,6 +1485,11 @@ void RedChannelClient::begin_send_message()
     }
 
     stat_inc_counter(priv->out_messages, 1);
+    if (priv->urgent_marshaller_is_active()) {
+        priv->send_data.urgent.begin_time = stat_histogram_start();
+    } else {
+        priv->send_data.main.begin_time = stat_histogram_start();
+    }
 
     /* canceling the latency test timer till the nework is idle */
     priv->cancel_ping_timer();
@@ -1537,6 +1693,10 @@ void RedChannelClient::disconnect()
     red_timer_remove(priv->connectivity_monitor.timer);
     priv->connectivity_monitor.timer = nullptr;
 
+    red_timer_remove(priv->pipe_hold_timer);
+    priv->pipe_hold_timer = nullptr;
+    priv->pipe_hold_until = 0;
+
     channel->remove_client(this);
     on_disconnect();
     // remove client from RedClient
@@ -1550,6 +1710,38 @@ bool RedChannelClient::is_blocked() const
     return priv->send_data.blocked;
 }
 
+static void pipe_hold_timer(RedChannelClient *rcc)
+{
+    rcc->hold_pipe(0);
+}
+
+void RedChannelClient::hold_pipe(uint64_t time)
+{
+    if (!time) {
+        red_timer_cancel(priv->pipe_hold_timer);
+        priv->pipe_hold_until = 0;
+        priv->watch_update_mask(SPICE_WATCH_EVENT_READ|SPICE_WATCH_EVENT_WRITE);
+        push();
+        return;
+    }
+
+    if (!is_connected()) {
+        return;
+    }
+
+    uint64_t now = spice_get_monotonic_time_ns();
+    if (time <= now || time <= priv->pipe_hold_until) {
+        return;
+    }
+    if (!priv->pipe_hold_timer) {
+        SpiceCoreInterfaceInternal *core = priv->channel->get_core_interface();
+        priv->pipe_hold_timer = core->timer_new(pipe_hold_timer, this);
+    }
+    priv->pipe_hold_until = time;
+    red_timer_start(priv->pipe_hold_timer,
+                    (time - now + NSEC_PER_MILLISEC - 1) / NSEC_PER_MILLISEC);
+}
+
 int RedChannelClient::send_message_pending()
 {
     return priv->send_data.header.get_msg_type(&priv->send_data.header) != 0;
@@ -1575,6 +1767,13 @@ void RedChannelClient::set_header_sub_list(uint32_t sub_list)
     priv->send_data.header.set_msg_sub_list(&priv->send_data.header, sub_list);
 }
 
+void RedChannelClient::set_send_origin_time(uint64_t origin_time)
+{
+    if (!priv->urgent_marshaller_is_active()) {
+        priv->send_data.origin_time = origin_time;
+    }
+}
+
 /* TODO: more evil sync stuff. anything with the word wait in it's name. */
 bool RedChannelClient::wait_pipe_item_sent(Pipe::iterator item_pos, int64_t timeout)
 {
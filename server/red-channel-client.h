@@ -108,6 +108,11 @@ public:
 
     bool is_blocked() const;
 
+    /* Don't send the items of the pipe before 'time' (as
+     * spice_get_monotonic_time_ns), so the items added meanwhile can still be
+     * replaced or removed. A time of 0 sends the pipe right away */
+    void hold_pipe(uint64_t time);
+
     /* helper for channels that have complex logic that can possibly ready a send */
     int send_message_pending();
 
@@ -126,6 +131,11 @@ public:
      * begin_send_message.*/
     void set_header_sub_list(uint32_t sub_list);
 
+    /* Time (as spice_get_monotonic_time_ns) of the event producing the
+     * message being marshalled, the delay until the message is written
+     * is added to the latency statistics of the channel */
+    void set_send_origin_time(uint64_t origin_time);
+
     /*
      * blocking functions.
      *
@@ -598,7 +598,7 @@ error:
     return nullptr;
 }
 
-static void red_put_image(SpiceImage *red)
+void red_put_image(SpiceImage *red)
 {
     if (red == nullptr)
         return;
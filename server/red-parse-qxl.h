@@ -118,6 +118,7 @@ struct RedCursorCmd final: public RedQXLResource<RedCursorCmd> {
 };
 
 void red_get_rect_ptr(SpiceRect *red, const QXLRect *qxl);
+void red_put_image(SpiceImage *red);
 
 red::shared_ptr<RedDrawable>
 red_drawable_new(QXLInstance *qxl, RedMemSlotInfo *slots,
@@ -574,7 +574,9 @@ void red_qxl_init(RedsState *reds, QXLInstance *qxl)
     pthread_mutex_init(&qxl_state->scanout_mutex, nullptr);
     qxl_state->scanout.drm_dma_buf_fd = -1;
     qxl_state->gl_draw_cookie = GL_DRAW_COOKIE_INVALID;
-    qxl_state->dispatcher = red::make_shared<Dispatcher>(RED_WORKER_MESSAGE_COUNT);
+    /* avoid a system call for each message sent from the vCPU threads */
+    qxl_state->dispatcher = red::make_shared<Dispatcher>(RED_WORKER_MESSAGE_COUNT,
+                                                         DISPATCHER_TRANSPORT_RING);
 
     qxl_state->max_monitors = UINT_MAX;
     qxl->st = qxl_state;
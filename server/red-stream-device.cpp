@@ -319,37 +319,32 @@ StreamDevice::handle_msg_data()
     spice_extra_assert(hdr_pos >= sizeof(StreamDevHeader));
     spice_extra_assert(hdr.type == STREAM_TYPE_DATA);
 
-    /* make sure we have a large enough buffer for the whole frame */
-    /* ---
-     * TODO: Now that we copy partial data into the buffer, for each frame
-     * the buffer is allocated and freed (look for g_realloc in
-     * partial_read).
-     * Probably better to just keep the larger buffer.
-     */
+    /* the frame is read in a new buffer which is then sent as is,
+     * the previous one can still be used by the channel */
     if (msg_pos == 0) {
         frame_mmtime = reds_get_mm_time();
         record(stream_device_data, "Stream data packet size %u mm_time %u",
                hdr.size, frame_mmtime);
-        if (msg_len < hdr.size) {
-            g_free(msg);
-            msg = static_cast<StreamDevice::AllMessages *>(g_malloc(hdr.size));
-            msg_len = hdr.size;
-        }
+        data_buffer.reset(new (hdr.size) StreamDataBuffer(hdr.size));
     }
 
-    /* read from device */
-    n = read(msg->buf + msg_pos, hdr.size - msg_pos);
-    if (n <= 0) {
-        return msg_pos == hdr.size;
+    /* read from device, keep reading while data are available to
+     * get the whole frame without waiting for another wakeup */
+    while (msg_pos < hdr.size) {
+        n = read(data_buffer->data + msg_pos, hdr.size - msg_pos);
+        if (n <= 0) { /* some bytes are still missing */
+            return false;
+        }
+        msg_pos += n;
     }
 
-    msg_pos += n;
-    if (msg_pos != hdr.size) { /* some bytes are still missing */
-        return false;
+    /* The whole frame was read from the device, send it.
+     * Empty frames were never sent, the read of 0 bytes made the
+     * function return before sending, keep ignoring them */
+    if (hdr.size > 0) {
+        stream_channel->send_data(data_buffer, frame_mmtime);
     }
-
-    /* The whole frame was read from the device, send it */
-    stream_channel->send_data(msg->buf, hdr.size, frame_mmtime);
+    data_buffer.reset();
 
     return true;
 }
@@ -655,6 +650,7 @@ StreamDevice::port_event(uint8_t event)
     }
     hdr_pos = 0;
     msg_pos = 0;
+    data_buffer.reset();
     has_error = false;
     flow_stopped = false;
     reset();
@@ -33,6 +33,7 @@ struct StreamDevice;
 
 // forward declarations
 struct StreamChannel;
+struct StreamDataBuffer;
 struct CursorChannel;
 struct StreamQueueStat;
 
@@ -79,6 +80,8 @@ private:
     } *msg;
     uint32_t msg_pos;
     uint32_t msg_len;
+    /* STREAM_TYPE_DATA messages are read here instead of msg */
+    red::shared_ptr<StreamDataBuffer> data_buffer;
     bool has_error;
     bool opened;
     bool flow_stopped;
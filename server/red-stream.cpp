@@ -17,15 +17,22 @@
 */
 #include <config.h>
 
+#include <atomic>
 #include <cerrno>
 
 #include <fcntl.h>
 #include <unistd.h>
 #ifndef _WIN32
+#include <csignal>
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <linux/errqueue.h>
+#endif
 #else
 #include <ws2tcpip.h>
 #endif
@@ -48,6 +55,74 @@
 #define TCP_CORK TCP_NOPUSH
 #endif
 
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define RED_STREAM_HAVE_ZEROCOPY 1
+#endif
+
+/* how long the socket of a freed stream is kept open waiting for the
+ * kernel to complete the zero copy sends before dropping the data not
+ * transmitted, and how often the completions are checked meanwhile */
+#define ZEROCOPY_LINGER_MS 100
+#define ZEROCOPY_LINGER_POLL_MS 5
+
+struct RedZeroCopyBuffer {
+    GList link;
+    /* nullptr if the stream was freed before the buffer was released */
+    RedStream *stream;
+    uint8_t *data;
+    size_t size;
+    RedZeroCopyFree free_cb;
+    void *opaque;
+    /* number of sends using the buffer not completed by the kernel */
+    unsigned pending;
+    bool released;
+};
+
+/* a send done with MSG_ZEROCOPY, the kernel identifies them with
+ * a sequential 32 bit number */
+struct ZeroCopySend {
+    uint32_t id;
+    RedZeroCopyBuffer *buffer;
+};
+
+#ifndef _WIN32
+/* maximum data queued to the sender thread, a power of 2 so the free
+ * running positions can wrap around */
+#define SENDER_QUEUE_SIZE (4 * 1024 * 1024)
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/* A thread writing the data of a stream, see red_stream_enable_sender.
+ * The data is queued in a ring with a single writer (the stream user) and
+ * a single reader (the thread), positions are free running byte counters */
+struct RedStreamSender {
+    SPICE_CXX_GLIB_ALLOCATOR
+
+    RedStream *stream;
+    pthread_t thread;
+    uint8_t *queue;
+    /* notify_fds[0] is for the stream user, notify_fds[1] for the thread,
+     * one byte is written to wake up the other side */
+    int notify_fds[2];
+
+    /* written by the stream user */
+    std::atomic<uint32_t> head{0};
+    /* the stream user found the queue full, notify when there's room again */
+    std::atomic<bool> waiting{false};
+    std::atomic<bool> quit{false};
+    /* keep fields written by different threads in different cache lines */
+    uint8_t padding[64];
+    /* written by the thread */
+    std::atomic<uint32_t> tail{0};
+    /* the thread found the queue empty, notify when data is queued */
+    std::atomic<bool> idle{false};
+    /* errno of a failed write, reported by the following writes */
+    std::atomic<int> error{0};
+};
+#endif
+
 struct AsyncRead {
     void *opaque;
     uint8_t *now;
@@ -102,8 +177,29 @@ struct RedStreamPrivate {
     ssize_t (*write)(RedStream *s, const void *buf, size_t nbyte);
     ssize_t (*writev)(RedStream *s, const struct iovec *iov, int iovcnt);
 
+    /* buffer used to gather small buffers in a TLS record */
+    uint8_t *ssl_record_buf;
+    /* length of the last SSL_write() which must be retried */
+    size_t ssl_retry_len;
+    /* the kernel encrypts the data written, see stream_ssl_check_ktls */
+    bool ktls;
+
     RedsState *reds;
     SpiceCoreInterfaceInternal *core;
+
+    /* zero copy state, see red_stream_enable_zerocopy */
+    bool zerocopy;
+    uint32_t zerocopy_next_id;
+    GQueue zerocopy_buffers;
+    GQueue zerocopy_sends;
+    /* the stream was freed and waits for the completions,
+     * see zerocopy_linger */
+    SpiceTimer *zerocopy_linger_timer;
+    gint64 zerocopy_linger_end;
+
+#ifndef _WIN32
+    RedStreamSender *sender;
+#endif
 };
 
 #ifndef _WIN32
@@ -157,6 +253,319 @@ static ssize_t stream_writev_cb(RedStream *s, const struct iovec *iov, int iovcn
     return ret;
 }
 
+static void stream_close(RedStream *s);
+
+static void zerocopy_buffer_free(RedZeroCopyBuffer *buffer)
+{
+    if (buffer->stream) {
+        g_queue_unlink(&buffer->stream->priv->zerocopy_buffers, &buffer->link);
+    }
+    buffer->free_cb(buffer->data, buffer->opaque);
+    g_free(buffer);
+}
+
+#ifdef RED_STREAM_HAVE_ZEROCOPY
+/* Find the registered buffer containing the data to send, if any */
+static RedZeroCopyBuffer *zerocopy_find_buffer(RedStream *s, const struct iovec *iov)
+{
+    if (!s->priv->zerocopy || iov->iov_len < RED_STREAM_ZEROCOPY_MIN_SIZE) {
+        return nullptr;
+    }
+
+    auto data = static_cast<const uint8_t *>(iov->iov_base);
+    for (GList *l = s->priv->zerocopy_buffers.head; l != nullptr; l = l->next) {
+        auto buffer = static_cast<RedZeroCopyBuffer *>(l->data);
+        if (data >= buffer->data && data + iov->iov_len <= buffer->data + buffer->size) {
+            return buffer;
+        }
+    }
+    return nullptr;
+}
+
+static ssize_t zerocopy_send(RedStream *s, RedZeroCopyBuffer *buffer, const struct iovec *iov)
+{
+    struct msghdr msg = {};
+    ssize_t n;
+
+    msg.msg_iov = const_cast<struct iovec *>(iov);
+    msg.msg_iovlen = 1;
+    n = sendmsg(s->socket, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    if (n < 0 && errno == ENOBUFS) {
+        /* not enough memory to pin the pages, copy the data */
+        return socket_writev(s->socket, iov, 1);
+    }
+    if (n > 0) {
+        auto send = g_new(ZeroCopySend, 1);
+        send->id = s->priv->zerocopy_next_id++;
+        send->buffer = buffer;
+        buffer->pending++;
+        g_queue_push_tail(&s->priv->zerocopy_sends, send);
+    }
+    return n;
+}
+
+/* Same as stream_writev_cb but registered buffers are sent with MSG_ZEROCOPY,
+ * every other data is grouped and sent normally */
+static ssize_t stream_zerocopy_writev_cb(RedStream *s, const struct iovec *iov, int iovcnt)
+{
+    ssize_t ret = 0;
+    int i = 0;
+
+    red_stream_zerocopy_poll(s);
+
+    while (i < iovcnt) {
+        RedZeroCopyBuffer *buffer = zerocopy_find_buffer(s, &iov[i]);
+        ssize_t n, expected = 0;
+
+        if (buffer) {
+            expected = iov[i].iov_len;
+            n = zerocopy_send(s, buffer, &iov[i]);
+            i++;
+        } else {
+            int start = i;
+            do {
+                expected += iov[i].iov_len;
+                i++;
+            } while (i < iovcnt && i - start < IOV_MAX && !zerocopy_find_buffer(s, &iov[i]));
+            n = socket_writev(s->socket, &iov[start], i - start);
+        }
+        if (n < expected) {
+            if (n > 0) {
+                ret += n;
+            }
+            return ret == 0 ? n : ret;
+        }
+        ret += n;
+    }
+
+    return ret;
+}
+
+/* The kernel completed the sends with id from @first to @last included */
+static void zerocopy_complete(RedStream *s, uint32_t first, uint32_t last)
+{
+    GList *l = s->priv->zerocopy_sends.head;
+
+    while (l != nullptr) {
+        GList *next = l->next;
+        auto send = static_cast<ZeroCopySend *>(l->data);
+
+        /* ids wrap around, compare the offsets from the range start */
+        if (send->id - first <= last - first) {
+            RedZeroCopyBuffer *buffer = send->buffer;
+
+            g_queue_delete_link(&s->priv->zerocopy_sends, l);
+            g_free(send);
+            if (--buffer->pending == 0 && buffer->released) {
+                zerocopy_buffer_free(buffer);
+            }
+        }
+        l = next;
+    }
+}
+
+/* reset the connection so the socket queue is purged on close */
+static void zerocopy_reset(RedStream *s)
+{
+    struct linger linger = { 1, 0 };
+
+    spice_debug("zero copy sends not completed, resetting the connection");
+    setsockopt(s->socket, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+}
+
+static void zerocopy_linger_timer(RedStream *s)
+{
+    red_stream_zerocopy_poll(s);
+    if (!g_queue_is_empty(&s->priv->zerocopy_sends)) {
+        if (g_get_monotonic_time() < s->priv->zerocopy_linger_end) {
+            red_timer_start(s->priv->zerocopy_linger_timer, ZEROCOPY_LINGER_POLL_MS);
+            return;
+        }
+        zerocopy_reset(s);
+    }
+    red_timer_remove(s->priv->zerocopy_linger_timer);
+    stream_close(s);
+}
+
+/* Until the data is acknowledged by the peer the socket queue keeps
+ * referencing the pages of the buffers, also after the socket is closed.
+ * Rather than blocking the thread, keep the socket open and check the
+ * completions from a timer, if the peer is not reading reset the
+ * connection after a while. Returns true if the stream will be closed
+ * by the timer */
+static bool zerocopy_linger(RedStream *s)
+{
+    red_stream_zerocopy_poll(s);
+    if (g_queue_is_empty(&s->priv->zerocopy_sends)) {
+        return false;
+    }
+
+    s->priv->zerocopy_linger_timer = s->priv->core->timer_new(zerocopy_linger_timer, s);
+    if (!s->priv->zerocopy_linger_timer) {
+        zerocopy_reset(s);
+        return false;
+    }
+    s->priv->zerocopy_linger_end = g_get_monotonic_time() + ZEROCOPY_LINGER_MS * 1000;
+    red_timer_start(s->priv->zerocopy_linger_timer, ZEROCOPY_LINGER_POLL_MS);
+    return true;
+}
+#endif
+
+#ifndef _WIN32
+static void sender_notify(int fd)
+{
+    const uint8_t c = 0;
+    /* if the socket is full the other side has still to be woken up */
+    while (write(fd, &c, sizeof(c)) < 0 && errno == EINTR) {
+        continue;
+    }
+}
+
+static void sender_drain(int fd)
+{
+    uint8_t buf[64];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0 && !(n < 0 && errno == EINTR)) {
+            break;
+        }
+    }
+}
+
+/* Wait for data to send, or for the thread to quit */
+static void sender_wait_data(RedStreamSender *sender)
+{
+    /* set the flag then check again, either the stream user sees the
+     * flag or the thread sees the data */
+    sender->idle = true;
+    if (!sender->quit && (sender->error || sender->head == sender->tail)) {
+        struct pollfd pfd = { sender->notify_fds[1], POLLIN, 0 };
+        poll(&pfd, 1, -1);
+        sender_drain(sender->notify_fds[1]);
+    }
+    sender->idle = false;
+}
+
+static void *stream_sender_main(void *opaque)
+{
+    auto sender = static_cast<RedStreamSender *>(opaque);
+    const int socket = sender->stream->socket;
+
+    while (!sender->quit) {
+        const uint32_t tail = sender->tail.load(std::memory_order_relaxed);
+        const uint32_t len = sender->head - tail;
+
+        if (len == 0 || sender->error) {
+            sender_wait_data(sender);
+            continue;
+        }
+
+        const uint32_t offset = tail % SENDER_QUEUE_SIZE;
+        ssize_t n = send(socket, sender->queue + offset,
+                         MIN(len, SENDER_QUEUE_SIZE - offset), MSG_NOSIGNAL);
+        int err = n < 0 ? errno : 0;
+        if (n > 0) {
+            sender->tail = tail + n;
+        } else if (err == EAGAIN) {
+            struct pollfd fds[2] = {
+                { socket, POLLOUT, 0 },
+                { sender->notify_fds[1], POLLIN, 0 },
+            };
+            poll(fds, G_N_ELEMENTS(fds), -1);
+            if (fds[1].revents & POLLIN) {
+                sender_drain(sender->notify_fds[1]);
+            }
+            continue;
+        } else if (err != EINTR) {
+            sender->error = err ? err : EPIPE;
+        }
+
+        if (sender->waiting &&
+            (sender->error || sender->head - sender->tail <= SENDER_QUEUE_SIZE / 2) &&
+            sender->waiting.exchange(false)) {
+            sender_notify(sender->notify_fds[1]);
+        }
+    }
+
+    return nullptr;
+}
+
+/* Copy the data at the head of the queue, the thread does not access the
+ * space between head and tail + SENDER_QUEUE_SIZE */
+static ssize_t sender_queue_data(RedStreamSender *sender, const struct iovec *iov, int iovcnt)
+{
+    const uint32_t head = sender->head.load(std::memory_order_relaxed);
+    const uint32_t room = SENDER_QUEUE_SIZE - (head - sender->tail);
+    uint32_t queued = 0;
+
+    for (int i = 0; i < iovcnt && queued < room; i++) {
+        auto data = static_cast<const uint8_t *>(iov[i].iov_base);
+        size_t size = MIN(iov[i].iov_len, room - queued);
+
+        while (size > 0) {
+            const uint32_t offset = (head + queued) % SENDER_QUEUE_SIZE;
+            const uint32_t now = MIN(size, SENDER_QUEUE_SIZE - offset);
+            memcpy(sender->queue + offset, data, now);
+            data += now;
+            size -= now;
+            queued += now;
+        }
+    }
+    if (queued > 0) {
+        sender->head = head + queued;
+    }
+    return queued;
+}
+
+static ssize_t stream_sender_writev_cb(RedStream *s, const struct iovec *iov, int iovcnt)
+{
+    RedStreamSender *sender = s->priv->sender;
+    int error = sender->error;
+
+    if (error) {
+        errno = error;
+        return -1;
+    }
+
+    ssize_t ret = sender_queue_data(sender, iov, iovcnt);
+    if (ret == 0) {
+        /* set the flag then check again, either the thread sees the flag
+         * or the stream user sees the room made */
+        sender->waiting = true;
+        ret = sender_queue_data(sender, iov, iovcnt);
+        if (ret == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        sender->waiting = false;
+    }
+    if (sender->idle && sender->idle.exchange(false)) {
+        sender_notify(sender->notify_fds[0]);
+    }
+    return ret;
+}
+
+static ssize_t stream_sender_write_cb(RedStream *s, const void *buf, size_t size)
+{
+    struct iovec iov = { const_cast<void *>(buf), size };
+
+    return stream_sender_writev_cb(s, &iov, 1);
+}
+
+static void stream_sender_free(RedStreamSender *sender)
+{
+    sender->quit = true;
+    /* wake up the thread if it's waiting for data or for the socket */
+    sender_notify(sender->notify_fds[0]);
+    pthread_join(sender->thread, nullptr);
+
+    socket_close(sender->notify_fds[0]);
+    socket_close(sender->notify_fds[1]);
+    g_free(sender->queue);
+    delete sender;
+}
+#endif
+
 static ssize_t stream_read_cb(RedStream *s, void *buf, size_t size)
 {
     return socket_read(s->socket, buf, size);
@@ -185,17 +594,88 @@ static ssize_t stream_ssl_error(RedStream *s, int return_code)
     return -1;
 }
 
-static ssize_t stream_ssl_write_cb(RedStream *s, const void *buf, size_t size)
+/* maximum plaintext size of a TLS record */
+#define SSL_RECORD_SIZE (16 * 1024)
+
+/* Write the buffers with a SSL_write() for each record, small buffers are
+ * gathered instead of producing a record for each of them.
+ * If SSL_write() has to be retried the caller passes the same data again
+ * as it did not advance, it must be retried with the same length */
+static ssize_t stream_ssl_writev_cb(RedStream *s, const struct iovec *iov, int iovcnt)
 {
-    int return_code;
+    RedStreamPrivate *priv = s->priv;
+    size_t offset = 0;
+    ssize_t written = 0;
+
+    while (iovcnt > 0) {
+        if (offset == iov->iov_len) {
+            iov++;
+            iovcnt--;
+            offset = 0;
+            continue;
+        }
 
-    return_code = SSL_write(s->priv->ssl, buf, size);
+        size_t max_len = priv->ssl_retry_len ? priv->ssl_retry_len : SSL_RECORD_SIZE;
+        const uint8_t *data;
+        size_t len;
 
-    if (return_code < 0) {
-        return stream_ssl_error(s, return_code);
+        if (iov->iov_len - offset >= max_len) {
+            /* large buffers are written in place */
+            data = static_cast<const uint8_t *>(iov->iov_base) + offset;
+            len = max_len;
+        } else {
+            if (!priv->ssl_record_buf) {
+                priv->ssl_record_buf = static_cast<uint8_t *>(g_malloc(SSL_RECORD_SIZE));
+            }
+            len = 0;
+            size_t buf_offset = offset;
+            for (int i = 0; i < iovcnt && len < max_len; i++) {
+                size_t now = MIN(iov[i].iov_len - buf_offset, max_len - len);
+                memcpy(priv->ssl_record_buf + len,
+                       static_cast<const uint8_t *>(iov[i].iov_base) + buf_offset, now);
+                len += now;
+                buf_offset = 0;
+            }
+            data = priv->ssl_record_buf;
+        }
+
+        int return_code = SSL_write(priv->ssl, data, len);
+        if (return_code <= 0) {
+            int ssl_error = SSL_get_error(priv->ssl, return_code);
+            if (ssl_error == SSL_ERROR_WANT_WRITE || ssl_error == SSL_ERROR_WANT_READ) {
+                priv->ssl_retry_len = len;
+            }
+            if (written > 0) {
+                return written;
+            }
+            return return_code < 0 ? stream_ssl_error(s, return_code) : 0;
+        }
+        priv->ssl_retry_len = 0;
+        written += return_code;
+
+        /* without SSL_MODE_ENABLE_PARTIAL_WRITE the record is fully written */
+        while (len > 0) {
+            size_t now = MIN(iov->iov_len - offset, len);
+            offset += now;
+            len -= now;
+            if (offset == iov->iov_len) {
+                iov++;
+                iovcnt--;
+                offset = 0;
+            }
+        }
     }
 
-    return return_code;
+    return written;
+}
+
+static ssize_t stream_ssl_write_cb(RedStream *s, const void *buf, size_t size)
+{
+    struct iovec iov;
+
+    iov.iov_base = const_cast<void *>(buf);
+    iov.iov_len = size;
+    return stream_ssl_writev_cb(s, &iov, 1);
 }
 
 static ssize_t stream_ssl_read_cb(RedStream *s, void *buf, size_t size)
@@ -258,6 +738,12 @@ bool red_stream_set_auto_flush(RedStream *s, bool auto_flush)
     if (s->priv->use_cork == !auto_flush) {
         return true;
     }
+#ifndef _WIN32
+    /* the data is sent asynchronously, there's no point to flush */
+    if (s->priv->sender && !auto_flush) {
+        return false;
+    }
+#endif
 
     s->priv->use_cork = !auto_flush;
     if (s->priv->use_cork) {
@@ -398,7 +884,7 @@ ssize_t red_stream_writev(RedStream *s, const struct iovec *iov, int iovcnt)
     int n;
     ssize_t ret = 0;
 
-    if (s->priv->writev != nullptr && iovcnt > 1) {
+    if (s->priv->writev != nullptr && (iovcnt > 1 || s->priv->zerocopy)) {
         return s->priv->writev(s, iov, iovcnt);
     }
 
@@ -433,10 +919,43 @@ void red_stream_free(RedStream *s)
     if (s->priv->ssl) {
         SSL_free(s->priv->ssl);
     }
+    g_free(s->priv->ssl_record_buf);
 
     websocket_free(s->priv->ws);
 
+#ifndef _WIN32
+    if (s->priv->sender) {
+        stream_sender_free(s->priv->sender);
+    }
+#endif
+
     red_stream_remove_watch(s);
+
+#ifdef RED_STREAM_HAVE_ZEROCOPY
+    if (zerocopy_linger(s)) {
+        return;
+    }
+#endif
+    stream_close(s);
+}
+
+/* Close the socket and free the stream, once the socket is closed no
+ * more completions can be received, either all the sends are completed
+ * or the queued data was purged by the connection reset */
+static void stream_close(RedStream *s)
+{
+    g_queue_clear_full(&s->priv->zerocopy_sends, g_free);
+    while (!g_queue_is_empty(&s->priv->zerocopy_buffers)) {
+        auto buffer = static_cast<RedZeroCopyBuffer *>(g_queue_peek_head(&s->priv->zerocopy_buffers));
+        buffer->pending = 0;
+        if (buffer->released) {
+            zerocopy_buffer_free(buffer);
+        } else {
+            g_queue_unlink(&s->priv->zerocopy_buffers, &buffer->link);
+            buffer->stream = nullptr;
+        }
+    }
+
     socket_close(s->socket);
 
     g_free(s);
@@ -508,11 +1027,211 @@ bool red_stream_is_ssl(RedStream *stream)
     return (stream->priv->ssl != nullptr);
 }
 
+bool red_stream_is_ktls(RedStream *stream)
+{
+    return stream->priv->ktls;
+}
+
 static void red_stream_disable_writev(RedStream *stream)
 {
     stream->priv->writev = nullptr;
 }
 
+bool red_stream_enable_zerocopy(RedStream *stream)
+{
+#ifdef RED_STREAM_HAVE_ZEROCOPY
+    int enable = 1;
+
+    /* SSL, SASL and websockets need to transform the data, kernel TLS
+     * does not accept MSG_ZEROCOPY */
+    if (stream->priv->writev != stream_writev_cb || stream->priv->ktls) {
+        return false;
+    }
+    if (setsockopt(stream->socket, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0) {
+        spice_debug("zero copy not supported: %s", strerror(errno));
+        return false;
+    }
+    stream->priv->writev = stream_zerocopy_writev_cb;
+    stream->priv->zerocopy = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool red_stream_is_zerocopy(RedStream *stream)
+{
+    return stream->priv->zerocopy;
+}
+
+bool red_stream_enable_sender(RedStream *stream)
+{
+#ifndef _WIN32
+    RedStreamSender *sender;
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+    int r;
+
+    /* SSL, SASL and websockets keep state shared with the reads, with
+     * kernel TLS OpenSSL still writes alerts and key updates to the socket
+     * while reading. File descriptors passed on Unix sockets must be
+     * ordered with the data */
+    if (stream->priv->writev != stream_writev_cb || stream->priv->ssl ||
+        red_stream_get_family(stream) == AF_UNIX) {
+        return false;
+    }
+
+    sender = new RedStreamSender();
+    if (socketpair(AF_LOCAL, SOCK_STREAM, 0, sender->notify_fds) == -1) {
+        spice_warning("socketpair failed %s", strerror(errno));
+        delete sender;
+        return false;
+    }
+    red_socket_set_non_blocking(sender->notify_fds[0], true);
+    red_socket_set_non_blocking(sender->notify_fds[1], true);
+    sender->stream = stream;
+    sender->queue = static_cast<uint8_t *>(g_malloc(SENDER_QUEUE_SIZE));
+
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+    r = pthread_create(&sender->thread, nullptr, stream_sender_main, sender);
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, nullptr);
+    if (r) {
+        spice_warning("create sender thread failed %d", r);
+        socket_close(sender->notify_fds[0]);
+        socket_close(sender->notify_fds[1]);
+        g_free(sender->queue);
+        delete sender;
+        return false;
+    }
+#if !defined(__APPLE__)
+    pthread_setname_np(sender->thread, "SPICE Sender");
+#endif
+
+    red_stream_set_auto_flush(stream, true);
+    stream->priv->sender = sender;
+    stream->priv->write = stream_sender_write_cb;
+    stream->priv->writev = stream_sender_writev_cb;
+    return true;
+#else
+    return false;
+#endif
+}
+
+int red_stream_get_sender_fd(RedStream *stream)
+{
+#ifndef _WIN32
+    if (stream->priv->sender) {
+        return stream->priv->sender->notify_fds[0];
+    }
+#endif
+    return -1;
+}
+
+void red_stream_sender_ack(RedStream *stream)
+{
+#ifndef _WIN32
+    if (stream->priv->sender) {
+        sender_drain(stream->priv->sender->notify_fds[0]);
+    }
+#endif
+}
+
+RedZeroCopyBuffer *red_stream_zerocopy_buffer_new(RedStream *stream,
+                                                  uint8_t *data, size_t size,
+                                                  RedZeroCopyFree free_cb, void *opaque)
+{
+    auto buffer = g_new0(RedZeroCopyBuffer, 1);
+
+    buffer->link.data = buffer;
+    buffer->stream = stream;
+    buffer->data = data;
+    buffer->size = size;
+    buffer->free_cb = free_cb;
+    buffer->opaque = opaque;
+    g_queue_push_tail_link(&stream->priv->zerocopy_buffers, &buffer->link);
+    return buffer;
+}
+
+void red_stream_zerocopy_buffer_release(RedZeroCopyBuffer *buffer)
+{
+    buffer->released = true;
+    if (buffer->pending == 0) {
+        zerocopy_buffer_free(buffer);
+        return;
+    }
+    /* the buffer could be freed by the completion */
+    red_stream_zerocopy_poll(buffer->stream);
+}
+
+void red_stream_zerocopy_poll(RedStream *stream)
+{
+#ifdef RED_STREAM_HAVE_ZEROCOPY
+    while (!g_queue_is_empty(&stream->priv->zerocopy_sends)) {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+        struct msghdr msg = {};
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(stream->socket, &msg, MSG_ERRQUEUE) < 0) {
+            /* EAGAIN, no more completions for now */
+            return;
+        }
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            auto err = reinterpret_cast<const struct sock_extended_err *>(CMSG_DATA(cmsg));
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                /* the kernel had to copy the data anyway (for instance on
+                 * loopback), pinning the pages only adds overhead */
+                if (stream->priv->zerocopy) {
+                    spice_debug("zero copy sends are copied, disabling");
+                    stream->priv->zerocopy = false;
+                }
+            }
+            zerocopy_complete(stream, err->ee_info, err->ee_data);
+        }
+    }
+#endif
+}
+
+bool red_stream_ssl_ctx_enable_ktls(SSL_CTX *ctx)
+{
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Once the handshake is done, if OpenSSL managed to pass the keys to the
+ * kernel, write to the socket directly. Reads still use OpenSSL which
+ * handles the non data records */
+static void stream_ssl_check_ktls(RedStream *stream)
+{
+#ifdef BIO_get_ktls_send
+    if (!BIO_get_ktls_send(SSL_get_wbio(stream->priv->ssl))) {
+        return;
+    }
+
+    spice_debug("using kernel TLS to send");
+    stream->priv->ktls = true;
+    stream->priv->write = stream_write_cb;
+    stream->priv->writev = stream_writev_cb;
+#endif
+}
+
 RedStreamSslStatus red_stream_ssl_accept(RedStream *stream)
 {
     int ssl_error;
@@ -520,6 +1239,7 @@ RedStreamSslStatus red_stream_ssl_accept(RedStream *stream)
 
     return_code = SSL_accept(stream->priv->ssl);
     if (return_code == 1) {
+        stream_ssl_check_ktls(stream);
         return RED_STREAM_SSL_STATUS_OK;
     }
 
@@ -563,10 +1283,13 @@ RedStreamSslStatus red_stream_enable_ssl(RedStream *stream, SSL_CTX *ctx)
     }
 
     SSL_set_bio(stream->priv->ssl, sbio, sbio);
+    /* a write is retried with the same data but not always from the
+     * same buffer, see stream_ssl_writev_cb */
+    SSL_set_mode(stream->priv->ssl, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
     stream->priv->write = stream_ssl_write_cb;
     stream->priv->read = stream_ssl_read_cb;
-    red_stream_disable_writev(stream);
+    stream->priv->writev = stream_ssl_writev_cb;
 
     return red_stream_ssl_accept(stream);
 }
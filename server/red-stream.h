@@ -38,6 +38,9 @@ struct RedStream {
     RedStreamPrivate *priv;
 };
 
+/* Let the kernel encrypt the TLS connections when supported */
+#define RED_STREAM_KTLS_ENV "SPICE_KTLS"
+
 typedef enum {
     RED_STREAM_SSL_STATUS_OK,
     RED_STREAM_SSL_STATUS_ERROR,
@@ -65,6 +68,13 @@ void red_stream_set_core_interface(RedStream *stream, SpiceCoreInterfaceInternal
 bool red_stream_is_ssl(RedStream *stream);
 RedStreamSslStatus red_stream_ssl_accept(RedStream *stream);
 RedStreamSslStatus red_stream_enable_ssl(RedStream *stream, SSL_CTX *ctx);
+/* Request kernel TLS for the connections using 'ctx'.
+ * Returns false if OpenSSL does not support it. If the kernel or the
+ * negotiated cipher does not support it either the streams keep
+ * using OpenSSL to encrypt */
+bool red_stream_ssl_ctx_enable_ktls(SSL_CTX *ctx);
+/* Whether the kernel encrypts the data written */
+bool red_stream_is_ktls(RedStream *stream);
 int red_stream_get_family(const RedStream *stream);
 bool red_stream_is_plain_unix(const RedStream *stream);
 bool red_stream_set_no_delay(RedStream *stream, bool no_delay);
@@ -95,6 +105,59 @@ void red_stream_flush(RedStream *stream);
 
 bool red_stream_is_websocket(RedStream *stream, const void *buf, size_t len);
 
+/* Buffers smaller than this are not worth pinning, copying them is cheaper */
+#define RED_STREAM_ZEROCOPY_MIN_SIZE (64 * 1024)
+
+typedef struct RedZeroCopyBuffer RedZeroCopyBuffer;
+typedef void (*RedZeroCopyFree)(uint8_t *data, void *opaque);
+
+/**
+ * Try to enable zero copy send (MSG_ZEROCOPY) on the stream.
+ * Only plain sockets are supported, streams using SSL, SASL or
+ * websockets are left unchanged.
+ *
+ * Returns true if zero copy is enabled.
+ */
+bool red_stream_enable_zerocopy(RedStream *stream);
+bool red_stream_is_zerocopy(RedStream *stream);
+
+/**
+ * Register a buffer that can be sent without copying it.
+ * The data will be passed to red_stream_writev as usual, however
+ * the kernel can keep using the memory after the write returned.
+ * Once the caller does not need the buffer anymore it should call
+ * red_stream_zerocopy_buffer_release, free_cb will be called
+ * when the kernel has completed all the transmissions.
+ */
+RedZeroCopyBuffer *red_stream_zerocopy_buffer_new(RedStream *stream,
+                                                  uint8_t *data, size_t size,
+                                                  RedZeroCopyFree free_cb, void *opaque);
+void red_stream_zerocopy_buffer_release(RedZeroCopyBuffer *buffer);
+
+/**
+ * Process the zero copy completions queued by the kernel releasing
+ * the buffers not used anymore.
+ * Should be called when the socket reports an error condition.
+ */
+void red_stream_zerocopy_poll(RedStream *stream);
+
+/**
+ * Write the data of the stream from a separate thread.
+ * The writes only copy the data to a queue so a slow peer does not
+ * block the caller, they fail with EAGAIN when the queue is full.
+ * The file descriptor returned by red_stream_get_sender_fd becomes
+ * readable when there's room again, red_stream_sender_ack should
+ * then be called.
+ * Only plain TCP sockets are supported, not TLS ones also when the
+ * kernel encrypts the data.
+ *
+ * Returns true if the thread is started.
+ */
+bool red_stream_enable_sender(RedStream *stream);
+/* Returns -1 if the stream does not use a sender thread */
+int red_stream_get_sender_fd(RedStream *stream);
+void red_stream_sender_ack(RedStream *stream);
+
 typedef enum {
     RED_SASL_ERROR_OK,
     RED_SASL_ERROR_GENERIC,
@@ -82,6 +82,8 @@ struct RedWorker {
     RedStatCounter command_counter;
     RedStatCounter full_loop_counter;
     RedStatCounter total_loop_counter;
+    /* time to get and parse a drawing command */
+    RedStatHistogram fetch_histogram;
 
     bool driver_cap_monitors_config;
 
@@ -172,6 +174,7 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
     worker->process_display_generation++;
     *ring_is_empty = FALSE;
     while (worker->display_channel->max_pipe_size() <= MAX_PIPE_SIZE) {
+        stat_time_t fetch_start = stat_histogram_start();
         if (!red_qxl_get_command(worker->qxl, &ext_cmd)) {
             *ring_is_empty = TRUE;
             if (worker->display_poll_tries < CMD_RING_POLL_RETRIES) {
@@ -197,6 +200,7 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
                                                  ext_cmd.flags); // returns with 1 ref
 
             if (red_drawable) {
+                stat_histogram_add(&worker->fetch_histogram, fetch_start);
                 display_channel_process_draw(worker->display_channel, std::move(red_drawable),
                                              worker->process_display_generation);
             }
@@ -252,6 +256,20 @@ static bool red_process_is_blocked(RedWorker *worker)
            worker->display_channel->max_pipe_size() > MAX_PIPE_SIZE;
 }
 
+/* Disconnect the clients which could not empty their pipe in time,
+ * the faster clients of the channel are kept */
+static void disconnect_slow_clients(RedChannel *red_channel)
+{
+    RedChannelClient *rcc;
+
+    FOREACH_CLIENT(red_channel, rcc) {
+        if (rcc->get_pipe_size() > MAX_PIPE_SIZE) {
+            red_channel_warning(red_channel, "flush timeout, disconnecting client %p", rcc);
+            rcc->disconnect();
+        }
+    }
+}
+
 using red_process_t = int (*)(RedWorker *worker, int *ring_is_empty);
 static void flush_commands(RedWorker *worker, RedChannel *red_channel,
                            red_process_t process)
@@ -280,14 +298,8 @@ static void flush_commands(RedWorker *worker, RedChannel *red_channel,
             }
             red_channel->receive();
             red_channel->send();
-            // TODO: MC: the whole timeout will break since it takes lowest timeout, should
-            // do it client by client.
             if (spice_get_monotonic_time_ns() >= end_time) {
-                // TODO: we need to record the client that actually causes the timeout.
-                // So we need to check the locations of the various pipe heads when counting,
-                // and disconnect only those/that.
-                spice_warning("flush timeout");
-                red_channel->disconnect();
+                disconnect_slow_clients(red_channel);
             } else {
                 usleep(DISPLAY_CLIENT_RETRY_INTERVAL);
             }
@@ -307,8 +319,7 @@ static void flush_cursor_commands(RedWorker *worker)
                    red_process_cursor);
 }
 
-// TODO: on timeout, don't disconnect all channels immediately - try to disconnect the slowest ones
-// first and maybe turn timeouts to several timeouts in order to disconnect channels gradually.
+// TODO: maybe turn timeouts to several timeouts in order to disconnect channels gradually.
 // Should use disconnect or shutdown?
 static void flush_all_qxl_commands(RedWorker *worker)
 {
@@ -917,12 +928,19 @@ static gboolean worker_source_dispatch(GSource *source, GSourceFunc callback,
 
     /* TODO: could use its own source */
     video_stream_timeout(display);
+    video_stream_push_encoded_frames(display);
 
     worker->event_timeout = INF_EVENT_WAIT;
     worker->was_blocked = FALSE;
     red_process_cursor(worker, &ring_is_empty);
     red_process_display(worker, &ring_is_empty);
 
+    /* nothing wakes up the worker when the pipe of a lagging client
+     * drains, poll until its damage is sent */
+    if (display_channel_push_damage(display)) {
+        worker->event_timeout = MIN(worker->event_timeout, CMD_RING_POLL_TIMEOUT);
+    }
+
     return TRUE;
 }
 
@@ -965,6 +983,7 @@ RedWorker* red_worker_new(QXLInstance *qxl)
     stat_init_counter(&worker->command_counter, reds, &worker->stat, "commands", TRUE);
     stat_init_counter(&worker->full_loop_counter, reds, &worker->stat, "full_loops", TRUE);
     stat_init_counter(&worker->total_loop_counter, reds, &worker->stat, "total_loops", TRUE);
+    stat_init_histogram(&worker->fetch_histogram, reds, &worker->stat, "fetch", TRUE);
 
     worker->dispatch_watch = dispatcher->create_watch(&worker->core);
     spice_assert(worker->dispatch_watch != nullptr);
@@ -29,6 +29,7 @@
 #include "stat-file.h"
 #include "red-record-qxl.h"
 #include "safe-list.hpp"
+#include "ticket-key-pool.h"
 
 #define MIGRATE_TIMEOUT (MSEC_PER_SEC * 10)
 #define MM_TIME_DELTA 400 /*ms*/
@@ -41,7 +42,6 @@ struct TicketAuthentication {
 struct TicketInfo {
     EVP_PKEY *rsa;
     int rsa_size;
-    BIGNUM *bn;
     SpiceLinkEncryptedTicket encrypted_ticket;
 };
 
@@ -117,6 +117,7 @@ struct RedsState {
     int seamless_migration_enabled; /* command line arg */
 
     SSL_CTX *ctx;
+    TicketKeyPool *ticket_key_pool;
 
 #ifdef RED_STATISTICS
     RedStatFile *stat_file;
@@ -39,7 +39,6 @@
 #include <ws2tcpip.h>
 #endif
 
-#include <openssl/bn.h>
 #include <openssl/err.h>
 #include <openssl/rsa.h>
 
@@ -82,7 +81,7 @@
 #include "net-utils.h"
 #include "red-stream-device.h"
 
-#define REDS_MAX_STAT_NODES 100
+#define REDS_MAX_STAT_NODES 4096
 
 static void reds_client_monitors_config(RedsState *reds, VDAgentMonitorsConfig *monitors_config);
 static gboolean reds_use_client_monitors_config(RedsState *reds);
@@ -268,9 +267,6 @@ static void reds_link_free(RedLinkInfo *link)
     g_free(link->link_mess);
     link->link_mess = nullptr;
 
-    BN_free(link->tiTicketing.bn);
-    link->tiTicketing.bn = nullptr;
-
     if (link->tiTicketing.rsa) {
         EVP_PKEY_free(link->tiTicketing.rsa);
         link->tiTicketing.rsa = nullptr;
@@ -312,6 +308,36 @@ void stat_remove_counter(SpiceServer *reds, RedStatCounter *counter)
     }
 }
 
+void stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                         const RedStatNode *parent, const char *name, int visible)
+{
+    RedStatNode node;
+    char bucket_name[16];
+
+    memset(histogram, 0, sizeof(*histogram));
+    stat_init_node(&node, reds, parent, name, visible);
+    if (node.ref == INVALID_STAT_REF) {
+        return;
+    }
+
+    /* the names are zero padded as the nodes are sorted by name */
+    for (unsigned int i = 0; i < STAT_HISTOGRAM_BUCKETS; i++) {
+        if (i < STAT_HISTOGRAM_BUCKETS - 1) {
+            snprintf(bucket_name, sizeof(bucket_name), "<%07uus", 1u << i);
+        } else {
+            snprintf(bucket_name, sizeof(bucket_name), ">=%07uus", 1u << (i - 1));
+        }
+        histogram->buckets[i] =
+            stat_file_add_counter(reds->stat_file, node.ref, bucket_name, visible);
+    }
+    histogram->total = stat_file_add_counter(reds->stat_file, node.ref, "total_us", visible);
+
+    /* stat_histogram_add_time checks only the buckets */
+    if (!histogram->total) {
+        memset(histogram, 0, sizeof(*histogram));
+    }
+}
+
 #endif
 
 void reds_register_channel(RedsState *reds, RedChannel *channel)
@@ -1503,41 +1529,6 @@ static bool red_link_info_test_capability(const RedLinkInfo *link, uint32_t cap)
     return test_capability(caps, link->link_mess->num_common_caps, cap);
 }
 
-// Check for EVP_RSA_gen. EVP_RSA_gen was always defined as a macro in <openssl/rsa.h>
-// and it's still so in OpenSSL 3.0 so checking for macro existence is a good way.
-#if OPENSSL_VERSION_NUMBER < 0x30000000L && !defined(EVP_RSA_gen)
-static EVP_PKEY *EVP_RSA_gen(unsigned int bits, BIGNUM *rsa_exponent)
-{
-    RSA *rsa = RSA_new();
-    if (!rsa) {
-        return nullptr;
-    }
-
-    if (RSA_generate_key_ex(rsa, SPICE_TICKET_KEY_PAIR_LENGTH,
-                            rsa_exponent, nullptr) != 1) {
-        RSA_free(rsa);
-        return nullptr;
-    }
-
-    EVP_PKEY *pk = EVP_PKEY_new();
-    if (!pk) {
-        RSA_free(rsa);
-        return nullptr;
-    }
-
-    if (!EVP_PKEY_set1_RSA(pk, rsa)) {
-        EVP_PKEY_free(pk);
-        RSA_free(rsa);
-        return nullptr;
-    }
-
-    RSA_free(rsa);
-    return pk;
-}
-
-#define EVP_RSA_gen(bits) EVP_RSA_gen(bits, (link->tiTicketing.bn))
-#endif
-
 static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
 {
     struct {
@@ -1588,7 +1579,7 @@ static bool reds_send_link_ack(RedsState *reds, RedLinkInfo *link)
             return FALSE;
         }
 
-        link->tiTicketing.rsa = EVP_RSA_gen(SPICE_TICKET_KEY_PAIR_LENGTH);
+        link->tiTicketing.rsa = ticket_key_pool_get(reds->ticket_key_pool);
         if (!link->tiTicketing.rsa) {
             spice_warning("Failed to generate %d bits RSA key",
                           SPICE_TICKET_KEY_PAIR_LENGTH);
@@ -1867,19 +1858,6 @@ static void reds_handle_main_link(RedsState *reds, RedLinkInfo *link)
     }
 }
 
-static void openssl_init(RedLinkInfo *link)
-{
-    unsigned long f4 = RSA_F4;
-    link->tiTicketing.bn = BN_new();
-
-    if (!link->tiTicketing.bn) {
-        red_dump_openssl_errors();
-        spice_error("OpenSSL BIGNUMS alloc failed");
-    }
-
-    BN_set_word(link->tiTicketing.bn, f4);
-}
-
 static void reds_channel_do_link(RedChannel *channel, RedClient *client,
                                  SpiceLinkMess *link_msg,
                                  RedStream *stream)
@@ -2397,8 +2375,6 @@ static RedLinkInfo *reds_init_client_connection(RedsState *reds, int socket)
 
     red_stream_push_channel_event(link->stream, SPICE_CHANNEL_EVENT_CONNECTED);
 
-    openssl_init(link);
-
     return link;
 }
 
@@ -2827,6 +2803,9 @@ static int reds_init_ssl(RedsState *reds)
     }
 
     SSL_CTX_set_options(reds->ctx, ssl_options);
+    if (getenv(RED_STREAM_KTLS_ENV) && !red_stream_ssl_ctx_enable_ktls(reds->ctx)) {
+        spice_warning("kernel TLS is not supported by OpenSSL");
+    }
 #if HAVE_DECL_SSL_CTX_SET_ECDH_AUTO || defined(SSL_CTX_set_ecdh_auto)
     SSL_CTX_set_ecdh_auto(reds->ctx, 1);
 #endif
@@ -3456,6 +3435,7 @@ static int do_spice_init(RedsState *reds, SpiceCoreInterface *core_interface)
         goto err;
     }
 #endif
+    reds->ticket_key_pool = ticket_key_pool_new_from_env(reds, nullptr);
 
     reds->main_channel = main_channel_new(reds);
     reds->inputs_channel = inputs_channel_new(reds);
@@ -3778,6 +3758,10 @@ SPICE_GNUC_VISIBLE void spice_server_destroy(SpiceServer *reds)
     reds_disconnect(reds);
 
     std::for_each(reds->qxl_instances.begin(), reds->qxl_instances.end(), red_qxl_destroy);
+#if defined(HAVE_GSTREAMER_1_0) || defined(HAVE_GSTREAMER_0_10)
+    // the streams are gone with the workers, free their idle pipelines
+    gstreamer_encoder_clear_pipeline_pool();
+#endif
 
     if (reds->inputs_channel) {
         reds->inputs_channel->destroy();
@@ -3805,6 +3789,7 @@ SPICE_GNUC_VISIBLE void spice_server_destroy(SpiceServer *reds)
 
     spice_buffer_free(&reds->client_monitors_config);
     red_record_unref(reds->record);
+    ticket_key_pool_free(reds->ticket_key_pool);
     reds_cleanup(reds);
 #ifdef RED_STATISTICS
     stat_file_free(reds->stat_file);
@@ -17,10 +17,75 @@
 */
 #include <config.h>
 
+#include <pthread.h>
 #include <sys/stat.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GRADUAL_X86_SIMD
+#include <immintrin.h>
+#endif
 
 #include "spice-bitmap-utils.h"
 
+// samples scored at once by compute_lines_gradual_score_q
+#define GRADUAL_BATCH_SIZE 64
+
+#ifdef GRADUAL_X86_SIMD
+/* Vector versions of pixels_square_score_q for 4 or 8 squares. The pixels
+ * have a channel in each of the 3 low bytes, 'th' holds CONTRAST_TH - 1 in
+ * the same bytes. The score of a pair is 2 if the pixels are equal, 4 if
+ * they contrast and -1 otherwise */
+__attribute__((target("sse2")))
+static inline __m128i pair_score_sse2(__m128i a, __m128i b, __m128i th, __m128i *equal)
+{
+    __m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+    __m128i no_contrast = _mm_cmpeq_epi32(_mm_subs_epu8(diff, th), _mm_setzero_si128());
+
+    *equal = _mm_cmpeq_epi32(a, b);
+    return _mm_add_epi32(_mm_set1_epi32(-1),
+                         _mm_add_epi32(_mm_and_si128(*equal, _mm_set1_epi32(3)),
+                                       _mm_andnot_si128(no_contrast, _mm_set1_epi32(5))));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i square_score_sse2(__m128i pix, __m128i right, __m128i below,
+                                        __m128i below_right, __m128i th)
+{
+    __m128i eq1, eq2, eq3;
+    __m128i score = _mm_add_epi32(pair_score_sse2(pix, right, th, &eq1),
+                                  pair_score_sse2(pix, below, th, &eq2));
+
+    score = _mm_add_epi32(score, pair_score_sse2(pix, below_right, th, &eq3));
+    // ignore squares where all pixels are identical
+    return _mm_andnot_si128(_mm_and_si128(eq1, _mm_and_si128(eq2, eq3)), score);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pair_score_avx2(__m256i a, __m256i b, __m256i th, __m256i *equal)
+{
+    __m256i diff = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+    __m256i no_contrast = _mm256_cmpeq_epi32(_mm256_subs_epu8(diff, th),
+                                             _mm256_setzero_si256());
+
+    *equal = _mm256_cmpeq_epi32(a, b);
+    return _mm256_add_epi32(_mm256_set1_epi32(-1),
+                            _mm256_add_epi32(_mm256_and_si256(*equal, _mm256_set1_epi32(3)),
+                                             _mm256_andnot_si256(no_contrast,
+                                                                 _mm256_set1_epi32(5))));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i square_score_avx2(__m256i pix, __m256i right, __m256i below,
+                                        __m256i below_right, __m256i th)
+{
+    __m256i eq1, eq2, eq3;
+    __m256i score = _mm256_add_epi32(pair_score_avx2(pix, right, th, &eq1),
+                                     pair_score_avx2(pix, below, th, &eq2));
+
+    score = _mm256_add_epi32(score, pair_score_avx2(pix, below_right, th, &eq3));
+    return _mm256_andnot_si256(_mm256_and_si256(eq1, _mm256_and_si256(eq2, eq3)), score);
+}
+#endif
+
 #define RED_BITMAP_UTILS_RGB16
 #include "spice-bitmap-utils.tmpl.c"
 #define RED_BITMAP_UTILS_RGB24
@@ -36,8 +101,140 @@
 // in window media player 12). see red_stream_add_frame
 #define GRADUAL_MEDIUM_SCORE_TH 0.002
 
+// images with more lines are scored on GRADUAL_SAMPLE_BANDS bands of
+// GRADUAL_SAMPLE_BAND_LINES lines spread over the image
+#define GRADUAL_SAMPLE_MIN_LINES 1024
+#define GRADUAL_SAMPLE_BANDS 32
+#define GRADUAL_SAMPLE_BAND_LINES 16
+
+static BitmapGradualType graduality_from_score(uint8_t format, double score)
+{
+    if (format == SPICE_BITMAP_FMT_16BIT) {
+        if (score < GRADUAL_HIGH_RGB16_TH) {
+            return BITMAP_GRADUAL_HIGH;
+        }
+    } else {
+        if (score < GRADUAL_HIGH_RGB24_TH) {
+            return BITMAP_GRADUAL_HIGH;
+        }
+    }
+
+    if (score < GRADUAL_MEDIUM_SCORE_TH) {
+        return BITMAP_GRADUAL_MEDIUM;
+    }
+
+    return BITMAP_GRADUAL_LOW;
+}
+
+static pthread_once_t score_squares_once = PTHREAD_ONCE_INIT;
+
+static void score_squares_init(void)
+{
+#ifdef GRADUAL_X86_SIMD
+    __builtin_cpu_init();
+#endif
+    score_squares_init_rgb16();
+    score_squares_init_rgb24();
+    score_squares_init_rgb32();
+}
+
+static void compute_lines_gradual_score_q(uint8_t format, uint8_t *lines, int width,
+                                          int num_lines, int64_t *o_samples_sum_score,
+                                          int *o_num_samples)
+{
+    switch (format) {
+    case SPICE_BITMAP_FMT_16BIT:
+        compute_lines_gradual_score_q_rgb16((rgb16_pixel_t *)lines, width, num_lines,
+                                            o_samples_sum_score, o_num_samples);
+        break;
+    case SPICE_BITMAP_FMT_24BIT:
+        compute_lines_gradual_score_q_rgb24((rgb24_pixel_t *)lines, width, num_lines,
+                                            o_samples_sum_score, o_num_samples);
+        break;
+    case SPICE_BITMAP_FMT_32BIT:
+    case SPICE_BITMAP_FMT_RGBA:
+        compute_lines_gradual_score_q_rgb32((rgb32_pixel_t *)lines, width, num_lines,
+                                            o_samples_sum_score, o_num_samples);
+        break;
+    default:
+        spice_error("invalid bitmap format (not RGB) %u", format);
+    }
+}
+
+/* Score the lines of the bitmap or, if band_spacing is not 0, only the
+ * bands starting every band_spacing lines */
+static void bitmap_gradual_score(SpiceBitmap *bitmap, uint32_t band_spacing,
+                                 int64_t *o_score, int *o_num_samples)
+{
+    int bpp = bitmap_fmt_get_bytes_per_pixel(bitmap->format);
+    SpiceChunk *chunk = bitmap->data->chunk;
+    int64_t score = 0;
+    int num_samples = 0;
+    int64_t chunk_score = 0;
+    int chunk_num_samples = 0;
+    uint32_t line = 0;
+    uint32_t i;
+
+    for (i = 0; i < bitmap->data->num_chunks; i++) {
+        uint32_t num_lines = chunk[i].len / bitmap->stride;
+        uint32_t chunk_line = line;
+
+        line += num_lines;
+        if (!band_spacing) {
+            compute_lines_gradual_score_q(bitmap->format, chunk[i].data, bitmap->x, num_lines,
+                                          &chunk_score, &chunk_num_samples);
+            score += chunk_score;
+            num_samples += chunk_num_samples;
+            continue;
+        }
+        for (uint32_t band = chunk_line / band_spacing; band < GRADUAL_SAMPLE_BANDS; band++) {
+            uint32_t start = MAX(band * band_spacing, chunk_line);
+            uint32_t end = MIN(band * band_spacing + GRADUAL_SAMPLE_BAND_LINES,
+                               chunk_line + num_lines);
+            if (start >= chunk_line + num_lines) {
+                break;
+            }
+            // the lines of a chunk are scored in pairs
+            if (end < start + 2) {
+                continue;
+            }
+            compute_lines_gradual_score_q(bitmap->format,
+                                          chunk[i].data + (start - chunk_line) * bitmap->x * bpp,
+                                          bitmap->x, end - start,
+                                          &chunk_score, &chunk_num_samples);
+            score += chunk_score;
+            num_samples += chunk_num_samples;
+        }
+    }
+
+    *o_score = score;
+    *o_num_samples = num_samples;
+}
+
 // assumes that stride doesn't overflow
 BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
+{
+    uint32_t band_spacing = 0;
+    int64_t score = 0;
+    int num_samples = 0;
+
+    pthread_once(&score_squares_once, score_squares_init);
+
+    if (bitmap->y > GRADUAL_SAMPLE_MIN_LINES) {
+        band_spacing = bitmap->y / GRADUAL_SAMPLE_BANDS;
+        bitmap_gradual_score(bitmap, band_spacing, &score, &num_samples);
+    }
+    // the bands can be split in chunks of a single line
+    if (num_samples == 0) {
+        bitmap_gradual_score(bitmap, 0, &score, &num_samples);
+    }
+
+    spice_assert(num_samples);
+    return graduality_from_score(bitmap->format, score / 4.0 / num_samples);
+}
+
+// assumes that stride doesn't overflow
+BitmapGradualType bitmap_get_graduality_level_reference(SpiceBitmap *bitmap)
 {
     double score = 0.0;
     int num_samples = 0;
@@ -75,21 +272,7 @@ BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
     spice_assert(num_samples);
     score /= num_samples;
 
-    if (bitmap->format == SPICE_BITMAP_FMT_16BIT) {
-        if (score < GRADUAL_HIGH_RGB16_TH) {
-            return BITMAP_GRADUAL_HIGH;
-        }
-    } else {
-        if (score < GRADUAL_HIGH_RGB24_TH) {
-            return BITMAP_GRADUAL_HIGH;
-        }
-    }
-
-    if (score < GRADUAL_MEDIUM_SCORE_TH) {
-        return BITMAP_GRADUAL_MEDIUM;
-    }
-
-    return BITMAP_GRADUAL_LOW;
+    return graduality_from_score(bitmap->format, score);
 }
 
 int bitmap_has_extra_stride(SpiceBitmap *bitmap)
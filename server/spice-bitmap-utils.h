@@ -85,7 +85,10 @@ static inline int bitmap_fmt_has_graduality(uint8_t fmt)
 }
 
 
+/* Images with more than 1024 lines are only sampled on some bands of lines,
+ * the reference version scores all the lines with the original code */
 BitmapGradualType bitmap_get_graduality_level     (SpiceBitmap *bitmap);
+BitmapGradualType bitmap_get_graduality_level_reference(SpiceBitmap *bitmap);
 int               bitmap_has_extra_stride         (SpiceBitmap *bitmap);
 
 void dump_bitmap(SpiceBitmap *bitmap);
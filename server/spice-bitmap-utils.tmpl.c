@@ -144,6 +144,202 @@ static void FNAME(compute_lines_gradual_score)(PIXEL *lines, int width, int num_
     (*o_num_samples) = num_samples * 3;
 }
 
+/* The same score with integers, in quarters of the weights above. The sums
+ * are exact with both types so the result is identical */
+static const int FNAME(PIX_PAIR_SCORE_Q)[] = {
+    2,
+    4,
+    -1,
+};
+
+static inline int FNAME(pixels_square_score_q)(PIXEL *line1, PIXEL *line2)
+{
+    int ret;
+    int any_different = 0;
+    int cmp_res;
+    cmp_res = FNAME(pixelcmp)(*line1, line1[1]);
+    any_different |= cmp_res;
+    ret  = FNAME(PIX_PAIR_SCORE_Q)[cmp_res];
+    cmp_res = FNAME(pixelcmp)(*line1, *line2);
+    any_different |= cmp_res;
+    ret += FNAME(PIX_PAIR_SCORE_Q)[cmp_res];
+    cmp_res = FNAME(pixelcmp)(*line1, line2[1]);
+    any_different |= cmp_res;
+    ret += FNAME(PIX_PAIR_SCORE_Q)[cmp_res];
+
+    // ignore squares where all pixels are identical
+    if (!any_different) {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+// score of the squares whose top left pixel is at the given offsets
+static int FNAME(score_squares)(PIXEL *lines, int width, const int32_t *offsets, int n)
+{
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        ret += FNAME(pixels_square_score_q)(lines + offsets[i], lines + offsets[i] + width);
+    }
+    return ret;
+}
+
+#ifdef GRADUAL_X86_SIMD
+// the channels in the bytes 0 (b), 1 (g) and 2 (r) for the vector code
+static inline uint32_t FNAME(pixel_norm)(PIXEL pix)
+{
+    return GET_b(pix) | (GET_g(pix) << 8) | (GET_r(pix) << 16);
+}
+
+#define NORM4(p, o) _mm_setr_epi32(FNAME(pixel_norm)(p[0][o]), FNAME(pixel_norm)(p[1][o]), \
+                                   FNAME(pixel_norm)(p[2][o]), FNAME(pixel_norm)(p[3][o]))
+
+__attribute__((target("sse2")))
+static int FNAME(score_squares_sse2)(PIXEL *lines, int width, const int32_t *offsets, int n)
+{
+    __m128i th = _mm_set1_epi32((CONTRAST_TH - 1) * 0x010101);
+    __m128i sum = _mm_setzero_si128();
+    int32_t lanes[4];
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        PIXEL *p[4] = {
+            lines + offsets[i], lines + offsets[i + 1],
+            lines + offsets[i + 2], lines + offsets[i + 3],
+        };
+        sum = _mm_add_epi32(sum, square_score_sse2(NORM4(p, 0), NORM4(p, 1),
+                                                   NORM4(p, width), NORM4(p, width + 1), th));
+    }
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+           FNAME(score_squares)(lines, width, offsets + i, n - i);
+}
+
+#undef NORM4
+
+// loads 4 bytes for each pixel, the last pixel of the buffer can't be read
+__attribute__((target("avx2")))
+static inline __m256i FNAME(gather_avx2)(PIXEL *lines, __m256i offsets)
+{
+#if defined(RED_BITMAP_UTILS_RGB32)
+    __m256i pix = _mm256_i32gather_epi32((const int *)lines, offsets, 4);
+    return _mm256_and_si256(pix, _mm256_set1_epi32(0xffffff));
+#elif defined(RED_BITMAP_UTILS_RGB24)
+    offsets = _mm256_add_epi32(offsets, _mm256_add_epi32(offsets, offsets));
+    __m256i pix = _mm256_i32gather_epi32((const int *)lines, offsets, 1);
+    return _mm256_and_si256(pix, _mm256_set1_epi32(0xffffff));
+#else
+    offsets = _mm256_add_epi32(offsets, offsets);
+    __m256i pix = _mm256_i32gather_epi32((const int *)lines, offsets, 1);
+    // xrrrrrgg gggbbbbb to a byte for each channel
+    return _mm256_or_si256(_mm256_and_si256(pix, _mm256_set1_epi32(0x1f)),
+               _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(pix, 3),
+                                                _mm256_set1_epi32(0x1f00)),
+                               _mm256_and_si256(_mm256_slli_epi32(pix, 6),
+                                                _mm256_set1_epi32(0x1f0000))));
+#endif
+}
+
+__attribute__((target("avx2")))
+static int FNAME(score_squares_avx2)(PIXEL *lines, int width, const int32_t *offsets, int n)
+{
+    __m256i th = _mm256_set1_epi32((CONTRAST_TH - 1) * 0x010101);
+    __m256i right = _mm256_set1_epi32(1);
+    __m256i below = _mm256_set1_epi32(width);
+    __m256i below_right = _mm256_set1_epi32(width + 1);
+    __m256i sum = _mm256_setzero_si256();
+    int32_t lanes[8];
+    int i, ret;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i pos = _mm256_loadu_si256((const __m256i *)(offsets + i));
+        sum = _mm256_add_epi32(sum, square_score_avx2(
+            FNAME(gather_avx2)(lines, pos),
+            FNAME(gather_avx2)(lines, _mm256_add_epi32(pos, right)),
+            FNAME(gather_avx2)(lines, _mm256_add_epi32(pos, below)),
+            FNAME(gather_avx2)(lines, _mm256_add_epi32(pos, below_right)), th));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    ret = FNAME(score_squares)(lines, width, offsets + i, n - i);
+    for (i = 0; i < 8; i++) {
+        ret += lanes[i];
+    }
+    return ret;
+}
+#endif
+
+static int (*FNAME(score_squares_func))(PIXEL *lines, int width,
+                                        const int32_t *offsets, int n) = FNAME(score_squares);
+
+static void FNAME(score_squares_init)(void)
+{
+#ifdef GRADUAL_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) {
+        FNAME(score_squares_func) = FNAME(score_squares_avx2);
+    } else if (__builtin_cpu_supports("sse2")) {
+        FNAME(score_squares_func) = FNAME(score_squares_sse2);
+    }
+#endif
+}
+
+static inline int FNAME(score_batch)(PIXEL *lines, int width, int num_pixels,
+                                     const int32_t *offsets, int n)
+{
+    // the vector code can read past the last pixel used
+    if (offsets[n - 1] + width + 2 < num_pixels) {
+        return FNAME(score_squares_func)(lines, width, offsets, n);
+    }
+    return FNAME(score_squares)(lines, width, offsets, n);
+}
+
+/* Same samples as compute_lines_gradual_score, scored by batches */
+static void FNAME(compute_lines_gradual_score_q)(PIXEL *lines, int width, int num_lines,
+                                                 int64_t *o_samples_sum_score,
+                                                 int *o_num_samples)
+{
+    int jump = (SAMPLE_JUMP % width) ? SAMPLE_JUMP : SAMPLE_JUMP - 1;
+    int32_t offsets[GRADUAL_BATCH_SIZE];
+    int pos = width / 2;
+    int column = pos;
+    int last_line = (num_lines - 1) * width;
+    int num_samples = 0;
+    int n = 0;
+    int64_t samples_sum_score = 0;
+
+    if ((width <= 1) || (num_lines <= 1)) {
+        *o_num_samples = 1;
+        *o_samples_sum_score = 4;
+        return;
+    }
+
+    while (pos < last_line) {
+        if (column == width - 1) { // last pixel in the row
+            pos--;
+            column--;
+        }
+        offsets[n++] = pos;
+        if (n == GRADUAL_BATCH_SIZE) {
+            samples_sum_score += FNAME(score_batch)(lines, width, num_lines * width, offsets, n);
+            n = 0;
+        }
+        num_samples++;
+        pos += jump;
+        column += jump;
+        while (column >= width) {
+            column -= width;
+        }
+    }
+    if (n) {
+        samples_sum_score += FNAME(score_batch)(lines, width, num_lines * width, offsets, n);
+    }
+
+    (*o_samples_sum_score) = samples_sum_score;
+    (*o_num_samples) = num_samples * 3;
+}
+
 #undef PIXEL
 #undef FNAME
 #undef GET_r
@@ -156,3 +352,5 @@ static void FNAME(compute_lines_gradual_score)(PIXEL *lines, int width, int num_
 #undef CONTRAST_TH
 #undef SAME_PIXEL_WEIGHT
 #undef NOT_CONTRAST_PIXELS_WEIGHT
+#undef CONTRAST_PIXELS_WEIGHT
+#undef CONTRASTING
@@ -34,11 +34,24 @@
 #include "red-channel-client.h"
 #include "reds.h"
 #include "migration-protocol.h"
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+#include "vmc-lz4-stream.h"
+#endif
 
 /* 64K should be enough for all but the largest writes + 32 bytes hdr */
 #define BUF_SIZE (64 * 1024 + 32)
 #define COMPRESS_THRESHOLD 1000
 
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+/* with a shared history even small messages compress */
+#define STREAM_COMPRESS_THRESHOLD 32
+/* data compressed in streaming mode is sent even if it did not compress */
+#define ITEM_BUF_SIZE LZ4_COMPRESSBOUND(BUF_SIZE)
+G_STATIC_ASSERT(BUF_SIZE <= VMC_LZ4_STREAM_MAX_BLOCK);
+#else
+#define ITEM_BUF_SIZE BUF_SIZE
+#endif
+
 // limit of the queued data, at this limit we stop reading from device to
 // avoid DoS
 #define QUEUED_DATA_LIMIT (1024*1024)
@@ -56,8 +69,8 @@ class VmcChannelClient;
 struct RedVmcPipeItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_SPICEVMC_DATA> {
     SpiceDataCompressionType type;
     uint32_t uncompressed_data_size = 0;
-    /* writes which don't fit this will get split, this is not a problem */
-    uint8_t buf[BUF_SIZE];
+    /* writes which don't fit BUF_SIZE will get split, this is not a problem */
+    uint8_t buf[ITEM_BUF_SIZE];
     uint32_t buf_used = 0;
 };
 
@@ -97,6 +110,14 @@ struct RedVmcChannel: public RedChannel
     RedStatCounter out_data;
     RedStatCounter out_compressed;
     RedStatCounter out_uncompressed;
+#ifdef USE_LZ4
+    /* output of the per message compression */
+    uint8_t *lz4_buf;
+#endif
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+    /* compression with the history of the connection, if the client supports it */
+    VmcLz4Stream *lz4_stream;
+#endif
 };
 
 
@@ -139,6 +160,9 @@ RedVmcChannel::RedVmcChannel(RedsState *reds, uint32_t type, uint32_t id):
 #ifdef USE_LZ4
     set_cap(SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4);
 #endif
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+    set_cap(SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4_STREAM);
+#endif
 
     reds_register_channel(reds, this);
 }
@@ -146,6 +170,12 @@ RedVmcChannel::RedVmcChannel(RedsState *reds, uint32_t type, uint32_t id):
 RedVmcChannel::~RedVmcChannel()
 {
     RedCharDevice::write_buffer_release(chardev, &recv_from_client_buf);
+#ifdef USE_LZ4
+    g_free(lz4_buf);
+#endif
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+    vmc_lz4_stream_free(lz4_stream);
+#endif
 }
 
 static red::shared_ptr<RedVmcChannel> red_vmc_channel_new(RedsState *reds, uint8_t channel_type)
@@ -180,13 +210,44 @@ struct RedPortEventPipeItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_PORT_EVENT
     uint8_t event;
 };
 
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+/* Compress using the previous data sent as dictionary. The data is
+ * compressed in place and sent compressed even if it did not compress,
+ * so the client history matches ours */
+static bool
+compress_lz4_stream(RedVmcChannel *channel, RedVmcPipeItem *msg_item)
+{
+    auto n = msg_item->buf_used;
+
+    if (n <= STREAM_COMPRESS_THRESHOLD) {
+        /* not part of the history */
+        return false;
+    }
+    if (!channel->lz4_stream) {
+        channel->lz4_stream = vmc_lz4_stream_new();
+    }
+    int compressed_data_count =
+        vmc_lz4_stream_compress(channel->lz4_stream, msg_item->buf, n, msg_item->buf);
+    if (compressed_data_count <= 0) {
+        /* should not happen, the buffer can hold any compressed data */
+        spice_warning("LZ4 stream compression failed");
+        return false;
+    }
+    stat_inc_counter(channel->out_uncompressed, n);
+    stat_inc_counter(channel->out_compressed, compressed_data_count);
+    msg_item->type = SPICE_DATA_COMPRESSION_TYPE_LZ4_STREAM;
+    msg_item->buf_used = compressed_data_count;
+    return true;
+}
+#endif
+
 /* msg_item -- the current pipe item with the uncompressed data
  * This function returns:
  *  - false upon failure.
  *  - true if compression succeeded
  */
 static bool
-try_compress_lz4(RedVmcChannel *channel, red::shared_ptr<RedVmcPipeItem>& msg_item)
+try_compress_lz4(RedVmcChannel *channel, RedVmcPipeItem *msg_item)
 {
 #ifdef USE_LZ4
     int compressed_data_count;
@@ -196,6 +257,11 @@ try_compress_lz4(RedVmcChannel *channel, red::shared_ptr<RedVmcPipeItem>& msg_it
         /* AF_LOCAL - data will not be compressed */
         return false;
     }
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+    if (channel->rcc->test_remote_cap(SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4_STREAM)) {
+        return compress_lz4_stream(channel, msg_item);
+    }
+#endif
     if (n <= COMPRESS_THRESHOLD) {
         /* n <= threshold - data will not be compressed */
         return false;
@@ -204,18 +270,21 @@ try_compress_lz4(RedVmcChannel *channel, red::shared_ptr<RedVmcPipeItem>& msg_it
         /* Client doesn't have compression cap - data will not be compressed */
         return false;
     }
-    auto msg_item_compressed = red::make_shared<RedVmcPipeItem>();
+    /* compress to a buffer kept by the channel then replace the data
+     * of the item, avoiding to allocate another item */
+    if (!channel->lz4_buf) {
+        channel->lz4_buf = static_cast<uint8_t *>(g_malloc(BUF_SIZE));
+    }
     compressed_data_count =
-        LZ4_compress_default(reinterpret_cast<char *>(&msg_item->buf),
-                             reinterpret_cast<char *>(&msg_item_compressed->buf), n, BUF_SIZE);
+        LZ4_compress_default(reinterpret_cast<char *>(msg_item->buf),
+                             reinterpret_cast<char *>(channel->lz4_buf), n, BUF_SIZE);
 
     if (compressed_data_count > 0 && compressed_data_count < n) {
         stat_inc_counter(channel->out_uncompressed, n);
         stat_inc_counter(channel->out_compressed, compressed_data_count);
-        msg_item_compressed->type = SPICE_DATA_COMPRESSION_TYPE_LZ4;
-        msg_item_compressed->uncompressed_data_size = n;
-        msg_item_compressed->buf_used = compressed_data_count;
-        msg_item = std::move(msg_item_compressed);
+        memcpy(msg_item->buf, channel->lz4_buf, compressed_data_count);
+        msg_item->type = SPICE_DATA_COMPRESSION_TYPE_LZ4;
+        msg_item->buf_used = compressed_data_count;
         return true;
     }
 
@@ -242,13 +311,13 @@ RedCharDeviceSpiceVmc::read_one_msg_from_device()
         msg_item = std::move(channel->pipe_item);
     }
 
-    n = read(msg_item->buf, sizeof(msg_item->buf));
+    n = read(msg_item->buf, BUF_SIZE);
     if (n > 0) {
         spice_debug("read from dev %d", n);
         msg_item->uncompressed_data_size = n;
         msg_item->buf_used = n;
 
-        if (!try_compress_lz4(channel.get(), msg_item)) {
+        if (!try_compress_lz4(channel.get(), msg_item.get())) {
             stat_inc_counter(channel->out_data, n);
         }
         spicevmc_red_channel_queue_data(channel.get(), std::move(msg_item));
@@ -354,6 +423,16 @@ static bool handle_compressed_msg(RedVmcChannel *channel, RedChannelClient *rcc,
     int decompressed_size;
     RedCharDeviceWriteBuffer *write_buf;
 
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+    /* the size is set by the client, check it before the decoder
+     * complains about it */
+    if (compressed_data_msg->type == SPICE_DATA_COMPRESSION_TYPE_LZ4_STREAM &&
+        (compressed_data_msg->uncompressed_size == 0 ||
+         compressed_data_msg->uncompressed_size > VMC_LZ4_STREAM_MAX_BLOCK)) {
+        return FALSE;
+    }
+#endif
+
     write_buf = channel->chardev->write_buffer_get_server(compressed_data_msg->uncompressed_size,
                                                           false);
     if (!write_buf) {
@@ -372,6 +451,21 @@ static bool handle_compressed_msg(RedVmcChannel *channel, RedChannelClient *rcc,
         stat_inc_counter(channel->in_decompressed, decompressed_size);
         break;
     }
+#endif
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+    case SPICE_DATA_COMPRESSION_TYPE_LZ4_STREAM: {
+        if (!channel->lz4_stream) {
+            channel->lz4_stream = vmc_lz4_stream_new();
+        }
+        decompressed_size = vmc_lz4_stream_decompress(channel->lz4_stream,
+                                                      compressed_data_msg->compressed_data,
+                                                      compressed_data_msg->compressed_size,
+                                                      write_buf->buf,
+                                                      compressed_data_msg->uncompressed_size);
+        stat_inc_counter(channel->in_compressed, compressed_data_msg->compressed_size);
+        stat_inc_counter(channel->in_decompressed, decompressed_size);
+        break;
+    }
 #endif
     default:
         spice_warning("Invalid Compression Type");
@@ -597,6 +691,12 @@ void RedVmcChannel::on_connect(RedClient *client, RedStream *stream, int migrati
         return;
     }
     vmc_channel->queued_data = 0;
+#ifdef HAVE_SPICE_VMC_LZ4_STREAM
+    /* the new client starts with an empty history */
+    if (vmc_channel->lz4_stream) {
+        vmc_lz4_stream_reset(vmc_channel->lz4_stream);
+    }
+#endif
     rcc->ack_zero_messages_window();
 
     if (strcmp(sin->subtype, "port") == 0) {
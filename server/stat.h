@@ -40,6 +40,22 @@ typedef struct {
     uint8_t dummy_empty_field[0]; /* C/C++ compatibility */
 } RedStatNode;
 
+/* Number of buckets of a RedStatHistogram. Bucket n counts the samples
+ * under 2^n microseconds not counted by the previous buckets, the last
+ * one counts all the longer samples */
+#define STAT_HISTOGRAM_BUCKETS 22
+
+/* A distribution of durations, each bucket is exported as a counter
+ * child of the histogram node */
+typedef struct {
+#ifdef RED_STATISTICS
+    uint64_t *buckets[STAT_HISTOGRAM_BUCKETS];
+    /* sum of all the samples in microseconds */
+    uint64_t *total;
+#endif
+    uint8_t dummy_empty_field[0]; /* C/C++ compatibility */
+} RedStatHistogram;
+
 #ifdef RED_STATISTICS
 void stat_init_node(RedStatNode *node, SpiceServer *reds,
                     const RedStatNode *parent, const char *name, int visible);
@@ -47,6 +63,8 @@ void stat_remove_node(SpiceServer *reds, RedStatNode *node);
 void stat_init_counter(RedStatCounter *counter, SpiceServer *reds,
                        const RedStatNode *parent, const char *name, int visible);
 void stat_remove_counter(SpiceServer *reds, RedStatCounter *counter);
+void stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                         const RedStatNode *parent, const char *name, int visible);
 
 #else
 
@@ -71,6 +89,12 @@ static inline void
 stat_remove_counter(SpiceServer *reds, RedStatCounter *counter)
 {
 }
+
+static inline void
+stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                    const RedStatNode *parent, const char *name, int visible)
+{
+}
 #endif /* RED_STATISTICS */
 
 static inline void
@@ -93,6 +117,43 @@ static inline stat_time_t stat_now(clockid_t clock_id)
     return ts.tv_nsec + (uint64_t) ts.tv_sec * (1000 * 1000 * 1000);
 }
 
+static inline void
+stat_histogram_add_time(G_GNUC_UNUSED RedStatHistogram *histogram,
+                        G_GNUC_UNUSED stat_time_t time)
+{
+#ifdef RED_STATISTICS
+    uint64_t us = time / 1000;
+    unsigned int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+    bucket = MIN(bucket, STAT_HISTOGRAM_BUCKETS - 1);
+    if (histogram->buckets[bucket]) {
+        ++*histogram->buckets[bucket];
+        *histogram->total += us;
+    }
+#endif
+}
+
+/* Start of a duration measured with stat_histogram_add, uses the same
+ * clock as spice_get_monotonic_time_ns */
+static inline stat_time_t stat_histogram_start(void)
+{
+#ifdef RED_STATISTICS
+    return stat_now(CLOCK_MONOTONIC);
+#else
+    return 0;
+#endif
+}
+
+/* Add the time elapsed since 'start' */
+static inline void
+stat_histogram_add(G_GNUC_UNUSED RedStatHistogram *histogram,
+                   G_GNUC_UNUSED stat_time_t start)
+{
+#ifdef RED_STATISTICS
+    stat_histogram_add_time(histogram, stat_now(CLOCK_MONOTONIC) - start);
+#endif
+}
+
 typedef struct {
 #if defined(RED_WORKER_STAT) || defined(COMPRESS_STAT)
     stat_time_t time;
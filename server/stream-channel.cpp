@@ -76,6 +76,8 @@ struct StreamDataItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_STREAM_DATA> {
     ~StreamDataItem() override;
 
     StreamChannel *channel;
+    // the frame, shared with the items sent to other clients
+    red::shared_ptr<StreamDataBuffer> buffer;
     // NOTE: this must be the last field in the structure
     SpiceMsgDisplayStreamData data;
 };
@@ -235,7 +237,7 @@ void StreamChannelClient::send_item(RedPipeItem *pipe_item)
         auto item = static_cast<StreamDataItem*>(pipe_item);
         init_send_data(SPICE_MSG_DISPLAY_STREAM_DATA);
         spice_marshall_msg_display_stream_data(m, &item->data);
-        pipe_item->add_to_marshaller(m, item->data.data, item->data.data_size);
+        pipe_item->add_to_marshaller(m, item->buffer->data, item->data.data_size);
         record(stream_channel_data, "Stream data packet size %u mm_time %u",
                item->data.data_size, item->data.base.multi_media_time);
         break;
@@ -457,7 +459,7 @@ StreamDataItem::~StreamDataItem()
 }
 
 void
-StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
+StreamChannel::send_data(const red::shared_ptr<StreamDataBuffer> &buffer, uint32_t mm_time)
 {
     if (stream_id < 0) {
         // this condition can happen if the guest didn't handle
@@ -466,15 +468,14 @@ StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
         return;
     }
 
-    auto item = new (size) StreamDataItem();
+    auto item = red::make_shared<StreamDataItem>();
     item->data.base.id = stream_id;
     item->data.base.multi_media_time = mm_time;
-    item->data.data_size = size;
+    item->data.data_size = buffer->size;
     item->channel = this;
-    update_queue_stat(1, size);
-    // TODO try to optimize avoiding the copy
-    memcpy(item->data.data, data, size);
-    pipes_add(red::shared_ptr<StreamDataItem>(item));
+    item->buffer = buffer;
+    update_queue_stat(1, buffer->size);
+    pipes_add(item);
 }
 
 void
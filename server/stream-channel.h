@@ -50,6 +50,26 @@ struct StreamQueueStat {
 typedef void (*stream_channel_queue_stat_proc)(void *opaque, const StreamQueueStat *stats,
                                                StreamChannel *channel);
 
+/**
+ * A frame of data read from the streaming device.
+ * The device reads the frame directly into the buffer and the items sending
+ * it to the clients keep a reference to it, so the data is never copied.
+ */
+struct StreamDataBuffer final: public red::simple_ptr_counted<StreamDataBuffer>
+{
+    void *operator new(size_t size, size_t additional)
+    {
+        return g_malloc(size + additional);
+    }
+
+    explicit StreamDataBuffer(uint32_t size): size(size)
+    {
+    }
+
+    const uint32_t size;
+    uint8_t data[];
+};
+
 struct StreamDataItem;
 class StreamChannelClient;
 struct StreamChannel final: public RedChannel
@@ -64,7 +84,7 @@ struct StreamChannel final: public RedChannel
     void reset();
 
     void change_format(const struct StreamMsgFormat *fmt);
-    void send_data(const void *data, size_t size, uint32_t mm_time);
+    void send_data(const red::shared_ptr<StreamDataBuffer> &buffer, uint32_t mm_time);
 
     void register_start_cb(stream_channel_start_proc cb, void *opaque);
     void register_queue_stat_cb(stream_channel_queue_stat_proc cb, void *opaque);
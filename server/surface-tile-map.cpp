@@ -0,0 +1,189 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <cstring>
+
+#include <common/rect.h>
+
+#include "surface-tile-map.h"
+
+/* hash of a tile whose content is not known */
+#define TILE_INVALID 0
+
+#define HASH_PRIME1 UINT64_C(0x9E3779B185EBCA87)
+#define HASH_PRIME2 UINT64_C(0xC2B2AE3D27D4EB4F)
+
+struct SurfaceTileMap {
+    uint32_t width;
+    uint32_t height;
+    uint32_t tiles_x;
+    uint32_t tiles_y;
+    uint64_t hashes[];
+};
+
+SurfaceTileMap *surface_tile_map_new(uint32_t width, uint32_t height)
+{
+    uint32_t tiles_x = (width + SURFACE_TILE_SIZE - 1) / SURFACE_TILE_SIZE;
+    uint32_t tiles_y = (height + SURFACE_TILE_SIZE - 1) / SURFACE_TILE_SIZE;
+    SurfaceTileMap *map;
+
+    map = static_cast<SurfaceTileMap *>(g_malloc0(sizeof(SurfaceTileMap) +
+                                                  sizeof(uint64_t) * tiles_x * tiles_y));
+    map->width = width;
+    map->height = height;
+    map->tiles_x = tiles_x;
+    map->tiles_y = tiles_y;
+    return map;
+}
+
+void surface_tile_map_free(SurfaceTileMap *map)
+{
+    g_free(map);
+}
+
+/* Clip 'area' to the surface and compute the range of tiles it touches,
+ * returns false if it's outside the surface */
+static bool get_tile_range(const SurfaceTileMap *map, const SpiceRect *area, SpiceRect *clipped,
+                           uint32_t *tx0, uint32_t *ty0, uint32_t *tx1, uint32_t *ty1)
+{
+    clipped->left = MAX(area->left, 0);
+    clipped->top = MAX(area->top, 0);
+    clipped->right = MIN(area->right, (int32_t) map->width);
+    clipped->bottom = MIN(area->bottom, (int32_t) map->height);
+    if (clipped->left >= clipped->right || clipped->top >= clipped->bottom) {
+        return false;
+    }
+
+    *tx0 = clipped->left / SURFACE_TILE_SIZE;
+    *ty0 = clipped->top / SURFACE_TILE_SIZE;
+    *tx1 = (clipped->right + SURFACE_TILE_SIZE - 1) / SURFACE_TILE_SIZE;
+    *ty1 = (clipped->bottom + SURFACE_TILE_SIZE - 1) / SURFACE_TILE_SIZE;
+    return true;
+}
+
+void surface_tile_map_invalidate(SurfaceTileMap *map, const SpiceRect *area)
+{
+    uint32_t tx0, ty0, tx1, ty1;
+    SpiceRect clipped;
+
+    if (!get_tile_range(map, area, &clipped, &tx0, &ty0, &tx1, &ty1)) {
+        return;
+    }
+    for (uint32_t ty = ty0; ty < ty1; ty++) {
+        uint64_t *hashes = &map->hashes[ty * map->tiles_x];
+        for (uint32_t tx = tx0; tx < tx1; tx++) {
+            hashes[tx] = TILE_INVALID;
+        }
+    }
+}
+
+static inline uint64_t hash_round(uint64_t hash, uint64_t input)
+{
+    hash += input * HASH_PRIME2;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * HASH_PRIME1;
+}
+
+static uint64_t hash_tile(const uint8_t *const *rows, uint32_t left,
+                          uint32_t width, uint32_t height)
+{
+    const size_t len = width * 4;
+    uint64_t hash = HASH_PRIME1;
+
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t *line = rows[y] + left * 4;
+        size_t i;
+
+        for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+            uint64_t word;
+            memcpy(&word, line + i, sizeof(word));
+            hash = hash_round(hash, word);
+        }
+        if (i < len) {
+            uint32_t word;
+            memcpy(&word, line + i, sizeof(word));
+            hash = hash_round(hash, word);
+        }
+    }
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    return hash != TILE_INVALID ? hash : 1;
+}
+
+bool surface_tile_map_update(SurfaceTileMap *map, const SpiceRect *dest,
+                             const uint8_t *const *rows, uint32_t src_left,
+                             SpiceRect *changed)
+{
+    uint32_t tx0, ty0, tx1, ty1;
+    SpiceRect clipped;
+    bool any_changed = false;
+
+    if (!get_tile_range(map, dest, &clipped, &tx0, &ty0, &tx1, &ty1)) {
+        return false;
+    }
+
+    for (uint32_t ty = ty0; ty < ty1; ty++) {
+        int32_t top = ty * SURFACE_TILE_SIZE;
+        int32_t bottom = MIN(top + SURFACE_TILE_SIZE, (int32_t) map->height);
+        uint64_t *hashes = &map->hashes[ty * map->tiles_x];
+
+        for (uint32_t tx = tx0; tx < tx1; tx++) {
+            int32_t left = tx * SURFACE_TILE_SIZE;
+            int32_t right = MIN(left + SURFACE_TILE_SIZE, (int32_t) map->width);
+
+            if (left >= clipped.left && right <= clipped.right &&
+                top >= clipped.top && bottom <= clipped.bottom) {
+                uint64_t hash = hash_tile(rows + (top - dest->top),
+                                          src_left + (left - dest->left),
+                                          right - left, bottom - top);
+                if (hash == hashes[tx]) {
+                    continue;
+                }
+                hashes[tx] = hash;
+            } else {
+                /* the tile is partially overwritten, its content is not
+                 * known anymore */
+                hashes[tx] = TILE_INVALID;
+            }
+
+            SpiceRect tile;
+            tile.left = MAX(left, clipped.left);
+            tile.top = MAX(top, clipped.top);
+            tile.right = MIN(right, clipped.right);
+            tile.bottom = MIN(bottom, clipped.bottom);
+            if (!any_changed) {
+                *changed = tile;
+                any_changed = true;
+            } else {
+                changed->left = MIN(changed->left, tile.left);
+                changed->top = MIN(changed->top, tile.top);
+                changed->right = MAX(changed->right, tile.right);
+                changed->bottom = MAX(changed->bottom, tile.bottom);
+            }
+        }
+    }
+    return any_changed;
+}
+
+bool surface_tile_map_should_crop(const SpiceRect *changed, const SpiceRect *dest)
+{
+    return rect_get_area(changed) * 4 <= rect_get_area(dest) * 3;
+}
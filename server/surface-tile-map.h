@@ -0,0 +1,64 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file surface-tile-map.h
+ * Detect which parts of a surface are changed by a bitmap copy.
+ *
+ * The surface is split in square tiles and a hash of the content last
+ * copied to each tile is kept. When a new bitmap is copied the hashes of
+ * the tiles it fully covers are compared to find the area really changed.
+ * Tiles modified by any other operation are invalidated.
+ */
+
+#ifndef SURFACE_TILE_MAP_H_
+#define SURFACE_TILE_MAP_H_
+
+#include "red-common.h"
+
+#include "push-visibility.h"
+
+/* Enable the tile map for the surfaces */
+#define SURFACE_TILE_MAP_ENV "SPICE_SURFACE_TILES"
+
+#define SURFACE_TILE_SIZE 64
+
+struct SurfaceTileMap;
+
+SurfaceTileMap *surface_tile_map_new(uint32_t width, uint32_t height);
+void surface_tile_map_free(SurfaceTileMap *map);
+
+/* Forget the content of the tiles intersecting 'area' */
+void surface_tile_map_invalidate(SurfaceTileMap *map, const SpiceRect *area);
+
+/* Update the tiles for a 32 bit per pixel copy to 'dest'.
+ * 'rows' contains the source lines for each line of 'dest' and 'src_left'
+ * is the first source pixel in the lines.
+ * Returns false if no tile changed, otherwise 'changed' is set to the
+ * part of 'dest' which changed */
+bool surface_tile_map_update(SurfaceTileMap *map, const SpiceRect *dest,
+                             const uint8_t *const *rows, uint32_t src_left,
+                             SpiceRect *changed);
+
+/* Whether copying only 'changed' out of 'dest' saves enough to be
+ * worth the copy of the bitmap needed to crop it */
+bool surface_tile_map_should_crop(const SpiceRect *changed, const SpiceRect *dest);
+
+#include "pop-visibility.h"
+
+#endif /* SURFACE_TILE_MAP_H_ */
@@ -0,0 +1,247 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test the graduality level of bitmaps against the reference code and
+ * measure speed
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include <common/mem.h>
+
+#include "test-glib-compat.h"
+#include "spice-bitmap-utils.h"
+
+typedef enum {
+    IMAGE_NOISE,
+    IMAGE_GRADIENT,
+    IMAGE_TEXT,
+    IMAGE_MIXED,
+    IMAGE_FLAT,
+    NUM_IMAGE_TYPES
+} ImageType;
+
+static void put_pixel(uint8_t format, uint8_t *pixel, unsigned r, unsigned g, unsigned b)
+{
+    switch (format) {
+    case SPICE_BITMAP_FMT_16BIT: {
+        uint16_t value = (r >> 3) << 10 | (g >> 3) << 5 | (b >> 3);
+        memcpy(pixel, &value, sizeof(value));
+        break;
+    }
+    case SPICE_BITMAP_FMT_24BIT:
+        pixel[0] = b;
+        pixel[1] = g;
+        pixel[2] = r;
+        break;
+    default:
+        pixel[0] = b;
+        pixel[1] = g;
+        pixel[2] = r;
+        // the alpha or padding byte is not part of the score
+        pixel[3] = r ^ g;
+        break;
+    }
+}
+
+static void fill_image(GRand *rand, ImageType type, uint8_t format,
+                       uint8_t *data, unsigned width, unsigned height)
+{
+    int bpp = bitmap_fmt_get_bytes_per_pixel(format);
+    unsigned noise = g_rand_int_range(rand, 1, 64);
+
+    for (unsigned y = 0; y < height; y++) {
+        for (unsigned x = 0; x < width; x++) {
+            uint8_t *pixel = data + (y * width + x) * bpp;
+            unsigned r, g, b;
+
+            switch (type) {
+            case IMAGE_NOISE:
+                r = g_rand_int_range(rand, 0, 256);
+                g = g_rand_int_range(rand, 0, 256);
+                b = g_rand_int_range(rand, 0, 256);
+                break;
+            case IMAGE_GRADIENT:
+                r = x * 255 / width;
+                g = y * 255 / height;
+                b = (x + y) * 127 / (width + height);
+                break;
+            case IMAGE_TEXT:
+                r = g = b = 0xee;
+                if (y % 16 < 12 && (x / 8 + y / 16) % 7 != 0 &&
+                    g_rand_int_range(rand, 0, 4) == 0) {
+                    r = g = b = 0x20;
+                }
+                break;
+            case IMAGE_MIXED:
+                // a photo-like area with some noise over a flat one
+                r = g = b = 0x80;
+                if (x < width / 2) {
+                    r = MIN(255, x * 255 / width + g_rand_int_range(rand, 0, noise));
+                    g = MIN(255, y * 255 / height + g_rand_int_range(rand, 0, noise));
+                    b = 0x40;
+                }
+                break;
+            default:
+                r = g = b = 0x30;
+                break;
+            }
+            put_pixel(format, pixel, r, g, b);
+        }
+    }
+}
+
+/* The image is split in chunks of lines_per_chunk lines */
+static SpiceBitmap *bitmap_new(GRand *rand, ImageType type, uint8_t format,
+                               unsigned width, unsigned height, unsigned lines_per_chunk)
+{
+    SpiceBitmap *bitmap = g_new0(SpiceBitmap, 1);
+    int bpp = bitmap_fmt_get_bytes_per_pixel(format);
+    unsigned num_chunks = (height + lines_per_chunk - 1) / lines_per_chunk;
+    uint8_t *data = g_malloc(width * height * bpp);
+
+    fill_image(rand, type, format, data, width, height);
+
+    bitmap->format = format;
+    bitmap->x = width;
+    bitmap->y = height;
+    bitmap->stride = width * bpp;
+    bitmap->data = spice_chunks_new(num_chunks);
+    for (unsigned i = 0; i < num_chunks; i++) {
+        unsigned lines = MIN(lines_per_chunk, height - i * lines_per_chunk);
+        // a copy for each chunk, the scoring must not read past its end
+        bitmap->data->chunk[i].data = g_memdup2(data + i * lines_per_chunk * bitmap->stride,
+                                                lines * bitmap->stride);
+        bitmap->data->chunk[i].len = lines * bitmap->stride;
+        bitmap->data->data_size += lines * bitmap->stride;
+    }
+    bitmap->data->flags |= SPICE_CHUNKS_FLAGS_FREE;
+    g_free(data);
+    return bitmap;
+}
+
+static void bitmap_free(SpiceBitmap *bitmap)
+{
+    spice_chunks_destroy(bitmap->data);
+    g_free(bitmap);
+}
+
+static const uint8_t formats[] = {
+    SPICE_BITMAP_FMT_16BIT,
+    SPICE_BITMAP_FMT_24BIT,
+    SPICE_BITMAP_FMT_32BIT,
+    SPICE_BITMAP_FMT_RGBA,
+};
+
+static void test_graduality_reference(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x6ad);
+    unsigned levels[BITMAP_GRADUAL_HIGH + 1] = { 0, };
+
+    for (unsigned n = 0; n < 3000; n++) {
+        uint8_t format = formats[g_rand_int_range(rand, 0, G_N_ELEMENTS(formats))];
+        ImageType type = g_rand_int_range(rand, 0, NUM_IMAGE_TYPES);
+        unsigned width = g_rand_int_range(rand, 1, 200);
+        unsigned height = g_rand_int_range(rand, 1, 120);
+        unsigned lines_per_chunk = g_rand_boolean(rand) ? height :
+                                   (unsigned) g_rand_int_range(rand, 1, 20);
+        SpiceBitmap *bitmap = bitmap_new(rand, type, format, width, height, lines_per_chunk);
+
+        BitmapGradualType level = bitmap_get_graduality_level(bitmap);
+        g_assert_cmpint(level, ==, bitmap_get_graduality_level_reference(bitmap));
+        levels[level]++;
+        bitmap_free(bitmap);
+    }
+    g_assert_cmpuint(levels[BITMAP_GRADUAL_LOW], >, 0);
+    g_assert_cmpuint(levels[BITMAP_GRADUAL_MEDIUM], >, 0);
+    g_assert_cmpuint(levels[BITMAP_GRADUAL_HIGH], >, 0);
+    g_rand_free(rand);
+}
+
+/* Bigger images are sampled, the level of uniform images must not change */
+static void test_graduality_sampled(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x5a3);
+    static const ImageType types[] = { IMAGE_NOISE, IMAGE_GRADIENT, IMAGE_TEXT };
+
+    for (unsigned i = 0; i < G_N_ELEMENTS(formats); i++) {
+        for (unsigned t = 0; t < G_N_ELEMENTS(types); t++) {
+            unsigned lines_per_chunk = t == 0 ? 1 : 100;
+            SpiceBitmap *bitmap = bitmap_new(rand, types[t], formats[i], 700, 2000,
+                                             lines_per_chunk);
+
+            g_assert_cmpint(bitmap_get_graduality_level(bitmap), ==,
+                            bitmap_get_graduality_level_reference(bitmap));
+            bitmap_free(bitmap);
+        }
+    }
+    g_rand_free(rand);
+}
+
+static void bench_graduality(SpiceBitmap *bitmap, const char *name)
+{
+    const unsigned iterations = 50;
+    BitmapGradualType level = BITMAP_GRADUAL_INVALID;
+    uint64_t ref_start = spice_get_monotonic_time_ns();
+
+    for (unsigned n = 0; n < iterations; n++) {
+        level = bitmap_get_graduality_level_reference(bitmap);
+    }
+    uint64_t start = spice_get_monotonic_time_ns();
+    for (unsigned n = 0; n < iterations; n++) {
+        g_assert_cmpint(bitmap_get_graduality_level(bitmap), ==, level);
+    }
+    uint64_t end = spice_get_monotonic_time_ns();
+
+    g_test_message("%s %ux%u: reference %.1fus, bitmap_get_graduality_level %.1fus",
+                   name, bitmap->x, bitmap->y,
+                   (start - ref_start) / 1000.0 / iterations,
+                   (end - start) / 1000.0 / iterations);
+}
+
+static void test_graduality_speed(void)
+{
+    GRand *rand = g_rand_new_with_seed(1);
+    SpiceBitmap *bitmap;
+
+    bitmap = bitmap_new(rand, IMAGE_MIXED, SPICE_BITMAP_FMT_32BIT, 1920, 1080, 1080);
+    bench_graduality(bitmap, "32 bit");
+    bitmap_free(bitmap);
+
+    bitmap = bitmap_new(rand, IMAGE_MIXED, SPICE_BITMAP_FMT_16BIT, 1920, 1080, 1080);
+    bench_graduality(bitmap, "16 bit");
+    bitmap_free(bitmap);
+
+    bitmap = bitmap_new(rand, IMAGE_TEXT, SPICE_BITMAP_FMT_32BIT, 3840, 2160, 2160);
+    bench_graduality(bitmap, "32 bit sampled");
+    bitmap_free(bitmap);
+
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/bitmap-graduality/reference", test_graduality_reference);
+    g_test_add_func("/server/bitmap-graduality/sampled", test_graduality_sampled);
+    g_test_add_func("/server/bitmap-graduality/speed", test_graduality_speed);
+
+    return g_test_run();
+}
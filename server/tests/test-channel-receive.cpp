@@ -0,0 +1,305 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Flood a channel with mouse motion messages and check they are all
+ * received in order and how many read system calls are needed
+ */
+#include <config.h>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <spice.h>
+#include <common/messages.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "reds.h"
+#include "red-client.h"
+#include "main-channel.h"
+#include "net-utils.h"
+#include "push-visibility.h"
+
+#define NUM_MESSAGES 100000
+// messages written by the client with a single write
+#define MESSAGES_PER_WRITE 64
+// messages written before the channel starts reading
+#define NUM_QUEUED_MESSAGES 4000
+// mini header and SpiceMsgcMouseMotion
+#define MESSAGE_SIZE (6 + 12)
+// size of the read ahead buffer of RedChannelClient
+#define RECEIVE_BUF_SIZE (16 * 1024)
+
+struct RedTestChannel final: public RedChannel
+{
+    using RedChannel::RedChannel;
+    void on_connect(RedClient *client, RedStream *stream,
+                    int migration, RedChannelCapabilities *caps) override;
+};
+
+class RedTestChannelClient final: public RedChannelClient
+{
+    using RedChannelClient::RedChannelClient;
+    uint8_t * alloc_recv_buf(uint16_t type, uint32_t size) override;
+    void release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg) override;
+    bool handle_message(uint16_t type, uint32_t size, void *message) override;
+};
+
+static unsigned messages_received;
+static unsigned messages_expected;
+
+void
+RedTestChannel::on_connect(RedClient *client, RedStream *stream,
+                           int migration, RedChannelCapabilities *caps)
+{
+    auto rcc =
+        red::make_shared<RedTestChannelClient>(this, client, stream, caps);
+    g_assert(rcc);
+    g_assert_true(rcc->init());
+}
+
+uint8_t *
+RedTestChannelClient::alloc_recv_buf(uint16_t type, uint32_t size)
+{
+    return static_cast<uint8_t *>(g_malloc(size));
+}
+
+void
+RedTestChannelClient::release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg)
+{
+    g_free(msg);
+}
+
+bool
+RedTestChannelClient::handle_message(uint16_t type, uint32_t size, void *message)
+{
+    if (type != SPICE_MSGC_INPUTS_MOUSE_MOTION) {
+        return RedChannelClient::handle_message(type, size, message);
+    }
+    // messages are written in bursts with increasing dx
+    auto motion = static_cast<SpiceMsgcMouseMotion *>(message);
+    g_assert_cmpuint(size, ==, sizeof(*motion));
+    g_assert_cmpint(motion->dx, ==, messages_received % MESSAGES_PER_WRITE + 1);
+    g_assert_cmpint(motion->dy, ==, -1);
+    g_assert_cmpuint(motion->buttons_state, ==, 0);
+    if (++messages_received == messages_expected) {
+        basic_event_loop_quit();
+    }
+    return true;
+}
+
+/* Number of read system calls done by the current thread, -1 if
+ * not available */
+static int64_t get_read_syscalls()
+{
+    gchar *contents = nullptr;
+    int64_t ret = -1;
+
+    if (!g_file_get_contents("/proc/thread-self/io", &contents, nullptr, nullptr)) {
+        return -1;
+    }
+    const char *syscr = strstr(contents, "syscr:");
+    if (syscr) {
+        ret = g_ascii_strtoll(syscr + 6, nullptr, 10);
+    }
+    g_free(contents);
+    return ret;
+}
+
+static void fill_messages(uint8_t (*msgs)[MESSAGE_SIZE], unsigned num_messages)
+{
+    for (unsigned n = 0; n < num_messages; n++) {
+        const uint16_t type = GUINT16_TO_LE(SPICE_MSGC_INPUTS_MOUSE_MOTION);
+        const uint32_t motion[4] = {
+            GUINT32_TO_LE(12), // message size
+            GUINT32_TO_LE(n % MESSAGES_PER_WRITE + 1), GUINT32_TO_LE(-1), // dx, dy
+            0 // buttons_state
+        };
+        memcpy(msgs[n], &type, sizeof(type));
+        memcpy(msgs[n] + sizeof(type), motion, sizeof(motion));
+    }
+}
+
+// client side, write all the messages in small bursts
+static void *client_thread(void *opaque)
+{
+    int socket = GPOINTER_TO_INT(opaque);
+    uint8_t msgs[MESSAGES_PER_WRITE][MESSAGE_SIZE];
+
+    red_socket_set_non_blocking(socket, false);
+    fill_messages(msgs, MESSAGES_PER_WRITE);
+
+    for (unsigned sent = 0; sent < NUM_MESSAGES; sent += MESSAGES_PER_WRITE) {
+        ssize_t size = MIN(MESSAGES_PER_WRITE, NUM_MESSAGES - sent) * MESSAGE_SIZE;
+        g_assert_cmpint(socket_write(socket, msgs, size), ==, size);
+    }
+    return nullptr;
+}
+
+static RedStream *create_dummy_stream(SpiceServer *server, int *p_socket)
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_LOCAL, SOCK_STREAM, 0, sv), ==, 0);
+    if (p_socket) {
+        *p_socket = sv[1];
+    }
+    red_socket_set_non_blocking(sv[0], true);
+    red_socket_set_non_blocking(sv[1], true);
+
+    RedStream * stream = red_stream_new(server, sv[0]);
+    g_assert_nonnull(stream);
+
+    return stream;
+}
+
+static void timeout_cb(void *opaque)
+{
+    g_error("timed out, received %u messages", messages_received);
+}
+
+/* Receive the messages written by the client.
+ * If queued is set all the messages are written to the socket before
+ * the channel starts reading, otherwise a thread writes them while
+ * the channel reads. Returns the number of read system calls done. */
+static int64_t channel_receive(unsigned num_messages, bool queued)
+{
+    SpiceCoreInterface *core;
+    int client_socket = -1;
+
+    SpiceServer *server = spice_server_new();
+    g_assert_nonnull(server);
+
+    core = basic_event_loop_init();
+    g_assert_nonnull(core);
+
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    auto channel =
+        red::make_shared<RedTestChannel>(server, SPICE_CHANNEL_INPUTS, 0);
+
+    RedChannelCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    uint32_t common_caps = 1 << SPICE_COMMON_CAP_MINI_HEADER;
+    caps.num_common_caps = 1;
+    caps.common_caps = static_cast<uint32_t *>(spice_memdup(&common_caps, sizeof(common_caps)));
+
+    RedClient *client = red_client_new(server, FALSE);
+    g_assert_nonnull(client);
+
+    red::shared_ptr<MainChannel> main_channel(main_channel_new(server));
+    g_assert(main_channel);
+
+    MainChannelClient *mcc;
+    mcc = main_channel_link(main_channel.get(), client, create_dummy_stream(server, nullptr),
+                            0, FALSE, &caps);
+    g_assert_nonnull(mcc);
+
+    channel->connect(client, create_dummy_stream(server, &client_socket),
+                     FALSE, &caps);
+    red_channel_capabilities_reset(&caps);
+
+    SpiceTimer *timeout_timer = core->timer_add(timeout_cb, nullptr);
+    core->timer_start(timeout_timer, 60 * 1000);
+
+    // reading the counter needs some read calls too
+    int64_t overhead = get_read_syscalls();
+    overhead = get_read_syscalls() - overhead;
+
+    messages_received = 0;
+    messages_expected = num_messages;
+    GThread *thread = nullptr;
+    if (queued) {
+        auto msgs = g_new(uint8_t[MESSAGE_SIZE], num_messages);
+        fill_messages(msgs, num_messages);
+        g_assert_cmpint(socket_write(client_socket, msgs, num_messages * MESSAGE_SIZE), ==,
+                        num_messages * MESSAGE_SIZE);
+        g_free(msgs);
+    }
+
+    int64_t reads = get_read_syscalls();
+    gint64 start = g_get_monotonic_time();
+    if (!queued) {
+        thread = g_thread_new("client", client_thread, GINT_TO_POINTER(client_socket));
+    }
+
+    basic_event_loop_mainloop();
+
+    gint64 cost = g_get_monotonic_time() - start;
+    reads = get_read_syscalls() - reads - overhead;
+    if (thread) {
+        g_thread_join(thread);
+    }
+
+    g_assert_cmpuint(messages_received, ==, num_messages);
+    printf("%u messages, %" G_GINT64_FORMAT " read syscalls, %gus per message\n",
+           num_messages, reads, (double) cost / num_messages);
+
+    core->timer_remove(timeout_timer);
+    client->destroy();
+    main_channel.reset();
+    channel.reset();
+    socket_close(client_socket);
+
+    spice_server_destroy(server);
+
+    basic_event_loop_destroy();
+
+    return reads;
+}
+
+static void test_channel_receive()
+{
+    if (get_read_syscalls() < 0) {
+        g_test_skip("read syscalls count not available");
+        return;
+    }
+
+    int64_t reads = channel_receive(NUM_MESSAGES, false);
+
+    // at worst every write of the client is read separately (or split
+    // by the end of the read ahead buffer) and followed by a read
+    // returning EAGAIN. Without read ahead each message needed 2 reads.
+    const int64_t num_writes = (NUM_MESSAGES + MESSAGES_PER_WRITE - 1) / MESSAGES_PER_WRITE;
+    g_assert_cmpint(reads, <=, 2 * (num_writes + NUM_MESSAGES * MESSAGE_SIZE / RECEIVE_BUF_SIZE + 1));
+}
+
+static void test_channel_receive_queued()
+{
+    if (get_read_syscalls() < 0) {
+        g_test_skip("read syscalls count not available");
+        return;
+    }
+
+    int64_t reads = channel_receive(NUM_QUEUED_MESSAGES, true);
+
+    // all data is read in RECEIVE_BUF_SIZE chunks, then a last read
+    // returns EAGAIN. The event loop can read its wakeup fd.
+    const int64_t expected_reads =
+        (NUM_QUEUED_MESSAGES * MESSAGE_SIZE + RECEIVE_BUF_SIZE - 1) / RECEIVE_BUF_SIZE + 1;
+    g_assert_cmpint(reads, >=, expected_reads);
+    g_assert_cmpint(reads, <=, expected_reads + 1);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/channel-receive", test_channel_receive);
+    g_test_add_func("/server/channel-receive-queued", test_channel_receive_queued);
+
+    return g_test_run();
+}
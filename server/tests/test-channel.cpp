@@ -41,6 +41,17 @@ struct RedTestChannel final: public RedChannel
                     int migration, RedChannelCapabilities *caps) override;
 };
 
+/*
+ * A channel without acks, keeping its client for the test
+ */
+struct RedHoldChannel final: public RedChannel
+{
+    using RedChannel::RedChannel;
+    void on_connect(RedClient *client, RedStream *stream,
+                    int migration, RedChannelCapabilities *caps) override;
+    RedChannelClient *rcc = nullptr;
+};
+
 class RedTestChannelClient final: public RedChannelClient
 {
     using RedChannelClient::RedChannelClient;
@@ -71,6 +82,16 @@ RedTestChannel::on_connect(RedClient *client, RedStream *stream,
     }
 }
 
+void
+RedHoldChannel::on_connect(RedClient *client, RedStream *stream,
+                           int migration, RedChannelCapabilities *caps)
+{
+    auto client_rcc =
+        red::make_shared<RedTestChannelClient>(this, client, stream, caps);
+    g_assert_true(client_rcc->init());
+    rcc = client_rcc.get();
+}
+
 uint8_t *
 RedTestChannelClient::alloc_recv_buf(uint16_t type, uint32_t size)
 {
@@ -270,11 +291,100 @@ static void channel_loop()
     basic_event_loop_destroy();
 }
 
+#define HOLD_MS 100
+// size of the messages sent with the mini header
+#define EMPTY_MSG_SIZE 6
+
+// before the deadline the items are still in the pipe
+static void hold_check_before(void *opaque)
+{
+    auto rcc = static_cast<RedChannelClient *>(opaque);
+    char buffer[256];
+
+    g_assert_cmpuint(rcc->get_pipe_size(), ==, 3);
+    g_assert_cmpint(socket_read(client_socket, buffer, sizeof(buffer)), <, 0);
+}
+
+// after the deadline they were all sent without further push
+static void hold_check_after(void *opaque)
+{
+    auto rcc = static_cast<RedChannelClient *>(opaque);
+    char buffer[256];
+
+    g_assert_true(rcc->pipe_is_empty());
+    g_assert_cmpint(socket_read(client_socket, buffer, sizeof(buffer)), ==, 3 * EMPTY_MSG_SIZE);
+
+    basic_event_loop_quit();
+}
+
+static void channel_hold_pipe()
+{
+    SpiceCoreInterface *core;
+    SpiceServer *server = spice_server_new();
+
+    g_assert_nonnull(server);
+
+    core = basic_event_loop_init();
+    g_assert_nonnull(core);
+
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    auto channel = red::make_shared<RedHoldChannel>(server, SPICE_CHANNEL_PORT, 0,
+                                                   RedChannel::FlagNone); // no acks
+
+    RedChannelCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    uint32_t common_caps = 1 << SPICE_COMMON_CAP_MINI_HEADER;
+    caps.num_common_caps = 1;
+    caps.common_caps = static_cast<uint32_t *>(spice_memdup(&common_caps, sizeof(common_caps)));
+
+    RedClient *client = red_client_new(server, FALSE);
+    g_assert_nonnull(client);
+
+    red::shared_ptr<MainChannel> main_channel(main_channel_new(server));
+    g_assert(main_channel);
+
+    g_assert_nonnull(main_channel_link(main_channel.get(), client,
+                                       create_dummy_stream(server, nullptr), 0, FALSE, &caps));
+
+    channel->connect(client, create_dummy_stream(server, &client_socket), FALSE, &caps);
+    red_channel_capabilities_reset(&caps);
+    RedChannelClient *rcc = channel->rcc;
+    g_assert_nonnull(rcc);
+
+    // hold the pipe then add some items, pushing does not send them
+    rcc->hold_pipe(spice_get_monotonic_time_ns() + HOLD_MS * NSEC_PER_MILLISEC);
+    for (int i = 0; i < 3; ++i) {
+        rcc->pipe_add_empty_msg(SPICE_MSG_MIGRATE_DATA);
+    }
+    rcc->push();
+
+    SpiceTimer *before_timer = core->timer_add(hold_check_before, rcc);
+    core->timer_start(before_timer, HOLD_MS / 2);
+    SpiceTimer *after_timer = core->timer_add(hold_check_after, rcc);
+    core->timer_start(after_timer, HOLD_MS * 3);
+
+    basic_event_loop_mainloop();
+
+    // cleanup
+    client->destroy();
+    main_channel.reset();
+    channel.reset();
+
+    core->timer_remove(after_timer);
+    core->timer_remove(before_timer);
+
+    spice_server_destroy(server);
+
+    basic_event_loop_destroy();
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/server/channel", channel_loop);
+    g_test_add_func("/server/channel/hold-pipe", channel_hold_pipe);
 
     return g_test_run();
 }
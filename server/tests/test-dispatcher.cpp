@@ -41,8 +41,17 @@ static SpiceWatch *watch;
 static unsigned num;
 using TestFixture = int;
 
+// parameters of each test
+struct TestParams {
+    // number of messages with NACK to send every 10 messages
+    int n_nack;
+    DispatcherTransport transport;
+};
+
 static void test_dispatcher_setup(TestFixture *fixture, gconstpointer user_data)
 {
+    auto params = static_cast<const TestParams *>(user_data);
+
     num = 0;
     dispatcher.reset();
     g_assert_null(core);
@@ -50,7 +59,7 @@ static void test_dispatcher_setup(TestFixture *fixture, gconstpointer user_data)
     g_assert_nonnull(core);
     core_int = core_interface_adapter;
     core_int.public_interface = core;
-    dispatcher = red::make_shared<Dispatcher>(10);
+    dispatcher = red::make_shared<Dispatcher>(10, params->transport);
     // TODO not create Reds, just the internal interface ??
     watch = dispatcher->create_watch(&core_int);
 }
@@ -88,8 +97,8 @@ static void msg_check(void *, Msg *msg)
 
 static void *thread_proc(void *arg)
 {
-    // the argument is number of messages with NACK to send
-    int n_nack = GPOINTER_TO_INT(arg);
+    auto params = static_cast<const TestParams *>(arg);
+    int n_nack = params->n_nack;
     g_assert_cmpint(n_nack, >=, 0);
     g_assert_cmpint(n_nack, <=, 10);
 
@@ -108,7 +117,8 @@ static void *thread_proc(void *arg)
     // measure time
     auto cost = spice_get_monotonic_time_ns() - start;
 
-    printf("With ACK/NACK %d/%d time spent %gus each over %u iterations\n",
+    printf("%s: with ACK/NACK %d/%d time spent %gus each over %u iterations\n",
+           dispatcher->get_transport() == DISPATCHER_TRANSPORT_RING ? "ring" : "socket",
            10 - n_nack, n_nack,
            cost / 1000.0 / iterations, iterations);
     return nullptr;
@@ -137,11 +147,23 @@ int main(int argc, char *argv[])
         iterations = atoi(argv[1]);
     }
 
-    for (int i = 0; i <= 10; ++i) {
-        char name[64];
-        sprintf(name, "/server/dispatcher/%d", i);
-        g_test_add(name, TestFixture, GINT_TO_POINTER(i), test_dispatcher_setup,
-                   test_dispatcher, test_dispatcher_teardown);
+    static const struct {
+        const char *name;
+        DispatcherTransport transport;
+    } transports[] = {
+        { "socket", DISPATCHER_TRANSPORT_SOCKET },
+        { "ring", DISPATCHER_TRANSPORT_RING },
+    };
+    static TestParams params[G_N_ELEMENTS(transports)][11];
+
+    for (unsigned t = 0; t < G_N_ELEMENTS(transports); ++t) {
+        for (int i = 0; i <= 10; ++i) {
+            char name[64];
+            params[t][i] = { i, transports[t].transport };
+            sprintf(name, "/server/dispatcher/%s/%d", transports[t].name, i);
+            g_test_add(name, TestFixture, &params[t][i], test_dispatcher_setup,
+                       test_dispatcher, test_dispatcher_teardown);
+        }
     }
 
     return g_test_run();
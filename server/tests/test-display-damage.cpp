@@ -0,0 +1,366 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test the drawables of a display client which stopped reading are
+ * accumulated as damage, and the damage of a surface destroyed meanwhile
+ * is dropped rather than sent once the client reads again.
+ * Test the frames sent to such a client are paced further apart
+ */
+#include <config.h>
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "dcc-private.h"
+#include "display-channel.h"
+#include "main-channel.h"
+#include "net-utils.h"
+#include "red-client.h"
+#include "red-parse-qxl.h"
+#include "reds.h"
+
+#define WIDTH 256
+#define HEIGHT 256
+// the surface copied to the primary one
+#define SURFACE_ID 1
+#define SURFACE_SIZE 64
+#define DAMAGE_PIPE_SIZE 16
+#define NUM_DRAWS 200
+#define FRAME_RATE 100
+#define NUM_BLOCKED_FRAMES 3
+
+static uint32_t primary_pixels[WIDTH * HEIGHT];
+static uint32_t surface_pixels[SURFACE_SIZE * SURFACE_SIZE];
+
+static red::shared_ptr<RedDrawable> red_drawable_new(uint32_t surface_id, const SpiceRect *bbox)
+{
+    auto red_drawable = red::make_shared<RedDrawable>();
+
+    red_drawable->surface_id = surface_id;
+    red_drawable->effect = QXL_EFFECT_OPAQUE;
+    red_drawable->bbox = *bbox;
+    red_drawable->clip.type = SPICE_CLIP_TYPE_NONE;
+    for (auto &surface_dep : red_drawable->surface_deps) {
+        surface_dep = -1;
+    }
+    return red_drawable;
+}
+
+static red::shared_ptr<RedDrawable> fill_new(uint32_t surface_id, const SpiceRect *bbox,
+                                             uint32_t color)
+{
+    auto red_drawable = red_drawable_new(surface_id, bbox);
+
+    red_drawable->type = QXL_DRAW_FILL;
+    red_drawable->u.fill.brush.type = SPICE_BRUSH_TYPE_SOLID;
+    red_drawable->u.fill.brush.u.color = color;
+    red_drawable->u.fill.rop_descriptor = SPICE_ROPD_OP_PUT;
+    return red_drawable;
+}
+
+// copy the whole surface SURFACE_ID to the primary surface
+static red::shared_ptr<RedDrawable> copy_surface_new(const SpiceRect *bbox)
+{
+    auto red_drawable = red_drawable_new(0, bbox);
+    const SpiceRect src_area = { 0, 0, SURFACE_SIZE, SURFACE_SIZE };
+    auto image = g_new0(SpiceImage, 1);
+
+    image->descriptor.type = SPICE_IMAGE_TYPE_SURFACE;
+    image->descriptor.width = SURFACE_SIZE;
+    image->descriptor.height = SURFACE_SIZE;
+    image->u.surface.surface_id = SURFACE_ID;
+
+    red_drawable->type = QXL_DRAW_COPY;
+    red_drawable->surface_deps[0] = SURFACE_ID;
+    red_drawable->surfaces_rects[0] = src_area;
+    red_drawable->u.copy.src_bitmap = image;
+    red_drawable->u.copy.src_area = src_area;
+    red_drawable->u.copy.rop_descriptor = SPICE_ROPD_OP_PUT;
+    red_drawable->u.copy.scale_mode = SPICE_IMAGE_SCALE_MODE_NEAREST;
+    return red_drawable;
+}
+
+static SpiceRect rand_rect(GRand *rand, int32_t max_size)
+{
+    SpiceRect rect;
+
+    rect.left = g_rand_int_range(rand, 0, max_size - 8);
+    rect.top = g_rand_int_range(rand, 0, max_size - 8);
+    rect.right = rect.left + 8;
+    rect.bottom = rect.top + 8;
+    return rect;
+}
+
+struct TestDisplay {
+    SpiceCoreInterface *core;
+    SpiceServer *server;
+    red::shared_ptr<DisplayChannel> display;
+    red::shared_ptr<MainChannel> main_channel;
+    RedClient *client;
+    DisplayChannelClient *dcc;
+    // both ends of the display channel connection
+    int server_socket;
+    int client_socket;
+};
+
+static RedStream *create_dummy_stream(SpiceServer *server, int *p_socket)
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_LOCAL, SOCK_STREAM, 0, sv), ==, 0);
+    if (p_socket) {
+        *p_socket = sv[1];
+    }
+    red_socket_set_non_blocking(sv[0], true);
+    red_socket_set_non_blocking(sv[1], true);
+
+    RedStream *stream = red_stream_new(server, sv[0]);
+    g_assert_nonnull(stream);
+
+    return stream;
+}
+
+// the client sends SPICE_MSGC_DISPLAY_INIT right after the link
+static void send_display_init(int socket)
+{
+    static const uint8_t msg[] = {
+        // mini header: type and size
+        SPICE_MSGC_DISPLAY_INIT & 0xff, SPICE_MSGC_DISPLAY_INIT >> 8, 14, 0, 0, 0,
+        // pixmap cache id and size
+        1, 0, 0, 0, 1, 0, 0, 0, 0,
+        // GLZ dictionary id and window size
+        1, 0, 0, 0x40, 0,
+    };
+    g_assert_cmpint(write(socket, msg, sizeof(msg)), ==, sizeof(msg));
+}
+
+static size_t read_all(int socket)
+{
+    uint8_t buffer[64 * 1024];
+    size_t total = 0;
+    ssize_t len;
+
+    while ((len = read(socket, buffer, sizeof(buffer))) > 0) {
+        total += len;
+    }
+    return total;
+}
+
+// create a display channel with the surfaces and connect a client
+// which doesn't read yet
+static void test_display_init(TestDisplay *test)
+{
+    SpiceCoreInterface *core = basic_event_loop_init();
+    SpiceServer *server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    // no capabilities, the guest is not told about the client
+    QXLInterface qxl_interface = {};
+    qxl_interface.base.major_version = 3;
+    QXLInstance qxl = {};
+    qxl.base.sif = &qxl_interface.base;
+
+    auto display = display_channel_new(server, &qxl, reds_get_core_interface(server), nullptr,
+                                       FALSE, SPICE_STREAM_VIDEO_OFF,
+                                       reds_get_video_codecs(server), 2);
+    g_assert_nonnull(display.get());
+    g_assert_nonnull(display_channel_create_surface(display.get(), 0, WIDTH, HEIGHT, WIDTH * 4,
+                                                    SPICE_SURFACE_FMT_32_xRGB, primary_pixels,
+                                                    FALSE, TRUE));
+    g_assert_nonnull(display_channel_create_surface(display.get(), SURFACE_ID,
+                                                    SURFACE_SIZE, SURFACE_SIZE, SURFACE_SIZE * 4,
+                                                    SPICE_SURFACE_FMT_32_xRGB, surface_pixels,
+                                                    FALSE, TRUE));
+
+    // connect a client
+    RedChannelCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    uint32_t common_caps = 1 << SPICE_COMMON_CAP_MINI_HEADER;
+    caps.num_common_caps = 1;
+    caps.common_caps = static_cast<uint32_t *>(spice_memdup(&common_caps, sizeof(common_caps)));
+
+    RedClient *client = red_client_new(server, FALSE);
+    g_assert_nonnull(client);
+    red::shared_ptr<MainChannel> main_channel(main_channel_new(server));
+    g_assert_nonnull(main_channel_link(main_channel.get(), client,
+                                       create_dummy_stream(server, nullptr), 0, FALSE, &caps));
+
+    int client_socket;
+    RedStream *stream = create_dummy_stream(server, &client_socket);
+    int server_socket = stream->socket;
+    send_display_init(client_socket);
+    display->connect(client, stream, FALSE, &caps);
+    red_channel_capabilities_reset(&caps);
+
+    g_assert_nonnull(display->get_clients());
+    auto dcc = static_cast<DisplayChannelClient *>(display->get_clients()->data);
+    g_assert_true(dcc->is_connected());
+
+    test->core = core;
+    test->server = server;
+    test->display = std::move(display);
+    test->main_channel = std::move(main_channel);
+    test->client = client;
+    test->dcc = dcc;
+    test->server_socket = server_socket;
+    test->client_socket = client_socket;
+}
+
+static void test_display_cleanup(TestDisplay *test)
+{
+    test->client->destroy();
+    test->main_channel.reset();
+    display_channel_destroy_surfaces(test->display.get());
+    test->display->destroy();
+    test->display.reset();
+    close(test->client_socket);
+
+    spice_server_destroy(test->server);
+    basic_event_loop_destroy();
+}
+
+static void test_display_damage()
+{
+    g_setenv(DISPLAY_DAMAGE_PIPE_SIZE_ENV, G_STRINGIFY(DAMAGE_PIPE_SIZE), TRUE);
+
+    TestDisplay test;
+    test_display_init(&test);
+    DisplayChannel *display = test.display.get();
+    DisplayChannelClient *dcc = test.dcc;
+
+    // the client does not read, the first drawables fill the pipe. The
+    // copy keeps the surface alive after it is destroyed
+    GRand *rand = g_rand_new_with_seed(7);
+    SpiceRect rect = rand_rect(rand, SURFACE_SIZE);
+    display_channel_process_draw(display, fill_new(SURFACE_ID, &rect, 0xff0000), 1);
+    const SpiceRect copy_bbox = { 16, 16, 16 + SURFACE_SIZE, 16 + SURFACE_SIZE };
+    display_channel_process_draw(display, copy_surface_new(&copy_bbox), 1);
+    for (unsigned n = 0; n < NUM_DRAWS; n++) {
+        uint32_t surface_id = n % 2 ? SURFACE_ID : 0;
+        rect = rand_rect(rand, surface_id ? SURFACE_SIZE : WIDTH);
+        display_channel_process_draw(display, fill_new(surface_id, &rect, g_rand_int(rand)), 1);
+    }
+    g_rand_free(rand);
+
+    // the other drawables are damage of both surfaces
+    g_assert_cmpuint(dcc->priv->damaged_surfaces, ==, 2);
+
+    // the surface is still referenced by the copy in the pipe
+    auto destroy_cmd = red::make_shared<RedSurfaceCmd>();
+    destroy_cmd->surface_id = SURFACE_ID;
+    destroy_cmd->type = QXL_SURFACE_CMD_DESTROY;
+    display_channel_process_surface_cmd(display, std::move(destroy_cmd), false);
+    g_assert_cmpuint(dcc->priv->damaged_surfaces, ==, 1);
+
+    // the client reads again, the damage of the primary surface is sent
+    // once the pipe is empty
+    size_t received = 0;
+    bool pending = true;
+    for (unsigned n = 0; n < 1000 && pending; n++) {
+        received += read_all(test.client_socket);
+        dcc->ack_zero_messages_window();
+        dcc->push();
+        pending = display_channel_push_damage(display) || !dcc->pipe_is_empty();
+    }
+    g_assert_false(pending);
+    g_assert_cmpuint(dcc->priv->damaged_surfaces, ==, 0);
+    g_assert_cmpuint(received, >, 0);
+    g_assert_true(dcc->is_connected());
+
+    test_display_cleanup(&test);
+    g_unsetenv(DISPLAY_DAMAGE_PIPE_SIZE_ENV);
+}
+
+// draw on the primary surface once the previous frame interval ended,
+// returns the time left before the next frame
+static uint64_t draw_frame(TestDisplay *test)
+{
+    DisplayChannelClient *dcc = test->dcc;
+    uint64_t now = spice_get_monotonic_time_ns();
+
+    if (now < dcc->priv->next_frame_time) {
+        g_usleep((dcc->priv->next_frame_time - now) / NSEC_PER_MICROSEC + 1);
+    }
+    const SpiceRect rect = { 0, 0, 8, 8 };
+    display_channel_process_draw(test->display.get(), fill_new(0, &rect, 0xff0000), 1);
+    dcc->ack_zero_messages_window();
+    dcc->push();
+
+    now = spice_get_monotonic_time_ns();
+    g_assert_cmpuint(dcc->priv->next_frame_time, >, now);
+    return dcc->priv->next_frame_time - now;
+}
+
+static void test_display_frame_rate()
+{
+    g_setenv(DISPLAY_FRAME_RATE_ENV, G_STRINGIFY(FRAME_RATE), TRUE);
+
+    TestDisplay test;
+    test_display_init(&test);
+    DisplayChannelClient *dcc = test.dcc;
+    const uint64_t frame_interval = NSEC_PER_SEC / FRAME_RATE;
+
+    // the client absorbs the frames, they are sent at the frame rate
+    g_assert_cmpuint(draw_frame(&test), <=, frame_interval);
+    read_all(test.client_socket);
+    g_assert_cmpuint(draw_frame(&test), <=, frame_interval);
+    g_assert_false(dcc->is_blocked());
+
+    // fill the connection, the next frame can't be sent and the interval
+    // grows with each frame sent while it's still blocked
+    uint8_t buffer[4096] = {};
+    while (write(test.server_socket, buffer, sizeof(buffer)) > 0) {
+        continue;
+    }
+    g_assert_cmpuint(draw_frame(&test), <=, frame_interval);
+    g_assert_true(dcc->is_blocked());
+    uint64_t interval = frame_interval;
+    for (unsigned n = 0; n < NUM_BLOCKED_FRAMES; n++) {
+        uint64_t next_interval = draw_frame(&test);
+        g_assert_cmpuint(next_interval, >, interval);
+        interval = next_interval;
+    }
+    // but not past the 10 frames per second minimum
+    g_assert_cmpuint(interval, <=, NSEC_PER_SEC / 10);
+    g_assert_true(dcc->is_blocked());
+
+    // the client reads again, the interval shrinks back
+    for (unsigned n = 0; n < 1000 && dcc->is_blocked(); n++) {
+        read_all(test.client_socket);
+        dcc->ack_zero_messages_window();
+        dcc->push();
+    }
+    g_assert_false(dcc->is_blocked());
+    g_assert_cmpuint(draw_frame(&test), <, interval);
+    g_assert_true(dcc->is_connected());
+
+    test_display_cleanup(&test);
+    g_unsetenv(DISPLAY_FRAME_RATE_ENV);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, nullptr);
+
+    g_test_add_func("/server/display-damage", test_display_damage);
+    g_test_add_func("/server/display-frame-rate", test_display_frame_rate);
+
+    return g_test_run();
+}
@@ -0,0 +1,159 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Replay a text heavy trace through the tree of a display channel, with
+ * and without the surface indexes, check the rendered surfaces are the
+ * same and compare the time needed
+ */
+#include <config.h>
+
+#include <cstdio>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "display-channel.h"
+#include "rect-index.h"
+#include "red-parse-qxl.h"
+#include "reds.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define NUM_DRAWS 50000
+// an update of a small area is requested every UPDATE_INTERVAL draws
+#define UPDATE_INTERVAL 64
+
+static SpiceServer *server;
+
+static red::shared_ptr<RedDrawable> fill_new(const SpiceRect *bbox, uint32_t color)
+{
+    auto red_drawable = red::make_shared<RedDrawable>();
+
+    red_drawable->surface_id = 0;
+    red_drawable->effect = QXL_EFFECT_OPAQUE;
+    red_drawable->type = QXL_DRAW_FILL;
+    red_drawable->bbox = *bbox;
+    red_drawable->clip.type = SPICE_CLIP_TYPE_NONE;
+    for (auto &surface_dep : red_drawable->surface_deps) {
+        surface_dep = -1;
+    }
+    red_drawable->u.fill.brush.type = SPICE_BRUSH_TYPE_SOLID;
+    red_drawable->u.fill.brush.u.color = color;
+    red_drawable->u.fill.rop_descriptor = SPICE_ROPD_OP_PUT;
+    return red_drawable;
+}
+
+static SpiceRect rand_rect(GRand *rand, int32_t width, int32_t height)
+{
+    SpiceRect rect;
+
+    rect.left = g_rand_int_range(rand, 0, WIDTH - width);
+    rect.top = g_rand_int_range(rand, 0, HEIGHT - height);
+    rect.right = rect.left + width;
+    rect.bottom = rect.top + height;
+    return rect;
+}
+
+/* Draw the trace on a new display channel, returns the time in
+ * microseconds. 'pixels' receives the content of the surface */
+static gint64 replay(int id, uint32_t *pixels)
+{
+    QXLInstance qxl = {};
+    qxl.id = id;
+
+    auto display = display_channel_new(server, &qxl, reds_get_core_interface(server), nullptr,
+                                       FALSE, SPICE_STREAM_VIDEO_OFF,
+                                       reds_get_video_codecs(server), 1);
+    g_assert_nonnull(display.get());
+    g_assert_nonnull(display_channel_create_surface(display.get(), 0, WIDTH, HEIGHT,
+                                                    WIDTH * 4, SPICE_SURFACE_FMT_32_xRGB,
+                                                    pixels, FALSE, FALSE));
+
+    GRand *rand = g_rand_new_with_seed(42);
+    gint64 start = g_get_monotonic_time();
+
+    for (unsigned n = 0; n < NUM_DRAWS; n++) {
+        unsigned kind = g_rand_int_range(rand, 0, 100);
+        SpiceRect rect;
+
+        if (kind < 85) {
+            // a glyph
+            rect = rand_rect(rand, 8, 16);
+        } else if (kind < 95) {
+            // a line of text is cleared
+            rect = rand_rect(rand, 400, 16);
+        } else {
+            // a window
+            rect = rand_rect(rand, g_rand_int_range(rand, 200, 800), g_rand_int_range(rand, 100, 600));
+        }
+        display_channel_process_draw(display.get(), fill_new(&rect, g_rand_int(rand)), 1);
+
+        if (n % UPDATE_INTERVAL == UPDATE_INTERVAL - 1) {
+            rect = rand_rect(rand, 64, 64);
+            display_channel_draw(display.get(), &rect, 0);
+        }
+    }
+
+    SpiceRect all = { 0, 0, WIDTH, HEIGHT };
+    display_channel_draw(display.get(), &all, 0);
+    gint64 cost = g_get_monotonic_time() - start;
+
+    g_rand_free(rand);
+    display_channel_destroy_surfaces(display.get());
+    display->destroy();
+    return cost;
+}
+
+static void test_display_tree()
+{
+    auto pixels_index = g_new(uint32_t, WIDTH * HEIGHT);
+    auto pixels_ring = g_new(uint32_t, WIDTH * HEIGHT);
+
+    g_unsetenv(RECT_INDEX_DISABLE_ENV);
+    gint64 index_us = replay(0, pixels_index);
+
+    g_setenv(RECT_INDEX_DISABLE_ENV, "1", TRUE);
+    gint64 ring_us = replay(1, pixels_ring);
+    g_unsetenv(RECT_INDEX_DISABLE_ENV);
+
+    // the index must not change what is drawn
+    g_assert_cmpmem(pixels_index, WIDTH * HEIGHT * 4, pixels_ring, WIDTH * HEIGHT * 4);
+
+    printf("%d draws: %.2fus per draw walking the rings, %.2fus with the indexes\n",
+           NUM_DRAWS, (double) ring_us / NUM_DRAWS, (double) index_us / NUM_DRAWS);
+
+    g_free(pixels_ring);
+    g_free(pixels_index);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, nullptr);
+
+    SpiceCoreInterface *core = basic_event_loop_init();
+    server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    g_test_add_func("/server/display-tree", test_display_tree);
+
+    int ret = g_test_run();
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+
+    return ret;
+}
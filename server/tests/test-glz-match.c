@@ -0,0 +1,170 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test GLZ match extension against the plain pixel loop and measure speed
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "glz-encoder.h"
+#include "glz-encoder-priv.h"
+
+#define FRAME_WIDTH 1920
+#define FRAME_HEIGHT 1080
+
+static const uint8_t masks[][4] = {
+    { 0xff, 0xff, 0xff, 0xff }, // PLT, RGB24
+    { 0x00, 0x00, 0x00, 0xff }, // RGB_ALPHA
+    { 0xff, 0x7f, 0xff, 0x7f }, // RGB16 (little endian)
+    { 0xff, 0xff, 0xff, 0x00 }, // RGB32
+};
+
+static size_t match_len_ref(const uint8_t *a, const uint8_t *b, size_t len, const uint8_t mask[4])
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if ((a[i] ^ b[i]) & mask[i & 3]) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void test_match_len(void)
+{
+    uint8_t a[512], b[512];
+    GRand *rand = g_rand_new_with_seed(0x5a5a);
+
+    for (unsigned n = 0; n < 100000; n++) {
+        size_t len = g_rand_int_range(rand, 0, 400);
+        size_t offset = g_rand_int_range(rand, 0, 4) * 4;
+        const uint8_t *mask = masks[g_rand_int_range(rand, 0, G_N_ELEMENTS(masks))];
+
+        for (unsigned i = 0; i < sizeof(a); i++) {
+            a[i] = b[i] = g_rand_int(rand);
+        }
+        // change a single bit, it could be masked out
+        b[g_rand_int_range(rand, 0, sizeof(b))] ^= 1 << g_rand_int_range(rand, 0, 8);
+
+        g_assert_cmpuint(glz_match_len(a + offset, b + offset, len, mask), ==,
+                         match_len_ref(a + offset, b + offset, len, mask));
+    }
+    g_rand_free(rand);
+}
+
+/* Build a frame looking like a desktop: a gradient background, some
+ * windows with a flat color and lines of "text" */
+static uint32_t *desktop_frame_new(unsigned seed)
+{
+    uint32_t *frame = g_new(uint32_t, FRAME_WIDTH * FRAME_HEIGHT);
+    GRand *rand = g_rand_new_with_seed(seed);
+
+    for (unsigned y = 0; y < FRAME_HEIGHT; y++) {
+        for (unsigned x = 0; x < FRAME_WIDTH; x++) {
+            frame[y * FRAME_WIDTH + x] = 0xff000000u | (y * 255 / FRAME_HEIGHT) << 8 | 0x40;
+        }
+    }
+    for (unsigned w = 0; w < 8; w++) {
+        unsigned x0 = g_rand_int_range(rand, 0, FRAME_WIDTH / 2);
+        unsigned y0 = g_rand_int_range(rand, 0, FRAME_HEIGHT / 2);
+        unsigned x1 = x0 + g_rand_int_range(rand, 100, FRAME_WIDTH / 2);
+        unsigned y1 = y0 + g_rand_int_range(rand, 100, FRAME_HEIGHT / 2);
+
+        for (unsigned y = y0; y < y1; y++) {
+            for (unsigned x = x0; x < x1; x++) {
+                uint32_t pixel = 0xffeeeeeeu;
+                // text lines 16 pixels high, glyphs 8 pixels wide
+                if (y % 16 < 12 && (x / 8 + y / 16) % 7 != 0 && g_rand_int_range(rand, 0, 4) == 0) {
+                    pixel = 0xff202020u;
+                }
+                frame[y * FRAME_WIDTH + x] = pixel;
+            }
+        }
+    }
+    g_rand_free(rand);
+    return frame;
+}
+
+static size_t match_frames(const uint32_t *a, const uint32_t *b, gboolean use_ref)
+{
+    // resolved once like the encoders do
+    GlzMatchLenFunc match_len = glz_get_match_len_func();
+    size_t total = 0;
+
+    for (size_t pos = 0; pos < FRAME_WIDTH * FRAME_HEIGHT; ) {
+        size_t len = (FRAME_WIDTH * FRAME_HEIGHT - pos) * sizeof(uint32_t);
+        if (use_ref) {
+            len = match_len_ref((const uint8_t *) (a + pos), (const uint8_t *) (b + pos),
+                                len, masks[3]);
+        } else {
+            len = match_len((const uint8_t *) (a + pos), (const uint8_t *) (b + pos),
+                            len, masks[3]);
+        }
+        len /= sizeof(uint32_t);
+        total += len;
+        pos += len + 1;
+    }
+    return total;
+}
+
+static void test_match_speed(void)
+{
+    uint32_t *frame = desktop_frame_new(1);
+    uint32_t *next_frame = g_memdup2(frame, FRAME_WIDTH * FRAME_HEIGHT * sizeof(uint32_t));
+    GRand *rand = g_rand_new_with_seed(2);
+    const unsigned iterations = 20;
+
+    // typing and cursor movements change a few pixels
+    for (unsigned n = 0; n < 20000; n++) {
+        next_frame[g_rand_int_range(rand, 0, FRAME_WIDTH * FRAME_HEIGHT)] ^= 0x00ffffff;
+    }
+    g_rand_free(rand);
+
+    for (int use_ref = 0; use_ref <= 1; use_ref++) {
+        size_t matched = 0;
+        gint64 start = g_get_monotonic_time();
+
+        for (unsigned n = 0; n < iterations; n++) {
+            matched += match_frames(frame, next_frame, use_ref);
+        }
+        gint64 cost = g_get_monotonic_time() - start;
+
+        printf("%s: %zu pixels matched, %gms per frame\n",
+               use_ref ? "pixel loop" : "glz_match_len", matched / iterations,
+               cost / 1000.0 / iterations);
+        g_assert_cmpuint(matched / iterations, ==, match_frames(frame, next_frame, true));
+    }
+
+    g_free(next_frame);
+    g_free(frame);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/glz/match-len", test_match_len);
+    g_test_add_func("/server/glz/match-speed", test_match_speed);
+
+    return g_test_run();
+}
@@ -67,6 +67,8 @@ enum {
 typedef struct {
     gint refs;
     SpiceBitmap *bitmap;
+    // index of the input frame
+    unsigned index;
 } TestFrame;
 
 #ifdef HAVE_GSTREAMER_0_10
@@ -142,6 +144,9 @@ typedef struct {
 
 // our video encoder we are testing
 static VideoEncoder *video_encoder = NULL;
+static const EncoderInfo *video_encoder_info = NULL;
+// if not 0 a new stream (encoder) is started every this number of frames
+static gint stream_frames = 0;
 
 // image settings
 static gboolean top_down = FALSE;
@@ -189,6 +194,53 @@ static double compute_psnr(SpiceBitmap *bitmap1, int32_t x1, int32_t y1,
                            SpiceBitmap *bitmap2, int32_t x2, int32_t y2,
                            int32_t w, int32_t h);
 
+// send an encoded frame to the output pipeline, the frame reference is
+// moved to the queue
+static void
+send_encoded_frame(TestFrame *frame, VideoBuffer *p_outbuf)
+{
+    // save frame into queue for comparison later
+    pthread_mutex_lock(&frame_queue_mtx);
+    g_queue_push_tail(&frame_queue, frame);
+    while (g_queue_get_length(&frame_queue) >= 16) {
+        pthread_cond_wait(&frame_queue_cond, &frame_queue_mtx);
+    }
+    pthread_mutex_unlock(&frame_queue_mtx);
+    spice_assert(p_outbuf);
+    pipeline_send_raw_data(output_pipeline, p_outbuf);
+    if (file_report) {
+        fprintf(file_report,
+                "Frame: %u\n"
+                "Output size: %u\n",
+                frame->index,
+                (unsigned) p_outbuf->size);
+    }
+}
+
+// send the frames the encoder compressed in the background,
+// waiting for all of them if wait is set
+static void
+get_encoded_frames(bool wait)
+{
+    if (!video_encoder->get_frame) {
+        return;
+    }
+    for (;;) {
+        uint32_t frame_mm_time;
+        gpointer frame;
+        VideoBuffer *p_outbuf = NULL;
+        VideoEncodeResults res =
+            video_encoder->get_frame(video_encoder, &frame_mm_time, &frame, &p_outbuf);
+        if (res == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+            send_encoded_frame((TestFrame *) frame, p_outbuf);
+        } else if (res == VIDEO_ENCODER_FRAME_PENDING && wait) {
+            g_usleep(1000);
+        } else {
+            break;
+        }
+    }
+}
+
 // handle output frames from input pipeline
 static GstFlowReturn
 input_frames(GstSample *sample, void *param)
@@ -197,6 +249,13 @@ input_frames(GstSample *sample, void *param)
 
     spice_assert(video_encoder && sample);
 
+    if (stream_frames && curr_frame_index > 0 && curr_frame_index % stream_frames == 0) {
+        // like a stream stopping and another one starting right after
+        get_encoded_frames(true);
+        video_encoder->destroy(video_encoder);
+        create_video_encoder(video_encoder_info);
+    }
+
     if (SPICE_UNLIKELY(!clipping_type_computed)) {
         compute_clipping_rect(sample);
     }
@@ -207,6 +266,7 @@ input_frames(GstSample *sample, void *param)
 
     // convert frame to SpiceBitmap/DRM prime
     TestFrame *frame = gst_to_spice_frame(sample);
+    frame->index = curr_frame_index;
 
     // send frame to our video encoder (must be from a single thread)
     VideoEncodeResults res =
@@ -214,23 +274,11 @@ input_frames(GstSample *sample, void *param)
                                     &clipping_rect, top_down, frame, &p_outbuf);
     switch (res) {
     case VIDEO_ENCODER_FRAME_ENCODE_DONE:
-        // save frame into queue for comparison later
         frame_ref(frame);
-        pthread_mutex_lock(&frame_queue_mtx);
-        g_queue_push_tail(&frame_queue, frame);
-        while (g_queue_get_length(&frame_queue) >= 16) {
-            pthread_cond_wait(&frame_queue_cond, &frame_queue_mtx);
-        }
-        pthread_mutex_unlock(&frame_queue_mtx);
-        spice_assert(p_outbuf);
-        pipeline_send_raw_data(output_pipeline, p_outbuf);
-        if (file_report) {
-            fprintf(file_report,
-                    "Frame: %u\n"
-                    "Output size: %u\n",
-                    curr_frame_index,
-                    (unsigned) p_outbuf->size);
-        }
+        send_encoded_frame(frame, p_outbuf);
+        break;
+    case VIDEO_ENCODER_FRAME_PENDING:
+        // the encoder keeps a reference until get_frame() returns it
         break;
     case VIDEO_ENCODER_FRAME_UNSUPPORTED:
         // ?? what to do ??
@@ -253,6 +301,7 @@ input_frames(GstSample *sample, void *param)
 
     // TODO call client_stream_report to simulate this report from the client
 
+    get_encoded_frames(false);
     frame_unref(frame);
     return GST_FLOW_OK;
 }
@@ -357,6 +406,8 @@ int main(int argc, char *argv[])
           "Split image into different chunks every LINES lines", "LINES" },
         { "report", 0, 0, G_OPTION_ARG_FILENAME, &file_report_name,
           "Report statistics to file", "FILENAME" },
+        { "stream-frames", 0, 0, G_OPTION_ARG_INT, &stream_frames,
+          "Start a new stream every FRAMES frames", "FRAMES" },
         { NULL }
     };
 
@@ -404,6 +455,11 @@ int main(int argc, char *argv[])
         exit(1);
     }
 
+    if (stream_frames < 0) {
+        g_printerr("Invalid --stream-frames option: %d\n", stream_frames);
+        exit(1);
+    }
+
     if (file_report_name) {
         file_report = fopen(file_report_name, "w");
         if (!file_report) {
@@ -425,7 +481,9 @@ int main(int argc, char *argv[])
     // run all input streaming
     pipeline_wait_eos(input_pipeline);
 
+    get_encoded_frames(true);
     video_encoder->destroy(video_encoder);
+    gstreamer_encoder_clear_pipeline_pool();
 
     // send EOS to output and wait
     // this assure we processed all frames sent from input pipeline
@@ -738,11 +796,18 @@ mock_update_client_playback_delay(void *opaque, uint32_t delay_ms)
     // TODO
 }
 
+static void
+mock_frame_ready(void *opaque)
+{
+    // the frames are polled from input_frames()
+}
+
 static VideoEncoderRateControlCbs rate_control_cbs = {
     .opaque = NULL,
     .get_roundtrip_ms = mock_get_roundtrip_ms,
     .get_source_fps = mock_get_source_fps,
     .update_client_playback_delay = mock_update_client_playback_delay,
+    .frame_ready = mock_frame_ready,
 };
 
 static void
@@ -750,6 +815,7 @@ create_video_encoder(const EncoderInfo *encoder)
 {
     spice_assert(encoder);
 
+    video_encoder_info = encoder;
     video_encoder = encoder->new_encoder(encoder->coded_type, starting_bit_rate, &rate_control_cbs,
                                          (bitmap_ref_t) frame_ref, (bitmap_unref_t) frame_unref);
     if (video_encoder == NULL) {
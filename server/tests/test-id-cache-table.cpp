@@ -0,0 +1,93 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test IdCacheTable against a simple list based implementation
+ */
+#include <config.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <list>
+
+#include "test-glib-compat.h"
+#include "id-cache-table.hpp"
+
+struct TestItem {
+    uint64_t value;
+};
+
+static void test_id_cache_table(void)
+{
+    red::IdCacheTable<TestItem> table;
+    // reference LRU, most recently used first
+    std::list<uint64_t> lru;
+    GRand *rand = g_rand_new_with_seed(1234);
+    uint64_t probes = 0, lookups = 0;
+
+    for (unsigned n = 0; n < 200000; n++) {
+        // use both sequential ids and ids with the same low bits
+        uint64_t id = g_rand_int_range(rand, 0, 5000);
+        if (g_rand_boolean(rand)) {
+            id <<= 20;
+        }
+        auto pos = std::find(lru.begin(), lru.end(), id);
+
+        int op = g_rand_int_range(rand, 0, 10);
+        if (op < 4) {
+            TestItem *item = table.find(id, &probes);
+            lookups++;
+            g_assert_true((item != nullptr) == (pos != lru.end()));
+            if (item) {
+                g_assert_cmpuint(item->value, ==, id * 3);
+                table.touch(item);
+                lru.erase(pos);
+                lru.push_front(id);
+            }
+        } else if (op < 7) {
+            if (pos == lru.end()) {
+                table.insert(id)->value = id * 3;
+                lru.push_front(id);
+            }
+        } else if (op < 9) {
+            TestItem *item = table.lru_tail();
+            g_assert_true((item == nullptr) == lru.empty());
+            if (item) {
+                g_assert_cmpuint(table.get_id(item), ==, lru.back());
+                table.remove(item);
+                lru.pop_back();
+            }
+        } else if (g_rand_int_range(rand, 0, 1000) == 0) {
+            table.clear();
+            lru.clear();
+        }
+        g_assert_cmpuint(table.size(), ==, lru.size());
+    }
+
+    printf("average probes %g\n", (double) probes / lookups);
+    table.destroy();
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/id-cache-table", test_id_cache_table);
+
+    return g_test_run();
+}
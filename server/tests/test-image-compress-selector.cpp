@@ -0,0 +1,150 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Check the image compression selector explores all the candidates,
+ * including when lossy compression is allowed, then picks the cheapest
+ */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "image-compress-selector.h"
+
+#define IMAGE_SIZE (256 * 1024)
+// 10Mbit/s
+#define BIT_RATE (10 * 1000 * 1000)
+#define NUM_CHOICES 200
+
+static SpiceCoreInterface *core;
+static SpiceServer *server;
+
+struct CodecResult {
+    SpiceImageCompression compression;
+    // compressed size and compression time of an IMAGE_SIZE image
+    uint64_t compressed_size;
+    uint64_t time_ns;
+};
+
+static const CodecResult *find_result(const CodecResult *results, size_t num_results,
+                                      SpiceImageCompression compression)
+{
+    for (size_t i = 0; i < num_results; i++) {
+        if (results[i].compression == compression) {
+            return &results[i];
+        }
+    }
+    return nullptr;
+}
+
+// Choose NUM_CHOICES times reporting the results, a codec without a
+// result is never reported like a failing one. 'chosen' counts the times
+// each codec was chosen
+static void run_choices(ImageCompressSelector *selector, BitmapGradualType graduality,
+                        const CodecResult *results, size_t num_results,
+                        uint32_t candidates, unsigned chosen[IMAGE_COMPRESS_NUM_CODECS])
+{
+    for (unsigned n = 0; n < NUM_CHOICES; n++) {
+        SpiceImageCompression compression =
+            image_compress_selector_choose(selector, graduality, candidates,
+                                           IMAGE_SIZE, BIT_RATE);
+        g_assert_cmpuint(compression, <, IMAGE_COMPRESS_NUM_CODECS);
+        g_assert_true(candidates & IMAGE_COMPRESS_CANDIDATE(compression));
+        chosen[compression]++;
+
+        const CodecResult *result = find_result(results, num_results, compression);
+        if (result) {
+            image_compress_selector_update(selector, graduality, compression, IMAGE_SIZE,
+                                           result->compressed_size, result->time_ns);
+        }
+    }
+}
+
+static void test_selector_lossy()
+{
+    // JPEG is the cheapest to send, LZ4 the fastest to compress
+    static const CodecResult results[] = {
+        { IMAGE_COMPRESS_JPEG, IMAGE_SIZE / 20, 2000 * 1000 },
+        { SPICE_IMAGE_COMPRESSION_GLZ, IMAGE_SIZE / 4, 3000 * 1000 },
+        { SPICE_IMAGE_COMPRESSION_LZ, IMAGE_SIZE / 3, 2000 * 1000 },
+        { SPICE_IMAGE_COMPRESSION_LZ4, IMAGE_SIZE / 2, 200 * 1000 },
+    };
+    const uint32_t candidates = IMAGE_COMPRESS_CANDIDATE(IMAGE_COMPRESS_JPEG) |
+                                IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_GLZ) |
+                                IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_LZ) |
+                                IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_LZ4);
+    unsigned chosen[IMAGE_COMPRESS_NUM_CODECS] = {};
+
+    ImageCompressSelector *selector = image_compress_selector_new(100, server, nullptr);
+    g_assert_nonnull(selector);
+    run_choices(selector, BITMAP_GRADUAL_HIGH, results, G_N_ELEMENTS(results),
+                candidates, chosen);
+
+    // every candidate was tried, then JPEG is usually chosen
+    for (const auto &result : results) {
+        g_assert_cmpuint(chosen[result.compression], >=, 4);
+    }
+    g_assert_cmpuint(chosen[IMAGE_COMPRESS_JPEG], >, NUM_CHOICES / 2);
+    g_assert_cmpuint(chosen[SPICE_IMAGE_COMPRESSION_QUIC], ==, 0);
+
+    image_compress_selector_free(selector);
+}
+
+static void test_selector_no_result()
+{
+    // GLZ always fails, it must not keep the others from being tried
+    static const CodecResult results[] = {
+        { SPICE_IMAGE_COMPRESSION_QUIC, IMAGE_SIZE / 8, 4000 * 1000 },
+        { SPICE_IMAGE_COMPRESSION_LZ, IMAGE_SIZE / 3, 1000 * 1000 },
+    };
+    const uint32_t candidates = IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_QUIC) |
+                                IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_GLZ) |
+                                IMAGE_COMPRESS_CANDIDATE(SPICE_IMAGE_COMPRESSION_LZ);
+    unsigned chosen[IMAGE_COMPRESS_NUM_CODECS] = {};
+
+    ImageCompressSelector *selector = image_compress_selector_new(100, server, nullptr);
+    g_assert_nonnull(selector);
+    run_choices(selector, BITMAP_GRADUAL_LOW, results, G_N_ELEMENTS(results),
+                candidates, chosen);
+
+    for (const auto &result : results) {
+        g_assert_cmpuint(chosen[result.compression], >=, 4);
+    }
+    // and it's retried only from time to time
+    g_assert_cmpuint(chosen[SPICE_IMAGE_COMPRESSION_GLZ], <, NUM_CHOICES / 10);
+
+    image_compress_selector_free(selector);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, nullptr);
+
+    core = basic_event_loop_init();
+    server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    g_test_add_func("/server/image-compress-selector/lossy", test_selector_lossy);
+    g_test_add_func("/server/image-compress-selector/no-result", test_selector_no_result);
+
+    int ret = g_test_run();
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+
+    return ret;
+}
@@ -0,0 +1,267 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test the conversion of lines for the JPEG encoders and measure the
+ * frames per second of jpeg_encode and of the MJPEG stream encoder
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "pixel-convert.h"
+#include "jpeg-encoder.h"
+#include "video-encoder.h"
+
+static void reference_convert(JpegEncoderImageType type, const uint8_t *src,
+                              uint8_t *dest, unsigned width)
+{
+    for (unsigned x = 0; x < width; x++, dest += 3) {
+        switch (type) {
+        case JPEG_IMAGE_TYPE_RGB16: {
+            unsigned pixel = src[x * 2] | src[x * 2 + 1] << 8;
+            unsigned r = (pixel >> 10) & 0x1f, g = (pixel >> 5) & 0x1f, b = pixel & 0x1f;
+            dest[0] = r << 3 | r >> 2;
+            dest[1] = g << 3 | g >> 2;
+            dest[2] = b << 3 | b >> 2;
+            break;
+        }
+        case JPEG_IMAGE_TYPE_BGR24:
+            dest[0] = src[x * 3 + 2];
+            dest[1] = src[x * 3 + 1];
+            dest[2] = src[x * 3];
+            break;
+        default:
+            dest[0] = src[x * 4 + 2];
+            dest[1] = src[x * 4 + 1];
+            dest[2] = src[x * 4];
+            break;
+        }
+    }
+}
+
+static const struct {
+    JpegEncoderImageType type;
+    unsigned bpp;
+    SpiceBitmapFmt bitmap_format;
+    PixelConvertLineFunc convert;
+} converters[] = {
+    { JPEG_IMAGE_TYPE_RGB16, 2, SPICE_BITMAP_FMT_16BIT, pixel_convert_rgb16_to_rgb24 },
+    { JPEG_IMAGE_TYPE_BGR24, 3, SPICE_BITMAP_FMT_24BIT, pixel_convert_bgr24_to_rgb24 },
+    { JPEG_IMAGE_TYPE_BGRX32, 4, SPICE_BITMAP_FMT_32BIT, pixel_convert_bgrx32_to_rgb24 },
+};
+
+static void test_pixel_convert(void)
+{
+    GRand *rand = g_rand_new_with_seed(0xc0de);
+
+    for (unsigned i = 0; i < G_N_ELEMENTS(converters); i++) {
+        for (unsigned n = 0; n < 2000; n++) {
+            unsigned width = g_rand_int_range(rand, 0, n < 200 ? 70 : 700);
+            unsigned offset = g_rand_int_range(rand, 0, 16);
+            unsigned src_size = width * converters[i].bpp;
+            // lines are allocated with their exact size so any over-read is caught
+            uint8_t *src = g_malloc(src_size + offset);
+            uint8_t *dest = g_malloc(width * 3 + offset);
+            uint8_t *expected = g_malloc(width * 3 + 1);
+
+            for (unsigned j = 0; j < src_size; j++) {
+                src[offset + j] = g_rand_int(rand);
+            }
+            reference_convert(converters[i].type, src + offset, expected, width);
+            converters[i].convert(src + offset, dest + offset, width);
+            g_assert_cmpmem(dest + offset, width * 3, expected, width * 3);
+
+            g_free(expected);
+            g_free(dest);
+            g_free(src);
+        }
+    }
+    g_rand_free(rand);
+}
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+typedef struct {
+    JpegEncoderUsrContext base;
+    uint8_t *out;
+    unsigned out_size;
+} BenchContext;
+
+static int bench_more_space(JpegEncoderUsrContext *usr, uint8_t **io_ptr)
+{
+    BenchContext *ctx = SPICE_CONTAINEROF(usr, BenchContext, base);
+
+    // restart from the start of the buffer, only the speed matters
+    *io_ptr = ctx->out;
+    return ctx->out_size;
+}
+
+static int bench_more_lines(JpegEncoderUsrContext *usr, uint8_t **lines)
+{
+    return 0;
+}
+
+/* A desktop like frame with some text over gradients */
+static void fill_frame(GRand *rand, unsigned bpp, uint8_t *data)
+{
+    for (unsigned y = 0; y < HEIGHT; y++) {
+        for (unsigned x = 0; x < WIDTH; x++) {
+            uint8_t *pixel = data + (y * WIDTH + x) * bpp;
+            unsigned r = x * 255 / WIDTH, g = y * 255 / HEIGHT, b = 0x80;
+
+            if (y % 16 < 12 && g_rand_int_range(rand, 0, 4) == 0) {
+                r = g = b = 0x10;
+            }
+            if (bpp == 2) {
+                uint16_t value = GUINT16_TO_LE((r >> 3) << 10 | (g >> 3) << 5 | (b >> 3));
+                memcpy(pixel, &value, sizeof(value));
+                continue;
+            }
+            pixel[0] = b;
+            pixel[1] = g;
+            pixel[2] = r;
+            if (bpp == 4) {
+                pixel[3] = 0;
+            }
+        }
+    }
+}
+
+static void test_jpeg_encode_speed(void)
+{
+    const unsigned frames = 20;
+    GRand *rand = g_rand_new_with_seed(1);
+    BenchContext ctx = {
+        .base = { bench_more_space, bench_more_lines },
+        .out_size = 1024 * 1024,
+    };
+    JpegEncoderContext *enc = jpeg_encoder_create(&ctx.base);
+
+    ctx.out = g_malloc(ctx.out_size);
+    for (unsigned i = 0; i < G_N_ELEMENTS(converters); i++) {
+        unsigned bpp = converters[i].bpp;
+        uint8_t *frame = g_malloc(WIDTH * HEIGHT * bpp);
+        int size = 0;
+
+        fill_frame(rand, bpp, frame);
+        uint64_t start = spice_get_monotonic_time_ns();
+        for (unsigned n = 0; n < frames; n++) {
+            size = jpeg_encode(enc, 85, converters[i].type, WIDTH, HEIGHT, frame, HEIGHT,
+                               WIDTH * bpp, ctx.out, ctx.out_size);
+        }
+        uint64_t elapsed = spice_get_monotonic_time_ns() - start;
+        g_assert_cmpint(size, >, 0);
+
+        g_test_message("%u bytes per pixel %ux%u: %.1f frames/s, %d bytes",
+                       bpp, WIDTH, HEIGHT, frames * 1e9 / elapsed, size);
+        g_free(frame);
+    }
+    g_free(ctx.out);
+    jpeg_encoder_destroy(enc);
+    g_rand_free(rand);
+}
+
+static void bitmap_ref_noop(gpointer data)
+{
+}
+
+/* Encode some frames with the MJPEG stream encoder, with and without the
+ * slice threads. Only the time spent encoding is measured, the frames the
+ * rate control drops are retried a bit later */
+static void test_mjpeg_encode_speed(void)
+{
+    const unsigned frames = 5;
+    static const char *const slice_threads[] = { "0", "4" };
+    GRand *rand = g_rand_new_with_seed(1);
+    VideoEncoderRateControlCbs cbs = { NULL };
+    const SpiceRect src = { 0, 0, WIDTH, HEIGHT };
+
+    for (unsigned i = 0; i < G_N_ELEMENTS(converters); i++) {
+        unsigned bpp = converters[i].bpp;
+        uint8_t *frame = g_malloc(WIDTH * HEIGHT * bpp);
+        SpiceChunks *chunks = g_malloc0(sizeof(SpiceChunks) + sizeof(SpiceChunk));
+        SpiceBitmap bitmap = {
+            .format = converters[i].bitmap_format,
+            .flags = SPICE_BITMAP_FLAGS_TOP_DOWN,
+            .x = WIDTH,
+            .y = HEIGHT,
+            .stride = WIDTH * bpp,
+            .data = chunks,
+        };
+
+        fill_frame(rand, bpp, frame);
+        chunks->data_size = WIDTH * HEIGHT * bpp;
+        chunks->num_chunks = 1;
+        chunks->chunk[0].data = frame;
+        chunks->chunk[0].len = chunks->data_size;
+
+        for (unsigned t = 0; t < G_N_ELEMENTS(slice_threads); t++) {
+            g_setenv(MJPEG_ENCODER_SLICE_THREADS_ENV, slice_threads[t], TRUE);
+            VideoEncoder *encoder = mjpeg_encoder_new(SPICE_VIDEO_CODEC_TYPE_MJPEG,
+                                                      1000 * 1000 * 1000, &cbs,
+                                                      bitmap_ref_noop, bitmap_ref_noop);
+            g_assert_nonnull(encoder);
+
+            uint64_t elapsed = 0;
+            uint32_t size = 0;
+            for (unsigned n = 0; n < frames; ) {
+                VideoBuffer *outbuf = NULL;
+                uint64_t start = spice_get_monotonic_time_ns();
+                VideoEncodeResults ret = encoder->encode_frame(encoder, n * 33, &bitmap, &src,
+                                                               TRUE, NULL, &outbuf);
+                if (ret == VIDEO_ENCODER_FRAME_DROP) {
+                    g_usleep(10 * 1000);
+                    continue;
+                }
+                elapsed += spice_get_monotonic_time_ns() - start;
+                g_assert_cmpint(ret, ==, VIDEO_ENCODER_FRAME_ENCODE_DONE);
+
+                // a complete JPEG image
+                g_assert_cmpuint(outbuf->size, >, 4);
+                g_assert_cmpuint(outbuf->data[0], ==, 0xff);
+                g_assert_cmpuint(outbuf->data[1], ==, 0xd8);
+                g_assert_cmpuint(outbuf->data[outbuf->size - 2], ==, 0xff);
+                g_assert_cmpuint(outbuf->data[outbuf->size - 1], ==, 0xd9);
+                size = outbuf->size;
+                outbuf->free(outbuf);
+                n++;
+            }
+            encoder->destroy(encoder);
+
+            g_test_message("MJPEG %u bytes per pixel %ux%u, %s slice threads: %.1f frames/s, %u bytes",
+                           bpp, WIDTH, HEIGHT, slice_threads[t], frames * 1e9 / elapsed, size);
+        }
+        g_unsetenv(MJPEG_ENCODER_SLICE_THREADS_ENV);
+        g_free(chunks);
+        g_free(frame);
+    }
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/pixel-convert", test_pixel_convert);
+    g_test_add_func("/server/pixel-convert/jpeg-encode-speed", test_jpeg_encode_speed);
+    g_test_add_func("/server/pixel-convert/mjpeg-encode-speed", test_mjpeg_encode_speed);
+
+    return g_test_run();
+}
@@ -0,0 +1,226 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test RectIndex against a walk of a ring and compare the time needed to
+ * find the items intersecting the drawables of a text heavy desktop
+ */
+#include <config.h>
+
+#include <common/ring.h>
+
+#include "test-glib-compat.h"
+#include "rect-index.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+struct TestItem {
+    RingItem link;
+    RectIndexEntry entry;
+    SpiceRect rect;
+};
+
+static bool rects_intersect(const SpiceRect *a, const SpiceRect *b)
+{
+    return a->left < b->right && b->left < a->right &&
+           a->top < b->bottom && b->top < a->bottom;
+}
+
+// the same search done walking the ring, the most recent items first
+static TestItem *ring_find(Ring *ring, TestItem *from, const SpiceRect *area)
+{
+    RingItem *link = from ? ring_next(ring, &from->link) : ring_get_head(ring);
+
+    for (; link; link = ring_next(ring, link)) {
+        auto item = SPICE_CONTAINEROF(link, TestItem, link);
+        if (rects_intersect(&item->rect, area)) {
+            return item;
+        }
+    }
+    return nullptr;
+}
+
+static TestItem *index_find(RectIndex *index, TestItem *from, const SpiceRect *area)
+{
+    return static_cast<TestItem *>(rect_index_find(index, from ? from->entry.order : UINT64_MAX,
+                                                   area));
+}
+
+static void random_rect(GRand *rand, SpiceRect *rect)
+{
+    // some items partially outside of the surface
+    rect->left = g_rand_int_range(rand, -50, WIDTH);
+    rect->top = g_rand_int_range(rand, -50, HEIGHT);
+    rect->right = rect->left + g_rand_int_range(rand, 1, g_rand_boolean(rand) ? 40 : 600);
+    rect->bottom = rect->top + g_rand_int_range(rand, 1, g_rand_boolean(rand) ? 40 : 400);
+}
+
+static void test_rect_index(void)
+{
+    RectIndex *index = rect_index_new(WIDTH, HEIGHT);
+    GRand *rand = g_rand_new_with_seed(4321);
+    GPtrArray *items = g_ptr_array_new();
+    Ring ring;
+
+    ring_init(&ring);
+    for (unsigned n = 0; n < 20000; n++) {
+        int op = g_rand_int_range(rand, 0, 10);
+        if (op < 4 || items->len == 0) {
+            auto item = g_new0(TestItem, 1);
+            random_rect(rand, &item->rect);
+            ring_add(&ring, &item->link);
+            rect_index_add(index, &item->entry, item, &item->rect, nullptr);
+            g_ptr_array_add(items, item);
+        } else if (op < 6) {
+            // remove an item, sometimes replacing it at the same position
+            guint pos = g_rand_int_range(rand, 0, items->len);
+            auto item = static_cast<TestItem *>(g_ptr_array_index(items, pos));
+            if (g_rand_boolean(rand)) {
+                auto replacement = g_new0(TestItem, 1);
+                random_rect(rand, &replacement->rect);
+                ring_add_after(&replacement->link, &item->link);
+                rect_index_add(index, &replacement->entry, replacement, &replacement->rect,
+                               &item->entry);
+                g_ptr_array_add(items, replacement);
+            }
+            ring_remove(&item->link);
+            rect_index_remove(index, &item->entry, item);
+            g_ptr_array_remove_index_fast(items, pos);
+            g_free(item);
+        } else {
+            // walk all the intersecting items from the start or from an item
+            SpiceRect area;
+            random_rect(rand, &area);
+            TestItem *from = nullptr;
+            if (op == 9) {
+                from = static_cast<TestItem *>(g_ptr_array_index(items,
+                                               g_rand_int_range(rand, 0, items->len)));
+            }
+            do {
+                TestItem *found = index_find(index, from, &area);
+                g_assert_true(found == ring_find(&ring, from, &area));
+                from = found;
+            } while (from);
+        }
+    }
+
+    for (guint i = 0; i < items->len; i++) {
+        g_free(g_ptr_array_index(items, i));
+    }
+    g_ptr_array_free(items, TRUE);
+    g_rand_free(rand);
+    rect_index_free(index);
+}
+
+/* Draw lines of glyphs over windows, keeping the last NUM_LIVE items like
+ * the tree does between two updates, and look for the items intersecting
+ * each new one */
+#define NUM_DRAWS 100000
+#define NUM_LIVE 5000
+
+static void next_text_rect(GRand *rand, unsigned n, SpiceRect *rect)
+{
+    if (n % 1000 == 0) {
+        // a window
+        random_rect(rand, rect);
+        rect->right += 400;
+        rect->bottom += 300;
+        return;
+    }
+    if (n % 50 == 0) {
+        // a fill behind a line of text
+        rect->left = g_rand_int_range(rand, 0, WIDTH - 800);
+        rect->top = g_rand_int_range(rand, 0, HEIGHT - 18);
+        rect->right = rect->left + 800;
+        rect->bottom = rect->top + 18;
+        return;
+    }
+    // glyphs of 8x16 along lines
+    unsigned glyph = n % 50;
+    unsigned line = (n / 50) % (HEIGHT / 16);
+    unsigned column = (n / 50 / (HEIGHT / 16)) % (WIDTH / 8 / 50);
+    rect->left = (column * 50 + glyph) * 8;
+    rect->top = line * 16;
+    rect->right = rect->left + 8;
+    rect->bottom = rect->top + 16;
+}
+
+static uint64_t bench_find(bool use_index, uint64_t *found_count)
+{
+    RectIndex *index = rect_index_new(WIDTH, HEIGHT);
+    GRand *rand = g_rand_new_with_seed(1);
+    Ring ring;
+    uint64_t found = 0;
+
+    ring_init(&ring);
+    uint64_t start = spice_get_monotonic_time_ns();
+    for (unsigned n = 0; n < NUM_DRAWS; n++) {
+        SpiceRect rect;
+        next_text_rect(rand, n, &rect);
+
+        TestItem *from = nullptr;
+        do {
+            from = use_index ? index_find(index, from, &rect) : ring_find(&ring, from, &rect);
+            found += from != nullptr;
+        } while (from);
+
+        auto item = g_new0(TestItem, 1);
+        item->rect = rect;
+        ring_add(&ring, &item->link);
+        rect_index_add(index, &item->entry, item, &item->rect, nullptr);
+        if (n >= NUM_LIVE) {
+            auto oldest = SPICE_CONTAINEROF(ring_get_tail(&ring), TestItem, link);
+            ring_remove(&oldest->link);
+            rect_index_remove(index, &oldest->entry, oldest);
+            g_free(oldest);
+        }
+    }
+    uint64_t elapsed = spice_get_monotonic_time_ns() - start;
+
+    RingItem *link;
+    while ((link = ring_get_head(&ring))) {
+        ring_remove(link);
+        g_free(SPICE_CONTAINEROF(link, TestItem, link));
+    }
+    g_rand_free(rand);
+    rect_index_free(index);
+    *found_count = found;
+    return elapsed;
+}
+
+static void test_rect_index_benchmark(void)
+{
+    uint64_t ring_found, index_found;
+    uint64_t ring_ns = bench_find(false, &ring_found);
+    uint64_t index_ns = bench_find(true, &index_found);
+
+    g_assert_cmpuint(ring_found, ==, index_found);
+    g_test_message("%d draws, %d items: ring walk %.2fus, index %.2fus per draw",
+                   NUM_DRAWS, NUM_LIVE, ring_ns / 1000.0 / NUM_DRAWS,
+                   index_ns / 1000.0 / NUM_DRAWS);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/rect-index", test_rect_index);
+    g_test_add_func("/server/rect-index-benchmark", test_rect_index_benchmark);
+
+    return g_test_run();
+}
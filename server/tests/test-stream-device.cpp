@@ -105,6 +105,7 @@ check_vmc_error_message()
 
 static int num_send_data_calls = 0;
 static size_t send_data_bytes = 0;
+static uint8_t send_data_last_byte;
 
 StreamChannel::StreamChannel(RedsState *reds, uint32_t id):
     RedChannel(reds, SPICE_CHANNEL_DISPLAY, id, RedChannel::HandleAcks)
@@ -118,10 +119,11 @@ StreamChannel::change_format(const StreamMsgFormat *fmt)
 }
 
 void
-StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
+StreamChannel::send_data(const red::shared_ptr<StreamDataBuffer> &buffer, uint32_t mm_time)
 {
     ++num_send_data_calls;
-    send_data_bytes += size;
+    send_data_bytes += buffer->size;
+    send_data_last_byte = buffer->data[buffer->size - 1];
 }
 
 void
@@ -329,6 +331,9 @@ static void test_stream_device_empty(TestFixture *fixture, gconstpointer user_da
     // we should have no data from the device
     discard_server_capabilities();
     g_assert_cmpint(vmc->write_pos, ==, 0);
+
+    // empty frames are ignored
+    g_assert_cmpint(num_send_data_calls, ==, 0);
 }
 
 // check that server refuse huge data messages
@@ -380,6 +385,76 @@ static void test_stream_device_data_message(TestFixture *fixture, gconstpointer
     // make sure data were collapsed in a single message
     g_assert_cmpint(num_send_data_calls, ==, 1);
     g_assert_cmpint(send_data_bytes, ==, 1017);
+    g_assert_cmpint(send_data_last_byte, ==, static_cast<uint8_t>(1016 * 123 + 57));
+}
+
+#define BENCH_FRAME_SIZE (512 * 1024)
+#define BENCH_NUM_FRAMES 2000
+
+// device emulating a guest agent writing frames as fast as possible
+static struct {
+    uint8_t *frame;
+    unsigned frame_len;
+    unsigned frame_pos;
+    unsigned frames_left;
+    unsigned reads;
+} bench;
+
+static int bench_vmc_read(SpiceCharDeviceInstance *sin, uint8_t *buf, int len)
+{
+    bench.reads++;
+    if (bench.frame_pos >= bench.frame_len) {
+        if (bench.frames_left == 0) {
+            return 0;
+        }
+        bench.frames_left--;
+        bench.frame_pos = 0;
+    }
+    int ret = MIN(bench.frame_len - bench.frame_pos, (unsigned) len);
+    memcpy(buf, bench.frame + bench.frame_pos, ret);
+    bench.frame_pos += ret;
+    return ret;
+}
+
+// measure the time and the number of reads needed to pass frames to the channel
+static void test_stream_device_data_benchmark(TestFixture *fixture, gconstpointer user_data)
+{
+    uint8_t *p = vmc->message;
+    p = add_format(p, 1920, 1080, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+    vmc_emu_add_read_till(vmc, p);
+    test_kick();
+    g_assert_cmpint(vmc->pos, ==, p - vmc->message);
+
+    bench.frame_len = sizeof(StreamDevHeader) + BENCH_FRAME_SIZE;
+    bench.frame = static_cast<uint8_t *>(g_malloc(bench.frame_len));
+    p = add_stream_hdr(bench.frame, STREAM_TYPE_DATA, BENCH_FRAME_SIZE);
+    for (unsigned i = 0; i < BENCH_FRAME_SIZE; i++) {
+        p[i] = static_cast<uint8_t>(i * 123 + 57);
+    }
+    bench.frame_pos = bench.frame_len;
+    bench.frames_left = BENCH_NUM_FRAMES;
+    bench.reads = 0;
+    vmc->vmc_interface.read = bench_vmc_read;
+
+    gint64 start = g_get_monotonic_time();
+    alarm(20);
+    spice_server_char_device_wakeup(&vmc->instance);
+    alarm(0);
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    g_assert_cmpint(bench.frames_left, ==, 0);
+    g_assert_cmpint(num_send_data_calls, ==, BENCH_NUM_FRAMES);
+    g_assert_cmpint(send_data_bytes, ==, (size_t) BENCH_NUM_FRAMES * BENCH_FRAME_SIZE);
+    g_assert_cmpint(send_data_last_byte, ==, static_cast<uint8_t>((BENCH_FRAME_SIZE - 1) * 123 + 57));
+    // a read for the header and one for the data, plus the final empty read
+    g_assert_cmpint(bench.reads, <=, BENCH_NUM_FRAMES * 2 + 1);
+
+    g_test_message("%d frames of %d bytes: %.1f MB/s, %.2f reads per frame",
+                   BENCH_NUM_FRAMES, BENCH_FRAME_SIZE,
+                   (double) send_data_bytes / elapsed,
+                   (double) bench.reads / BENCH_NUM_FRAMES);
+
+    g_free(bench.frame);
 }
 
 static void test_display_info(TestFixture *fixture, gconstpointer user_data)
@@ -475,6 +550,8 @@ int main(int argc, char *argv[])
              test_stream_device_huge_data, nullptr);
     test_add("/server/stream-device-data-message",
              test_stream_device_data_message, nullptr);
+    test_add("/server/stream-device-data-benchmark",
+             test_stream_device_data_benchmark, nullptr);
     test_add("/server/display-info", test_display_info, nullptr);
 
     return g_test_run();
@@ -0,0 +1,253 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Write messages made of many small buffers over a loopback TLS
+ * connection, check the data received and compare the throughput and
+ * the number of TLS records with a write per buffer and with kernel TLS
+ */
+#include <config.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <openssl/ssl.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "red-stream.h"
+#include "net-utils.h"
+#include "utils.h"
+
+#define PKI_DIR SPICE_TOP_SRCDIR "/server/tests/pki/"
+
+#define NUM_BATCHES 1000
+// messages sent with a single writev, like RedChannelClient does
+#define MESSAGES_PER_BATCH 16
+// a message is a header, some small items and some data
+static const size_t message_parts[] = { 6, 20, 20, 20, 512 };
+#define PARTS_PER_MESSAGE G_N_ELEMENTS(message_parts)
+#define MESSAGE_SIZE (6 + 20 * 3 + 512)
+#define TOTAL_SIZE (size_t{NUM_BATCHES} * MESSAGES_PER_BATCH * MESSAGE_SIZE)
+
+static inline uint8_t data_byte(size_t pos)
+{
+    return pos * 7;
+}
+
+struct Client {
+    int socket;
+    unsigned records;
+};
+
+static void client_msg_cb(int write_p, int version, int content_type,
+                          const void *buf, size_t len, SSL *ssl, void *arg)
+{
+    auto client = static_cast<Client *>(arg);
+
+    if (!write_p && content_type == SSL3_RT_HEADER && len > 0 &&
+        static_cast<const uint8_t *>(buf)[0] == SSL3_RT_APPLICATION_DATA) {
+        client->records++;
+    }
+}
+
+static gpointer client_thread(gpointer opaque)
+{
+    auto client = static_cast<Client *>(opaque);
+    SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+    g_assert_nonnull(ctx);
+    // the test certificate is self-signed, no verification
+    SSL_CTX_set_msg_callback(ctx, client_msg_cb);
+    SSL_CTX_set_msg_callback_arg(ctx, client);
+
+    SSL *ssl = SSL_new(ctx);
+    g_assert_nonnull(ssl);
+    SSL_set_fd(ssl, client->socket);
+    g_assert_cmpint(SSL_connect(ssl), ==, 1);
+
+    // read slowly from time to time to get the server blocked
+    static uint8_t buf[64 * 1024];
+    size_t received = 0;
+    unsigned reads = 0;
+    while (received < TOTAL_SIZE) {
+        int n = SSL_read(ssl, buf, sizeof(buf));
+        g_assert_cmpint(n, >, 0);
+        for (int i = 0; i < n; i++) {
+            g_assert_cmpint(buf[i], ==, data_byte(received + i));
+        }
+        received += n;
+        if (++reads % 256 == 0) {
+            g_usleep(1000);
+        }
+    }
+
+    SSL_free(ssl);
+    SSL_CTX_free(ctx);
+    return nullptr;
+}
+
+// write the buffers, on EAGAIN retry from the current position like
+// RedChannelClient does
+static void write_batch(RedStream *stream, struct iovec *iov, int iovcnt, bool use_writev)
+{
+    while (iovcnt > 0) {
+        ssize_t n;
+        if (use_writev) {
+            n = red_stream_writev(stream, iov, iovcnt);
+        } else {
+            n = red_stream_write(stream, iov->iov_base, iov->iov_len);
+        }
+        if (n < 0) {
+            g_assert_true(errno == EAGAIN || errno == EINTR);
+            struct pollfd pollfd = { stream->socket, POLLOUT, 0 };
+            poll(&pollfd, 1, -1);
+            continue;
+        }
+        g_assert_cmpint(n, >, 0);
+        while (iovcnt > 0 && size_t(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (n > 0) {
+            iov->iov_base = static_cast<uint8_t *>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+static void test_stream_ssl(SpiceServer *server, SSL_CTX *ctx, bool use_writev)
+{
+    int listen_socket, server_socket;
+    struct sockaddr_in addr = {};
+    socklen_t addr_len = sizeof(addr);
+    Client client = {};
+
+    // loopback TCP connection
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(listen_socket, >=, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_assert_cmpint(bind(listen_socket, (struct sockaddr *) &addr, sizeof(addr)), ==, 0);
+    g_assert_cmpint(listen(listen_socket, 1), ==, 0);
+    g_assert_cmpint(getsockname(listen_socket, (struct sockaddr *) &addr, &addr_len), ==, 0);
+    client.socket = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(connect(client.socket, (struct sockaddr *) &addr, sizeof(addr)), ==, 0);
+    server_socket = accept(listen_socket, nullptr, nullptr);
+    g_assert_cmpint(server_socket, >=, 0);
+    close(listen_socket);
+
+    GThread *thread = g_thread_new("client", client_thread, &client);
+
+    RedStream *stream = red_stream_new(server, server_socket);
+    g_assert_cmpint(red_stream_enable_ssl(stream, ctx), ==, RED_STREAM_SSL_STATUS_OK);
+    red_socket_set_non_blocking(server_socket, true);
+
+    auto data = static_cast<uint8_t *>(g_malloc(TOTAL_SIZE));
+    for (size_t i = 0; i < TOTAL_SIZE; i++) {
+        data[i] = data_byte(i);
+    }
+
+    uint64_t start = spice_get_monotonic_time_ns();
+    uint8_t *pos = data;
+    for (unsigned batch = 0; batch < NUM_BATCHES; batch++) {
+        struct iovec iov[MESSAGES_PER_BATCH * PARTS_PER_MESSAGE];
+        int iovcnt = 0;
+        for (unsigned msg = 0; msg < MESSAGES_PER_BATCH; msg++) {
+            for (auto part_size : message_parts) {
+                iov[iovcnt].iov_base = pos;
+                iov[iovcnt].iov_len = part_size;
+                pos += part_size;
+                iovcnt++;
+            }
+        }
+        write_batch(stream, iov, iovcnt, use_writev);
+    }
+    g_thread_join(thread);
+    uint64_t elapsed = spice_get_monotonic_time_ns() - start;
+
+    g_test_message("%s%s: %.1f MB/s, %u TLS records",
+                   use_writev ? "writev" : "write per buffer",
+                   red_stream_is_ktls(stream) ? " (kernel TLS)" : "",
+                   TOTAL_SIZE * 1000.0 / elapsed, client.records);
+    if (use_writev && !red_stream_is_ktls(stream)) {
+        // a batch fits in a record, some more records are used by the handshake
+        g_assert_cmpuint(client.records, <=, NUM_BATCHES + 16);
+    }
+
+    g_free(data);
+    red_stream_free(stream);
+    close(client.socket);
+}
+
+static SSL_CTX *create_server_ctx(void)
+{
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    g_assert_nonnull(ctx);
+    g_assert_cmpint(SSL_CTX_use_certificate_chain_file(ctx, PKI_DIR "server-cert.pem"), ==, 1);
+    g_assert_cmpint(SSL_CTX_use_PrivateKey_file(ctx, PKI_DIR "server-key.pem",
+                                                SSL_FILETYPE_PEM), ==, 1);
+    return ctx;
+}
+
+static void test_stream_ssl_writev(void)
+{
+    SpiceCoreInterface *core = basic_event_loop_init();
+    SpiceServer *server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    SSL_CTX *ctx = create_server_ctx();
+    test_stream_ssl(server, ctx, true);
+    test_stream_ssl(server, ctx, false);
+    SSL_CTX_free(ctx);
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+}
+
+// the data must go through even if the kernel does not support TLS
+static void test_stream_ssl_ktls(void)
+{
+    SpiceCoreInterface *core = basic_event_loop_init();
+    SpiceServer *server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    SSL_CTX *ctx = create_server_ctx();
+    if (!red_stream_ssl_ctx_enable_ktls(ctx)) {
+        g_test_skip("kernel TLS not supported by OpenSSL");
+    } else {
+        test_stream_ssl(server, ctx, true);
+    }
+    SSL_CTX_free(ctx);
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/stream-ssl-writev", test_stream_ssl_writev);
+    g_test_add_func("/server/stream-ssl-ktls", test_stream_ssl_ktls);
+
+    return g_test_run();
+}
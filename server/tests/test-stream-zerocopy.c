@@ -0,0 +1,232 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test the zero copy buffers of RedStream are freed only once the
+ * kernel completed the sends, or the stream is freed and its connection
+ * is reset without blocking.
+ */
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "test-glib-compat.h"
+#include "red-stream.h"
+#include "basic-event-loop.h"
+
+#define BUFFER_SIZE (4 * RED_STREAM_ZEROCOPY_MIN_SIZE)
+
+static SpiceCoreInterface *core;
+static SpiceServer *server;
+static unsigned num_frees;
+
+static void buffer_free(uint8_t *data, void *opaque)
+{
+    g_assert_true(data == opaque);
+    g_free(data);
+    num_frees++;
+}
+
+static void set_nonblock(int fd)
+{
+    g_assert_cmpint(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK), ==, 0);
+}
+
+/* connect two TCP sockets on loopback, zero copy is not supported
+ * by local sockets */
+static void tcp_pair(int sv[2])
+{
+    struct sockaddr_in addr = { 0 };
+    socklen_t addr_len = sizeof(addr);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    g_assert_cmpint(listen_fd, >=, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    g_assert_cmpint(bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)), ==, 0);
+    g_assert_cmpint(listen(listen_fd, 1), ==, 0);
+    g_assert_cmpint(getsockname(listen_fd, (struct sockaddr *) &addr, &addr_len), ==, 0);
+
+    sv[0] = socket(AF_INET, SOCK_STREAM, 0);
+    g_assert_cmpint(sv[0], >=, 0);
+    g_assert_cmpint(connect(sv[0], (struct sockaddr *) &addr, sizeof(addr)), ==, 0);
+    sv[1] = accept(listen_fd, NULL, NULL);
+    g_assert_cmpint(sv[1], >=, 0);
+    close(listen_fd);
+
+    set_nonblock(sv[0]);
+    set_nonblock(sv[1]);
+}
+
+static RedStream *zerocopy_stream_new(int fd)
+{
+    RedStream *stream = red_stream_new(server, fd);
+
+    if (!red_stream_enable_zerocopy(stream)) {
+        red_stream_free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+static uint8_t *buffer_new(void)
+{
+    uint8_t *data = g_malloc(BUFFER_SIZE);
+
+    for (unsigned i = 0; i < BUFFER_SIZE; i++) {
+        data[i] = i * 7 + (i >> 12);
+    }
+    return data;
+}
+
+static void test_zerocopy_complete(void)
+{
+    int sv[2];
+    tcp_pair(sv);
+
+    RedStream *stream = zerocopy_stream_new(sv[0]);
+    if (!stream) {
+        close(sv[1]);
+        g_test_skip("zero copy not supported");
+        return;
+    }
+
+    uint8_t *data = buffer_new();
+    uint8_t *received = g_malloc(BUFFER_SIZE);
+    size_t sent = 0, read_size = 0;
+    RedZeroCopyBuffer *buffer = red_stream_zerocopy_buffer_new(stream, data, BUFFER_SIZE,
+                                                               buffer_free, data);
+    num_frees = 0;
+
+    // send the whole buffer reading from the other side
+    while (read_size < BUFFER_SIZE) {
+        if (sent < BUFFER_SIZE) {
+            struct iovec iov = { data + sent, BUFFER_SIZE - sent };
+            ssize_t n = red_stream_writev(stream, &iov, 1);
+            if (n < 0) {
+                g_assert_cmpint(errno, ==, EAGAIN);
+            } else {
+                sent += n;
+            }
+        }
+        struct pollfd pfd = { sv[1], POLLIN, 0 };
+        poll(&pfd, 1, 100);
+        ssize_t n = read(sv[1], received + read_size, BUFFER_SIZE - read_size);
+        if (n < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+        } else {
+            g_assert_cmpint(n, >, 0);
+            read_size += n;
+        }
+    }
+    g_assert_cmpmem(received, BUFFER_SIZE, data, BUFFER_SIZE);
+
+    // the data was received, wait for the completions
+    red_stream_zerocopy_buffer_release(buffer);
+    for (unsigned n = 0; n < 100 && num_frees == 0; n++) {
+        struct pollfd pfd = { sv[0], 0, 0 };
+        poll(&pfd, 1, 10);
+        red_stream_zerocopy_poll(stream);
+    }
+    g_assert_cmpuint(num_frees, ==, 1);
+
+    red_stream_free(stream);
+    g_assert_cmpuint(num_frees, ==, 1);
+    close(sv[1]);
+    g_free(received);
+}
+
+static void test_zerocopy_free(void)
+{
+    int sv[2];
+    tcp_pair(sv);
+
+    RedStream *stream = zerocopy_stream_new(sv[0]);
+    if (!stream) {
+        close(sv[1]);
+        g_test_skip("zero copy not supported");
+        return;
+    }
+
+    uint8_t *data[2] = { buffer_new(), buffer_new() };
+    RedZeroCopyBuffer *buffers[2];
+    num_frees = 0;
+    for (unsigned i = 0; i < G_N_ELEMENTS(buffers); i++) {
+        buffers[i] = red_stream_zerocopy_buffer_new(stream, data[i], BUFFER_SIZE,
+                                                    buffer_free, data[i]);
+    }
+
+    // the other side does not read, fill the socket queues
+    for (unsigned n = 0; n < 1000; n++) {
+        struct iovec iov[2] = {
+            { data[0], BUFFER_SIZE },
+            { data[1], BUFFER_SIZE },
+        };
+        if (red_stream_writev(stream, iov, G_N_ELEMENTS(iov)) < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+            break;
+        }
+    }
+
+    // the buffer is kept while the kernel could still use it
+    red_stream_zerocopy_buffer_release(buffers[0]);
+    g_assert_cmpuint(num_frees, <=, 1);
+
+    // freeing the stream does not wait for the completions, the released
+    // buffer only is freed once the connection is reset
+    gint64 start = g_get_monotonic_time();
+    red_stream_free(stream);
+    g_assert_cmpint(g_get_monotonic_time() - start, <, 50 * 1000);
+    g_assert_cmpuint(num_frees, <=, 1);
+    for (unsigned n = 0; n < 1000 && num_frees == 0; n++) {
+        g_main_context_iteration(basic_event_loop_get_context(), TRUE);
+    }
+    g_assert_cmpuint(num_frees, ==, 1);
+
+    // the other is freed once released
+    red_stream_zerocopy_buffer_release(buffers[1]);
+    g_assert_cmpuint(num_frees, ==, 2);
+
+    close(sv[1]);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    core = basic_event_loop_init();
+    server = spice_server_new();
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    g_test_add_func("/server/stream/zerocopy-complete", test_zerocopy_complete);
+    g_test_add_func("/server/stream/zerocopy-free", test_zerocopy_free);
+
+    int ret = g_test_run();
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+
+    return ret;
+}
@@ -0,0 +1,153 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test SurfaceTileMap finds the part of a copy really changing the surface
+ */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "surface-tile-map.h"
+
+// not a multiple of the tile size, the last tiles are partial
+#define WIDTH 200
+#define HEIGHT 150
+
+static uint32_t frame[HEIGHT][WIDTH];
+
+static SpiceRect make_rect(int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    SpiceRect rect = { left, top, right, bottom };
+    return rect;
+}
+
+#define assert_rect(rect, l, t, r, b) G_STMT_START { \
+    g_assert_cmpint((rect).left, ==, l); \
+    g_assert_cmpint((rect).top, ==, t); \
+    g_assert_cmpint((rect).right, ==, r); \
+    g_assert_cmpint((rect).bottom, ==, b); \
+} G_STMT_END
+
+// copy the area 'dest' of the frame to the same position of the surface
+static bool copy_frame(SurfaceTileMap *map, SpiceRect dest, SpiceRect *changed)
+{
+    const uint8_t *rows[HEIGHT];
+
+    for (int32_t y = dest.top; y < dest.bottom; y++) {
+        rows[y - dest.top] = reinterpret_cast<const uint8_t *>(frame[y]);
+    }
+    return surface_tile_map_update(map, &dest, rows, dest.left, changed);
+}
+
+static void fill_frame()
+{
+    for (unsigned y = 0; y < HEIGHT; y++) {
+        for (unsigned x = 0; x < WIDTH; x++) {
+            frame[y][x] = 0xff000000u | (y << 8) | x;
+        }
+    }
+}
+
+static void test_tile_map_update()
+{
+    SurfaceTileMap *map = surface_tile_map_new(WIDTH, HEIGHT);
+    const SpiceRect full = make_rect(0, 0, WIDTH, HEIGHT);
+    SpiceRect changed;
+
+    fill_frame();
+
+    // the initial content is not known
+    g_assert_true(copy_frame(map, full, &changed));
+    assert_rect(changed, 0, 0, WIDTH, HEIGHT);
+
+    // the same content does not change anything
+    g_assert_false(copy_frame(map, full, &changed));
+
+    // a pixel changes a single tile
+    frame[10][70] ^= 0xffffff;
+    g_assert_true(copy_frame(map, full, &changed));
+    assert_rect(changed, 64, 0, 128, 64);
+
+    // the partial tiles at the bottom right are compared too
+    frame[HEIGHT - 1][WIDTH - 1] ^= 0xffffff;
+    g_assert_true(copy_frame(map, full, &changed));
+    assert_rect(changed, 192, 128, WIDTH, HEIGHT);
+
+    // copying the same content to a part of the surface changes nothing
+    g_assert_false(copy_frame(map, make_rect(64, 64, 192, 128), &changed));
+
+    surface_tile_map_free(map);
+}
+
+static void test_tile_map_invalidate()
+{
+    SurfaceTileMap *map = surface_tile_map_new(WIDTH, HEIGHT);
+    const SpiceRect full = make_rect(0, 0, WIDTH, HEIGHT);
+    SpiceRect changed;
+
+    fill_frame();
+    g_assert_true(copy_frame(map, full, &changed));
+
+    // other drawings make the content of the tiles unknown
+    SpiceRect area = make_rect(100, 100, 101, 101);
+    surface_tile_map_invalidate(map, &area);
+    g_assert_true(copy_frame(map, full, &changed));
+    assert_rect(changed, 64, 64, 128, 128);
+
+    // a copy not covering a whole tile invalidates it
+    g_assert_true(copy_frame(map, make_rect(10, 10, 50, 50), &changed));
+    assert_rect(changed, 10, 10, 50, 50);
+    g_assert_true(copy_frame(map, full, &changed));
+    assert_rect(changed, 0, 0, 64, 64);
+
+    // areas outside of the surface are ignored
+    area = make_rect(WIDTH, 0, WIDTH + 100, 100);
+    surface_tile_map_invalidate(map, &area);
+    g_assert_false(copy_frame(map, full, &changed));
+    g_assert_false(surface_tile_map_update(map, &area, nullptr, 0, &changed));
+
+    surface_tile_map_free(map);
+}
+
+static void test_tile_map_should_crop()
+{
+    const SpiceRect dest = make_rect(0, 0, 256, 256);
+
+    // a single tile is worth a copy
+    SpiceRect changed = make_rect(64, 64, 128, 128);
+    g_assert_true(surface_tile_map_should_crop(&changed, &dest));
+
+    // a quarter less is still worth it
+    changed = make_rect(0, 0, 256, 192);
+    g_assert_true(surface_tile_map_should_crop(&changed, &dest));
+
+    // not a bit more
+    changed = make_rect(0, 0, 256, 193);
+    g_assert_false(surface_tile_map_should_crop(&changed, &dest));
+    g_assert_false(surface_tile_map_should_crop(&dest, &dest));
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, nullptr);
+
+    g_test_add_func("/server/tile-map/update", test_tile_map_update);
+    g_test_add_func("/server/tile-map/invalidate", test_tile_map_invalidate);
+    g_test_add_func("/server/tile-map/should-crop", test_tile_map_should_crop);
+
+    return g_test_run();
+}
@@ -0,0 +1,126 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Check the ticketing key pool and compare the time needed to get the
+ * key pairs for the channels of a client link with and without it
+ */
+#include <config.h>
+#include <cstring>
+#include <spice.h>
+#include <spice/protocol.h>
+
+#include <openssl/x509.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "ticket-key-pool.h"
+#include "utils.h"
+
+// channels linked by a typical client
+#define NUM_LINKS 8
+
+static GBytes *get_public_key(EVP_PKEY *key)
+{
+    unsigned char *der = nullptr;
+    int len = i2d_PUBKEY(key, &der);
+
+    g_assert_cmpint(len, >, 0);
+    GBytes *bytes = g_bytes_new(der, len);
+    OPENSSL_free(der);
+    return bytes;
+}
+
+// get the key pairs for NUM_LINKS links, returns the time in microseconds
+static uint64_t link_keys(TicketKeyPool *pool, GPtrArray *public_keys)
+{
+    uint64_t start = spice_get_monotonic_time_ns();
+
+    for (unsigned i = 0; i < NUM_LINKS; i++) {
+        EVP_PKEY *key = ticket_key_pool_get(pool);
+        g_assert_nonnull(key);
+        g_assert_cmpint(EVP_PKEY_bits(key), ==, SPICE_TICKET_KEY_PAIR_LENGTH);
+        g_ptr_array_add(public_keys, get_public_key(key));
+        EVP_PKEY_free(key);
+    }
+    return (spice_get_monotonic_time_ns() - start) / NSEC_PER_MICROSEC;
+}
+
+static void wait_pool_filled(TicketKeyPool *pool)
+{
+    for (unsigned i = 0; i < 3000 && ticket_key_pool_get_count(pool) < NUM_LINKS; i++) {
+        g_usleep(10 * 1000);
+    }
+    g_assert_cmpuint(ticket_key_pool_get_count(pool), ==, NUM_LINKS);
+}
+
+static void test_ticket_key_pool(void)
+{
+    SpiceCoreInterface *core = basic_event_loop_init();
+    SpiceServer *server = spice_server_new();
+    GPtrArray *public_keys = g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref);
+    uint64_t inline_us, pool_us;
+
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    inline_us = link_keys(nullptr, public_keys);
+
+    TicketKeyPool *pool = ticket_key_pool_new(NUM_LINKS, server, nullptr);
+    g_assert_nonnull(pool);
+    wait_pool_filled(pool);
+    pool_us = link_keys(pool, public_keys);
+
+    // the pool is refilled after use
+    wait_pool_filled(pool);
+    ticket_key_pool_set_paused(pool, true);
+    link_keys(pool, public_keys);
+    g_assert_cmpuint(ticket_key_pool_get_count(pool), ==, 0);
+
+    // an empty pool falls back to generating the keys
+    link_keys(pool, public_keys);
+    g_assert_cmpuint(ticket_key_pool_get_count(pool), ==, 0);
+
+    // and is filled again once restarted
+    ticket_key_pool_set_paused(pool, false);
+    wait_pool_filled(pool);
+
+    // every link must get a different key pair
+    for (unsigned i = 0; i < public_keys->len; i++) {
+        for (unsigned j = i + 1; j < public_keys->len; j++) {
+            g_assert_false(g_bytes_equal(g_ptr_array_index(public_keys, i),
+                                         g_ptr_array_index(public_keys, j)));
+        }
+    }
+
+    g_test_message("keys for %d links: %" G_GUINT64_FORMAT "us generated, "
+                   "%" G_GUINT64_FORMAT "us from the pool",
+                   NUM_LINKS, inline_us, pool_us);
+
+    ticket_key_pool_free(pool);
+    g_ptr_array_free(public_keys, TRUE);
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/ticket-key-pool", test_ticket_key_pool);
+
+    return g_test_run();
+}
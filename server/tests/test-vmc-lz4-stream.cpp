@@ -0,0 +1,238 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Check the LZ4 streaming compression of the spicevmc channels and
+ * compare it with the per message compression replaying a usbredir
+ * trace of a mass storage device being written
+ */
+#include <config.h>
+#include <cstring>
+
+#include <lz4.h>
+
+#include "test-glib-compat.h"
+#include "vmc-lz4-stream.h"
+#include "utils.h"
+
+// same limits as spicevmc
+#define BUF_SIZE (64 * 1024 + 32)
+#define COMPRESS_THRESHOLD 1000
+#define STREAM_COMPRESS_THRESHOLD 32
+
+#define NUM_TRANSFERS 2000
+#define SECTOR_SIZE 512
+
+struct Trace {
+    GPtrArray *messages;
+    uint64_t size;
+};
+
+static const char *const words[] = {
+    "the", "spice", "server", "usb", "redirection", "file", "data", "block",
+    "sector", "device", "transfer", "mass", "storage", "write", "read", "guest",
+};
+
+// fill a sector like a file system does: text files, empty blocks and
+// already compressed data
+static void fill_sector(uint8_t *sector, GRand *rand)
+{
+    int type = g_rand_int_range(rand, 0, 10);
+
+    if (type < 4) {
+        unsigned pos = 0;
+        while (pos < SECTOR_SIZE) {
+            const char *word = words[g_rand_int_range(rand, 0, G_N_ELEMENTS(words))];
+            for (; *word && pos < SECTOR_SIZE; word++) {
+                sector[pos++] = *word;
+            }
+            if (pos < SECTOR_SIZE) {
+                sector[pos++] = g_rand_int_range(rand, 0, 8) ? ' ' : '\n';
+            }
+        }
+    } else if (type < 7) {
+        memset(sector, 0, SECTOR_SIZE);
+    } else {
+        for (unsigned i = 0; i < SECTOR_SIZE; i += 4) {
+            uint32_t r = g_rand_int(rand);
+            memcpy(sector + i, &r, 4);
+        }
+    }
+}
+
+static void add_message(Trace *trace, const uint8_t *data, size_t size)
+{
+    g_ptr_array_add(trace->messages, g_bytes_new(data, size));
+    trace->size += size;
+}
+
+// usbredir bulk packets from the guest: for each SCSI WRITE(10) a
+// command block wrapper then the data
+static Trace create_trace()
+{
+    Trace trace = { g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref), 0 };
+    GRand *rand = g_rand_new_with_seed(0x5350);
+    uint32_t lba = 2048;
+    uint64_t id = 1;
+
+    for (unsigned n = 0; n < NUM_TRANSFERS; n++) {
+        uint8_t msg[BUF_SIZE] = {};
+        uint32_t sectors = g_rand_int_range(rand, 1, 121);
+        uint32_t data_len = sectors * SECTOR_SIZE;
+
+        // usbredir header (type, length, id), bulk packet header
+        // (endpoint, status, length, stream id, length high) and CBW
+        uint32_t header[2] = { GUINT32_TO_LE(101), GUINT32_TO_LE(10 + 31) };
+        memcpy(msg, header, sizeof(header));
+        uint64_t le_id = GUINT64_TO_LE(id++);
+        memcpy(msg + 8, &le_id, 8);
+        msg[16] = 0x02;
+        msg[18] = 31;
+        memcpy(msg + 26, "USBC", 4);
+        uint32_t tag = GUINT32_TO_LE(n);
+        memcpy(msg + 30, &tag, 4);
+        uint32_t le_data_len = GUINT32_TO_LE(data_len);
+        memcpy(msg + 34, &le_data_len, 4);
+        msg[40] = 10;
+        msg[41] = 0x2a; // WRITE(10)
+        uint32_t be_lba = GUINT32_TO_BE(lba);
+        memcpy(msg + 43, &be_lba, 4);
+        msg[48] = sectors >> 8;
+        msg[49] = sectors & 0xff;
+        add_message(&trace, msg, 26 + 31);
+
+        // then the data, split as the device reads would
+        header[1] = GUINT32_TO_LE(10 + data_len);
+        memcpy(msg, header, sizeof(header));
+        le_id = GUINT64_TO_LE(id++);
+        memcpy(msg + 8, &le_id, 8);
+        msg[16] = 0x02;
+        uint16_t len16 = GUINT16_TO_LE(data_len & 0xffff);
+        memcpy(msg + 18, &len16, 2);
+        size_t size = 26;
+        for (uint32_t i = 0; i < sectors; i++) {
+            if (size + SECTOR_SIZE > BUF_SIZE) {
+                add_message(&trace, msg, size);
+                size = 0;
+            }
+            fill_sector(msg + size, rand);
+            size += SECTOR_SIZE;
+        }
+        add_message(&trace, msg, size);
+        lba += sectors;
+    }
+    g_rand_free(rand);
+    return trace;
+}
+
+static void test_vmc_lz4_stream_roundtrip()
+{
+    VmcLz4Stream *encoder = vmc_lz4_stream_new();
+    VmcLz4Stream *decoder = vmc_lz4_stream_new();
+    Trace trace = create_trace();
+    static uint8_t compressed[LZ4_COMPRESSBOUND(BUF_SIZE)];
+    static uint8_t decompressed[BUF_SIZE];
+
+    for (unsigned n = 0; n < trace.messages->len; n++) {
+        // check a new connection restarts with an empty history
+        if (n == trace.messages->len / 2) {
+            vmc_lz4_stream_reset(encoder);
+            vmc_lz4_stream_free(decoder);
+            decoder = vmc_lz4_stream_new();
+        }
+        auto bytes = static_cast<GBytes *>(g_ptr_array_index(trace.messages, n));
+        gsize size;
+        auto data = static_cast<const uint8_t *>(g_bytes_get_data(bytes, &size));
+
+        int compressed_size = vmc_lz4_stream_compress(encoder, data, size, compressed);
+        g_assert_cmpint(compressed_size, >, 0);
+        int decompressed_size = vmc_lz4_stream_decompress(decoder, compressed, compressed_size,
+                                                          decompressed, size);
+        g_assert_cmpint(decompressed_size, ==, size);
+        g_assert_true(memcmp(data, decompressed, size) == 0);
+    }
+
+    g_ptr_array_free(trace.messages, TRUE);
+    vmc_lz4_stream_free(encoder);
+    vmc_lz4_stream_free(decoder);
+}
+
+// compress the trace like spicevmc, returns the size sent
+static uint64_t compress_trace(const Trace *trace, bool stream_mode, uint64_t *time_ns)
+{
+    VmcLz4Stream *stream = vmc_lz4_stream_new();
+    static uint8_t buf[LZ4_COMPRESSBOUND(BUF_SIZE)];
+    static uint8_t out[BUF_SIZE];
+    uint64_t sent = 0;
+
+    uint64_t start = spice_get_monotonic_time_ns();
+    for (unsigned n = 0; n < trace->messages->len; n++) {
+        auto bytes = static_cast<GBytes *>(g_ptr_array_index(trace->messages, n));
+        gsize size;
+        auto data = static_cast<const uint8_t *>(g_bytes_get_data(bytes, &size));
+        int compressed_size = 0;
+
+        // the device is read into the pipe item
+        memcpy(buf, data, size);
+        if (stream_mode) {
+            if (size > STREAM_COMPRESS_THRESHOLD) {
+                compressed_size = vmc_lz4_stream_compress(stream, buf, size, buf);
+            }
+        } else if (size > COMPRESS_THRESHOLD) {
+            compressed_size = LZ4_compress_default(reinterpret_cast<char *>(buf),
+                                                   reinterpret_cast<char *>(out),
+                                                   size, BUF_SIZE);
+            if (compressed_size >= (int) size) {
+                compressed_size = 0;
+            }
+        }
+        sent += compressed_size > 0 ? compressed_size : size;
+    }
+    *time_ns = spice_get_monotonic_time_ns() - start;
+
+    vmc_lz4_stream_free(stream);
+    return sent;
+}
+
+static void test_vmc_lz4_stream_benchmark()
+{
+    Trace trace = create_trace();
+    uint64_t message_ns, stream_ns;
+
+    uint64_t message_sent = compress_trace(&trace, false, &message_ns);
+    uint64_t stream_sent = compress_trace(&trace, true, &stream_ns);
+
+    g_test_message("%u messages, %" G_GUINT64_FORMAT " bytes", trace.messages->len, trace.size);
+    g_test_message("per message: ratio %.3f, %.1f MB/s",
+                   (double) message_sent / trace.size, trace.size * 1000.0 / message_ns);
+    g_test_message("streaming: ratio %.3f, %.1f MB/s",
+                   (double) stream_sent / trace.size, trace.size * 1000.0 / stream_ns);
+
+    g_assert_cmpuint(stream_sent, <, message_sent);
+
+    g_ptr_array_free(trace.messages, TRUE);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/vmc-lz4-stream-roundtrip", test_vmc_lz4_stream_roundtrip);
+    g_test_add_func("/server/vmc-lz4-stream-benchmark", test_vmc_lz4_stream_benchmark);
+
+    return g_test_run();
+}
@@ -18,7 +18,9 @@
 /* Utility to allow checking our websocket implementaion using Autobahn
  * Test Suite.
  * This suite require a WebSocket server implementation echoing
- * data sent to it
+ * data sent to it.
+ * With --benchmark it measures instead the throughput of reading masked
+ * frames and writing messages made of many buffers over a socket pair.
  */
 #undef NDEBUG
 #include <config.h>
@@ -59,6 +61,7 @@ if data size == 0 when we receive we must send it
 static int port = 7777;
 static gboolean non_blocking = false;
 static gboolean debug = false;
+static gboolean benchmark = false;
 static volatile bool got_term = false;
 static unsigned int num_connections = 0;
 
@@ -69,10 +72,13 @@ static GOptionEntry cmd_entries[] = {
    "Enable non-blocking i/o", NULL},
   {"debug", 0, 0, G_OPTION_ARG_NONE, &debug,
    "Enable debug output", NULL},
+  {"benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark,
+   "Run the throughput benchmark and exit", NULL},
   {NULL}
 };
 
 static void handle_client(int new_sock);
+static void run_benchmark(void);
 
 static int
 wait_for(int sock, short events)
@@ -140,6 +146,11 @@ main(int argc, char **argv)
         errx(1, "%s: %s\n", argv[0], error->message);
     }
 
+    if (benchmark) {
+        run_benchmark();
+        return 0;
+    }
+
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         err(1, "socket");
@@ -294,3 +305,231 @@ handle_client(int new_sock)
         printf("connection closed\n");
     }
 }
+
+#define BENCH_FRAME_SIZE (32 * 1024)
+#define BENCH_NUM_FRAMES 8192
+#define BENCH_TOTAL_SIZE ((uint64_t) BENCH_FRAME_SIZE * BENCH_NUM_FRAMES)
+// messages written with a single writev, like RedChannelClient does
+#define BENCH_NUM_MESSAGES 65536
+static const size_t bench_message_parts[] = { 6, 20, 20, 20, 512, 6, 20, 20, 20, 1500 };
+#define BENCH_PARTS_PER_MESSAGE G_N_ELEMENTS(bench_message_parts)
+
+// the data repeats every 256 bytes so it can be checked with memcmp
+static uint8_t bench_pattern[64 * 1024 + 256];
+
+static inline uint8_t bench_byte(uint64_t pos)
+{
+    return pos * 7;
+}
+
+static inline void bench_check(const uint8_t *data, size_t len, uint64_t pos)
+{
+    assert(len <= sizeof(bench_pattern) - 256);
+    assert(memcmp(data, bench_pattern + pos % 256, len) == 0);
+}
+
+static void
+write_all(int sock, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            err(1, "send");
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+static void
+read_all(int sock, void *buf, size_t len)
+{
+    if (recv(sock, buf, len, MSG_WAITALL) != len) {
+        err(1, "recv");
+    }
+}
+
+// client side of the read test, send masked binary frames
+static gpointer
+bench_send_frames(gpointer opaque)
+{
+    int sock = GPOINTER_TO_INT(opaque);
+    static const uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    uint8_t *frame = g_malloc(BENCH_FRAME_SIZE + 8);
+    uint64_t pos = 0;
+
+    frame[0] = 0x82; // final binary frame
+    frame[1] = 0x80 | 126; // masked, 16 bit length
+    frame[2] = BENCH_FRAME_SIZE >> 8;
+    frame[3] = BENCH_FRAME_SIZE & 0xff;
+    memcpy(frame + 4, mask, sizeof(mask));
+    for (unsigned n = 0; n < BENCH_NUM_FRAMES; n++) {
+        for (unsigned i = 0; i < BENCH_FRAME_SIZE; i++, pos++) {
+            frame[8 + i] = bench_byte(pos) ^ mask[i % 4];
+        }
+        write_all(sock, frame, BENCH_FRAME_SIZE + 8);
+    }
+    g_free(frame);
+    return NULL;
+}
+
+// client side of the write test, check the frames, returns their number
+static gpointer
+bench_receive_frames(gpointer opaque)
+{
+    int sock = GPOINTER_TO_INT(opaque);
+    uint8_t *data = g_malloc(64 * 1024);
+    uint64_t received = 0, expected = 0;
+    unsigned frames = 0;
+
+    for (unsigned i = 0; i < BENCH_PARTS_PER_MESSAGE; i++) {
+        expected += bench_message_parts[i];
+    }
+    expected *= BENCH_NUM_MESSAGES;
+
+    while (received < expected) {
+        uint8_t header[10];
+        uint64_t len;
+
+        read_all(sock, header, 2);
+        assert(header[0] == 0x82);
+        len = header[1];
+        assert(len < 127);
+        if (len == 126) {
+            read_all(sock, header + 2, 2);
+            len = (header[2] << 8) | header[3];
+        }
+        assert(len <= 64 * 1024);
+        read_all(sock, data, len);
+        bench_check(data, len, received);
+        received += len;
+        frames++;
+    }
+    g_free(data);
+    return GUINT_TO_POINTER(frames);
+}
+
+static RedsWebSocket *
+bench_connect(int sock, int client_sock)
+{
+    static const char request[] =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Version: 13\r\n"
+        "\r\n";
+
+    write_all(client_sock, request, strlen(request));
+    RedsWebSocket *ws = websocket_new("", 0, GINT_TO_POINTER(sock),
+                                      ws_read, ws_write, ws_writev);
+    assert(ws);
+
+    // discard the reply
+    char reply[1024];
+    size_t len = 0;
+    while (len < 4 || memcmp(reply + len - 4, "\r\n\r\n", 4) != 0) {
+        assert(len < sizeof(reply));
+        read_all(client_sock, reply + len, 1);
+        len++;
+    }
+    return ws;
+}
+
+static void
+bench_read(void)
+{
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0) {
+        err(1, "socketpair");
+    }
+    RedsWebSocket *ws = bench_connect(socks[0], socks[1]);
+
+    GThread *thread = g_thread_new("client", bench_send_frames, GINT_TO_POINTER(socks[1]));
+
+    // an odd size to split the frames at any mask position
+    static uint8_t buffer[64 * 1024 - 3];
+    uint64_t received = 0;
+    gint64 start = g_get_monotonic_time();
+    while (received < BENCH_TOTAL_SIZE) {
+        unsigned flags;
+        int size = websocket_read(ws, buffer, sizeof(buffer), &flags);
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        assert(size > 0);
+        bench_check(buffer, size, received);
+        received += size;
+    }
+    gint64 elapsed = g_get_monotonic_time() - start;
+    g_thread_join(thread);
+
+    printf("read: %.1f MB/s unmasking %u frames\n",
+           BENCH_TOTAL_SIZE / (double) elapsed, BENCH_NUM_FRAMES);
+
+    websocket_free(ws);
+    socket_close(socks[0]);
+    socket_close(socks[1]);
+}
+
+static void
+bench_write(void)
+{
+    int socks[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0) {
+        err(1, "socketpair");
+    }
+    RedsWebSocket *ws = bench_connect(socks[0], socks[1]);
+
+    GThread *thread = g_thread_new("client", bench_receive_frames, GINT_TO_POINTER(socks[1]));
+
+    size_t message_size = 0;
+    for (unsigned i = 0; i < BENCH_PARTS_PER_MESSAGE; i++) {
+        message_size += bench_message_parts[i];
+    }
+    uint8_t *message = g_malloc(message_size);
+    uint64_t sent = 0;
+    gint64 start = g_get_monotonic_time();
+    for (unsigned n = 0; n < BENCH_NUM_MESSAGES; n++) {
+        struct iovec iov[BENCH_PARTS_PER_MESSAGE];
+        uint8_t *pos = message;
+
+        memcpy(message, bench_pattern + sent % 256, message_size);
+        for (unsigned i = 0; i < BENCH_PARTS_PER_MESSAGE; i++) {
+            iov[i].iov_base = pos;
+            iov[i].iov_len = bench_message_parts[i];
+            pos += bench_message_parts[i];
+        }
+        // the socket is blocking, the whole message is written
+        int size = websocket_writev(ws, iov, BENCH_PARTS_PER_MESSAGE, WEBSOCKET_BINARY_FINAL);
+        assert(size == message_size);
+        sent += size;
+    }
+    unsigned frames = GPOINTER_TO_UINT(g_thread_join(thread));
+    gint64 elapsed = g_get_monotonic_time() - start;
+
+    // every message must be sent as a single frame
+    assert(frames == BENCH_NUM_MESSAGES);
+    printf("write: %.1f MB/s, %u messages of %zu buffers\n",
+           sent / (double) elapsed, frames, BENCH_PARTS_PER_MESSAGE);
+
+    g_free(message);
+    websocket_free(ws);
+    socket_close(socks[0]);
+    socket_close(socks[1]);
+}
+
+static void
+run_benchmark(void)
+{
+    for (unsigned i = 0; i < sizeof(bench_pattern); i++) {
+        bench_pattern[i] = bench_byte(i);
+    }
+    bench_read();
+    bench_write();
+}
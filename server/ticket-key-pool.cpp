@@ -0,0 +1,260 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+
+#include <pthread.h>
+
+#include <openssl/bn.h>
+#include <openssl/rsa.h>
+
+#include <spice/protocol.h>
+
+#include "ticket-key-pool.h"
+#include "utils.h"
+
+struct TicketKeyPool {
+    unsigned int size;
+    unsigned int count;
+    EVP_PKEY **keys;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    /* signaled when a key is taken or the thread must stop */
+    pthread_cond_t cond;
+    bool quit;
+    /* see ticket_key_pool_set_paused */
+    bool paused;
+
+    RedStatNode stat;
+    RedStatCounter hits;
+    RedStatCounter misses;
+};
+
+EVP_PKEY *ticket_key_generate(void)
+{
+// Check for EVP_RSA_gen. EVP_RSA_gen was always defined as a macro in <openssl/rsa.h>
+// and it's still so in OpenSSL 3.0 so checking for macro existence is a good way.
+#if OPENSSL_VERSION_NUMBER < 0x30000000L && !defined(EVP_RSA_gen)
+    BIGNUM *rsa_exponent = BN_new();
+    if (!rsa_exponent || !BN_set_word(rsa_exponent, RSA_F4)) {
+        BN_free(rsa_exponent);
+        return nullptr;
+    }
+
+    RSA *rsa = RSA_new();
+    if (!rsa) {
+        BN_free(rsa_exponent);
+        return nullptr;
+    }
+
+    if (RSA_generate_key_ex(rsa, SPICE_TICKET_KEY_PAIR_LENGTH,
+                            rsa_exponent, nullptr) != 1) {
+        RSA_free(rsa);
+        BN_free(rsa_exponent);
+        return nullptr;
+    }
+    BN_free(rsa_exponent);
+
+    EVP_PKEY *pk = EVP_PKEY_new();
+    if (!pk) {
+        RSA_free(rsa);
+        return nullptr;
+    }
+
+    if (!EVP_PKEY_set1_RSA(pk, rsa)) {
+        EVP_PKEY_free(pk);
+        RSA_free(rsa);
+        return nullptr;
+    }
+
+    RSA_free(rsa);
+    return pk;
+#else
+    return EVP_RSA_gen(SPICE_TICKET_KEY_PAIR_LENGTH);
+#endif
+}
+
+static void *ticket_key_pool_main(void *opaque)
+{
+    auto pool = static_cast<TicketKeyPool *>(opaque);
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->quit) {
+        if (pool->count >= pool->size || pool->paused) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+        EVP_PKEY *key = ticket_key_generate();
+        pthread_mutex_lock(&pool->lock);
+
+        if (!key) {
+            /* for instance RSA 1024 is not allowed in FIPS mode, links
+             * will fail or use SASL anyway */
+            spice_warning("Failed to generate %d bits RSA key, stop filling the pool",
+                          SPICE_TICKET_KEY_PAIR_LENGTH);
+            red_dump_openssl_errors();
+            break;
+        }
+        if (pool->paused) {
+            EVP_PKEY_free(key);
+            continue;
+        }
+        /* only this thread adds keys so there's still room */
+        pool->keys[pool->count++] = key;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return nullptr;
+}
+
+TicketKeyPool *ticket_key_pool_new(unsigned int size, RedsState *reds,
+                                   const RedStatNode *stat)
+{
+#ifndef _WIN32
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+#endif
+    TicketKeyPool *pool;
+    int r;
+
+    spice_return_val_if_fail(size > 0 && size <= TICKET_KEY_POOL_MAX_SIZE, nullptr);
+
+    pool = g_new0(TicketKeyPool, 1);
+    pool->size = size;
+    pool->keys = g_new0(EVP_PKEY *, size);
+    pthread_mutex_init(&pool->lock, nullptr);
+    pthread_cond_init(&pool->cond, nullptr);
+
+#ifndef _WIN32
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+#endif
+    r = pthread_create(&pool->thread, nullptr, ticket_key_pool_main, pool);
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, nullptr);
+#endif
+    if (r) {
+        spice_warning("create ticket key pool thread failed %d", r);
+        pthread_cond_destroy(&pool->cond);
+        pthread_mutex_destroy(&pool->lock);
+        g_free(pool->keys);
+        g_free(pool);
+        return nullptr;
+    }
+#if !defined(__APPLE__)
+    pthread_setname_np(pool->thread, "SPICE Keys");
+#endif
+
+    stat_init_node(&pool->stat, reds, stat, "ticket_key_pool", TRUE);
+    stat_init_counter(&pool->hits, reds, &pool->stat, "hits", TRUE);
+    stat_init_counter(&pool->misses, reds, &pool->stat, "misses", TRUE);
+    return pool;
+}
+
+TicketKeyPool *ticket_key_pool_new_from_env(RedsState *reds, const RedStatNode *stat)
+{
+    const char *env = getenv(TICKET_KEY_POOL_ENV);
+    unsigned long size;
+    char *end;
+
+    if (!env) {
+        return nullptr;
+    }
+    if (!*env) {
+        return ticket_key_pool_new(TICKET_KEY_POOL_DEFAULT_SIZE, reds, stat);
+    }
+
+    errno = 0;
+    size = strtoul(env, &end, 10);
+    if (errno != 0 || *end != '\0' || size == 0 || size > TICKET_KEY_POOL_MAX_SIZE) {
+        spice_warning("error parsing %s: %s", TICKET_KEY_POOL_ENV, env);
+        return nullptr;
+    }
+    return ticket_key_pool_new(size, reds, stat);
+}
+
+void ticket_key_pool_free(TicketKeyPool *pool)
+{
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_join(pool->thread, nullptr);
+
+    for (unsigned int i = 0; i < pool->count; i++) {
+        EVP_PKEY_free(pool->keys[i]);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    g_free(pool->keys);
+    g_free(pool);
+}
+
+unsigned int ticket_key_pool_get_count(TicketKeyPool *pool)
+{
+    unsigned int count;
+
+    pthread_mutex_lock(&pool->lock);
+    count = pool->count;
+    pthread_mutex_unlock(&pool->lock);
+    return count;
+}
+
+void ticket_key_pool_set_paused(TicketKeyPool *pool, bool paused)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->paused = paused;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+EVP_PKEY *ticket_key_pool_get(TicketKeyPool *pool)
+{
+    EVP_PKEY *key = nullptr;
+
+    if (!pool) {
+        return ticket_key_generate();
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count > 0) {
+        key = pool->keys[--pool->count];
+        pool->keys[pool->count] = nullptr;
+        pthread_cond_signal(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (key) {
+        stat_inc_counter(pool->hits, 1);
+        return key;
+    }
+    stat_inc_counter(pool->misses, 1);
+    return ticket_key_generate();
+}
@@ -0,0 +1,69 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file ticket-key-pool.h
+ * Pool of pre-generated RSA key pairs used for ticketing.
+ *
+ * Every channel link needs a fresh key pair to receive the encrypted
+ * password. Generating it takes a noticeable time, so a thread keeps a
+ * pool of key pairs ready. Each key pair is used for a single link.
+ * When the pool is empty the key pair is generated by the caller.
+ */
+
+#ifndef TICKET_KEY_POOL_H_
+#define TICKET_KEY_POOL_H_
+
+#include <openssl/evp.h>
+
+#include "red-common.h"
+#include "stat.h"
+
+#include "push-visibility.h"
+
+/* Enable the pool, the value is the number of key pairs kept ready,
+ * empty for the default */
+#define TICKET_KEY_POOL_ENV "SPICE_TICKET_KEY_POOL"
+
+#define TICKET_KEY_POOL_DEFAULT_SIZE 16
+#define TICKET_KEY_POOL_MAX_SIZE 1024
+
+struct TicketKeyPool;
+
+TicketKeyPool *ticket_key_pool_new(unsigned int size, RedsState *reds,
+                                   const RedStatNode *stat);
+TicketKeyPool *ticket_key_pool_new_from_env(RedsState *reds, const RedStatNode *stat);
+void ticket_key_pool_free(TicketKeyPool *pool);
+
+/* Number of key pairs currently ready */
+unsigned int ticket_key_pool_get_count(TicketKeyPool *pool);
+
+/* Stop or restart filling the pool. Once paused no key pair is added
+ * till the pool is restarted */
+void ticket_key_pool_set_paused(TicketKeyPool *pool, bool paused);
+
+/* Generate a SPICE_TICKET_KEY_PAIR_LENGTH bits RSA key pair */
+EVP_PKEY *ticket_key_generate(void);
+
+/* Take a key pair from the pool, generating it if the pool is empty.
+ * 'pool' can be NULL. Returns NULL on failure */
+EVP_PKEY *ticket_key_pool_get(TicketKeyPool *pool);
+
+#include "pop-visibility.h"
+
+#endif /* TICKET_KEY_POOL_H_ */
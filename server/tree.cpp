@@ -197,6 +197,7 @@ Shadow* shadow_new(DrawItem *item, const SpicePoint *delta)
 
     shadow->base.type = TREE_ITEM_TYPE_SHADOW;
     shadow->base.container = nullptr;
+    shadow->base.index_entry.order = 0;
     region_clone(&shadow->base.rgn, &item->base.rgn);
     region_offset(&shadow->base.rgn, delta->x, delta->y);
     ring_item_init(&shadow->base.siblings_link);
@@ -206,17 +207,34 @@ Shadow* shadow_new(DrawItem *item, const SpicePoint *delta)
     return shadow;
 }
 
+/* Add @item of the top level ring to @index. @item is placed just after
+ * @after in the ring, which will be removed, or at its head if @after is
+ * NULL */
+void tree_item_index_add(TreeItem *item, RectIndex *index, const TreeItem *after)
+{
+    const pixman_box32_t *extents = &item->rgn.extents;
+    SpiceRect rect = { extents->x1, extents->y1, extents->x2, extents->y2 };
+
+    rect_index_add(index, &item->index_entry, item, &rect, after ? &after->index_entry : nullptr);
+}
+
+void tree_item_index_remove(TreeItem *item, RectIndex *index)
+{
+    rect_index_remove(index, &item->index_entry, item);
+}
+
 /* Create a new container to hold @item and insert @item into this container.
  *
  * NOTE: This function assumes that @item is already inside a different Ring,
  * so it removes @item from that ring before inserting it into the new
  * container */
-Container* container_new(DrawItem *item)
+Container* container_new(DrawItem *item, RectIndex *index)
 {
     auto container = g_new(Container, 1);
 
     container->base.type = TREE_ITEM_TYPE_CONTAINER;
     container->base.container = item->base.container;
+    container->base.index_entry.order = 0;
     item->base.container = container;
     item->container_root = TRUE;
     region_clone(&container->base.rgn, &item->base.rgn);
@@ -225,20 +243,26 @@ Container* container_new(DrawItem *item)
     ring_remove(&item->base.siblings_link);
     ring_init(&container->items);
     ring_add(&container->items, &item->base.siblings_link);
+    /* the container takes the place of @item in the top level ring */
+    if (item->base.index_entry.order) {
+        tree_item_index_add(&container->base, index, &item->base);
+        tree_item_index_remove(&item->base, index);
+    }
 
     return container;
 }
 
-void container_free(Container *container)
+void container_free(Container *container, RectIndex *index)
 {
     spice_return_if_fail(ring_is_empty(&container->items));
 
+    tree_item_index_remove(&container->base, index);
     ring_remove(&container->base.siblings_link);
     region_destroy(&container->base.rgn);
     g_free(container);
 }
 
-void container_cleanup(Container *container)
+void container_cleanup(Container *container, RectIndex *index)
 {
     /* visit upward, removing containers */
     /* non-empty container get its element moving up ?? */
@@ -251,8 +275,11 @@ void container_cleanup(Container *container)
             ring_remove(&item->siblings_link);
             ring_add_after(&item->siblings_link, &container->base.siblings_link);
             item->container = container->base.container;
+            if (container->base.index_entry.order) {
+                tree_item_index_add(item, index, &container->base);
+            }
         }
-        container_free(container);
+        container_free(container, index);
         container = next;
     }
 }
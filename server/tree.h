@@ -24,6 +24,7 @@
 #include <common/ring.h>
 
 #include "spice-bitmap-utils.h"
+#include "rect-index.h"
 
 #include "push-visibility.h"
 
@@ -47,6 +48,9 @@ struct TreeItem {
      * tree, this region may be modified to exclude the portion of the item
      * that is obscured by other items */
     QRegion rgn;
+    /* position in the index of the surface, only for the items
+     * of the top level ring */
+    RectIndexEntry index_entry;
 };
 
 /* A region "below" a copy, or the src region of the copy */
@@ -90,11 +94,15 @@ Shadow*    tree_item_find_shadow                    (TreeItem *item);
 bool       tree_item_contained_by                   (TreeItem *item, Ring *ring);
 Ring*      tree_item_container_items                (TreeItem *item, Ring *ring);
 
+void       tree_item_index_add                      (TreeItem *item, RectIndex *index,
+                                                     const TreeItem *after);
+void       tree_item_index_remove                   (TreeItem *item, RectIndex *index);
+
 void       draw_item_remove_shadow                  (DrawItem *item);
 Shadow*    shadow_new                               (DrawItem *item, const SpicePoint *delta);
-Container* container_new                            (DrawItem *item);
-void       container_free                           (Container *container);
-void       container_cleanup                        (Container *container);
+Container* container_new                            (DrawItem *item, RectIndex *index);
+void       container_free                           (Container *container, RectIndex *index);
+void       container_cleanup                        (Container *container, RectIndex *index);
 
 #include "pop-visibility.h"
 
@@ -48,6 +48,7 @@ typedef enum {
     VIDEO_ENCODER_FRAME_UNSUPPORTED = -1,
     VIDEO_ENCODER_FRAME_DROP,
     VIDEO_ENCODER_FRAME_ENCODE_DONE,
+    VIDEO_ENCODER_FRAME_PENDING,
 } VideoEncodeResults;
 
 typedef struct VideoEncoderStats {
@@ -78,12 +79,36 @@ struct VideoEncoder {
      *     VIDEO_ENCODER_FRAME_UNSUPPORTED if the frame cannot be encoded.
      *     VIDEO_ENCODER_FRAME_DROP if the frame was dropped. This value can
      *                              only happen if rate control is active.
+     *     VIDEO_ENCODER_FRAME_PENDING if the frame is being encoded in the
+     *                              background, see get_frame().
      */
     VideoEncodeResults (*encode_frame)(VideoEncoder *encoder, uint32_t frame_mm_time,
                                        const SpiceBitmap *bitmap,
                                        const SpiceRect *src, int top_down,
                                        gpointer bitmap_opaque, VideoBuffer** outbuf);
 
+    /* Returns the oldest of the frames for which encode_frame() returned
+     * VIDEO_ENCODER_FRAME_PENDING, once it is compressed. The frames are
+     * returned in the order they were submitted in.
+     * This is NULL for the encoders that never return
+     * VIDEO_ENCODER_FRAME_PENDING.
+     *
+     * @encoder:       The video encoder.
+     * @frame_mm_time: The frame's mm-time timestamp, as given to
+     *                 encode_frame().
+     * @bitmap_opaque: The bitmap_opaque given to encode_frame(). The caller
+     *                 owns a reference to it which it must release with
+     *                 bitmap_unref().
+     * @outbuf:        A pointer to a VideoBuffer structure containing the
+     *                 compressed frame, see encode_frame().
+     * @return:
+     *     VIDEO_ENCODER_FRAME_ENCODE_DONE if a frame is returned.
+     *     VIDEO_ENCODER_FRAME_PENDING if no frame is ready yet.
+     *     VIDEO_ENCODER_FRAME_UNSUPPORTED if there is no frame to wait for.
+     */
+    VideoEncodeResults (*get_frame)(VideoEncoder *encoder, uint32_t *frame_mm_time,
+                                    gpointer *bitmap_opaque, VideoBuffer** outbuf);
+
     /*
      * Bit rate control methods.
      */
@@ -169,6 +194,12 @@ typedef struct VideoEncoderRateControlCbs {
      *              frames to reach the client.
      */
     void (*update_client_playback_delay)(void *opaque, uint32_t delay_ms);
+
+    /* Signals that get_frame() has a frame ready. This is called from
+     * another thread and must not call back into the encoder.
+     * If NULL the encoder does not encode the frames in the background.
+     */
+    void (*frame_ready)(void *opaque);
 } VideoEncoderRateControlCbs;
 
 typedef void (*bitmap_ref_t)(gpointer data);
@@ -195,17 +226,30 @@ typedef VideoEncoder* (*new_video_encoder_t)(SpiceVideoCodecType codec_type,
                                              bitmap_ref_t bitmap_ref,
                                              bitmap_unref_t bitmap_unref);
 
+/* Number of threads encoding slices of large MJPEG frames along with the
+ * caller, 0 or unset encodes the frames serially */
+#define MJPEG_ENCODER_SLICE_THREADS_ENV "SPICE_MJPEG_SLICE_THREADS"
+
 VideoEncoder* mjpeg_encoder_new(SpiceVideoCodecType codec_type,
                                 uint64_t starting_bit_rate,
                                 VideoEncoderRateControlCbs *cbs,
                                 bitmap_ref_t bitmap_ref,
                                 bitmap_unref_t bitmap_unref);
 #if defined(HAVE_GSTREAMER_1_0) || defined(HAVE_GSTREAMER_0_10)
+/* If set the GStreamer encoders return without waiting for the compressed
+ * frames, provided the frame_ready() callback is implemented */
+#define GSTREAMER_ENCODER_ASYNC_ENV "SPICE_GST_ASYNC_ENCODE"
+/* Number of idle pipelines to keep for each codec so new streams can start
+ * quickly, 0 or unset disables the pool */
+#define GSTREAMER_ENCODER_PIPELINE_POOL_ENV "SPICE_GST_PIPELINE_POOL"
+
 VideoEncoder* gstreamer_encoder_new(SpiceVideoCodecType codec_type,
                                     uint64_t starting_bit_rate,
                                     VideoEncoderRateControlCbs *cbs,
                                     bitmap_ref_t bitmap_ref,
                                     bitmap_unref_t bitmap_unref);
+/* Frees the idle pipelines kept for SPICE_GST_PIPELINE_POOL */
+void gstreamer_encoder_clear_pipeline_pool(void);
 #endif
 
 
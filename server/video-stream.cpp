@@ -27,6 +27,7 @@
 
 static void video_stream_unref(DisplayChannel *display, VideoStream *stream);
 static void video_stream_agent_unref(DisplayChannel *display, VideoStreamAgent *agent);
+static void video_stream_agent_push_encoded_frames(VideoStreamAgent *agent);
 
 static void video_stream_agent_stats_print(VideoStreamAgent *agent)
 {
@@ -77,6 +78,25 @@ StreamCreateDestroyItem::StreamCreateDestroyItem(VideoStreamAgent *init_agent, i
     agent->stream->refs++;
 }
 
+StreamDataItem::~StreamDataItem()
+{
+    if (outbuf) {
+        outbuf->free(outbuf);
+    }
+    video_stream_agent_unref(DCC_TO_DC(agent->dcc), agent);
+}
+
+StreamDataItem::StreamDataItem(VideoStreamAgent *init_agent, RedDrawable *init_red_drawable,
+                               uint32_t init_frame_mm_time, VideoBuffer *init_outbuf):
+    RedPipeItem(RED_PIPE_ITEM_TYPE_STREAM_DATA),
+    agent(init_agent),
+    red_drawable(init_red_drawable),
+    frame_mm_time(init_frame_mm_time),
+    outbuf(init_outbuf)
+{
+    agent->stream->refs++;
+}
+
 static RedPipeItemPtr video_stream_create_item_new(VideoStreamAgent *agent)
 {
     return red::make_shared<StreamCreateDestroyItem>(agent, RED_PIPE_ITEM_TYPE_STREAM_CREATE);
@@ -113,6 +133,7 @@ void video_stream_stop(DisplayChannel *display, VideoStream *stream)
                 dcc_set_max_stream_bit_rate(dcc, stream_bit_rate);
             }
         }
+        video_stream_agent_push_encoded_frames(stream_agent);
         dcc->pipe_add(video_stream_destroy_item_new(stream_agent));
         video_stream_agent_stats_print(stream_agent);
     }
@@ -201,7 +222,8 @@ static void update_copy_graduality(DisplayChannel *display, Drawable *drawable)
         (bitmap->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE)) {
         drawable->copy_bitmap_graduality = BITMAP_GRADUAL_NOT_AVAIL;
     } else  {
-        drawable->copy_bitmap_graduality = bitmap_get_graduality_level(bitmap);
+        drawable->copy_bitmap_graduality = display_channel_get_bitmap_graduality(
+            display, &drawable->red_drawable->u.copy.src_bitmap->descriptor, bitmap);
     }
 }
 
@@ -696,6 +718,15 @@ static void bitmap_unref(gpointer data)
     shared_ptr_unref(red_drawable);
 }
 
+/* Called from an encoder thread, the frame is picked up by
+ * video_stream_push_encoded_frames() in the next worker iteration. */
+static void frame_ready(void *opaque)
+{
+    auto agent = static_cast<VideoStreamAgent *>(opaque);
+
+    g_main_context_wakeup(agent->dcc->get_channel()->get_core_interface()->main_context);
+}
+
 /* A helper for dcc_create_stream(). */
 static VideoEncoder* dcc_create_video_encoder(DisplayChannelClient *dcc,
                                               uint64_t starting_bit_rate,
@@ -752,6 +783,7 @@ void dcc_create_stream(DisplayChannelClient *dcc, VideoStream *stream)
     video_cbs.get_roundtrip_ms = get_roundtrip_ms;
     video_cbs.get_source_fps = get_source_fps;
     video_cbs.update_client_playback_delay = update_client_playback_delay;
+    video_cbs.frame_ready = frame_ready;
 
     uint64_t initial_bit_rate = get_initial_bit_rate(dcc, stream);
     agent->video_encoder = dcc_create_video_encoder(dcc, initial_bit_rate, &video_cbs);
@@ -947,6 +979,41 @@ void video_stream_timeout(DisplayChannel *display)
     }
 }
 
+static void video_stream_agent_push_encoded_frames(VideoStreamAgent *agent)
+{
+    VideoEncoder *video_encoder = agent->video_encoder;
+    uint32_t frame_mm_time;
+    gpointer bitmap_opaque;
+    VideoBuffer *outbuf;
+
+    if (!video_encoder || !video_encoder->get_frame) {
+        return;
+    }
+    while (video_encoder->get_frame(video_encoder, &frame_mm_time, &bitmap_opaque,
+                                    &outbuf) == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
+        auto red_drawable = static_cast<RedDrawable *>(bitmap_opaque);
+        agent->dcc->pipe_add(red::make_shared<StreamDataItem>(agent, red_drawable,
+                                                              frame_mm_time, outbuf));
+        bitmap_unref(red_drawable);
+    }
+}
+
+/* Sends the frames the video encoders compressed in the background */
+void video_stream_push_encoded_frames(DisplayChannel *display)
+{
+    RingItem *item;
+    DisplayChannelClient *dcc;
+
+    FOREACH_STREAMS(display, item) {
+        VideoStream *stream = SPICE_CONTAINEROF(item, VideoStream, link);
+        int stream_id = display_channel_get_video_stream_id(display, stream);
+
+        FOREACH_DCC(display, dcc) {
+            video_stream_agent_push_encoded_frames(dcc_get_video_stream_agent(dcc, stream_id));
+        }
+    }
+}
+
 void video_stream_trace_add_drawable(DisplayChannel *display,
                                      Drawable *item)
 {
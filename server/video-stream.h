@@ -96,6 +96,17 @@ struct StreamCreateDestroyItem: public RedPipeItem {
     VideoStreamAgent *agent;
 };
 
+/* A frame the video encoder compressed in the background */
+struct StreamDataItem: public RedPipeItem {
+    StreamDataItem(VideoStreamAgent *agent, RedDrawable *red_drawable,
+                   uint32_t frame_mm_time, VideoBuffer *outbuf);
+    ~StreamDataItem();
+    VideoStreamAgent *agent;
+    red::shared_ptr<RedDrawable> red_drawable;
+    uint32_t frame_mm_time;
+    VideoBuffer *outbuf;
+};
+
 struct ItemTrace {
     red_time_t time;
     red_time_t first_frame_time;
@@ -129,6 +140,7 @@ void video_stream_trace_update(DisplayChannel *display, Drawable *drawable);
 void video_stream_maintenance(DisplayChannel *display, Drawable *candidate,
                               Drawable *prev);
 void video_stream_timeout(DisplayChannel *display);
+void video_stream_push_encoded_frames(DisplayChannel *display);
 void video_stream_detach_and_stop(DisplayChannel *display);
 void video_stream_trace_add_drawable(DisplayChannel *display, Drawable *item);
 void video_stream_detach_behind(DisplayChannel *display, QRegion *region,
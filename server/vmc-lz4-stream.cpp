@@ -0,0 +1,130 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <lz4.h>
+
+#include "vmc-lz4-stream.h"
+
+#define HISTORY_SIZE (64 * 1024)
+
+/* The data to compress is copied at the end of the previous one, so the
+ * history is always in memory. The ring is large enough for a message
+ * to never overwrite the history it's compressed with */
+#define ENCODE_RING_SIZE (HISTORY_SIZE + 2 * VMC_LZ4_STREAM_MAX_BLOCK)
+
+/* Messages are decompressed one after the other, wrapping when there's
+ * not room for the largest one, as LZ4_decoderRingBufferSize() */
+#define DECODE_RING_SIZE (HISTORY_SIZE + 14 + VMC_LZ4_STREAM_MAX_BLOCK)
+
+struct VmcLz4Stream {
+    LZ4_stream_t *encoder;
+    uint8_t *encode_ring;
+    int encode_pos;
+
+    LZ4_streamDecode_t *decoder;
+    uint8_t *decode_ring;
+    int decode_pos;
+};
+
+VmcLz4Stream *vmc_lz4_stream_new(void)
+{
+    auto stream = g_new0(VmcLz4Stream, 1);
+
+    stream->encoder = LZ4_createStream();
+    stream->encode_ring = static_cast<uint8_t *>(g_malloc(ENCODE_RING_SIZE));
+    return stream;
+}
+
+void vmc_lz4_stream_free(VmcLz4Stream *stream)
+{
+    if (!stream) {
+        return;
+    }
+
+    LZ4_freeStream(stream->encoder);
+    g_free(stream->encode_ring);
+    if (stream->decoder) {
+        LZ4_freeStreamDecode(stream->decoder);
+    }
+    g_free(stream->decode_ring);
+    g_free(stream);
+}
+
+void vmc_lz4_stream_reset(VmcLz4Stream *stream)
+{
+    LZ4_freeStream(stream->encoder);
+    stream->encoder = LZ4_createStream();
+    stream->encode_pos = 0;
+
+    if (stream->decoder) {
+        LZ4_setStreamDecode(stream->decoder, nullptr, 0);
+    }
+    stream->decode_pos = 0;
+}
+
+int vmc_lz4_stream_compress(VmcLz4Stream *stream, const uint8_t *src, int size,
+                            uint8_t *dest)
+{
+    spice_return_val_if_fail(size > 0 && size <= VMC_LZ4_STREAM_MAX_BLOCK, 0);
+
+    if (ENCODE_RING_SIZE - stream->encode_pos < VMC_LZ4_STREAM_MAX_BLOCK) {
+        stream->encode_pos = 0;
+    }
+    auto input = reinterpret_cast<char *>(stream->encode_ring + stream->encode_pos);
+    memcpy(input, src, size);
+
+#ifdef HAVE_LZ4_COMPRESS_FAST_CONTINUE
+    int compressed = LZ4_compress_fast_continue(stream->encoder, input,
+                                                reinterpret_cast<char *>(dest),
+                                                size, LZ4_COMPRESSBOUND(size), 1);
+#else
+    int compressed = LZ4_compress_continue(stream->encoder, input,
+                                           reinterpret_cast<char *>(dest), size);
+#endif
+    if (compressed <= 0) {
+        return 0;
+    }
+    stream->encode_pos += size;
+    return compressed;
+}
+
+int vmc_lz4_stream_decompress(VmcLz4Stream *stream, const uint8_t *src, int src_size,
+                              uint8_t *dest, int size)
+{
+    spice_return_val_if_fail(size > 0 && size <= VMC_LZ4_STREAM_MAX_BLOCK, -1);
+
+    if (!stream->decoder) {
+        stream->decoder = LZ4_createStreamDecode();
+        stream->decode_ring = static_cast<uint8_t *>(g_malloc(DECODE_RING_SIZE));
+    }
+    if (DECODE_RING_SIZE - stream->decode_pos < VMC_LZ4_STREAM_MAX_BLOCK) {
+        stream->decode_pos = 0;
+    }
+
+    uint8_t *output = stream->decode_ring + stream->decode_pos;
+    int decompressed =
+        LZ4_decompress_safe_continue(stream->decoder, reinterpret_cast<const char *>(src),
+                                     reinterpret_cast<char *>(output), src_size, size);
+    if (decompressed <= 0) {
+        return -1;
+    }
+    memcpy(dest, output, decompressed);
+    stream->decode_pos += decompressed;
+    return decompressed;
+}
@@ -0,0 +1,65 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file vmc-lz4-stream.h
+ * LZ4 streaming compression of the spicevmc channels data.
+ *
+ * Each message is compressed using the previous 64KB of data sent in
+ * the same direction as dictionary. The small messages of usbredir and
+ * webdav compress much better than one at a time.
+ * The compressed messages must be decompressed in the order they were
+ * compressed. Data sent uncompressed is not part of the history.
+ *
+ * The channels use it only if spice-protocol defines the capability
+ * SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4_STREAM and the compression type
+ * SPICE_DATA_COMPRESSION_TYPE_LZ4_STREAM (HAVE_SPICE_VMC_LZ4_STREAM).
+ */
+
+#ifndef VMC_LZ4_STREAM_H_
+#define VMC_LZ4_STREAM_H_
+
+#include "red-common.h"
+
+#include "push-visibility.h"
+
+/* Largest message, compressed or decompressed */
+#define VMC_LZ4_STREAM_MAX_BLOCK (64 * 1024 + 32)
+
+struct VmcLz4Stream;
+
+VmcLz4Stream *vmc_lz4_stream_new(void);
+void vmc_lz4_stream_free(VmcLz4Stream *stream);
+
+/* Forget the history of both directions, for a new connection */
+void vmc_lz4_stream_reset(VmcLz4Stream *stream);
+
+/* Compress 'size' bytes of 'src' to 'dest' which must have room for
+ * LZ4_COMPRESSBOUND(size) bytes. 'src' and 'dest' can be the same buffer.
+ * Returns the compressed size, 0 on failure */
+int vmc_lz4_stream_compress(VmcLz4Stream *stream, const uint8_t *src, int size,
+                            uint8_t *dest);
+
+/* Decompress a message of 'size' bytes to 'dest'.
+ * Returns the decompressed size, a negative value on failure */
+int vmc_lz4_stream_decompress(VmcLz4Stream *stream, const uint8_t *src, int src_size,
+                              uint8_t *dest, int size);
+
+#include "pop-visibility.h"
+
+#endif /* VMC_LZ4_STREAM_H_ */
@@ -31,6 +31,11 @@
 #endif
 
 #include <glib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include <common/log.h>
 #include <common/mem.h>
@@ -68,6 +73,9 @@
 
 #define WEBSOCKET_MAX_HEADER_SIZE (1 + 9 + 4)
 
+/* iovecs used by websocket_writev() without allocating */
+#define WEBSOCKET_STACK_IOV 128
+
 #define MAX_CONTROL_DATA 125
 #define CONTROL_HDR_LEN 2
 
@@ -316,13 +324,65 @@ static bool websocket_get_frame_header(websocket_frame_t *frame)
     return true;
 }
 
+/* XOR 'size' bytes of payload with the mask, 'pos' is the position of
+   the data in the frame.
+   The mask is rotated to start at 'pos' so the data can be processed a
+   vector at a time, every block being a multiple of the mask length. */
+static void unmask_data(uint8_t *buf, size_t size, const uint8_t *mask, uint64_t pos)
+{
+    uint8_t rotated[4];
+    uint32_t mask32;
+    uint64_t mask64;
+    size_t i;
+
+    for (i = 0; i < 4; i++) {
+        rotated[i] = mask[(pos + i) % 4];
+    }
+    memcpy(&mask32, rotated, sizeof(mask32));
+
+#ifdef __SSE2__
+    const __m128i mask128 = _mm_set1_epi32(mask32);
+    for (; size >= 32; buf += 32, size -= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *) buf);
+        __m128i b = _mm_loadu_si128((const __m128i *) (buf + 16));
+        _mm_storeu_si128((__m128i *) buf, _mm_xor_si128(a, mask128));
+        _mm_storeu_si128((__m128i *) (buf + 16), _mm_xor_si128(b, mask128));
+    }
+    if (size >= 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) buf);
+        _mm_storeu_si128((__m128i *) buf, _mm_xor_si128(a, mask128));
+        buf += 16;
+        size -= 16;
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t mask128 = vreinterpretq_u8_u32(vdupq_n_u32(mask32));
+    for (; size >= 32; buf += 32, size -= 32) {
+        vst1q_u8(buf, veorq_u8(vld1q_u8(buf), mask128));
+        vst1q_u8(buf + 16, veorq_u8(vld1q_u8(buf + 16), mask128));
+    }
+    if (size >= 16) {
+        vst1q_u8(buf, veorq_u8(vld1q_u8(buf), mask128));
+        buf += 16;
+        size -= 16;
+    }
+#endif
+
+    mask64 = ((uint64_t) mask32 << 32) | mask32;
+    for (; size >= 8; buf += 8, size -= 8) {
+        uint64_t data;
+        memcpy(&data, buf, sizeof(data));
+        data ^= mask64;
+        memcpy(buf, &data, sizeof(data));
+    }
+    for (i = 0; i < size; i++) {
+        buf[i] ^= rotated[i % 4];
+    }
+}
+
 static void relay_data(uint8_t* buf, size_t size, websocket_frame_t *frame)
 {
     if (frame->masked) {
-        size_t i;
-        for (i = 0; i < size; i++) {
-            *buf++ ^= frame->mask[(frame->relayed + i) % 4];
-        }
+        unmask_data(buf, size, frame->mask, frame->relayed);
     }
 }
 
@@ -525,18 +585,24 @@ static int send_data_header_left(RedsWebSocket *ws)
     return -1;
 }
 
-static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
+/* fill the header of a new data frame, a continuation frame if the
+   previous message is not finished */
+static void prepare_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
 {
     spice_assert(ws->write_header_pos >= ws->write_header_len);
     spice_assert(ws->write_remainder == 0);
 
-    /* fill a new header */
     ws->write_header_pos = 0;
     if (ws->send_unfinished) {
         type &= FIN_FLAG;
     }
     ws->write_header_len = fill_header(ws->write_header, len, type);
     ws->send_unfinished = (type & FIN_FLAG) == 0;
+}
+
+static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
+{
+    prepare_data_header(ws, len, type);
 
     return send_data_header_left(ws);
 }
@@ -588,11 +654,13 @@ static int send_pending_data(RedsWebSocket *ws)
     return 1;
 }
 
-/* Write a WebSocket frame with the enclosed data out. */
+/* Write a WebSocket frame with the enclosed data out.
+   The header and the data are written with a single writev. */
 int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, unsigned flags)
 {
     uint64_t len;
     int rc;
+    struct iovec iov_stack[WEBSOCKET_STACK_IOV];
     struct iovec *iov_out;
     int iov_out_cnt;
     int i;
@@ -619,27 +687,33 @@ int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, uns
     }
 
     iov_out_cnt = iovcnt + 1;
-    iov_out = g_malloc(iov_out_cnt * sizeof(*iov_out));
+    iov_out = iov_stack;
+    if (SPICE_UNLIKELY(iov_out_cnt > WEBSOCKET_STACK_IOV)) {
+        iov_out = g_new(struct iovec, iov_out_cnt);
+    }
 
     for (i = 0, len = 0; i < iovcnt; i++) {
         len += iov[i].iov_len;
         iov_out[i + 1] = iov[i];
     }
 
-    ws->write_header_pos = 0;
-    ws->write_header_len = fill_header(ws->write_header, len, flags);
+    bool send_unfinished = ws->send_unfinished;
+    prepare_data_header(ws, len, flags);
     iov_out[0].iov_len = ws->write_header_len;
     iov_out[0].iov_base = ws->write_header;
     rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
-    g_free(iov_out);
+    if (iov_out != iov_stack) {
+        g_free(iov_out);
+    }
     if (rc <= 0) {
         ws->write_header_len = 0;
+        ws->send_unfinished = send_unfinished;
         return rc;
     }
 
     /* this can happen if we can't write the header */
     if (SPICE_UNLIKELY(rc < ws->write_header_len)) {
-        ws->write_header_pos = ws->write_header_len - rc;
+        ws->write_header_pos = rc;
         errno = EAGAIN;
         return -1;
     }
@@ -651,6 +725,11 @@ int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, uns
        a header of any kind the next time around */
     ws->write_remainder = len - rc;
 
+    /* only the header was written, returning 0 would mean a closed stream */
+    if (SPICE_UNLIKELY(rc == 0 && len > 0)) {
+        errno = EAGAIN;
+        return -1;
+    }
     return rc;
 }
 
@@ -658,6 +737,12 @@ int websocket_write(RedsWebSocket *ws, const void *buf, size_t len, unsigned fla
 {
     int rc;
 
+    /* send the header along with the data */
+    if (ws->raw_writev) {
+        struct iovec iov = { (void *) buf, len };
+        return websocket_writev(ws, &iov, 1, flags);
+    }
+
     if (ws->closed) {
         errno = EPIPE;
         return -1;
@@ -39,13 +39,74 @@ verify(sizeof(SpiceStat) == 20 || sizeof(SpiceStat) == 24);
 static SpiceStatNode *reds_nodes = NULL;
 static uint64_t *values = NULL;
 
+/* histograms have a counter child for each bucket, named with the
+ * bucket bound in microseconds, "<0000001us" ... ">=1048576us" */
+static int is_histogram_bucket(const SpiceStatNode *node)
+{
+    return (node->flags & SPICE_STAT_NODE_FLAG_VALUE) &&
+           (node->name[0] == '<' || node->name[0] == '>');
+}
+
+static int is_histogram(const SpiceStatNode *node)
+{
+    return !(node->flags & SPICE_STAT_NODE_FLAG_VALUE) &&
+           node->first_child_index != INVALID_STAT_REF &&
+           is_histogram_bucket(&reds_nodes[node->first_child_index]);
+}
+
+static void format_bucket(char *buf, size_t size, const SpiceStatNode *bucket)
+{
+    const char *bound = bucket->name + strspn(bucket->name, "<>=");
+
+    snprintf(buf, size, "%.*s%lluus", (int) (bound - bucket->name), bucket->name,
+             strtoull(bound, NULL, 10));
+}
+
+/* print the samples added since the last call and their percentiles */
+static void print_histogram(const SpiceStatNode *node, int depth)
+{
+    uint64_t count = 0, seen = 0;
+    char p50[32] = "-", p99[32] = "-", max[32] = "-";
+    uint32_t index;
+
+    for (index = node->first_child_index; index != INVALID_STAT_REF;
+         index = reds_nodes[index].next_sibling_index) {
+        if (is_histogram_bucket(&reds_nodes[index])) {
+            count += reds_nodes[index].value - values[index];
+        }
+    }
+    for (index = node->first_child_index; index != INVALID_STAT_REF;
+         index = reds_nodes[index].next_sibling_index) {
+        const SpiceStatNode *bucket = &reds_nodes[index];
+        uint64_t samples = bucket->value - values[index];
+
+        values[index] = bucket->value;
+        if (!is_histogram_bucket(bucket) || samples == 0) {
+            continue;
+        }
+        if (seen * 2 < count && (seen + samples) * 2 >= count) {
+            format_bucket(p50, sizeof(p50), bucket);
+        }
+        if (seen * 100 < count * 99 && (seen + samples) * 100 >= count * 99) {
+            format_bucket(p99, sizeof(p99), bucket);
+        }
+        format_bucket(max, sizeof(max), bucket);
+        seen += samples;
+    }
+    printf(":%*s%" PRIu64 " p50 %s p99 %s max %s\n",
+           (int) ((VALUE_TABS - depth) * TAB_LEN - strlen(node->name) - 1), "",
+           count, p50, p99, max);
+}
+
 static void print_stat_tree(int32_t node_index, int depth)
 {
     SpiceStatNode *node = &reds_nodes[node_index];
 
     if ((node->flags & SPICE_STAT_NODE_MASK_SHOW) == SPICE_STAT_NODE_MASK_SHOW) {
         printf("%*s%s", depth * TAB_LEN, "", node->name);
-        if (node->flags & SPICE_STAT_NODE_FLAG_VALUE) {
+        if (is_histogram(node)) {
+            print_histogram(node, depth);
+        } else if (node->flags & SPICE_STAT_NODE_FLAG_VALUE) {
             printf(":%*s%"PRIu64" (%"PRIu64")\n", (int) ((VALUE_TABS - depth) * TAB_LEN - strlen(node->name) - 1), "",
                    node->value, node->value - values[node_index]);
             values[node_index] = node->value;